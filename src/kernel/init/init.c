@@ -11,6 +11,9 @@
 #include <lib/target.h>
 #include <mem/heap/heap.h>
 #include <mem/mem.h>
+#include <mem/phys/phys.h>
+#include <mem/reclaim.h>
+#include <mem/stats.h>
 #include <misc/misc.h>
 #include <sys/arch/interrupts.h>
 #include <sys/ic.h>
@@ -112,7 +115,11 @@ void kernel_unload_stivale2_term(void) {
 //! @brief Kernel init stage2
 void kernel_init_stage2() {
 	LOG_SUCCESS("Running in stage 2");
+	// APs are online now, let them finish memory manager initialization on their nodes
+	mem_phys_init_deferred();
+	mem_reclaim_start();
 	tests_run();
+	mem_stats_dump();
 	hang();
 }
 
@@ -1,7 +1,137 @@
 //! @file string.c
 //! @brief File containing implementations of string functions
+//!
+//! memcpy and memset are dispatched to implementations picked once CPU features are known. Until
+//! then (and on CPUs without fast string instructions) 8 byte unrolled loops are used. Loops are
+//! compiled without loop distribution, as otherwise GCC may turn them back into memcpy calls
 
+#include <lib/log.h>
 #include <lib/string.h>
+#include <sys/cpuid.h>
+
+MODULE("lib/string")
+TARGET(string_dispatch_available, string_dispatch_init, {})
+
+//! @brief Size from which rep movsb/stosb outperform unrolled loops on CPUs without FSRM
+#define STRING_REP_THRESHOLD 128
+
+//! @brief Pattern with lowest bit of each byte set
+#define STRING_BYTES_ONE 0x0101010101010101ULL
+
+//! @brief Disable transformation of loops into library calls
+#define STRING_NO_LIBCALLS __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+//! @brief Qword type that can alias any object and does not need to be aligned
+typedef uint64_t __attribute__((may_alias, aligned(1))) string_qword_t;
+
+//! @brief True if CPU supports enhanced rep movsb/stosb
+bool string_erms_supported = false;
+
+//! @brief True if CPU supports fast short rep movsb
+bool string_fsrm_supported = false;
+
+//! @brief Copy with 8 byte unrolled loop
+//! @param dest Pointer to destination buffer
+//! @param src Pointer to data to be copied
+//! @param n Number of bytes to be copied
+//! @return Value of dest parameter
+STRING_NO_LIBCALLS static void *string_memcpy_unrolled(void *dest, const void *src, size_t n) {
+	uint8_t *cdest = dest;
+	const uint8_t *csrc = src;
+	while (n >= 32) {
+		const uint64_t q0 = ((const string_qword_t *)csrc)[0];
+		const uint64_t q1 = ((const string_qword_t *)csrc)[1];
+		const uint64_t q2 = ((const string_qword_t *)csrc)[2];
+		const uint64_t q3 = ((const string_qword_t *)csrc)[3];
+		((string_qword_t *)cdest)[0] = q0;
+		((string_qword_t *)cdest)[1] = q1;
+		((string_qword_t *)cdest)[2] = q2;
+		((string_qword_t *)cdest)[3] = q3;
+		cdest += 32;
+		csrc += 32;
+		n -= 32;
+	}
+	while (n >= 8) {
+		*(string_qword_t *)cdest = *(const string_qword_t *)csrc;
+		cdest += 8;
+		csrc += 8;
+		n -= 8;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		cdest[i] = csrc[i];
+	}
+	return dest;
+}
+
+//! @brief Copy with rep movsb
+//! @param dest Pointer to destination buffer
+//! @param src Pointer to data to be copied
+//! @param n Number of bytes to be copied
+//! @return Value of dest parameter
+static void *string_memcpy_rep(void *dest, const void *src, size_t n) {
+	void *result = dest;
+	asm volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+	return result;
+}
+
+//! @brief Copy with rep movsb if buffer is large enough to amortize its startup cost
+//! @param dest Pointer to destination buffer
+//! @param src Pointer to data to be copied
+//! @param n Number of bytes to be copied
+//! @return Value of dest parameter
+static void *string_memcpy_erms(void *dest, const void *src, size_t n) {
+	if (n < STRING_REP_THRESHOLD) {
+		return string_memcpy_unrolled(dest, src, n);
+	}
+	return string_memcpy_rep(dest, src, n);
+}
+
+//! @brief Fill with 8 byte unrolled loop
+//! @param dest Pointer to destination buffer
+//! @param fill Byte to fill with
+//! @param size Size of the destination buffer
+//! @return Value of dest parameter
+STRING_NO_LIBCALLS static void *string_memset_unrolled(void *dest, int fill, size_t size) {
+	uint8_t *cdest = dest;
+	const uint64_t pattern = (uint8_t)fill * STRING_BYTES_ONE;
+	while (size >= 32) {
+		((string_qword_t *)cdest)[0] = pattern;
+		((string_qword_t *)cdest)[1] = pattern;
+		((string_qword_t *)cdest)[2] = pattern;
+		((string_qword_t *)cdest)[3] = pattern;
+		cdest += 32;
+		size -= 32;
+	}
+	while (size >= 8) {
+		*(string_qword_t *)cdest = pattern;
+		cdest += 8;
+		size -= 8;
+	}
+	for (size_t i = 0; i < size; ++i) {
+		cdest[i] = (uint8_t)fill;
+	}
+	return dest;
+}
+
+//! @brief Fill with rep stosb if buffer is large enough to amortize its startup cost
+//! @param dest Pointer to destination buffer
+//! @param fill Byte to fill with
+//! @param size Size of the destination buffer
+//! @return Value of dest parameter
+static void *string_memset_erms(void *dest, int fill, size_t size) {
+	if (size < STRING_REP_THRESHOLD) {
+		return string_memset_unrolled(dest, fill, size);
+	}
+	void *result = dest;
+	asm volatile("rep stosb" : "+D"(dest), "+c"(size) : "a"(fill) : "memory");
+	return result;
+}
+
+//! @brief Selected memcpy implementation
+static void *(*string_memcpy_impl)(void *, const void *, size_t) = string_memcpy_unrolled;
+
+//! @brief Selected memset implementation
+static void *(*string_memset_impl)(void *, int, size_t) = string_memset_unrolled;
 
 //! @brief Calculate length of null-terminated string
 //! @param str String, length of which should be calculated
@@ -19,12 +149,7 @@ size_t strlen(const char *str) {
 //! @param n Number of bytes to be copied
 //! @return Value of dest parameter
 void *memcpy(void *dest, const void *src, size_t n) {
-	uint8_t *cdest = dest;
-	const uint8_t *csrc = src;
-	for (size_t i = 0; i < n; ++i) {
-		cdest[i] = csrc[i];
-	}
-	return dest;
+	return string_memcpy_impl(dest, src, n);
 }
 
 //! @brief Fill area with bytes
@@ -32,11 +157,7 @@ void *memcpy(void *dest, const void *src, size_t n) {
 //! @param fill Byte to fill with
 //! @param size Size of the destination buffer
 void *memset(void *dest, int fill, size_t size) {
-	uint8_t *cdest = dest;
-	for (size_t i = 0; i < size; ++i) {
-		cdest[i] = (uint8_t)fill;
-	}
-	return dest;
+	return string_memset_impl(dest, fill, size);
 }
 
 //! @brief Compare two memory areas for equality
@@ -44,13 +165,131 @@ void *memset(void *dest, int fill, size_t size) {
 //! @param ptr2 Second memory area
 //! @param len Length of data to be compared
 //! @return -1, if str1 > str2, 0 if str1 == str2, 1 if str2 > str1
-int memcmp(const void *ptr1, const void *ptr2, size_t len) {
-	for (size_t i = 0; i < len; ++i) {
-		if (((uint8_t *)ptr1)[i] > ((uint8_t *)ptr2)[i]) {
+STRING_NO_LIBCALLS int memcmp(const void *ptr1, const void *ptr2, size_t len) {
+	const uint8_t *cptr1 = ptr1;
+	const uint8_t *cptr2 = ptr2;
+	size_t i = 0;
+	// Skip equal qwords, mismatching one is compared bytewise below
+	while (i + 8 <= len &&
+	       *(const string_qword_t *)(cptr1 + i) == *(const string_qword_t *)(cptr2 + i)) {
+		i += 8;
+	}
+	for (; i < len; ++i) {
+		if (cptr1[i] > cptr2[i]) {
 			return -1;
-		} else if (((uint8_t *)ptr1)[i] < ((uint8_t *)ptr2)[i]) {
+		} else if (cptr1[i] < cptr2[i]) {
 			return 1;
 		}
 	}
 	return 0;
 }
+
+//! @brief Copy memory with non-temporal stores, bypassing caches
+//! @param dest Pointer to destination buffer
+//! @param src Pointer to data to be copied
+//! @param n Number of bytes to be copied
+//! @note Intended for buffers of at least a page in size that won't be read back soon
+void memcpy_nt(void *dest, const void *src, size_t n) {
+	uint8_t *cdest = dest;
+	const uint8_t *csrc = src;
+	// Head is copied with regular stores until destination is 8 bytes aligned
+	const size_t head = (8 - (uintptr_t)cdest % 8) % 8;
+	if (head >= n) {
+		memcpy(dest, src, n);
+		return;
+	}
+	memcpy(cdest, csrc, head);
+	cdest += head;
+	csrc += head;
+	n -= head;
+	uint64_t *qdest = (uint64_t *)cdest;
+	for (size_t i = 0; i < n / 8; ++i) {
+		asm volatile("movnti %1, %0"
+		             : "=m"(qdest[i])
+		             : "r"(((const string_qword_t *)csrc)[i]));
+	}
+	memcpy(cdest + n - n % 8, csrc + n - n % 8, n % 8);
+	// Order non-temporal stores before stores that publish the memory
+	asm volatile("sfence" ::: "memory");
+}
+
+//! @brief Fill memory with non-temporal stores, bypassing caches
+//! @param dest Pointer to destination buffer
+//! @param fill Byte to fill with
+//! @param size Size of the destination buffer
+//! @note Intended for buffers of at least a page in size that won't be read back soon
+void memset_nt(void *dest, int fill, size_t size) {
+	uint8_t *cdest = dest;
+	const size_t head = (8 - (uintptr_t)cdest % 8) % 8;
+	if (head >= size) {
+		memset(dest, fill, size);
+		return;
+	}
+	memset(cdest, fill, head);
+	cdest += head;
+	size -= head;
+	const uint64_t pattern = (uint8_t)fill * STRING_BYTES_ONE;
+	uint64_t *qdest = (uint64_t *)cdest;
+	for (size_t i = 0; i < size / 8; ++i) {
+		asm volatile("movnti %1, %0" : "=m"(qdest[i]) : "r"(pattern));
+	}
+	memset(cdest + size - size % 8, fill, size % 8);
+	asm volatile("sfence" ::: "memory");
+}
+
+//! @brief Zero memory with non-temporal stores, bypassing caches
+//! @param dest Pointer to destination buffer. Should be 8 bytes aligned
+//! @param size Size of the destination buffer. Should be a multiple of 8
+void memzero_nt(void *dest, size_t size) {
+	uint64_t *qdest = dest;
+	for (size_t i = 0; i < size / 8; ++i) {
+		asm volatile("movnti %1, %0" : "=m"(qdest[i]) : "r"(0ULL));
+	}
+	// Order non-temporal stores before stores that publish the memory
+	asm volatile("sfence" ::: "memory");
+}
+
+//! @brief Force use of the given memcpy and memset implementations
+//! @param kind Implementation kind
+void string_dispatch_force(enum string_impl kind) {
+	switch (kind) {
+	case STRING_IMPL_UNROLLED:
+		string_memcpy_impl = string_memcpy_unrolled;
+		string_memset_impl = string_memset_unrolled;
+		break;
+	case STRING_IMPL_ERMS:
+		string_memcpy_impl = string_memcpy_erms;
+		string_memset_impl = string_memset_erms;
+		break;
+	case STRING_IMPL_FSRM:
+		// Fast short rep movsb has no startup cost to amortize. Short rep stosb is still slow
+		string_memcpy_impl = string_memcpy_rep;
+		string_memset_impl = string_memset_erms;
+		break;
+	}
+}
+
+//! @brief Get best memcpy and memset implementations for this CPU
+//! @return Implementation kind
+enum string_impl string_dispatch_best(void) {
+	if (string_fsrm_supported) {
+		return STRING_IMPL_FSRM;
+	} else if (string_erms_supported) {
+		return STRING_IMPL_ERMS;
+	}
+	return STRING_IMPL_UNROLLED;
+}
+
+//! @brief Select memcpy and memset implementations based on CPU features
+static void string_dispatch_init(void) {
+	struct cpuid buf;
+	cpuid(0, 0, &buf);
+	if (buf.eax >= 7) {
+		cpuid(7, 0, &buf);
+		string_erms_supported = (buf.ebx & (1U << 9U)) != 0;
+		string_fsrm_supported = (buf.edx & (1U << 4U)) != 0;
+	}
+	string_dispatch_force(string_dispatch_best());
+	LOG_INFO("ERMS: %s, FSRM: %s", string_erms_supported ? "yes" : "no",
+	         string_fsrm_supported ? "yes" : "no");
+}
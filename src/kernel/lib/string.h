@@ -3,8 +3,26 @@
 
 #pragma once
 
+#include <lib/target.h>
 #include <misc/types.h>
 
+//! @brief memcpy and memset implementation kinds
+enum string_impl
+{
+	//! @brief 8 byte unrolled loops
+	STRING_IMPL_UNROLLED,
+	//! @brief rep movsb/stosb for all but short buffers
+	STRING_IMPL_ERMS,
+	//! @brief rep movsb for copies of any size
+	STRING_IMPL_FSRM,
+};
+
+//! @brief True if CPU supports enhanced rep movsb/stosb
+extern bool string_erms_supported;
+
+//! @brief True if CPU supports fast short rep movsb
+extern bool string_fsrm_supported;
+
 //! @brief Calculate length of null-terminated string
 //! @param str String, length of which should be calculated
 size_t strlen(const char *str);
@@ -28,3 +46,34 @@ void *memset(void *dest, int fill, size_t size);
 //! @param len Length of data to be compared
 //! @return -1, if str1 > str2, 0 if str1 == str2, 1 if str2 > str1
 int memcmp(const void *ptr1, const void *ptr2, size_t len);
+
+//! @brief Copy memory with non-temporal stores, bypassing caches
+//! @param dest Pointer to destination buffer
+//! @param src Pointer to data to be copied
+//! @param n Number of bytes to be copied
+//! @note Intended for buffers of at least a page in size that won't be read back soon
+void memcpy_nt(void *dest, const void *src, size_t n);
+
+//! @brief Fill memory with non-temporal stores, bypassing caches
+//! @param dest Pointer to destination buffer
+//! @param fill Byte to fill with
+//! @param size Size of the destination buffer
+//! @note Intended for buffers of at least a page in size that won't be read back soon
+void memset_nt(void *dest, int fill, size_t size);
+
+//! @brief Zero memory with non-temporal stores, bypassing caches
+//! @param dest Pointer to destination buffer. Should be 8 bytes aligned
+//! @param size Size of the destination buffer. Should be a multiple of 8
+void memzero_nt(void *dest, size_t size);
+
+//! @brief Force use of the given memcpy and memset implementations
+//! @param kind Implementation kind
+//! @note Meant for benchmarks. Kind should be supported by the CPU
+void string_dispatch_force(enum string_impl kind);
+
+//! @brief Get best memcpy and memset implementations for this CPU
+//! @return Implementation kind
+enum string_impl string_dispatch_best(void);
+
+//! @brief Export string functions dispatch target
+EXPORT_TARGET(string_dispatch_available)
@@ -4,6 +4,7 @@
 #include <lib/log.h>
 #include <lib/panic.h>
 #include <lib/target.h>
+#include <sys/tsc.h>
 
 MODULE("initgraph")
 
@@ -48,13 +49,18 @@ struct target *target_compute_plan(struct target *target) {
 
 //! @brief Execute plan
 //! @param plan Plan to be executed returned from target_compute_plan
+//! @note Time spent on each target is reported in TSC cycles, as TSC may be not calibrated yet
 void target_execute_plan(struct target *plan) {
 	struct target *current = plan;
+	const uint64_t plan_start = tsc_read();
 	while (current != NULL) {
+		const uint64_t start = tsc_read();
 		current->callback();
-		LOG_SUCCESS("Target \033[33m\"%s\"\033[0m reached", current->name);
+		LOG_SUCCESS("Target \033[33m\"%s\"\033[0m reached (%U cycles)", current->name,
+		            tsc_read() - start);
 		current = current->next;
 	}
+	LOG_INFO("Plan executed in %U cycles", tsc_read() - plan_start);
 }
 
 //! @brief Dump plan to kernel log
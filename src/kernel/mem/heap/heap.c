@@ -7,27 +7,31 @@
 #include <mem/heap/slab.h>
 #include <mem/misc.h>
 #include <mem/phys/phys.h>
+#include <mem/reclaim.h>
+#include <mem/virt/vmalloc.h>
 #include <sys/numa/numa.h>
 #include <thread/smp/core.h>
 
 // Overview
 // 1. Slabs are aligned 64k regions for objects that are smaller that one page size. Each slab has a
 // special area reserved for slab header, that stores owner NUMA id
-// 2. Since physical memory allocation subsystem does not guarantee alignment above 4k, and heap
-// slabs need 64k alignment (to calculate slab header address), slabs are allocated in a big chunks
-// (64 slabs in a chunk in the best case, 63 in the worst) and padding is then leaked.
+// 2. Heap slabs need 64k alignment (to calculate slab header address). Slabs are allocated in big
+// chunks of 64 slabs. PMM aligns blocks on their size, so no padding is lost. Chunks are split into
+// separate PMM blocks, so that not-yet used slabs can be given back to PMM under memory pressure
 // 3. For each neighbour proximity domain (including self :^) allocator will first try to allocate
 // from slabs, and then it will try to allocate new chunk
 // 4. If there is no good block in free list, allocator will ask PMM for a new chunk. However, new
 // slabs from the chunk are added to the node which PMM picked for allocation, not to the node ID of
 // which was passed to mem_heap_alloc call
 // 5. For objects larger than 4k, allocator will directly call PMM to satisfy allocation request
-// TODO: maybe its a good idea to reclaim memory for slabs? We have slab headers anyway
+// 6. Objects larger than MEM_HEAP_VMALLOC_THRESHOLD are allocated with vmalloc instead, as PMM
+// would round them up to the next power of two
+// TODO: slabs that became empty after use are not reclaimed, as they are not tracked
 
 MODULE("mem/heap")
-TARGET(mem_heap_available, META_DUMMY,
-       {mem_phys_available, mem_misc_collect_info_available, thread_smp_core_available})
-META_DEFINE_DUMMY()
+TARGET(mem_heap_available, mem_heap_init,
+       {mem_phys_available, mem_misc_collect_info_available, thread_smp_core_available,
+        mem_vmalloc_available, mem_phys_frame_caches_available, mem_reclaim_available})
 
 //! @brief Slab size
 #define MEM_HEAP_SLAB_SIZE 65536
@@ -35,6 +39,9 @@ META_DEFINE_DUMMY()
 //! @brief Slab chunk size
 #define MEM_HEAP_CHUNK_SIZE (64 * MEM_HEAP_SLAB_SIZE)
 
+//! @brief Allocations larger than this size are served by vmalloc
+#define MEM_HEAP_VMALLOC_THRESHOLD (16 * PAGE_SIZE)
+
 //! @brief Free object in the slab
 struct mem_heap_obj {
 	//! @brief Next free object
@@ -59,9 +66,12 @@ static bool mem_allocate_new_slabs_chunk(numa_id_t id) {
 	if (backing_physmem == PHYS_NULL) {
 		return false;
 	}
-	// Align begin and end to slab size
-	uintptr_t backing_begin = align_up(backing_physmem, MEM_HEAP_SLAB_SIZE);
-	uintptr_t backing_end = align_down(backing_physmem + MEM_HEAP_CHUNK_SIZE, MEM_HEAP_SLAB_SIZE);
+	// PMM blocks are naturally aligned, hence chunk is aligned on slab size as well
+	ASSERT(backing_physmem % MEM_HEAP_CHUNK_SIZE == 0, "Chunk is not aligned");
+	// Let slabs be freed one by one
+	mem_phys_split_nolock(backing_physmem, MEM_HEAP_SLAB_SIZE);
+	uintptr_t backing_begin = backing_physmem;
+	uintptr_t backing_end = backing_physmem + MEM_HEAP_CHUNK_SIZE;
 	// Iterate over new slabs in backing memory
 	for (uintptr_t physaddr = backing_begin; physaddr < backing_end;
 	     physaddr += MEM_HEAP_SLAB_SIZE) {
@@ -72,7 +82,9 @@ static bool mem_allocate_new_slabs_chunk(numa_id_t id) {
 		// Add it to the list
 		new_slab->next_free = self->slab_data.slabs;
 		self->slab_data.slabs = new_slab;
+		self->slab_data.stats.empty_slabs++;
 	}
+	self->slab_data.stats.chunks++;
 	return true;
 }
 
@@ -86,6 +98,8 @@ static void mem_heap_add_slab(numa_id_t id, size_t order) {
 	// Take one slab
 	struct mem_heap_slab_hdr *new_slab = self->slab_data.slabs;
 	self->slab_data.slabs = new_slab->next_free;
+	self->slab_data.stats.empty_slabs--;
+	self->slab_data.stats.slabs[order]++;
 	new_slab->owner = id;
 	const uintptr_t start =
 	    align_up((uintptr_t)new_slab + sizeof(struct mem_heap_slab_hdr), (1ULL << order));
@@ -96,6 +110,7 @@ static void mem_heap_add_slab(numa_id_t id, size_t order) {
 		struct mem_heap_obj *obj = (struct mem_heap_obj *)addr;
 		obj->next = self->slab_data.free_lists[order];
 		self->slab_data.free_lists[order] = obj;
+		self->slab_data.stats.free[order]++;
 	}
 }
 
@@ -128,9 +143,47 @@ static struct mem_heap_obj *mem_allocate_from_slab(numa_id_t id, size_t order) {
 	ASSERT(numa_nodes[id].slab_data.free_lists[order] != NULL, "Free-list is empty");
 	struct mem_heap_obj *obj = numa_nodes[id].slab_data.free_lists[order];
 	numa_nodes[id].slab_data.free_lists[order] = obj->next;
+	numa_nodes[id].slab_data.stats.free[order]--;
+	numa_nodes[id].slab_data.stats.allocated[order]++;
 	return obj;
 }
 
+//! @brief Allocate object from heap slabs
+//! @param order Object size order
+//! @param id ID of the NUMA node on behalf of which memory will be allocated
+//! @param strict True if memory should be allocated on the node "id" only
+//! @return Pointer to the object or NULL if allocation failed
+static void *mem_heap_alloc_from_slabs(size_t order, numa_id_t id, bool strict) {
+	// Allocate using slabs. Its a bit more intricate here
+	// 1. Get NUMA node data. Bind policy allows only the node itself
+	struct numa_node *self = numa_nodes + id;
+	// 2. Iterate over all nodes
+	for (size_t i = 0; i < (strict ? 1 : numa_nodes_count); ++i) {
+		const numa_id_t neighbour_id = strict ? id : self->neighbours[i];
+		struct numa_node *neighbour = numa_nodes + neighbour_id;
+		// 3. Take node lock
+		const bool int_state = thread_spinlock_lock(&neighbour->lock);
+		// 3. Check if corresponding free list has anything for us
+		if (neighbour->slab_data.free_lists[order] == NULL) {
+			// 4. Okey, time to make a new slab. If there are no empty slabs, allocate a new chunk
+			if (neighbour->slab_data.slabs == NULL && !mem_allocate_new_slabs_chunk(neighbour_id)) {
+				thread_spinlock_unlock(&neighbour->lock, int_state);
+				continue;
+			}
+			mem_heap_add_slab(neighbour_id, order);
+		}
+		// 5. Cool, let's give that as a result
+		struct mem_heap_obj *obj = mem_allocate_from_slab(neighbour_id, order);
+		thread_spinlock_unlock(&neighbour->lock, int_state);
+		if (neighbour_id != id) {
+			MEM_STATS_NUMA_BUMP(neighbour, heap_remote_served);
+			MEM_STATS_NUMA_BUMP(self, heap_fallbacks);
+		}
+		return (void *)obj;
+	}
+	return NULL;
+}
+
 //! @brief Allocate memory
 //! @param size Size of the memory to be allocated
 //! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
@@ -145,51 +198,72 @@ void *mem_heap_alloc(size_t size) {
 //! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
 //! otherwise
 void *mem_heap_alloc_on_behalf(size_t size, numa_id_t id) {
+	struct mem_policy policy = MEM_POLICY_PREFERRED_INIT(id);
+	return mem_heap_alloc_policy(size, &policy);
+}
+
+//! @brief Allocate memory according to the NUMA placement policy
+//! @param size Size of the memory to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+//! @note Allocations served by vmalloc apply policy to each backing page
+void *mem_heap_alloc_policy(size_t size, struct mem_policy *policy) {
 	// Get size order
 	size_t order = mem_heap_get_size_order(size, MEM_HEAP_SLAB_ORDERS);
-	if (order == MEM_HEAP_SLAB_ORDERS) {
+	if (size > MEM_HEAP_VMALLOC_THRESHOLD) {
+		return mem_vmalloc_alloc_policy(size, policy);
+	} else if (order == MEM_HEAP_SLAB_ORDERS) {
 		// Allocate directly using PMM and cast to upper half
-		uintptr_t res = mem_phys_alloc_on_behalf(size, id);
+		uintptr_t res = mem_phys_alloc_policy(size, policy);
 		if (res == PHYS_NULL) {
 			return NULL;
 		}
 		return (void *)(mem_wb_phys_win_base + res);
 	}
-	// Allocate using slabs. Its a bit more intricate here
-	// 1. Get NUMA node data
-	struct numa_node *self = numa_nodes + id;
-	// 2. Iterate over all nodes
-	for (size_t i = 0; i < numa_nodes_count; ++i) {
-		const numa_id_t neighbour_id = self->neighbours[i];
-		struct numa_node *neighbour = numa_nodes + neighbour_id;
-		// 3. Take node lock
-		const bool int_state = thread_spinlock_lock(&neighbour->lock);
-		// 3. Check if corresponding free list has anything for us
-		if (neighbour->slab_data.free_lists[order] != NULL) {
-			// Cool, let's give that as a result
-			struct mem_heap_obj *obj = mem_allocate_from_slab(neighbour_id, order);
-			thread_spinlock_unlock(&neighbour->lock, int_state);
-			return (void *)obj;
-		}
-		// 4. Okey, time to make a new slab
-		if (neighbour->slab_data.slabs != NULL) {
-			// There are some empty slabs, just use them
-			mem_heap_add_slab(neighbour_id, order);
-			struct mem_heap_obj *obj = mem_allocate_from_slab(neighbour_id, order);
-			thread_spinlock_unlock(&neighbour->lock, int_state);
-			return (void *)obj;
-		}
-		// 5. Alright, let's allocate a new chunk
-		if (!mem_allocate_new_slabs_chunk(neighbour_id)) {
-			thread_spinlock_unlock(&neighbour->lock, int_state);
-			continue;
+	// Allocate using slabs
+	const numa_id_t id = mem_policy_next_node(policy);
+	const bool strict = mem_policy_is_strict(policy);
+	void *result = mem_heap_alloc_from_slabs(order, id, strict);
+	// If there is no memory left, ask caches to give memory back and try once more
+	if (result == NULL && mem_reclaim_direct(id) != 0) {
+		result = mem_heap_alloc_from_slabs(order, id, strict);
+	}
+	if (result == NULL) {
+		MEM_STATS_NUMA_BUMP(numa_nodes + id, heap_failures);
+	}
+	return result;
+}
+
+//! @brief Allocate zeroed memory
+//! @param size Size of the memory to be allocated
+//! @return NULL pointer if allocation failed, pointer to the zeroed virtual memory of size "size"
+//! otherwise
+//! @note Page-sized and larger allocations use pages from the pool of pre-zeroed pages
+void *mem_heap_alloc_zeroed(size_t size) {
+	return mem_heap_alloc_zeroed_policy(size, NULL);
+}
+
+//! @brief Allocate zeroed memory according to the NUMA placement policy
+//! @param size Size of the memory to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return NULL pointer if allocation failed, pointer to the zeroed virtual memory of size "size"
+//! otherwise
+void *mem_heap_alloc_zeroed_policy(size_t size, struct mem_policy *policy) {
+	if (size > MEM_HEAP_VMALLOC_THRESHOLD) {
+		return mem_vmalloc_alloc_zeroed_policy(size, policy);
+	} else if (size > PAGE_SIZE / 2 && size <= PAGE_SIZE && !mem_policy_is_strict(policy)) {
+		uintptr_t res = mem_phys_alloc_zeroed_page(mem_policy_next_node(policy));
+		if (res == PHYS_NULL) {
+			return NULL;
 		}
-		mem_heap_add_slab(neighbour_id, order);
-		struct mem_heap_obj *obj = mem_allocate_from_slab(neighbour_id, order);
-		thread_spinlock_unlock(&neighbour->lock, int_state);
-		return (void *)obj;
+		return (void *)(mem_wb_phys_win_base + res);
 	}
-	return NULL;
+	void *result = mem_heap_alloc_policy(size, policy);
+	if (result != NULL) {
+		memset(result, 0, size);
+	}
+	return result;
 }
 
 //! @brief Free memory on behalf of a given node
@@ -198,7 +272,10 @@ void *mem_heap_alloc_on_behalf(size_t size, numa_id_t id) {
 void mem_heap_free(void *mem, size_t size) {
 	ASSERT(mem != NULL, "Attempt to free NULL");
 	size_t order = mem_heap_get_size_order(size, MEM_HEAP_SLAB_ORDERS);
-	if (order == MEM_HEAP_SLAB_ORDERS) {
+	if (size > MEM_HEAP_VMALLOC_THRESHOLD) {
+		mem_vmalloc_free(mem, size);
+		return;
+	} else if (order == MEM_HEAP_SLAB_ORDERS) {
 		mem_phys_free((uintptr_t)mem - mem_wb_phys_win_base);
 		return;
 	}
@@ -214,6 +291,8 @@ void mem_heap_free(void *mem, size_t size) {
 	struct mem_heap_obj *obj = (struct mem_heap_obj *)mem;
 	obj->next = data->slab_data.free_lists[order];
 	data->slab_data.free_lists[order] = obj;
+	data->slab_data.stats.free[order]++;
+	data->slab_data.stats.allocated[order]--;
 	// 5. Free NUMA lock
 	thread_spinlock_unlock(&data->lock, int_state);
 }
@@ -233,6 +312,10 @@ void *mem_heap_realloc(void *mem, size_t newsize, size_t oldsize) {
 		mem_heap_free(mem, oldsize);
 		return NULL;
 	}
+	// If both regions are in vmalloc area, pages can be remapped without copying
+	if (oldsize > MEM_HEAP_VMALLOC_THRESHOLD && newsize > MEM_HEAP_VMALLOC_THRESHOLD) {
+		return mem_vmalloc_realloc(mem, newsize, oldsize);
+	}
 	// If orders match, we can just reuse mem. If not, reallocate to a new region
 	// NOTE: We assume here that PMM also allocates orders of 2
 	size_t oldorder = mem_heap_get_size_order(oldsize, 64);
@@ -252,3 +335,90 @@ void *mem_heap_realloc(void *mem, size_t newsize, size_t oldsize) {
 	mem_heap_free(mem, oldsize);
 	return result;
 }
+
+//! @brief Allocate aligned memory on behalf of a given node
+//! @param size Size of the memory to be allocated
+//! @param align Alignment. Should be a power of two not greater than PAGE_SIZE
+//! @param id Locality to which memory will belong
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+//! @note Memory is padded to the multiple of "align", so that no other object shares the last
+//! "align"-sized block with it
+void *mem_heap_alloc_aligned(size_t size, size_t align, numa_id_t id) {
+	ASSERT(align != 0 && (align & (align - 1)) == 0, "Alignment %U is not a power of two", align);
+	ASSERT(align <= PAGE_SIZE, "Alignment %U is greater than page size", align);
+	// Slab objects are naturally aligned to their order, and PMM/vmalloc memory is page-aligned
+	void *result = mem_heap_alloc_on_behalf(align_up(size, align), id);
+	ASSERT(((uintptr_t)result & (align - 1)) == 0, "Allocation at %p is not aligned", result);
+	return result;
+}
+
+//! @brief Free aligned memory
+//! @param mem Pointer to the previously allocated memory
+//! @param size Size of the allocated memory
+//! @param align Alignment passed to mem_heap_alloc_aligned
+void mem_heap_free_aligned(void *mem, size_t size, size_t align) {
+	mem_heap_free(mem, align_up(size, align));
+}
+
+//! @brief Allocate per-CPU array
+//! @param size Size of one element
+//! @return Table of thread_smp_core_max_cpus pointers to elements or NULL on failure
+//! @note Each element is padded to the cache line size and placed on its core's NUMA node
+void **mem_heap_alloc_per_cpu(size_t size) {
+	// Table itself is only read after creation, so it can be shared
+	void **array = mem_heap_alloc(sizeof(void *) * thread_smp_core_max_cpus);
+	if (array == NULL) {
+		return NULL;
+	}
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		array[i] = mem_heap_alloc_aligned(size, CACHE_LINE_SIZE, thread_smp_core_array[i].numa_id);
+		if (array[i] == NULL) {
+			for (size_t j = 0; j < i; ++j) {
+				mem_heap_free_aligned(array[j], size, CACHE_LINE_SIZE);
+			}
+			mem_heap_free(array, sizeof(void *) * thread_smp_core_max_cpus);
+			return NULL;
+		}
+	}
+	return array;
+}
+
+//! @brief Free per-CPU array
+//! @param array Table returned from mem_heap_alloc_per_cpu
+//! @param size Size of one element
+void mem_heap_free_per_cpu(void **array, size_t size) {
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		mem_heap_free_aligned(array[i], size, CACHE_LINE_SIZE);
+	}
+	mem_heap_free(array, sizeof(void *) * thread_smp_core_max_cpus);
+}
+
+//! @brief Give not-yet used slabs of the node back to PMM
+//! @param id ID of the node that is short on memory
+//! @return Number of bytes released
+static size_t mem_heap_shrink(numa_id_t id) {
+	struct numa_node *node = numa_nodes + id;
+	size_t result = 0;
+	const bool int_state = thread_spinlock_lock(&node->lock);
+	while (node->slab_data.slabs != NULL) {
+		struct mem_heap_slab_hdr *slab = node->slab_data.slabs;
+		node->slab_data.slabs = slab->next_free;
+		node->slab_data.stats.empty_slabs--;
+		// Chunks are split on allocation, so each slab is a separate PMM block of the same node
+		mem_phys_free_nolock((uintptr_t)slab - mem_wb_phys_win_base);
+		result += MEM_HEAP_SLAB_SIZE;
+	}
+	thread_spinlock_unlock(&node->lock, int_state);
+	return result;
+}
+
+//! @brief Heap shrinker
+static struct mem_reclaim_shrinker mem_heap_shrinker;
+
+//! @brief Initialize heap
+static void mem_heap_init(void) {
+	// Heap shrinker only takes node locks, which are never held while calling into allocator
+	mem_heap_shrinker = MEM_RECLAIM_SHRINKER_INIT("heap/empty_slabs", mem_heap_shrink, true);
+	mem_reclaim_register_shrinker(&mem_heap_shrinker);
+}
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <lib/target.h>
+#include <mem/policy.h>
 #include <misc/types.h>
 #include <sys/numa/numa.h>
 
@@ -20,6 +21,28 @@ void *mem_heap_alloc(size_t size);
 //! otherwise
 void *mem_heap_alloc_on_behalf(size_t size, numa_id_t id);
 
+//! @brief Allocate zeroed memory
+//! @param size Size of the memory to be allocated
+//! @return NULL pointer if allocation failed, pointer to the zeroed virtual memory of size "size"
+//! otherwise
+//! @note Page-sized and larger allocations use pages from the pool of pre-zeroed pages
+void *mem_heap_alloc_zeroed(size_t size);
+
+//! @brief Allocate memory according to the NUMA placement policy
+//! @param size Size of the memory to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+//! @note Allocations served by vmalloc apply policy to each backing page
+void *mem_heap_alloc_policy(size_t size, struct mem_policy *policy);
+
+//! @brief Allocate zeroed memory according to the NUMA placement policy
+//! @param size Size of the memory to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return NULL pointer if allocation failed, pointer to the zeroed virtual memory of size "size"
+//! otherwise
+void *mem_heap_alloc_zeroed_policy(size_t size, struct mem_policy *policy);
+
 //! @brief Free memory on behalf of a given node
 //! @param ptr Pointer to the previously allocated memory
 //! @param size Size of the allocated memory
@@ -32,5 +55,32 @@ void mem_heap_free(void *mem, size_t size);
 //! @return Pointer to the new memory or NULL if realloc failed
 void *mem_heap_realloc(void *mem, size_t newsize, size_t oldsize);
 
+//! @brief Allocate aligned memory on behalf of a given node
+//! @param size Size of the memory to be allocated
+//! @param align Alignment. Should be a power of two not greater than PAGE_SIZE
+//! @param id Locality to which memory will belong
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+//! @note Memory is padded to the multiple of "align", so that no other object shares the last
+//! "align"-sized block with it
+void *mem_heap_alloc_aligned(size_t size, size_t align, numa_id_t id);
+
+//! @brief Free aligned memory
+//! @param mem Pointer to the previously allocated memory
+//! @param size Size of the allocated memory
+//! @param align Alignment passed to mem_heap_alloc_aligned
+void mem_heap_free_aligned(void *mem, size_t size, size_t align);
+
+//! @brief Allocate per-CPU array
+//! @param size Size of one element
+//! @return Table of thread_smp_core_max_cpus pointers to elements or NULL on failure
+//! @note Each element is padded to the cache line size and placed on its core's NUMA node
+void **mem_heap_alloc_per_cpu(size_t size);
+
+//! @brief Free per-CPU array
+//! @param array Table returned from mem_heap_alloc_per_cpu
+//! @param size Size of one element
+void mem_heap_free_per_cpu(void **array, size_t size);
+
 //! @brief Target to initialize kernel heap
 EXPORT_TARGET(mem_heap_available)
@@ -3,19 +3,38 @@
 
 #pragma once
 
+#include <misc/types.h>
+
 //! @brief Slab orders count
 #define MEM_HEAP_SLAB_ORDERS 12
 
+//! @brief Heap slab's statistics
+struct mem_heap_slab_stats {
+	//! @brief Number of allocated objects for each order
+	size_t allocated[MEM_HEAP_SLAB_ORDERS];
+	//! @brief Number of objects in free lists for each order
+	size_t free[MEM_HEAP_SLAB_ORDERS];
+	//! @brief Number of slabs used for each order
+	size_t slabs[MEM_HEAP_SLAB_ORDERS];
+	//! @brief Number of allocated and not-yet used slabs
+	size_t empty_slabs;
+	//! @brief Number of slab chunks allocated from PMM
+	//! @note Slabs given back to PMM by heap shrinker are not subtracted
+	size_t chunks;
+};
+
 //! @brief Heap slab's data
 struct mem_heap_slab_data {
 	//! @brief Free lists
 	struct mem_heap_obj *free_lists[MEM_HEAP_SLAB_ORDERS];
 	//! @brief Allocated and not-yet used slabs
 	struct mem_heap_slab_hdr *slabs;
+	//! @brief Slab statistics
+	struct mem_heap_slab_stats stats;
 };
 
 //! @brief Static slab data init
 #define MEM_HEAP_SLAB_DATA_INIT                                                                    \
 	(struct mem_heap_slab_data) {                                                                  \
-		.free_lists = {0}, .slabs = 0                                                              \
+		.free_lists = {0}, .slabs = 0, .stats = {{0}, {0}, {0}, 0, 0},                             \
 	}
@@ -9,13 +9,17 @@
 #include <mem/mem.h>
 #include <mem/misc.h>
 #include <mem/phys/phys.h>
+#include <mem/usercopy.h>
+#include <mem/virt/fault.h>
 #include <sys/acpi/numa.h>
 #include <sys/numa/numa.h>
 
 MODULE("mem");
 TARGET(mem_add_numa_ranges_available, mem_add_numa_ranges,
        {numa_available, acpi_numa_available, mem_bootstrap_alloc_available})
-TARGET(mem_all_available, META_DUMMY, {mem_phys_available, mem_heap_available})
+TARGET(mem_all_available, META_DUMMY,
+       {mem_phys_available, mem_heap_available, mem_virt_fault_available,
+        mem_usercopy_available})
 META_DEFINE_DUMMY()
 
 //! @brief Estimate maximum number of memory region entries
@@ -41,6 +45,50 @@ static size_t mem_estimate_boot_ranges_upper_bound(void) {
 	return result;
 }
 
+//! @brief Table of all physical memory ranges sorted by base address
+struct mem_range *mem_ranges = NULL;
+
+//! @brief Number of entries in mem_ranges table
+size_t mem_ranges_count = 0;
+
+//! @brief Find memory range containing a given physical address
+//! @param addr Physical address
+//! @return Pointer to the memory range or NULL if address is not managed by any range
+struct mem_range *mem_range_lookup(uintptr_t addr) {
+	// Binary search for the last range with base <= addr
+	size_t low = 0;
+	size_t high = mem_ranges_count;
+	while (low < high) {
+		const size_t mid = (low + high) / 2;
+		if (mem_ranges[mid].slab.base <= addr) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (low == 0) {
+		return NULL;
+	}
+	struct mem_range *range = mem_ranges + (low - 1);
+	if (addr - range->slab.base >= range->slab.length) {
+		return NULL;
+	}
+	return range;
+}
+
+//! @brief Sort memory ranges table by base address
+//! @note Insertion sort is used, as there are only a few ranges
+static void mem_sort_ranges(void) {
+	for (size_t i = 1; i < mem_ranges_count; ++i) {
+		const struct mem_range current = mem_ranges[i];
+		size_t j = i;
+		for (; j > 0 && mem_ranges[j - 1].slab.base > current.slab.base; --j) {
+			mem_ranges[j] = mem_ranges[j - 1];
+		}
+		mem_ranges[j] = current;
+	}
+}
+
 //! @brief Initialize NUMA nodes with memory ranges
 //! @param memmap Stivale2 memory map tag
 static void mem_add_numa_ranges(void) {
@@ -50,8 +98,7 @@ static void mem_add_numa_ranges(void) {
 	// Allocate memory pool for boot memory ranges
 	size_t num_entries = mem_estimate_boot_ranges_upper_bound();
 	size_t size = sizeof(struct mem_range) * num_entries;
-	struct mem_range *entries = mem_bootstrap_alloc(size);
-	size_t current_entry = 0;
+	mem_ranges = mem_bootstrap_alloc(size);
 	// Terminate bootstrap allocator and get border of bootstrap allocated memory
 	uintptr_t border = mem_bootstrap_terminate_allocator();
 	// Enumerate all usable memory map entries
@@ -76,19 +123,33 @@ static void mem_add_numa_ranges(void) {
 			LOG_INFO("Usable memory range %p - %p belongs to domain %u", buf.start, buf.end,
 			         (uint32_t)buf.node_id);
 			// Allocate memory range object for this physical region
-			ASSERT(current_entry < num_entries,
+			ASSERT(mem_ranges_count < num_entries,
 			       "Failed to statically allocate memory range object");
-			struct mem_range *range = entries + (current_entry++);
-			// Get corresponding NUMA node object
-			struct numa_node *node = numa_nodes + buf.node_id;
-			if (node == NULL) {
-				LOG_PANIC("Unknown NUMA node");
-			}
-			// Initialize range info
-			mem_phys_slab_init(&range->slab, buf.start, buf.end - buf.start);
-			// Add range to node's ranges list
-			range->next_range = node->ranges;
-			node->ranges = range;
+			struct mem_range *range = mem_ranges + (mem_ranges_count++);
+			// Record range bounds. Slab is initialized once table is sorted
+			range->slab.base = buf.start;
+			range->slab.length = buf.end - buf.start;
+			range->node_id = buf.node_id;
+		}
+	}
+	// Sort ranges table so that ranges could be found by address
+	mem_sort_ranges();
+	for (size_t i = 0; i < mem_ranges_count; ++i) {
+		struct mem_range *range = mem_ranges + i;
+		// Get corresponding NUMA node object
+		struct numa_node *node = numa_nodes + range->node_id;
+		if (node == NULL) {
+			LOG_PANIC("Unknown NUMA node");
 		}
+		// Initialize range info. Ranges of other nodes are only partially initialized, the rest
+		// is done by the cores on these nodes once they are online
+		const size_t eager_length = range->node_id == acpi_numa_boot_domain
+		                                ? range->slab.length
+		                                : MEM_PHYS_EAGER_INIT_SIZE;
+		mem_phys_slab_init_partial(&range->slab, range->slab.base, range->slab.length,
+		                           eager_length);
+		// Add range to node's ranges list
+		range->next_range = node->ranges;
+		node->ranges = range;
 	}
 }
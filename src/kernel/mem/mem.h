@@ -7,6 +7,7 @@
 #include <lib/target.h>
 #include <mem/phys/slab.h>
 #include <mem/rc.h>
+#include <sys/numa/numa.h>
 
 //! @brief Physical memory range
 struct mem_range {
@@ -14,8 +15,21 @@ struct mem_range {
 	struct mem_range *next_range;
 	//! @brief Physical memory slab
 	struct mem_phys_slab slab;
+	//! @brief ID of the NUMA node range belongs to
+	numa_id_t node_id;
 };
 
+//! @brief Table of all physical memory ranges sorted by base address
+extern struct mem_range *mem_ranges;
+
+//! @brief Number of entries in mem_ranges table
+extern size_t mem_ranges_count;
+
+//! @brief Find memory range containing a given physical address
+//! @param addr Physical address
+//! @return Pointer to the memory range or NULL if address is not managed by any range
+struct mem_range *mem_range_lookup(uintptr_t addr);
+
 //! @brief Export "add memory ranges to NUMA nodes" target
 EXPORT_TARGET(mem_add_numa_ranges_available)
 
@@ -11,6 +11,9 @@
 //! @brief Page size
 #define PAGE_SIZE (1ULL << PHYS_SLAB_GRAN)
 
+//! @brief Cache line size
+#define CACHE_LINE_SIZE 64ULL
+
 //! @brief End of low physical memory
 #define PHYS_LOW (2 * 1024 * 1024)
 
@@ -26,12 +29,16 @@ extern uintptr_t mem_wb_phys_win_base;
 //! @brief True if 5 level paging is enabled
 extern bool mem_5level_paging_enabled;
 
+//! @brief True if 1 GB pages are supported
+extern bool mem_1gb_pages_supported;
+
 //! @brief Physical space size
 extern size_t mem_phys_space_size;
 
 //! @brief Export boot memory-related info detection routine
 //! @note Required as a dependency to use mem_wb_phys_win_base
 //! @note Required as a dependency to use mem_5level_paging_enabled
+//! @note Required as a dependency to use mem_1gb_pages_supported
 EXPORT_TARGET(mem_misc_collect_info_available)
 
 //! @brief Export phys space size calculation target
@@ -8,36 +8,31 @@
 #include <mem/mem.h>
 #include <mem/misc.h>
 #include <mem/phys/phys.h>
+#include <mem/reclaim.h>
 #include <misc/misc.h>
-#include <sys/acpi/numa.h>
 #include <sys/numa/numa.h>
+#include <sys/tsc.h>
+#include <thread/smp/core.h>
+#include <thread/tasking/localsched.h>
+#include <thread/tasking/task.h>
 
 MODULE("mem/phys")
 TARGET(mem_phys_available, mem_phys_init,
        {mem_add_numa_ranges_available, numa_available, mem_misc_collect_info_available,
         mem_phys_space_size_available})
+TARGET(mem_phys_frame_caches_available, mem_phys_frame_caches_init,
+       {mem_phys_available, thread_smp_core_available, mem_reclaim_available})
 
-//! @brief Pointer to array of mem_phys_object_data structures.
-//! @note Used to store information about allocated physical objects
-static struct mem_phys_object_data *mem_phys_objects_info = NULL;
-
-//! @brief Safe info about newly allocated physical block
-//! @param addr Physical address
-//! @param size Size
-//! @param range Weak ref to range
-//! @param id NUMA node id
-static void mem_phys_store_info(uintptr_t addr, size_t size, struct mem_range *range,
-                                numa_id_t id) {
-	// If object info pointer is NULL, do not store any info
-	if (mem_phys_objects_info == NULL) {
-		return;
-	}
-	// Get allocation object
-	struct mem_phys_object_data *obj = mem_phys_objects_info + (addr / PAGE_SIZE);
-	// Store reference to the memory pool in it
-	obj->range = MEM_REF_BORROW(range);
-	obj->size = size;
-	obj->node_id = id;
+//! @brief True if per-CPU frame caches can be used
+static bool mem_phys_frame_caches_enabled = false;
+
+//! @brief Get memory range allocated block belongs to
+//! @param addr Physical address of the block
+//! @return Pointer to the memory range
+static struct mem_range *mem_phys_get_range(uintptr_t addr) {
+	struct mem_range *range = mem_range_lookup(addr);
+	ASSERT(range != NULL, "Physical address 0x%p is not managed by PMM", addr);
+	return range;
 }
 
 //! @brief Allocate permanent physical memory in the specific NUMA node wihtout taking NUMA
@@ -53,7 +48,6 @@ uintptr_t mem_phys_alloc_specific_nolock(size_t size, numa_id_t id) {
 		uintptr_t result = mem_phys_slab_alloc(&range->slab, size);
 		ASSERT(result < mem_wb_phys_win_base, "Block in higher half");
 		if (result != PHYS_NULL) {
-			mem_phys_store_info(result, size, range, id);
 			return result;
 		}
 	}
@@ -69,6 +63,130 @@ uintptr_t mem_phys_alloc_specific(size_t size, numa_id_t id) {
 	const bool int_state = thread_spinlock_lock(&node->lock);
 	uintptr_t result = mem_phys_alloc_specific_nolock(size, id);
 	thread_spinlock_unlock(&node->lock, int_state);
+	mem_reclaim_check(id);
+	return result;
+}
+
+//! @brief Give block back to the range or to the 1 GiB blocks reserve of its node
+//! @param range Memory range block belongs to
+//! @param addr Physical address of the block
+//! @param order Block order
+//! @note Lock of the node memory belongs to should be held
+static void mem_phys_release_nolock(struct mem_range *range, uintptr_t addr, size_t order) {
+	struct numa_node *node = numa_nodes + range->node_id;
+	// Reserved blocks stay allocated in the range, so that small allocations can't split them
+	if ((1ULL << order) == MEM_PHYS_HUGE_1G_SIZE &&
+	    node->huge_reserve_count < node->huge_reserve_target) {
+		*(uintptr_t *)(mem_wb_phys_win_base + addr) = node->huge_reserve;
+		node->huge_reserve = addr;
+		node->huge_reserve_count++;
+		return;
+	}
+	mem_phys_slab_free(&range->slab, addr, 1ULL << order);
+}
+
+//! @brief Free permanent physical memory without taking owning node's lock
+//! @param addr Address returned from mem_phys_alloc_specific_nolock
+//! @note Lock of the node memory belongs to should be held
+void mem_phys_free_nolock(uintptr_t addr) {
+	struct mem_range *range = mem_phys_get_range(addr);
+	mem_phys_slab_free(&range->slab, addr, 1ULL << mem_phys_slab_block_order(&range->slab, addr));
+}
+
+//! @brief Split allocated physical memory into smaller blocks that can be freed separately
+//! @param addr Address returned from mem_phys_alloc_specific_nolock
+//! @param piece Size of the new blocks. Should be a power of two not less than PAGE_SIZE
+//! @note Lock of the node memory belongs to should be held
+void mem_phys_split_nolock(uintptr_t addr, size_t piece) {
+	struct mem_range *range = mem_phys_get_range(addr);
+	mem_phys_slab_split_allocated(&range->slab, addr, piece);
+}
+
+//! @brief Split allocated physical memory into smaller blocks that can be freed separately
+//! @param addr Address returned from one of mem_phys_alloc_* functions
+//! @param piece Size of the new blocks. Should be a power of two not less than PAGE_SIZE
+void mem_phys_split(uintptr_t addr, size_t piece) {
+	struct mem_range *range = mem_phys_get_range(addr);
+	struct numa_node *node = numa_nodes + range->node_id;
+	const bool int_state = thread_spinlock_lock(&node->lock);
+	mem_phys_slab_split_allocated(&range->slab, addr, piece);
+	thread_spinlock_unlock(&node->lock, int_state);
+}
+
+//! @brief Refill per-CPU frame cache from the node
+//! @param cache Pointer to the frame cache
+//! @param id ID of the core's NUMA node
+//! @note Runs with ints disabled
+static void mem_phys_frame_cache_refill(struct mem_phys_frame_cache *cache, numa_id_t id) {
+	struct numa_node *node = numa_nodes + id;
+	thread_spinlock_grab(&node->lock);
+	while (cache->count < MEM_PHYS_FRAME_CACHE_BATCH) {
+		const uintptr_t frame = mem_phys_alloc_specific_nolock(PAGE_SIZE, id);
+		if (frame == PHYS_NULL) {
+			break;
+		}
+		cache->frames[cache->count++] = frame;
+	}
+	thread_spinlock_ungrab(&node->lock);
+}
+
+//! @brief Drain a batch of frames from per-CPU frame cache back to the node
+//! @param cache Pointer to the frame cache
+//! @param id ID of the core's NUMA node
+//! @note Runs with ints disabled
+static void mem_phys_frame_cache_drain(struct mem_phys_frame_cache *cache, numa_id_t id) {
+	struct numa_node *node = numa_nodes + id;
+	const size_t new_count = cache->count - MEM_PHYS_FRAME_CACHE_BATCH;
+	thread_spinlock_grab(&node->lock);
+	for (size_t i = new_count; i < cache->count; ++i) {
+		struct mem_range *range = mem_phys_get_range(cache->frames[i]);
+		mem_phys_slab_free(&range->slab, cache->frames[i], PAGE_SIZE);
+	}
+	thread_spinlock_ungrab(&node->lock);
+	cache->count = new_count;
+}
+
+//! @brief Allocate frame from per-CPU frame cache
+//! @param id Numa node on behalf of which memory will be allocated
+//! @return Physical address of the frame or PHYS_NULL if cache can't be used
+static uintptr_t mem_phys_frame_cache_alloc(numa_id_t id) {
+	uintptr_t result = PHYS_NULL;
+	bool refilled = false;
+	// Disable interrupts to stay on this core
+	const bool int_state = intlevel_elevate();
+	if (PER_CPU(numa_id) == id) {
+		struct mem_phys_frame_cache *cache = &PER_CPU(frame_cache);
+		if (cache->count == 0) {
+			mem_phys_frame_cache_refill(cache, id);
+			refilled = true;
+		}
+		if (cache->count != 0) {
+			result = cache->frames[--cache->count];
+		}
+	}
+	intlevel_recover(int_state);
+	if (refilled) {
+		mem_reclaim_check(id);
+	}
+	return result;
+}
+
+//! @brief Free frame to per-CPU frame cache
+//! @param addr Physical address of the frame
+//! @param id ID of the NUMA node frame belongs to
+//! @return True if frame was put in the cache
+static bool mem_phys_frame_cache_free(uintptr_t addr, numa_id_t id) {
+	bool result = false;
+	const bool int_state = intlevel_elevate();
+	if (PER_CPU(numa_id) == id) {
+		struct mem_phys_frame_cache *cache = &PER_CPU(frame_cache);
+		if (cache->count == MEM_PHYS_FRAME_CACHE_SIZE) {
+			mem_phys_frame_cache_drain(cache, id);
+		}
+		cache->frames[cache->count++] = addr;
+		result = true;
+	}
+	intlevel_recover(int_state);
 	return result;
 }
 
@@ -77,54 +195,358 @@ uintptr_t mem_phys_alloc_specific(size_t size, numa_id_t id) {
 //! @param id Numa node on behalf of which memory will be allocated
 //! @return Physical address of the allocated area, PHYS_NULL otherwise
 uintptr_t mem_phys_alloc_on_behalf(size_t size, numa_id_t id) {
-	// Get NUMA node data
-	const struct numa_node *data = numa_nodes + id;
-	// Iterate over all nodes
-	for (size_t i = 0; i < numa_nodes_count; ++i) {
-		const numa_id_t neighbour_id = data->neighbours[i];
-		uintptr_t result = mem_phys_alloc_specific(size, neighbour_id);
+	// Try per-CPU frame cache first
+	if (size <= PAGE_SIZE && mem_phys_frame_caches_enabled) {
+		uintptr_t result = mem_phys_frame_cache_alloc(id);
 		if (result != PHYS_NULL) {
 			return result;
 		}
 	}
+	// Get NUMA node data
+	const struct numa_node *data = numa_nodes + id;
+	// Iterate over all nodes. If all of them are out of memory, ask caches to give memory back
+	// and try once more
+	for (size_t attempt = 0; attempt < 2; ++attempt) {
+		for (size_t i = 0; i < numa_nodes_count; ++i) {
+			const numa_id_t neighbour_id = data->neighbours[i];
+			uintptr_t result = mem_phys_alloc_specific(size, neighbour_id);
+			if (result != PHYS_NULL) {
+				if (neighbour_id != id) {
+					MEM_STATS_NUMA_BUMP(numa_nodes + neighbour_id, phys_remote_served);
+					MEM_STATS_NUMA_BUMP(numa_nodes + id, phys_fallbacks);
+				}
+				return result;
+			}
+		}
+		if (attempt != 0 || mem_reclaim_direct(id) == 0) {
+			break;
+		}
+	}
+	MEM_STATS_NUMA_BUMP(numa_nodes + id, phys_failures);
 	return PHYS_NULL;
 }
 
-//! @brief Free permanent physical memory
-//! @param addr Address returned from mem_phys_alloc_on_behalf
-void mem_phys_free(uintptr_t addr) {
-	// Get allocation data
-	struct mem_phys_object_data *obj = mem_phys_objects_info + (addr / PAGE_SIZE);
+//! @brief Allocate permanent physical memory according to the NUMA placement policy
+//! @param size Size of the memory area to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return Physical address of the allocated area, PHYS_NULL otherwise
+uintptr_t mem_phys_alloc_policy(size_t size, struct mem_policy *policy) {
+	const numa_id_t id = mem_policy_next_node(policy);
+	if (!mem_policy_is_strict(policy)) {
+		return mem_phys_alloc_on_behalf(size, id);
+	}
+	uintptr_t result = mem_phys_alloc_specific(size, id);
+	if (result == PHYS_NULL && mem_reclaim_direct(id) != 0) {
+		result = mem_phys_alloc_specific(size, id);
+	}
+	if (result == PHYS_NULL) {
+		MEM_STATS_NUMA_BUMP(numa_nodes + id, phys_failures);
+	}
+	return result;
+}
+
+//! @brief Free permanent physical memory back to the memory range
+//! @param range Memory range block belongs to
+//! @param addr Physical address of the block
+//! @param order Block order
+static void mem_phys_free_to_range(struct mem_range *range, uintptr_t addr, size_t order) {
 	// Lock owning NUMA node
-	struct numa_node *data = numa_nodes + obj->node_id;
+	struct numa_node *data = numa_nodes + range->node_id;
 	const bool int_state = thread_spinlock_lock(&data->lock);
 	// Free memory back to the memory region
-	mem_phys_slab_free(&obj->range->slab, addr, obj->size);
+	mem_phys_release_nolock(range, addr, order);
 	// Unlock NUMA node
 	thread_spinlock_unlock(&data->lock, int_state);
-	// Drop reference to the memory region
-	MEM_REF_DROP(obj->range);
 }
 
-//! @brief Get access to physical regions's data
-//! @param addr Address of the physical
-//! @return Pointer to physical region data
-struct mem_phys_object_data *mem_phys_get_data(uintptr_t addr) {
-	return mem_phys_objects_info + (addr / PAGE_SIZE);
+//! @brief Free permanent physical memory
+//! @param addr Address returned from mem_phys_alloc_on_behalf
+void mem_phys_free(uintptr_t addr) {
+	// Get owning range and block order
+	struct mem_range *range = mem_phys_get_range(addr);
+	const size_t order = mem_phys_slab_block_order(&range->slab, addr);
+	// Put single frames in per-CPU cache if possible
+	if (order == PHYS_SLAB_GRAN && mem_phys_frame_caches_enabled &&
+	    mem_phys_frame_cache_free(addr, range->node_id)) {
+		return;
+	}
+	mem_phys_free_to_range(range, addr, order);
+}
+
+//! @brief Free permanent physical memory directly to the owning node bypassing per-CPU frame cache
+//! @param addr Address returned from mem_phys_alloc_on_behalf
+void mem_phys_free_uncached(uintptr_t addr) {
+	struct mem_range *range = mem_phys_get_range(addr);
+	mem_phys_free_to_range(range, addr, mem_phys_slab_block_order(&range->slab, addr));
+}
+
+//! @brief Take one more reference to the allocated block
+//! @param addr Address returned from one of mem_phys_alloc_* functions
+//! @note Used to share frames between copy-on-write mappings. Block is only freed by mem_phys_put
+//! once all references are dropped
+void mem_phys_share(uintptr_t addr) {
+	struct mem_range *range = mem_phys_get_range(addr);
+	ATOMIC_FETCH_INCREMENT(mem_phys_slab_block_shares(&range->slab, addr));
+}
+
+//! @brief Check if allocated block has more than one reference
+//! @param addr Address returned from one of mem_phys_alloc_* functions
+//! @return True if block is shared
+bool mem_phys_shared(uintptr_t addr) {
+	struct mem_range *range = mem_phys_get_range(addr);
+	return ATOMIC_ACQUIRE_LOAD(mem_phys_slab_block_shares(&range->slab, addr)) != 0;
+}
+
+//! @brief Drop reference to the allocated block and free it if it was the last one
+//! @param addr Address returned from one of mem_phys_alloc_* functions
+void mem_phys_put(uintptr_t addr) {
+	struct mem_range *range = mem_phys_get_range(addr);
+	uint32_t *shares = mem_phys_slab_block_shares(&range->slab, addr);
+	// Counter only wraps for the last owner, who restores it before freeing the block
+	if (ATOMIC_FETCH_DECREMENT(shares) != 0) {
+		return;
+	}
+	ATOMIC_RELEASE_STORE(shares, 0);
+	mem_phys_free(addr);
+}
+
+//! @brief Drop references to a batch of allocated blocks and free the ones that lost their last
+//! reference
+//! @param addrs Array of addresses returned from one of mem_phys_alloc_* functions. Overwritten
+//! @param count Number of addresses in the array
+//! @note Blocks bypass per-CPU frame caches. Node lock is taken once per run of blocks from the
+//! same node
+void mem_phys_put_batch(uintptr_t *addrs, size_t count) {
+	// Keep only blocks that lost their last reference
+	size_t freed = 0;
+	for (size_t i = 0; i < count; ++i) {
+		struct mem_range *range = mem_phys_get_range(addrs[i]);
+		uint32_t *shares = mem_phys_slab_block_shares(&range->slab, addrs[i]);
+		if (ATOMIC_FETCH_DECREMENT(shares) != 0) {
+			continue;
+		}
+		ATOMIC_RELEASE_STORE(shares, 0);
+		addrs[freed++] = addrs[i];
+	}
+	size_t i = 0;
+	while (i < freed) {
+		const numa_id_t id = mem_phys_get_range(addrs[i])->node_id;
+		struct numa_node *node = numa_nodes + id;
+		const bool int_state = thread_spinlock_lock(&node->lock);
+		for (; i < freed; ++i) {
+			struct mem_range *range = mem_phys_get_range(addrs[i]);
+			if (range->node_id != id) {
+				break;
+			}
+			const size_t order = mem_phys_slab_block_order(&range->slab, addrs[i]);
+			mem_phys_release_nolock(range, addrs[i], order);
+		}
+		thread_spinlock_unlock(&node->lock, int_state);
+	}
+}
+
+//! @brief Return all frames from this core's frame cache to the node
+//! @param id ID of the node that is short on memory
+//! @return Number of bytes returned
+//! @note Only the cache of the current core can be flushed, and only if it belongs to the node
+static size_t mem_phys_frame_cache_shrink(numa_id_t id) {
+	if (!mem_phys_frame_caches_enabled) {
+		return 0;
+	}
+	const bool int_state = intlevel_elevate();
+	struct mem_phys_frame_cache *cache = &PER_CPU(frame_cache);
+	const size_t result = cache->count * PAGE_SIZE;
+	if (PER_CPU(numa_id) != id) {
+		intlevel_recover(int_state);
+		return 0;
+	}
+	struct numa_node *node = numa_nodes + id;
+	thread_spinlock_grab(&node->lock);
+	for (size_t i = 0; i < cache->count; ++i) {
+		struct mem_range *range = mem_phys_get_range(cache->frames[i]);
+		mem_phys_slab_free(&range->slab, cache->frames[i], PAGE_SIZE);
+	}
+	thread_spinlock_ungrab(&node->lock);
+	cache->count = 0;
+	intlevel_recover(int_state);
+	return result;
+}
+
+//! @brief Return all pages from the node's pool of pre-zeroed pages to PMM
+//! @param id ID of the node that is short on memory
+//! @return Number of bytes returned
+static size_t mem_phys_zero_pool_shrink(numa_id_t id) {
+	return mem_phys_zero_pool_drain(id) * PAGE_SIZE;
+}
+
+//! @brief Per-CPU frame cache shrinker
+static struct mem_reclaim_shrinker mem_phys_frame_cache_shrinker;
+
+//! @brief Pre-zeroed pages pool shrinker
+static struct mem_reclaim_shrinker mem_phys_zero_pool_shrinker;
+
+//! @brief Allocate naturally aligned physical memory on behalf of the given NUMA node
+//! @param size Size of the memory area to be allocated. Should be a power of two
+//! @param id Numa node on behalf of which memory will be allocated
+//! @return Physical address of the allocated area aligned on its size, PHYS_NULL otherwise
+//! @note Intended for 2 MiB and 1 GiB huge page blocks. 1 GiB blocks are taken from the node's
+//! reserve first. If no free block is large enough, pages cached in pools are returned to PMM by
+//! direct reclaim to let buddies merge, and allocation is retried
+uintptr_t mem_phys_alloc_aligned_on_behalf(size_t size, numa_id_t id) {
+	ASSERT(size >= PAGE_SIZE && (size & (size - 1)) == 0, "Size %U is not a power of two", size);
+	if (size == MEM_PHYS_HUGE_1G_SIZE) {
+		struct numa_node *node = numa_nodes + id;
+		const bool int_state = thread_spinlock_lock(&node->lock);
+		const uintptr_t reserved = node->huge_reserve;
+		if (reserved != PHYS_NULL) {
+			node->huge_reserve = *(uintptr_t *)(mem_wb_phys_win_base + reserved);
+			node->huge_reserve_count--;
+		}
+		thread_spinlock_unlock(&node->lock, int_state);
+		if (reserved != PHYS_NULL) {
+			return reserved;
+		}
+	}
+	// Buddy allocator places blocks of size 2^k on 2^k boundary, so any block will do
+	const uintptr_t result = mem_phys_alloc_on_behalf(size, id);
+	ASSERT(result % size == 0, "Block at 0x%p is not aligned on %U", result, size);
+	return result;
 }
 
 //! @brief Initialize physical memory manager
 static void mem_phys_init(void) {
-	// Calculate space needed to store info about allocations
-	const size_t gran_units_size = mem_phys_space_size / PAGE_SIZE;
-	const size_t info_size = gran_units_size * sizeof(struct mem_phys_object_data);
-	// Allocate space for info in boot domain
-	const numa_id_t boot_domain = acpi_numa_boot_domain;
-	uintptr_t info_phys = mem_phys_alloc_on_behalf(info_size, boot_domain);
-	if (info_phys == PHYS_NULL) {
-		PANIC("Failed to allocate space to store info about physical allocations");
-	}
-	// Convert to higher half
-	mem_phys_objects_info = (struct mem_phys_object_data *)(mem_wb_phys_win_base + info_phys);
-	LOG_INFO("mem_phys_objects_info at %p", mem_phys_objects_info);
+	// Report PMM metadata overhead. Only usable ranges have per-page metadata (free heads bit and
+	// order byte), node and range are found in a sorted ranges table
+	size_t meta_bytes = mem_ranges_count * sizeof(struct mem_range);
+	size_t managed_bytes = 0;
+	for (size_t i = 0; i < mem_ranges_count; ++i) {
+		meta_bytes += mem_ranges[i].slab.meta_length;
+		managed_bytes += mem_ranges[i].slab.length;
+	}
+	LOG_INFO("PMM metadata: %U bytes for %U ranges (%U bytes managed, physical space size %U)",
+	         meta_bytes, mem_ranges_count, managed_bytes, mem_phys_space_size);
+}
+
+//! @brief Number of nodes which deferred PMM initialization is still in progress for
+static size_t mem_phys_deferred_remaining = 0;
+
+//! @brief Add deferred parts of all node's ranges to free lists
+//! @param id ID of the node
+//! @return Number of bytes added
+static size_t mem_phys_init_deferred_on_node(numa_id_t id) {
+	struct numa_node *node = numa_nodes + id;
+	size_t result = 0;
+	for (struct mem_range *range = node->ranges; range != NULL; range = range->next_range) {
+		if (range->slab.deferred_length == 0) {
+			continue;
+		}
+		result += range->slab.deferred_length;
+		// Zero metadata without holding the lock, only free lists update needs it
+		mem_phys_slab_prepare_deferred(&range->slab);
+		const bool int_state = thread_spinlock_lock(&node->lock);
+		mem_phys_slab_add_deferred(&range->slab);
+		thread_spinlock_unlock(&node->lock, int_state);
+	}
+	return result;
+}
+
+//! @brief Deferred PMM initialization task
+//! @param ctx NUMA node ID casted to pointer
+static void mem_phys_init_deferred_task(void *ctx) {
+	const numa_id_t id = (numa_id_t)(uintptr_t)ctx;
+	const uint64_t start = tsc_read();
+	const size_t bytes = mem_phys_init_deferred_on_node(id);
+	LOG_INFO("Node %u: %U bytes added to PMM on core %u in %U us", id, bytes, PER_CPU(logical_id),
+	         (tsc_read() - start) / PER_CPU(tsc_freq));
+	ATOMIC_FETCH_DECREMENT(&mem_phys_deferred_remaining);
+	thread_localsched_terminate();
+}
+
+//! @brief Check if node has ranges with deferred initialization
+//! @param id ID of the node
+//! @return True if there are such ranges
+static bool mem_phys_node_has_deferred(numa_id_t id) {
+	for (struct mem_range *range = numa_nodes[id].ranges; range != NULL;
+	     range = range->next_range) {
+		if (range->slab.deferred_length != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//! @brief Reserve 1 GiB blocks on nodes that have enough memory
+//! @note Moving live pages to free 1 GiB blocks later is not possible, as there are no reverse
+//! mappings to fix page tables with. Blocks are reserved while memory is not fragmented yet
+static void mem_phys_reserve_huge(void) {
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		struct numa_node *node = numa_nodes + i;
+		if (!node->initialized) {
+			continue;
+		}
+		size_t bytes = 0;
+		for (struct mem_range *range = node->ranges; range != NULL; range = range->next_range) {
+			bytes += range->slab.length;
+		}
+		if (bytes < MEM_PHYS_HUGE_1G_RESERVE_MIN_NODE) {
+			continue;
+		}
+		node->huge_reserve_target = MEM_PHYS_HUGE_1G_RESERVED;
+		for (size_t j = 0; j < MEM_PHYS_HUGE_1G_RESERVED; ++j) {
+			const uintptr_t block = mem_phys_alloc_specific(MEM_PHYS_HUGE_1G_SIZE, i);
+			if (block == PHYS_NULL) {
+				break;
+			}
+			// Reserve is not full, so the block goes there
+			mem_phys_free_uncached(block);
+		}
+		LOG_INFO("Node %u: %U 1 GiB blocks reserved", i, node->huge_reserve_count);
+	}
+}
+
+//! @brief Finish initialization of PMM metadata on all nodes in parallel
+//! @note Should be called from task context once APs are online. Each node is initialized by one
+//! of its cores, so that node's metadata is only touched locally
+void mem_phys_init_deferred(void) {
+	const uint64_t start = tsc_read();
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		if (!numa_nodes[i].initialized || !mem_phys_node_has_deferred(i)) {
+			continue;
+		}
+		// Memory-only nodes have no cores, initialize them from here
+		const size_t core = thread_smp_core_find_on_node(i);
+		struct thread_task *task = NULL;
+		if (core != thread_smp_core_max_cpus) {
+			task = thread_task_create_call(
+			    CALLBACK_VOID(mem_phys_init_deferred_task, (void *)(uintptr_t)i));
+		}
+		if (task == NULL) {
+			mem_phys_init_deferred_on_node(i);
+			continue;
+		}
+		task->kernel_only = true;
+		ATOMIC_FETCH_INCREMENT(&mem_phys_deferred_remaining);
+		thread_localsched_associate(core, task);
+	}
+	while (ATOMIC_ACQUIRE_LOAD(&mem_phys_deferred_remaining) != 0) {
+		asm volatile("pause");
+	}
+	LOG_INFO("Deferred PMM initialization finished in %U us",
+	         (tsc_read() - start) / PER_CPU(tsc_freq));
+	mem_phys_reserve_huge();
+}
+
+//! @brief Initialize per-CPU frame caches
+static void mem_phys_frame_caches_init(void) {
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		thread_smp_core_array[i].frame_cache.count = 0;
+	}
+	mem_phys_frame_caches_enabled = true;
+	// Frame cache and zero pool shrinkers only take PMM locks, so they can run on allocation path
+	mem_phys_frame_cache_shrinker =
+	    MEM_RECLAIM_SHRINKER_INIT("phys/frame_cache", mem_phys_frame_cache_shrink, true);
+	mem_reclaim_register_shrinker(&mem_phys_frame_cache_shrinker);
+	mem_phys_zero_pool_shrinker =
+	    MEM_RECLAIM_SHRINKER_INIT("phys/zero_pool", mem_phys_zero_pool_shrink, true);
+	mem_reclaim_register_shrinker(&mem_phys_zero_pool_shrinker);
 }
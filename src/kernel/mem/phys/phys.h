@@ -1,19 +1,46 @@
 //! @file phys.h
 //! @brief Physical memory management
 
+#pragma once
+
 #include <init/stivale2.h>
+#include <lib/target.h>
+#include <mem/policy.h>
 #include <mem/phys/slab.h>
 #include <misc/types.h>
 #include <sys/numa/numa.h>
 
-//! @brief Physical allocation data
-struct mem_phys_object_data {
-	//! @brief Memory range object was allocated in
-	struct mem_range *range;
-	//! @brief Size of the memory block
-	size_t size;
-	//! @brief NUMA id of the owner
-	numa_id_t node_id;
+//! @brief Size of the 2 MiB huge page block
+#define MEM_PHYS_HUGE_2M_SIZE 0x200000ULL
+
+//! @brief Size of the 1 GiB huge page block
+#define MEM_PHYS_HUGE_1G_SIZE 0x40000000ULL
+
+//! @brief Number of 1 GiB blocks each node reserves for mem_phys_alloc_aligned_on_behalf once all
+//! its memory is added to PMM
+#define MEM_PHYS_HUGE_1G_RESERVED 1
+
+//! @brief Nodes with less memory don't reserve 1 GiB blocks, as reserve would take a large share
+//! of their memory
+#define MEM_PHYS_HUGE_1G_RESERVE_MIN_NODE (8 * MEM_PHYS_HUGE_1G_SIZE)
+
+//! @brief Size of memory in each range of non-boot nodes that is usable right after PMM init. The
+//! rest is added by mem_phys_init_deferred
+#define MEM_PHYS_EAGER_INIT_SIZE (32 * 1024 * 1024)
+
+//! @brief Capacity of the per-CPU frame cache
+#define MEM_PHYS_FRAME_CACHE_SIZE 64
+
+//! @brief Number of frames moved between per-CPU frame cache and node at once
+#define MEM_PHYS_FRAME_CACHE_BATCH 32
+
+//! @brief Per-CPU cache of free 4k frames from the core's NUMA node
+//! @note Cached frames are accounted as allocated by the node
+struct mem_phys_frame_cache {
+	//! @brief Physical addresses of cached frames
+	uintptr_t frames[MEM_PHYS_FRAME_CACHE_SIZE];
+	//! @brief Number of cached frames
+	size_t count;
 };
 
 //! @brief Allocate permanent physical memory in the specific NUMA node without taking node's lock
@@ -28,20 +55,104 @@ uintptr_t mem_phys_alloc_specific_nolock(size_t size, numa_id_t id);
 //! @return Physical address of the allocated area, PHYS_NULL otherwise
 uintptr_t mem_phys_alloc_specific(size_t size, numa_id_t id);
 
+//! @brief Free permanent physical memory without taking owning node's lock
+//! @param addr Address returned from mem_phys_alloc_specific_nolock
+//! @note Lock of the node memory belongs to should be held
+void mem_phys_free_nolock(uintptr_t addr);
+
+//! @brief Split allocated physical memory into smaller blocks that can be freed separately
+//! @param addr Address returned from mem_phys_alloc_specific_nolock
+//! @param piece Size of the new blocks. Should be a power of two not less than PAGE_SIZE
+//! @note Lock of the node memory belongs to should be held
+void mem_phys_split_nolock(uintptr_t addr, size_t piece);
+
+//! @brief Split allocated physical memory into smaller blocks that can be freed separately
+//! @param addr Address returned from one of mem_phys_alloc_* functions
+//! @param piece Size of the new blocks. Should be a power of two not less than PAGE_SIZE
+void mem_phys_split(uintptr_t addr, size_t piece);
+
 //! @brief Allocate permanent physical memory on behalf of the given NUMA node
 //! @param size Size of the memory area to be allocated
 //! @param id Numa node on behalf of which memory will be allocated
 //! @return Physical address of the allocated area, PHYS_NULL otherwise
 uintptr_t mem_phys_alloc_on_behalf(size_t size, numa_id_t id);
 
+//! @brief Allocate permanent physical memory according to the NUMA placement policy
+//! @param size Size of the memory area to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return Physical address of the allocated area, PHYS_NULL otherwise
+uintptr_t mem_phys_alloc_policy(size_t size, struct mem_policy *policy);
+
+//! @brief Allocate naturally aligned physical memory on behalf of the given NUMA node
+//! @param size Size of the memory area to be allocated. Should be a power of two
+//! @param id Numa node on behalf of which memory will be allocated
+//! @return Physical address of the allocated area aligned on its size, PHYS_NULL otherwise
+//! @note Intended for 2 MiB and 1 GiB huge page blocks. 1 GiB blocks are taken from the node's
+//! reserve first. If no free block is large enough, pages cached in pools are returned to PMM by
+//! direct reclaim to let buddies merge, and allocation is retried
+uintptr_t mem_phys_alloc_aligned_on_behalf(size_t size, numa_id_t id);
+
 //! @brief Free permanent physical memory
 //! @param addr Address returned from mem_phys_alloc_on_behalf
 void mem_phys_free(uintptr_t addr);
 
-//! @brief Get access to physical regions's data
-//! @param addr Address of the physical
-//! @return Pointer to physical region data
-struct mem_phys_object_data *mem_phys_get_data(uintptr_t addr);
+//! @brief Free permanent physical memory directly to the owning node bypassing per-CPU frame cache
+//! @param addr Address returned from mem_phys_alloc_on_behalf
+void mem_phys_free_uncached(uintptr_t addr);
+
+//! @brief Take one more reference to the allocated block
+//! @param addr Address returned from one of mem_phys_alloc_* functions
+//! @note Used to share frames between copy-on-write mappings. Block is only freed by mem_phys_put
+//! once all references are dropped
+void mem_phys_share(uintptr_t addr);
+
+//! @brief Check if allocated block has more than one reference
+//! @param addr Address returned from one of mem_phys_alloc_* functions
+//! @return True if block is shared
+bool mem_phys_shared(uintptr_t addr);
+
+//! @brief Drop reference to the allocated block and free it if it was the last one
+//! @param addr Address returned from one of mem_phys_alloc_* functions
+void mem_phys_put(uintptr_t addr);
+
+//! @brief Drop references to a batch of allocated blocks and free the ones that lost their last
+//! reference
+//! @param addrs Array of addresses returned from one of mem_phys_alloc_* functions. Overwritten
+//! @param count Number of addresses in the array
+//! @note Blocks bypass per-CPU frame caches. Node lock is taken once per run of blocks from the
+//! same node
+void mem_phys_put_batch(uintptr_t *addrs, size_t count);
+
+//! @brief Allocate zeroed page on behalf of the given NUMA node
+//! @param id Numa node on behalf of which memory will be allocated
+//! @return Physical address of the zeroed page, PHYS_NULL otherwise
+//! @note Page is taken from the node's pool of pre-zeroed pages if possible
+uintptr_t mem_phys_alloc_zeroed_page(numa_id_t id);
+
+//! @brief Return all pages from the node's pool of pre-zeroed pages to PMM
+//! @param id ID of the NUMA node
+//! @return Number of pages returned
+size_t mem_phys_zero_pool_drain(numa_id_t id);
+
+//! @brief Zero one more page and put it in the node's pool of pre-zeroed pages
+//! @param id ID of the NUMA node
+//! @return True if page was added, false if pool is full or node is short on memory
+//! @note Intended to be called by idle cores
+bool mem_phys_zero_pool_refill_step(numa_id_t id);
+
+//! @brief Put page that is already zeroed in the pool of its node
+//! @param page Physical address of the zeroed page. Should not be shared
+//! @return True if page was added, false if pool is full or node is short on memory
+//! @note Page is left to the caller if false is returned
+bool mem_phys_zero_pool_put(uintptr_t page);
+
+//! @brief Finish initialization of PMM metadata on all nodes in parallel
+//! @note Should be called from task context once APs are online. Each node is initialized by one
+//! of its cores, so that node's metadata is only touched locally
+void mem_phys_init_deferred(void);
 
 //! @brief Export PMM initializaton target
 EXPORT_TARGET(mem_phys_available)
+
+//! @brief Export per-CPU frame caches initialization target
+EXPORT_TARGET(mem_phys_frame_caches_available)
@@ -2,29 +2,77 @@
 //! @brief File containing interface for physical memory slabs
 
 #include <lib/panic.h>
+#include <lib/string.h>
 #include <lib/target.h>
 #include <mem/misc.h>
 #include <mem/phys/slab.h>
+#include <misc/misc.h>
 
 MODULE("mem/phys/slab")
 
-//! @brief Initialize mem_phys_slab for allocations from a given memory range
+// Overview
+// 1. Each block of order k is aligned on 2^k in physical memory. Block's buddy is found by flipping
+// bit k of its address
+// 2. Free blocks store free-list header in their first bytes. Bitmap at the start of the range
+// tells which pages are heads of free blocks, so that header is only trusted if the bit is set
+// 3. Order of each allocated block is stored in a byte array after the bitmap, indexed by the first
+// page of the block. Share counters used by copy-on-write mappings are stored the same way. Share
+// counters of free blocks are always 0, so blocks come out of the allocator with one owner
+// 4. On free, block is merged with its buddy while buddy is free and has the same order
+// 5. Mask of non-empty free lists gives O(1) lookup of the suitable order
+
+//! @brief Header of the free block
+struct mem_phys_slab_free_block {
+	//! @brief Physical address of the next free block of the same order
+	uintptr_t next;
+	//! @brief Physical address of the previous free block of the same order
+	uintptr_t prev;
+	//! @brief Block order
+	size_t order;
+};
+
+//! @brief Get pointer to the free block header
+//! @param block Physical address of the block
+//! @return Pointer to the header
+static inline struct mem_phys_slab_free_block *mem_phys_slab_get_hdr(uintptr_t block) {
+	return (struct mem_phys_slab_free_block *)(mem_wb_phys_win_base + block);
+}
+
+//! @brief Get index of the page in the free heads bitmap
 //! @param slab Slab object
-//! @param base Physical memory range base
-//! @param length Physical memory range length
-void mem_phys_slab_init(struct mem_phys_slab *slab, uintptr_t base, size_t length) {
-	slab->base = base;
-	slab->length = length;
-	slab->brk_bytes = 0;
-	// Zero out free-lists
-	for (size_t i = 0; i < 64; ++i) {
-		slab->free_lists[i] = PHYS_NULL;
+//! @param block Physical address of the block
+//! @return Page index
+static inline size_t mem_phys_slab_page_index(struct mem_phys_slab *slab, uintptr_t block) {
+	return (block - slab->base) / PAGE_SIZE;
+}
+
+//! @brief Set or clear free head bit for a given block
+//! @param slab Slab object
+//! @param block Physical address of the block
+//! @param free New bit value
+static inline void mem_phys_slab_set_free_head(struct mem_phys_slab *slab, uintptr_t block,
+                                               bool free) {
+	const size_t index = mem_phys_slab_page_index(slab, block);
+	if (free) {
+		slab->free_heads[index / 64] |= (1ULL << (index % 64));
+	} else {
+		slab->free_heads[index / 64] &= ~(1ULL << (index % 64));
 	}
-	slab->max_freed_order = 0;
 }
 
-//! @brief Physical NULL
-#define PHYS_NULL ((uintptr_t)0)
+//! @brief Check if block is a head of the free block of a given order
+//! @param slab Slab object
+//! @param block Physical address of the block
+//! @param order Block order
+//! @return True if block is free and has the given order
+static inline bool mem_phys_slab_is_free(struct mem_phys_slab *slab, uintptr_t block,
+                                         size_t order) {
+	const size_t index = mem_phys_slab_page_index(slab, block);
+	if ((slab->free_heads[index / 64] & (1ULL << (index % 64))) == 0) {
+		return false;
+	}
+	return mem_phys_slab_get_hdr(block)->order == order;
+}
 
 //! @brief Enqueue block in the free list of the given slab object
 //! @param slab Slab object
@@ -32,12 +80,40 @@ void mem_phys_slab_init(struct mem_phys_slab *slab, uintptr_t base, size_t lengt
 //! @param block Physical address of the block
 static void mem_phys_slab_enqueue(struct mem_phys_slab *slab, size_t order, uintptr_t block) {
 	ASSERT(block < mem_wb_phys_win_base, "Block in higher half");
-	if (slab->max_freed_order < order) {
-		slab->max_freed_order = order;
+	struct mem_phys_slab_free_block *hdr = mem_phys_slab_get_hdr(block);
+	hdr->next = slab->free_lists[order];
+	hdr->prev = PHYS_NULL;
+	hdr->order = order;
+	if (hdr->next != PHYS_NULL) {
+		mem_phys_slab_get_hdr(hdr->next)->prev = block;
 	}
-	uintptr_t *block_next_ptr = (uintptr_t *)(mem_wb_phys_win_base + block);
-	*block_next_ptr = slab->free_lists[order];
 	slab->free_lists[order] = block;
+	slab->free_orders_mask |= (1ULL << order);
+	slab->free_blocks[order]++;
+	slab->free_bytes += 1ULL << order;
+	mem_phys_slab_set_free_head(slab, block, true);
+}
+
+//! @brief Remove block from the free list
+//! @param slab Slab object
+//! @param order Block order
+//! @param block Physical address of the block
+static void mem_phys_slab_remove(struct mem_phys_slab *slab, size_t order, uintptr_t block) {
+	struct mem_phys_slab_free_block *hdr = mem_phys_slab_get_hdr(block);
+	if (hdr->prev != PHYS_NULL) {
+		mem_phys_slab_get_hdr(hdr->prev)->next = hdr->next;
+	} else {
+		slab->free_lists[order] = hdr->next;
+	}
+	if (hdr->next != PHYS_NULL) {
+		mem_phys_slab_get_hdr(hdr->next)->prev = hdr->prev;
+	}
+	if (slab->free_lists[order] == PHYS_NULL) {
+		slab->free_orders_mask &= ~(1ULL << order);
+	}
+	slab->free_blocks[order]--;
+	slab->free_bytes -= 1ULL << order;
+	mem_phys_slab_set_free_head(slab, block, false);
 }
 
 //! @brief Dequeue block from the free list
@@ -46,21 +122,100 @@ static void mem_phys_slab_enqueue(struct mem_phys_slab *slab, size_t order, uint
 //! @return Physical address of the block
 static uintptr_t mem_phys_slab_dequeue(struct mem_phys_slab *slab, size_t order) {
 	uintptr_t block = slab->free_lists[order];
-	uintptr_t next = *(uintptr_t *)(mem_wb_phys_win_base + block);
-	slab->free_lists[order] = next;
-	if (next == PHYS_NULL && slab->max_freed_order == order) {
-		size_t i = slab->max_freed_order - 1;
-		slab->max_freed_order = 0;
-		while (i-- > 0) {
-			if (slab->free_lists[i] != PHYS_NULL) {
-				slab->max_freed_order = i;
-			}
-		}
-	}
+	ASSERT(block != PHYS_NULL, "Free-list is empty");
+	mem_phys_slab_remove(slab, order, block);
 	ASSERT(block < mem_wb_phys_win_base, "Block in higher half");
 	return block;
 }
 
+//! @brief Add memory range to free lists as a sequence of naturally aligned blocks
+//! @param slab Slab object
+//! @param start Start of the range
+//! @param end End of the range
+static void mem_phys_slab_add_free_range(struct mem_phys_slab *slab, uintptr_t start,
+                                         uintptr_t end) {
+	while (start < end) {
+		// Take the largest block that is aligned on its size and fits in the range
+		size_t order = start == 0 ? MEM_PHYS_SLAB_ORDERS_COUNT - 1 : __builtin_ctzll(start);
+		while ((1ULL << order) > end - start) {
+			order--;
+		}
+		mem_phys_slab_enqueue(slab, order, start);
+		start += (1ULL << order);
+	}
+}
+
+//! @brief Initialize mem_phys_slab, adding only the head of the range to free lists
+//! @param slab Slab object
+//! @param base Physical memory range base
+//! @param length Physical memory range length
+//! @param eager_length Length of the memory made available right away. Rounded up to
+//! MEM_PHYS_SLAB_EAGER_GRAN
+//! @note Metadata for the whole range is reserved. Rest of the range should be added with
+//! mem_phys_slab_prepare_deferred and mem_phys_slab_add_deferred
+void mem_phys_slab_init_partial(struct mem_phys_slab *slab, uintptr_t base, size_t length,
+                                size_t eager_length) {
+	// Zero out free-lists and statistics
+	for (size_t i = 0; i < MEM_PHYS_SLAB_ORDERS_COUNT; ++i) {
+		slab->free_lists[i] = PHYS_NULL;
+		slab->free_blocks[i] = 0;
+		slab->allocated_blocks[i] = 0;
+	}
+	slab->free_orders_mask = 0;
+	slab->free_bytes = 0;
+	// Place free heads bitmap, shares and orders arrays at the start of the range. For simplicity,
+	// they cover metadata pages too
+	const size_t pages = length / PAGE_SIZE;
+	const size_t bitmap_size = align_up(pages, 64) / 8;
+	const size_t meta_size = align_up(bitmap_size + pages * (sizeof(uint32_t) + 1), PAGE_SIZE);
+	if (length <= meta_size) {
+		slab->base = base;
+		slab->length = 0;
+		slab->meta_length = 0;
+		slab->deferred_length = 0;
+		slab->free_heads = NULL;
+		slab->shares = NULL;
+		slab->orders = NULL;
+		return;
+	}
+	slab->free_heads = (uint64_t *)(mem_wb_phys_win_base + base);
+	slab->shares = (uint32_t *)((uint8_t *)slab->free_heads + bitmap_size);
+	slab->orders = (uint8_t *)(slab->shares + pages);
+	slab->meta_length = meta_size;
+	slab->base = base + meta_size;
+	// Only the eager part of the range is managed for now
+	const size_t total_length = align_down(length - meta_size, PAGE_SIZE);
+	const size_t eager = align_up(eager_length, MEM_PHYS_SLAB_EAGER_GRAN);
+	slab->length = eager < total_length ? eager : total_length;
+	slab->deferred_length = total_length - slab->length;
+	memset(slab->free_heads, 0, align_up(slab->length / PAGE_SIZE, 64) / 8);
+	memset(slab->shares, 0, slab->length / PAGE_SIZE * sizeof(uint32_t));
+	mem_phys_slab_add_free_range(slab, slab->base, slab->base + slab->length);
+}
+
+//! @brief Initialize mem_phys_slab for allocations from a given memory range
+//! @param slab Slab object
+//! @param base Physical memory range base
+//! @param length Physical memory range length
+void mem_phys_slab_init(struct mem_phys_slab *slab, uintptr_t base, size_t length) {
+	mem_phys_slab_init_partial(slab, base, length, length);
+}
+
+//! @brief Prepare metadata for the deferred part of the range
+//! @param slab Slab object
+//! @note Does not require any locks, as slab never looks at metadata beyond its length
+void mem_phys_slab_prepare_deferred(struct mem_phys_slab *slab) {
+	if (slab->deferred_length == 0) {
+		return;
+	}
+	const size_t eager_words = slab->length / PAGE_SIZE / 64;
+	const size_t total_pages = (slab->length + slab->deferred_length) / PAGE_SIZE;
+	const size_t total_words = align_up(total_pages, 64) / 64;
+	memset(slab->free_heads + eager_words, 0, (total_words - eager_words) * sizeof(uint64_t));
+	const size_t eager_pages = slab->length / PAGE_SIZE;
+	memset(slab->shares + eager_pages, 0, (total_pages - eager_pages) * sizeof(uint32_t));
+}
+
 //! @brief Split block of physical memory of a given order to the order needed
 //! @param slab Slab object
 //! @param base Block physical base
@@ -94,31 +249,48 @@ static size_t mem_phys_slab_get_order(size_t size) {
 uintptr_t mem_phys_slab_alloc(struct mem_phys_slab *slab, size_t size) {
 	// Allocation algorithm is very simple
 	// 1. Find which free list we need to query
-	// 2. Return block from that free list if its not empty
-	// 3. Split blocks from higher order free lists if those are not empty
-	// 4. If all free lists are empty, attempt to allocate by incerasing slab->brk_base by size
+	// 2. Find the smallest non-empty free list of this or higher order using free orders mask
+	// 3. Split block from that free list down to the order needed
 	// Get block order
 	size_t order = mem_phys_slab_get_order(size);
 	// If block is larger than all orders we provide, return PHYS_NULL
 	if (order == MEM_PHYS_SLAB_ORDERS_COUNT) {
 		return PHYS_NULL;
 	}
-	// 2 and 3. Iterate free from order to slab->max_freed_order
-	for (size_t i = order; i <= slab->max_freed_order; ++i) {
-		if (slab->free_lists[i] != PHYS_NULL) {
-			uintptr_t block = mem_phys_slab_dequeue(slab, i);
-			mem_phys_slab_split_until_target(slab, block, i, order);
-			return block;
-		}
+	// 2. Mask out orders that are too small
+	const uint64_t candidates = slab->free_orders_mask & ~((1ULL << order) - 1);
+	if (candidates == 0) {
+		return PHYS_NULL;
 	}
-	// 4. Allocate with brk
-	size_t new_brk_bytes = slab->brk_bytes + (1ULL << order);
-	if (new_brk_bytes <= slab->length) {
-		uintptr_t base = slab->brk_bytes + slab->base;
-		slab->brk_bytes = new_brk_bytes;
-		return base;
+	// 3. Split block to the target order
+	const size_t found = __builtin_ctzll(candidates);
+	uintptr_t block = mem_phys_slab_dequeue(slab, found);
+	mem_phys_slab_split_until_target(slab, block, found, order);
+	slab->orders[mem_phys_slab_page_index(slab, block)] = (uint8_t)order;
+	slab->allocated_blocks[order]++;
+	return block;
+}
+
+//! @brief Insert free block, merging it with buddies while possible
+//! @param slab Slab object
+//! @param addr Physical address of the block
+//! @param order Block order
+static void mem_phys_slab_insert(struct mem_phys_slab *slab, uintptr_t addr, size_t order) {
+	const uintptr_t end = slab->base + slab->length;
+	while (order + 1 < MEM_PHYS_SLAB_ORDERS_COUNT) {
+		const uintptr_t buddy = addr ^ (1ULL << order);
+		if (buddy < slab->base || buddy + (1ULL << order) > end) {
+			break;
+		}
+		if (!mem_phys_slab_is_free(slab, buddy, order)) {
+			break;
+		}
+		mem_phys_slab_remove(slab, order, buddy);
+		addr = addr < buddy ? addr : buddy;
+		order++;
 	}
-	return PHYS_NULL;
+	// Add block to the free list
+	mem_phys_slab_enqueue(slab, order, addr);
 }
 
 //! @brief Deallocate physical memory
@@ -126,7 +298,48 @@ uintptr_t mem_phys_slab_alloc(struct mem_phys_slab *slab, size_t size) {
 //! @param addr Addess of the previously allocated physical memory range
 //! @param size Size of the memory to be allocated
 void mem_phys_slab_free(struct mem_phys_slab *slab, uintptr_t addr, size_t size) {
-	// Add block to the free list
 	size_t order = mem_phys_slab_get_order(size);
-	mem_phys_slab_enqueue(slab, order, addr);
+	ASSERT(addr % (1ULL << order) == 0, "Block at 0x%p is not aligned on its size", addr);
+	ASSERT(mem_phys_slab_block_order(slab, addr) == order, "Block at 0x%p has order mismatch",
+	       addr);
+	slab->allocated_blocks[order]--;
+	mem_phys_slab_insert(slab, addr, order);
+}
+
+//! @brief Split allocated block into smaller allocated blocks that can be freed separately
+//! @param slab Slab object
+//! @param addr Address of the block returned from mem_phys_slab_alloc
+//! @param piece Size of the new blocks. Should be a power of two not less than PAGE_SIZE
+void mem_phys_slab_split_allocated(struct mem_phys_slab *slab, uintptr_t addr, size_t piece) {
+	const size_t order = mem_phys_slab_block_order(slab, addr);
+	const size_t piece_order = mem_phys_slab_get_order(piece);
+	ASSERT(piece_order <= order, "Can't split block at 0x%p of order %U into pieces of order %U",
+	       addr, order, piece_order);
+	ASSERT(*mem_phys_slab_block_shares(slab, addr) == 0, "Can't split shared block at 0x%p", addr);
+	// Only heads of allocated blocks have valid orders, so it is enough to update them
+	for (uintptr_t current = addr; current < addr + (1ULL << order);
+	     current += (1ULL << piece_order)) {
+		slab->orders[mem_phys_slab_page_index(slab, current)] = (uint8_t)piece_order;
+	}
+	slab->allocated_blocks[order]--;
+	slab->allocated_blocks[piece_order] += 1ULL << (order - piece_order);
+}
+
+//! @brief Add deferred part of the range to free lists
+//! @param slab Slab object
+//! @note mem_phys_slab_prepare_deferred should be called first. Slab lock should be held
+void mem_phys_slab_add_deferred(struct mem_phys_slab *slab) {
+	uintptr_t start = slab->base + slab->length;
+	const uintptr_t end = start + slab->deferred_length;
+	slab->length += slab->deferred_length;
+	slab->deferred_length = 0;
+	// Blocks are inserted with merging, so that they coalesce with the eager part of the range
+	while (start < end) {
+		size_t order = __builtin_ctzll(start);
+		while ((1ULL << order) > end - start) {
+			order--;
+		}
+		mem_phys_slab_insert(slab, start, order);
+		start += (1ULL << order);
+	}
 }
@@ -7,7 +7,11 @@
 #include <mem/rc.h>
 #include <misc/types.h>
 
-//! @brief One physical memory slab on a given range of physical memory
+//! @brief Number of physical slab orders
+#define MEM_PHYS_SLAB_ORDERS_COUNT 64
+
+//! @brief One physical memory slab on a given range of physical memory. Manages memory with buddy
+//! allocator, blocks of each order are naturally aligned
 struct mem_phys_slab {
 	//! @brief Refcounted base
 	struct mem_rc rc_base;
@@ -15,16 +19,33 @@ struct mem_phys_slab {
 	struct mem_phys_slab *next;
 	//! @brief Physical memory region base
 	uintptr_t base;
-	//! @brief Bytes allocated with brk
-	size_t brk_bytes;
 	//! @brief Length of the memory region
 	size_t length;
-
-#define MEM_PHYS_SLAB_ORDERS_COUNT 64
-	//! @brief Free-lists
+	//! @brief Bitmap with one bit per page. Bit is set if page is the first page of a free block
+	//! @note Stored at the start of the memory range
+	uint64_t *free_heads;
+	//! @brief Number of extra references to the allocated block for each page (0 if block has one
+	//! owner). Only valid for first pages of blocks
+	//! @note Stored at the start of the memory range right after free heads bitmap
+	uint32_t *shares;
+	//! @brief Order of the allocated block for each page. Only valid for first pages of blocks
+	//! @note Stored at the start of the memory range right after shares array
+	uint8_t *orders;
+	//! @brief Size of the metadata carved from the start of the memory range
+	size_t meta_length;
+	//! @brief Length of the tail of the memory range that is not yet added to free lists
+	size_t deferred_length;
+	//! @brief Free-lists (doubly linked through headers stored in free blocks)
 	uintptr_t free_lists[MEM_PHYS_SLAB_ORDERS_COUNT];
-	//! @brief Max freed order
-	size_t max_freed_order;
+	//! @brief Mask of orders with non-empty free-lists
+	uint64_t free_orders_mask;
+	//! @brief Number of blocks in free lists for each order
+	size_t free_blocks[MEM_PHYS_SLAB_ORDERS_COUNT];
+	//! @brief Number of allocated blocks for each order
+	size_t allocated_blocks[MEM_PHYS_SLAB_ORDERS_COUNT];
+	//! @brief Total size of blocks in free lists
+	//! @note Updated under slab lock, may be read without it to estimate memory pressure
+	size_t free_bytes;
 };
 
 //! @brief Initialize mem_phys_slab for allocations from a given memory range
@@ -33,6 +54,31 @@ struct mem_phys_slab {
 //! @param length Physical memory range length
 void mem_phys_slab_init(struct mem_phys_slab *slab, uintptr_t base, size_t length);
 
+//! @brief Granularity of the eagerly initialized part of the range. Chosen so that free heads
+//! bitmap words are not shared between eager and deferred parts
+#define MEM_PHYS_SLAB_EAGER_GRAN (64 * PAGE_SIZE)
+
+//! @brief Initialize mem_phys_slab, adding only the head of the range to free lists
+//! @param slab Slab object
+//! @param base Physical memory range base
+//! @param length Physical memory range length
+//! @param eager_length Length of the memory made available right away. Rounded up to
+//! MEM_PHYS_SLAB_EAGER_GRAN
+//! @note Metadata for the whole range is reserved. Rest of the range should be added with
+//! mem_phys_slab_prepare_deferred and mem_phys_slab_add_deferred
+void mem_phys_slab_init_partial(struct mem_phys_slab *slab, uintptr_t base, size_t length,
+                                size_t eager_length);
+
+//! @brief Prepare metadata for the deferred part of the range
+//! @param slab Slab object
+//! @note Does not require any locks, as slab never looks at metadata beyond its length
+void mem_phys_slab_prepare_deferred(struct mem_phys_slab *slab);
+
+//! @brief Add deferred part of the range to free lists
+//! @param slab Slab object
+//! @note mem_phys_slab_prepare_deferred should be called first. Slab lock should be held
+void mem_phys_slab_add_deferred(struct mem_phys_slab *slab);
+
 //! @brief Physical NULL
 #define PHYS_NULL ((uintptr_t)0)
 
@@ -47,3 +93,36 @@ uintptr_t mem_phys_slab_alloc(struct mem_phys_slab *slab, size_t size);
 //! @param addr Addess of the previously allocated physical memory range
 //! @param size Size of the memory to be allocated
 void mem_phys_slab_free(struct mem_phys_slab *slab, uintptr_t addr, size_t size);
+
+//! @brief Split allocated block into smaller allocated blocks that can be freed separately
+//! @param slab Slab object
+//! @param addr Address of the block returned from mem_phys_slab_alloc
+//! @param piece Size of the new blocks. Should be a power of two not less than PAGE_SIZE
+void mem_phys_slab_split_allocated(struct mem_phys_slab *slab, uintptr_t addr, size_t piece);
+
+//! @brief Get order of the allocated block
+//! @param slab Slab object
+//! @param addr Address of the block returned from mem_phys_slab_alloc
+//! @return Block order
+static inline size_t mem_phys_slab_block_order(const struct mem_phys_slab *slab, uintptr_t addr) {
+	return slab->orders[(addr - slab->base) / PAGE_SIZE];
+}
+
+//! @brief Get pointer to the share counter of the allocated block
+//! @param slab Slab object
+//! @param addr Address of the block returned from mem_phys_slab_alloc
+//! @return Pointer to the counter of extra references to the block
+static inline uint32_t *mem_phys_slab_block_shares(const struct mem_phys_slab *slab,
+                                                   uintptr_t addr) {
+	return slab->shares + (addr - slab->base) / PAGE_SIZE;
+}
+
+//! @brief Get order of the largest free block
+//! @param slab Slab object
+//! @return Order of the largest free block or MEM_PHYS_SLAB_ORDERS_COUNT if there are none
+static inline size_t mem_phys_slab_max_free_order(const struct mem_phys_slab *slab) {
+	if (slab->free_orders_mask == 0) {
+		return MEM_PHYS_SLAB_ORDERS_COUNT;
+	}
+	return MEM_PHYS_SLAB_ORDERS_COUNT - 1 - __builtin_clzll(slab->free_orders_mask);
+}
@@ -0,0 +1,116 @@
+//! @file zero.c
+//! @brief File containing implementation of the pool of pre-zeroed pages
+
+#include <lib/string.h>
+#include <lib/target.h>
+#include <mem/mem.h>
+#include <mem/misc.h>
+#include <mem/phys/phys.h>
+#include <mem/phys/zero.h>
+#include <mem/reclaim.h>
+#include <sys/numa/numa.h>
+
+MODULE("mem/phys/zero")
+
+//! @brief Allocate zeroed page on behalf of the given NUMA node
+//! @param id Numa node on behalf of which memory will be allocated
+//! @return Physical address of the zeroed page, PHYS_NULL otherwise
+//! @note Page is taken from the node's pool of pre-zeroed pages if possible
+uintptr_t mem_phys_alloc_zeroed_page(numa_id_t id) {
+	struct numa_node *node = numa_nodes + id;
+	struct mem_phys_zero_pool *pool = &node->zero_pool;
+	uintptr_t result = PHYS_NULL;
+	if (ATOMIC_RELAXED_LOAD(&pool->count) != 0) {
+		const bool int_state = thread_spinlock_lock(&pool->lock);
+		if (pool->count != 0) {
+			result = pool->pages[--pool->count];
+		}
+		thread_spinlock_unlock(&pool->lock, int_state);
+	}
+	if (result != PHYS_NULL) {
+		MEM_STATS_NUMA_BUMP(node, zero_pool_hits);
+		return result;
+	}
+	MEM_STATS_NUMA_BUMP(node, zero_pool_misses);
+	result = mem_phys_alloc_on_behalf(PAGE_SIZE, id);
+	if (result == PHYS_NULL) {
+		return PHYS_NULL;
+	}
+	memset((void *)(mem_wb_phys_win_base + result), 0, PAGE_SIZE);
+	return result;
+}
+
+//! @brief Zero one more page and put it in the node's pool of pre-zeroed pages
+//! @param id ID of the NUMA node
+//! @return True if page was added, false if pool is full or node is short on memory
+//! @note Intended to be called by idle cores
+bool mem_phys_zero_pool_refill_step(numa_id_t id) {
+	struct mem_phys_zero_pool *pool = &numa_nodes[id].zero_pool;
+	if (ATOMIC_RELAXED_LOAD(&pool->count) >= MEM_PHYS_ZERO_POOL_SIZE) {
+		return false;
+	}
+	// Do not take memory that reclaim is trying to get back
+	if (mem_reclaim_below_low(id)) {
+		return false;
+	}
+	// Do not fall back to other nodes, pool pages should be local
+	const uintptr_t page = mem_phys_alloc_specific(PAGE_SIZE, id);
+	if (page == PHYS_NULL) {
+		return false;
+	}
+	// Non-temporal stores do not evict useful data from caches
+	memzero_nt((void *)(mem_wb_phys_win_base + page), PAGE_SIZE);
+	const bool int_state = thread_spinlock_lock(&pool->lock);
+	if (pool->count < MEM_PHYS_ZERO_POOL_SIZE) {
+		pool->pages[pool->count++] = page;
+		thread_spinlock_unlock(&pool->lock, int_state);
+		return true;
+	}
+	thread_spinlock_unlock(&pool->lock, int_state);
+	mem_phys_free(page);
+	return false;
+}
+
+//! @brief Put page that is already zeroed in the pool of its node
+//! @param page Physical address of the zeroed page. Should not be shared
+//! @return True if page was added, false if pool is full or node is short on memory
+//! @note Page is left to the caller if false is returned
+bool mem_phys_zero_pool_put(uintptr_t page) {
+	const numa_id_t id = mem_range_lookup(page)->node_id;
+	struct mem_phys_zero_pool *pool = &numa_nodes[id].zero_pool;
+	if (ATOMIC_RELAXED_LOAD(&pool->count) >= MEM_PHYS_ZERO_POOL_SIZE ||
+	    mem_reclaim_below_low(id)) {
+		return false;
+	}
+	bool result = false;
+	const bool int_state = thread_spinlock_lock(&pool->lock);
+	if (pool->count < MEM_PHYS_ZERO_POOL_SIZE) {
+		pool->pages[pool->count++] = page;
+		result = true;
+	}
+	thread_spinlock_unlock(&pool->lock, int_state);
+	return result;
+}
+
+//! @brief Return all pages from the node's pool of pre-zeroed pages to PMM
+//! @param id ID of the NUMA node
+//! @return Number of pages returned
+size_t mem_phys_zero_pool_drain(numa_id_t id) {
+	struct mem_phys_zero_pool *pool = &numa_nodes[id].zero_pool;
+	size_t result = 0;
+	while (ATOMIC_RELAXED_LOAD(&pool->count) != 0) {
+		uintptr_t page = PHYS_NULL;
+		const bool int_state = thread_spinlock_lock(&pool->lock);
+		if (pool->count != 0) {
+			page = pool->pages[--pool->count];
+		}
+		thread_spinlock_unlock(&pool->lock, int_state);
+		if (page == PHYS_NULL) {
+			break;
+		}
+		// Bypass per-CPU caches, as the point is to let buddies merge
+		mem_phys_free_uncached(page);
+		result++;
+	}
+	return result;
+}
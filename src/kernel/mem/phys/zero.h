@@ -0,0 +1,26 @@
+//! @file zero.h
+//! @brief File containing definition of the pool of pre-zeroed pages
+
+#pragma once
+
+#include <misc/types.h>
+#include <thread/locking/spinlock.h>
+
+//! @brief Capacity of the node's pool of pre-zeroed pages
+#define MEM_PHYS_ZERO_POOL_SIZE 128
+
+//! @brief Pool of pre-zeroed pages of one NUMA node
+struct mem_phys_zero_pool {
+	//! @brief Physical addresses of zeroed pages
+	uintptr_t pages[MEM_PHYS_ZERO_POOL_SIZE];
+	//! @brief Number of pages in the pool
+	size_t count;
+	//! @brief Pool lock
+	struct thread_spinlock lock;
+};
+
+//! @brief Static zeroed pages pool init
+#define MEM_PHYS_ZERO_POOL_INIT                                                                    \
+	(struct mem_phys_zero_pool) {                                                                  \
+		.pages = {0}, .count = 0, .lock = THREAD_SPINLOCK_INIT,                                    \
+	}
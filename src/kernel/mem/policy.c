@@ -0,0 +1,51 @@
+//! @file policy.c
+//! @brief File containing implementation of NUMA memory placement policies
+
+#include <lib/panic.h>
+#include <mem/policy.h>
+#include <misc/atomics.h>
+#include <sys/acpi/numa.h>
+#include <sys/intlevel.h>
+#include <thread/smp/core.h>
+#include <thread/tasking/localsched.h>
+
+MODULE("mem/policy")
+
+//! @brief Pick node for the next allocation
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return ID of the node allocation should be attempted on first
+//! @note For interleave policy, each call advances round-robin cursor
+numa_id_t mem_policy_next_node(struct mem_policy *policy) {
+	if (policy == NULL) {
+		return PER_CPU(numa_id);
+	}
+	switch (policy->mode) {
+	case MEM_POLICY_LOCAL:
+		return PER_CPU(numa_id);
+	case MEM_POLICY_PREFERRED:
+	case MEM_POLICY_BIND:
+		ASSERT(policy->node < numa_nodes_size && numa_nodes[policy->node].initialized,
+		       "Policy refers to unknown node %u", policy->node);
+		return policy->node;
+	case MEM_POLICY_INTERLEAVE: {
+		// Any neighbours list enumerates all nodes. Boot domain's one is used to get a stable order
+		const size_t cursor = ATOMIC_FETCH_INCREMENT(&policy->interleave_cursor);
+		return numa_nodes[acpi_numa_boot_domain].neighbours[cursor % numa_nodes_count];
+	}
+	default:
+		PANIC("Unknown policy mode %u", (uint32_t)policy->mode);
+	}
+}
+
+//! @brief Get policy of the current task
+//! @return Pointer to the current task's policy or NULL if there is no current task
+struct mem_policy *mem_policy_current(void) {
+	// Do not migrate while reading per-CPU data
+	const bool int_state = intlevel_elevate();
+	struct thread_task *task = thread_localsched_get_current_task();
+	intlevel_recover(int_state);
+	if (task == NULL) {
+		return NULL;
+	}
+	return &task->policy;
+}
@@ -0,0 +1,72 @@
+//! @file policy.h
+//! @brief File containing declarations of NUMA memory placement policies
+
+#pragma once
+
+#include <misc/types.h>
+#include <sys/numa/numa.h>
+
+//! @brief NUMA memory placement policy mode
+enum mem_policy_mode {
+	//! @brief Allocate on the node of the allocating core, fall back to its neighbours
+	MEM_POLICY_LOCAL = 0,
+	//! @brief Allocate on the given node, fall back to its neighbours
+	MEM_POLICY_PREFERRED = 1,
+	//! @brief Allocate strictly on the given node, fail otherwise
+	MEM_POLICY_BIND = 2,
+	//! @brief Spread allocations (page by page for large buffers) over all nodes round-robin
+	MEM_POLICY_INTERLEAVE = 3,
+};
+
+//! @brief NUMA memory placement policy
+struct mem_policy {
+	//! @brief Policy mode
+	enum mem_policy_mode mode;
+	//! @brief Target node for MEM_POLICY_PREFERRED and MEM_POLICY_BIND modes
+	numa_id_t node;
+	//! @brief Round-robin cursor for MEM_POLICY_INTERLEAVE mode
+	size_t interleave_cursor;
+};
+
+//! @brief Local policy init
+#define MEM_POLICY_LOCAL_INIT                                                                      \
+	(struct mem_policy) {                                                                          \
+		.mode = MEM_POLICY_LOCAL, .node = 0, .interleave_cursor = 0                                \
+	}
+
+//! @brief Preferred node policy init
+//! @param id Preferred node
+#define MEM_POLICY_PREFERRED_INIT(id)                                                              \
+	(struct mem_policy) {                                                                          \
+		.mode = MEM_POLICY_PREFERRED, .node = (id), .interleave_cursor = 0                         \
+	}
+
+//! @brief Bind policy init
+//! @param id Node memory is bound to
+#define MEM_POLICY_BIND_INIT(id)                                                                   \
+	(struct mem_policy) {                                                                          \
+		.mode = MEM_POLICY_BIND, .node = (id), .interleave_cursor = 0                              \
+	}
+
+//! @brief Interleave policy init
+#define MEM_POLICY_INTERLEAVE_INIT                                                                 \
+	(struct mem_policy) {                                                                          \
+		.mode = MEM_POLICY_INTERLEAVE, .node = 0, .interleave_cursor = 0                           \
+	}
+
+//! @brief Pick node for the next allocation
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return ID of the node allocation should be attempted on first
+//! @note For interleave policy, each call advances round-robin cursor
+numa_id_t mem_policy_next_node(struct mem_policy *policy);
+
+//! @brief Check if allocation may fall back to other nodes
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return True if only the node returned by mem_policy_next_node may be used
+static inline bool mem_policy_is_strict(const struct mem_policy *policy) {
+	return policy != NULL && policy->mode == MEM_POLICY_BIND;
+}
+
+//! @brief Get policy of the current task
+//! @return Pointer to the current task's policy or NULL if there is no current task
+struct mem_policy *mem_policy_current(void);
@@ -0,0 +1,73 @@
+//! @file rc_per_cpu.c
+//! @brief File containing implementation of reference counts sharded across CPUs
+
+#include <lib/containerof.h>
+#include <lib/panic.h>
+#include <mem/heap/heap.h>
+#include <mem/rc_per_cpu.h>
+
+MODULE("mem/rc_per_cpu")
+
+//! @brief Free shards and run object's destructor
+//! @param obj Object to dispose
+//! @note No one touches shards once the atomic counter drops to zero, as every shard access is
+//! done on behalf of the reference that is counted
+static void mem_rc_per_cpu_dispose(struct mem_rc_per_cpu *obj) {
+	mem_heap_free_per_cpu((void **)obj->shards, sizeof(size_t));
+	if (obj->drop != NULL) {
+		obj->drop(&obj->rc_base);
+	}
+}
+
+//! @brief Drop reference counted on the atomic counter
+//! @param obj Object to drop
+void mem_rc_per_cpu_drop_atomic(struct mem_rc_per_cpu *obj) {
+	const size_t count = ATOMIC_FETCH_DECREMENT(&obj->count);
+	ASSERT(count != 0, "rc == 0 in mem_rc_per_cpu_drop for %p", obj);
+	if (count == 1) {
+		mem_rc_per_cpu_dispose(obj);
+	}
+}
+
+//! @brief Switch object to atomic mode once its last owner reference is dropped
+//! @param rc_base Pointer to the rc_base member
+static void mem_rc_per_cpu_kill(struct mem_rc *rc_base) {
+	struct mem_rc_per_cpu *obj = CONTAINER_OF(rc_base, struct mem_rc_per_cpu, rc_base);
+	// Operations that find their shard sealed go to the atomic counter, so every borrow and drop
+	// is counted exactly once. Bias keeps counter above zero while shards are being sealed
+	size_t sum = 0;
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		sum += ATOMIC_FETCH_OR(obj->shards[i], MEM_RC_PER_CPU_SEALED);
+	}
+	const size_t borrowed = (size_t)((int64_t)sum / MEM_RC_PER_CPU_UNIT);
+	// Fold shards, remove bias and drop the reference owners held collectively in one go
+	const size_t delta = borrowed - MEM_RC_PER_CPU_BIAS - 1;
+	if (ATOMIC_FETCH_ADD(&obj->count, delta) + delta == 0) {
+		mem_rc_per_cpu_dispose(obj);
+	}
+}
+
+//! @brief Initialize object with reference count sharded across CPUs
+//! @param obj Object to initialize
+//! @param callback Callback to be called on object disposal. Called with pointer to rc_base
+//! @return True on success, false if shards could not be allocated
+//! @note Object starts with one owner reference
+bool mem_rc_per_cpu_init(struct mem_rc_per_cpu *obj, mem_rc_dispose_t callback) {
+	obj->shards = (size_t **)mem_heap_alloc_per_cpu(sizeof(size_t));
+	if (obj->shards == NULL) {
+		return false;
+	}
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		*obj->shards[i] = 0;
+	}
+	obj->count = MEM_RC_PER_CPU_BIAS + 1;
+	obj->drop = callback;
+	mem_rc_init(&obj->rc_base, mem_rc_per_cpu_kill);
+	return true;
+}
+
+//! @brief Free shards of the object that has never been shared
+//! @param obj Object initialized with mem_rc_per_cpu_init
+void mem_rc_per_cpu_destroy(struct mem_rc_per_cpu *obj) {
+	mem_heap_free_per_cpu((void **)obj->shards, sizeof(size_t));
+}
@@ -0,0 +1,87 @@
+//! @file rc_per_cpu.h
+//! @brief File containing declarations of reference counts sharded across CPUs
+//!
+//! Objects that are borrowed on every API call (mailboxes, callees, tokens) would have their
+//! shared counter cache line bounce between all cores using them. Instead, borrowed references
+//! are counted on per-CPU shards, while owner references (e.g. handles in universes) are still
+//! counted on a regular mem_rc header. Once the last owner reference is dropped, shards are
+//! sealed and folded into a single atomic counter, and the object is disposed once that one
+//! drops to zero.
+//!
+//! Shards count in units of MEM_RC_PER_CPU_UNIT, so that the lowest bit is never touched by
+//! increments and decrements and can be used to mark the shard as sealed. Operation that finds
+//! its shard sealed is redone on the atomic counter. Reference may be borrowed on one core and
+//! dropped on another, so shards may wrap below zero, only their sum is meaningful.
+
+#pragma once
+
+#include <mem/rc.h>
+#include <misc/atomics.h>
+#include <misc/types.h>
+#include <thread/smp/core.h>
+
+//! @brief Shard increment
+#define MEM_RC_PER_CPU_UNIT 2
+
+//! @brief Shard flag set once shard is folded into the atomic counter
+#define MEM_RC_PER_CPU_SEALED 1
+
+//! @brief Bias of the atomic counter while shards are in use. Counter can not drop to zero before
+//! shards are folded
+#define MEM_RC_PER_CPU_BIAS (1ULL << 62ULL)
+
+//! @brief Header of an object with reference count sharded across CPUs
+struct mem_rc_per_cpu {
+	//! @brief Owner references. Shards are switched to atomic mode once all of them are dropped
+	struct mem_rc rc_base;
+	//! @brief Per-CPU counters of borrowed references
+	size_t **shards;
+	//! @brief Atomic counter. Holds MEM_RC_PER_CPU_BIAS and one reference on behalf of all owners
+	//! until shards are folded into it
+	size_t count;
+	//! @brief Callback called once all owner and borrowed references are dropped
+	mem_rc_dispose_t drop;
+};
+
+//! @brief Initialize object with reference count sharded across CPUs
+//! @param obj Object to initialize
+//! @param callback Callback to be called on object disposal. Called with pointer to rc_base
+//! @return True on success, false if shards could not be allocated
+//! @note Object starts with one owner reference
+bool mem_rc_per_cpu_init(struct mem_rc_per_cpu *obj, mem_rc_dispose_t callback);
+
+//! @brief Free shards of the object that has never been shared
+//! @param obj Object initialized with mem_rc_per_cpu_init
+void mem_rc_per_cpu_destroy(struct mem_rc_per_cpu *obj);
+
+//! @brief Drop reference counted on the atomic counter
+//! @param obj Object to drop
+void mem_rc_per_cpu_drop_atomic(struct mem_rc_per_cpu *obj);
+
+//! @brief Borrow reference to the object
+//! @param obj Object to borrow. Caller should hold owner or borrowed reference to it
+static inline struct mem_rc_per_cpu *mem_rc_per_cpu_borrow(struct mem_rc_per_cpu *obj) {
+	// Task may migrate once core ID is read, shard of the other core is still updated atomically
+	size_t *shard = obj->shards[PER_CPU(logical_id)];
+	if ((ATOMIC_FETCH_ADD(shard, MEM_RC_PER_CPU_UNIT) & MEM_RC_PER_CPU_SEALED) != 0) {
+		ATOMIC_FETCH_INCREMENT(&obj->count);
+	}
+	return obj;
+}
+
+//! @brief Drop reference obtained with mem_rc_per_cpu_borrow
+//! @param obj Object to drop
+static inline void mem_rc_per_cpu_drop(struct mem_rc_per_cpu *obj) {
+	size_t *shard = obj->shards[PER_CPU(logical_id)];
+	if ((ATOMIC_FETCH_SUB(shard, MEM_RC_PER_CPU_UNIT) & MEM_RC_PER_CPU_SEALED) != 0) {
+		mem_rc_per_cpu_drop_atomic(obj);
+	}
+}
+
+//! @brief Initialize object with reference count sharded across CPUs
+//! @param x Pointer to the object
+//! @param callback Destructor callback
+//! @return True on success, false if shards could not be allocated
+//! @note Requires mem_rc_per_cpu to be right at the start of the pointed object
+#define MEM_REF_PER_CPU_INIT(x, callback)                                                          \
+	mem_rc_per_cpu_init((struct mem_rc_per_cpu *)x, (mem_rc_dispose_t)callback)
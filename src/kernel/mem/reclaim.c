@@ -0,0 +1,218 @@
+//! @file reclaim.c
+//! @brief File containing implementation of memory pressure watermarks and reclaim
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <mem/mem.h>
+#include <mem/phys/phys.h>
+#include <mem/reclaim.h>
+#include <misc/atomics.h>
+#include <thread/smp/core.h>
+#include <thread/tasking/localsched.h>
+#include <thread/tasking/task.h>
+
+MODULE("mem/reclaim")
+TARGET(mem_reclaim_available, mem_reclaim_init, {mem_phys_available, numa_available})
+
+//! @brief Maximum number of times reclaim task runs shrinkers in one go
+#define MEM_RECLAIM_MAX_PASSES 4
+
+//! @brief Registered shrinkers
+//! @note Shrinkers are never unregistered, so the list can be walked without taking the lock
+static struct mem_reclaim_shrinker *mem_reclaim_shrinkers = NULL;
+
+//! @brief Lock serializing shrinkers registration
+static struct thread_spinlock mem_reclaim_shrinkers_lock = THREAD_SPINLOCK_INIT;
+
+//! @brief Register shrinker
+//! @param shrinker Pointer to the shrinker. Should stay valid forever
+void mem_reclaim_register_shrinker(struct mem_reclaim_shrinker *shrinker) {
+	const bool int_state = thread_spinlock_lock(&mem_reclaim_shrinkers_lock);
+	shrinker->next = mem_reclaim_shrinkers;
+	ATOMIC_RELEASE_STORE(&mem_reclaim_shrinkers, shrinker);
+	thread_spinlock_unlock(&mem_reclaim_shrinkers_lock, int_state);
+	LOG_INFO("Registered shrinker \"%s\"", shrinker->name);
+}
+
+//! @brief Get number of free bytes on the node
+//! @param id ID of the NUMA node
+//! @return Number of bytes in node's free lists
+//! @note Node lock is not taken, so the result is only an estimate
+size_t mem_reclaim_free_bytes(numa_id_t id) {
+	size_t result = 0;
+	for (struct mem_range *range = numa_nodes[id].ranges; range != NULL;
+	     range = range->next_range) {
+		result += ATOMIC_RELAXED_LOAD(&range->slab.free_bytes);
+	}
+	return result;
+}
+
+//! @brief Check if node is below its low watermark
+//! @param id ID of the NUMA node
+//! @return True if node is short on memory
+bool mem_reclaim_below_low(numa_id_t id) {
+	return mem_reclaim_free_bytes(id) < numa_nodes[id].watermarks.low;
+}
+
+//! @brief Run shrinkers on behalf of the node
+//! @param id ID of the NUMA node
+//! @param direct True if only shrinkers safe for direct reclaim should be run
+//! @return Number of bytes released
+static size_t mem_reclaim_run_shrinkers(numa_id_t id, bool direct) {
+	size_t result = 0;
+	struct mem_reclaim_shrinker *shrinker = ATOMIC_ACQUIRE_LOAD(&mem_reclaim_shrinkers);
+	for (; shrinker != NULL; shrinker = shrinker->next) {
+		if (direct && !shrinker->direct) {
+			continue;
+		}
+		result += shrinker->shrink(id);
+	}
+	ATOMIC_FETCH_ADD_REL(&numa_nodes[id].watermarks.reclaimed, result);
+	return result;
+}
+
+//! @brief Run direct shrinkers on the node and its neighbours
+//! @param id ID of the NUMA node allocation failed on behalf of
+//! @return Number of bytes released
+//! @note Should be called without node locks held
+size_t mem_reclaim_direct(numa_id_t id) {
+	size_t result = 0;
+	for (size_t i = 0; i < numa_nodes_count; ++i) {
+		result += mem_reclaim_run_shrinkers(numa_nodes[id].neighbours[i], true);
+	}
+	return result;
+}
+
+//! @brief Wake up node's reclaim task if node is below its low watermark
+//! @param id ID of the NUMA node
+//! @note Should be called without node lock held
+void mem_reclaim_check(numa_id_t id) {
+	struct mem_watermarks *watermarks = &numa_nodes[id].watermarks;
+	// Cheap checks first, as this is called on allocation path
+	if (ATOMIC_RELAXED_LOAD(&watermarks->task) == NULL ||
+	    ATOMIC_RELAXED_LOAD(&watermarks->pending) || !mem_reclaim_below_low(id)) {
+		return;
+	}
+	const bool int_state = thread_spinlock_lock(&watermarks->lock);
+	if (!watermarks->pending) {
+		watermarks->pending = true;
+		watermarks->wakeups++;
+		if (watermarks->sleeping) {
+			watermarks->sleeping = false;
+			thread_localsched_wake_up(watermarks->task);
+		}
+	}
+	thread_spinlock_unlock(&watermarks->lock, int_state);
+}
+
+//! @brief Queue work to the node's reclaim task
+//! @param id ID of the NUMA node
+//! @param work Pointer to the work item with callback set. Should stay valid until callback is run
+//! @return False if reclaim task has not been started yet, in which case work is not queued
+bool mem_reclaim_defer(numa_id_t id, struct mem_reclaim_work *work) {
+	struct mem_watermarks *watermarks = &numa_nodes[id].watermarks;
+	if (ATOMIC_ACQUIRE_LOAD(&watermarks->task) == NULL) {
+		return false;
+	}
+	work->next = NULL;
+	const bool int_state = thread_spinlock_lock(&watermarks->lock);
+	if (watermarks->work_last == NULL) {
+		watermarks->work = work;
+	} else {
+		watermarks->work_last->next = work;
+	}
+	watermarks->work_last = work;
+	if (watermarks->sleeping) {
+		watermarks->sleeping = false;
+		thread_localsched_wake_up(watermarks->task);
+	}
+	thread_spinlock_unlock(&watermarks->lock, int_state);
+	return true;
+}
+
+//! @brief Run shrinkers until node gets back above its high watermark
+//! @param id ID of the NUMA node
+static void mem_reclaim_balance(numa_id_t id) {
+	const size_t high = numa_nodes[id].watermarks.high;
+	for (size_t i = 0; i < MEM_RECLAIM_MAX_PASSES && mem_reclaim_free_bytes(id) < high; ++i) {
+		// Shrinkers only release what is cached right now, stop once they have nothing left
+		if (mem_reclaim_run_shrinkers(id, false) == 0) {
+			break;
+		}
+	}
+}
+
+//! @brief Reclaim task
+//! @param ctx NUMA node ID casted to pointer
+static void mem_reclaim_task(void *ctx) {
+	const numa_id_t id = (numa_id_t)(uintptr_t)ctx;
+	struct mem_watermarks *watermarks = &numa_nodes[id].watermarks;
+	while (true) {
+		const bool int_state = thread_spinlock_lock(&watermarks->lock);
+		if (!watermarks->pending && watermarks->work == NULL) {
+			// Sleep until mem_reclaim_check or mem_reclaim_defer wakes us up. Lock is dropped once
+			// task is suspended
+			watermarks->sleeping = true;
+			thread_localsched_suspend_current(
+			    CALLBACK_VOID(thread_spinlock_ungrab, &watermarks->lock));
+			intlevel_recover(int_state);
+			continue;
+		}
+		const bool pending = watermarks->pending;
+		struct mem_reclaim_work *work = watermarks->work;
+		watermarks->pending = false;
+		watermarks->work = watermarks->work_last = NULL;
+		thread_spinlock_unlock(&watermarks->lock, int_state);
+		// Deferred work goes first, as it usually gives memory back. Callback may free the item
+		while (work != NULL) {
+			struct mem_reclaim_work *next = work->next;
+			callback_void_run(work->callback);
+			work = next;
+		}
+		if (pending) {
+			mem_reclaim_balance(id);
+		}
+	}
+}
+
+//! @brief Start reclaim tasks on all nodes
+//! @note Should be called from task context once APs are online
+void mem_reclaim_start(void) {
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		if (!numa_nodes[i].initialized) {
+			continue;
+		}
+		// Memory-only nodes have no cores, their reclaim task runs on the boot core
+		size_t core = thread_smp_core_find_on_node(i);
+		if (core == thread_smp_core_max_cpus) {
+			core = PER_CPU(logical_id);
+		}
+		struct thread_task *task =
+		    thread_task_create_call(CALLBACK_VOID(mem_reclaim_task, (void *)(uintptr_t)i));
+		if (task == NULL) {
+			PANIC("Failed to allocate reclaim task for node %u", i);
+		}
+		task->kernel_only = true;
+		ATOMIC_RELEASE_STORE(&numa_nodes[i].watermarks.task, task);
+		thread_localsched_associate(core, task);
+	}
+}
+
+//! @brief Initialize watermarks
+static void mem_reclaim_init(void) {
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		if (!numa_nodes[i].initialized) {
+			continue;
+		}
+		// Account deferred parts of ranges as well, they will be added to free lists soon
+		size_t total = 0;
+		for (struct mem_range *range = numa_nodes[i].ranges; range != NULL;
+		     range = range->next_range) {
+			total += range->slab.length + range->slab.deferred_length;
+		}
+		struct mem_watermarks *watermarks = &numa_nodes[i].watermarks;
+		watermarks->low = total / 1000 * MEM_RECLAIM_LOW_PERMILLE;
+		watermarks->high = total / 1000 * MEM_RECLAIM_HIGH_PERMILLE;
+		LOG_INFO("Node %u watermarks: low = %U, high = %U", i, watermarks->low, watermarks->high);
+	}
+}
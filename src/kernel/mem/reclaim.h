@@ -0,0 +1,86 @@
+//! @file reclaim.h
+//! @brief File containing declarations of memory pressure watermarks and reclaim
+
+#pragma once
+
+#include <lib/callback.h>
+#include <lib/target.h>
+#include <misc/types.h>
+#include <sys/numa/numa.h>
+
+//! @brief Low watermark in permille of the node's memory
+#define MEM_RECLAIM_LOW_PERMILLE 16
+
+//! @brief High watermark in permille of the node's memory
+#define MEM_RECLAIM_HIGH_PERMILLE 32
+
+//! @brief Shrinker. Gives memory cached by some subsystem back to the allocator it was taken from
+struct mem_reclaim_shrinker {
+	//! @brief Release cached memory
+	//! @param id ID of the NUMA node that is short on memory
+	//! @return Number of bytes released
+	size_t (*shrink)(numa_id_t id);
+	//! @brief Shrinker name
+	const char *name;
+	//! @brief True if shrinker can be run from allocation path before allocation fails. Should be
+	//! false if shrinker takes locks that may be held while allocating memory
+	bool direct;
+	//! @brief Next registered shrinker
+	struct mem_reclaim_shrinker *next;
+};
+
+//! @brief Statically initialize shrinker
+//! @param _name Shrinker name
+//! @param _shrink Shrink function
+//! @param _direct True if shrinker can be run from allocation path
+#define MEM_RECLAIM_SHRINKER_INIT(_name, _shrink, _direct)                                         \
+	(struct mem_reclaim_shrinker) {                                                                \
+		.shrink = (_shrink), .name = (_name), .direct = (_direct), .next = NULL                    \
+	}
+
+//! @brief Work deferred to the node's reclaim task (e.g. freeing large structures)
+struct mem_reclaim_work {
+	//! @brief Callback run by reclaim task. May free the work item
+	struct callback_void callback;
+	//! @brief Next queued work item
+	struct mem_reclaim_work *next;
+};
+
+//! @brief Register shrinker
+//! @param shrinker Pointer to the shrinker. Should stay valid forever
+void mem_reclaim_register_shrinker(struct mem_reclaim_shrinker *shrinker);
+
+//! @brief Get number of free bytes on the node
+//! @param id ID of the NUMA node
+//! @return Number of bytes in node's free lists
+//! @note Node lock is not taken, so the result is only an estimate
+size_t mem_reclaim_free_bytes(numa_id_t id);
+
+//! @brief Check if node is below its low watermark
+//! @param id ID of the NUMA node
+//! @return True if node is short on memory
+bool mem_reclaim_below_low(numa_id_t id);
+
+//! @brief Wake up node's reclaim task if node is below its low watermark
+//! @param id ID of the NUMA node
+//! @note Should be called without node lock held
+void mem_reclaim_check(numa_id_t id);
+
+//! @brief Run direct shrinkers on the node and its neighbours
+//! @param id ID of the NUMA node allocation failed on behalf of
+//! @return Number of bytes released
+//! @note Should be called without node locks held
+size_t mem_reclaim_direct(numa_id_t id);
+
+//! @brief Queue work to the node's reclaim task
+//! @param id ID of the NUMA node
+//! @param work Pointer to the work item with callback set. Should stay valid until callback is run
+//! @return False if reclaim task has not been started yet, in which case work is not queued
+bool mem_reclaim_defer(numa_id_t id, struct mem_reclaim_work *work);
+
+//! @brief Start reclaim tasks on all nodes
+//! @note Should be called from task context once APs are online
+void mem_reclaim_start(void);
+
+//! @brief Export reclaim initialization target
+EXPORT_TARGET(mem_reclaim_available)
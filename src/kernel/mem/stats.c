@@ -0,0 +1,134 @@
+//! @file stats.c
+//! @brief File containing implementation of memory management statistics dump
+
+#include <lib/log.h>
+#include <lib/target.h>
+#include <mem/heap/slab.h>
+#include <mem/mem.h>
+#include <mem/phys/slab.h>
+#include <mem/reclaim.h>
+#include <mem/stats.h>
+#include <mem/virt/vmalloc.h>
+#include <sys/numa/numa.h>
+#include <thread/locking/spinlock.h>
+
+MODULE("mem/stats")
+
+//! @brief Snapshot of node's PMM statistics
+struct mem_stats_phys_snapshot {
+	//! @brief Number of blocks in free lists for each order
+	size_t free_blocks[MEM_PHYS_SLAB_ORDERS_COUNT];
+	//! @brief Number of allocated blocks for each order
+	size_t allocated_blocks[MEM_PHYS_SLAB_ORDERS_COUNT];
+	//! @brief Total size of all node's memory ranges
+	size_t total_bytes;
+};
+
+//! @brief Calculate permille ratio
+//! @param part Part
+//! @param whole Whole
+//! @return part * 1000 / whole or 0 if whole is 0
+static size_t mem_stats_permille(size_t part, size_t whole) {
+	if (whole == 0) {
+		return 0;
+	}
+	return (part * 1000) / whole;
+}
+
+//! @brief Collect PMM statistics of the node
+//! @param node Pointer to the NUMA node
+//! @param snapshot Buffer to store statistics in
+//! @note Node lock should be held
+static void mem_stats_collect_phys(struct numa_node *node,
+                                   struct mem_stats_phys_snapshot *snapshot) {
+	for (size_t i = 0; i < MEM_PHYS_SLAB_ORDERS_COUNT; ++i) {
+		snapshot->free_blocks[i] = 0;
+		snapshot->allocated_blocks[i] = 0;
+	}
+	snapshot->total_bytes = 0;
+	for (struct mem_range *range = node->ranges; range != NULL; range = range->next_range) {
+		const struct mem_phys_slab *slab = &range->slab;
+		for (size_t i = 0; i < MEM_PHYS_SLAB_ORDERS_COUNT; ++i) {
+			snapshot->free_blocks[i] += slab->free_blocks[i];
+			snapshot->allocated_blocks[i] += slab->allocated_blocks[i];
+		}
+		snapshot->total_bytes += slab->length;
+	}
+}
+
+//! @brief Dump statistics for one NUMA node
+//! @param id ID of the NUMA node
+static void mem_stats_dump_node(numa_id_t id) {
+	struct numa_node *node = numa_nodes + id;
+	struct mem_heap_slab_stats heap;
+	struct mem_stats_phys_snapshot phys;
+	// Take a consistent snapshot under node lock, as printing with lock held is too slow
+	const bool int_state = thread_spinlock_lock(&node->lock);
+	heap = node->slab_data.stats;
+	mem_stats_collect_phys(node, &phys);
+	thread_spinlock_unlock(&node->lock, int_state);
+	// Dump NUMA placement counters
+	log_printf("memstat node=%u kind=numa heap_remote_served=%U heap_fallbacks=%U "
+	           "heap_failures=%U phys_remote_served=%U phys_fallbacks=%U phys_failures=%U\n",
+	           id, ATOMIC_RELAXED_LOAD(&node->numa_stats.heap_remote_served),
+	           ATOMIC_RELAXED_LOAD(&node->numa_stats.heap_fallbacks),
+	           ATOMIC_RELAXED_LOAD(&node->numa_stats.heap_failures),
+	           ATOMIC_RELAXED_LOAD(&node->numa_stats.phys_remote_served),
+	           ATOMIC_RELAXED_LOAD(&node->numa_stats.phys_fallbacks),
+	           ATOMIC_RELAXED_LOAD(&node->numa_stats.phys_failures));
+	log_printf("memstat node=%u kind=zero_pool pages=%U hits=%U misses=%U\n", id,
+	           ATOMIC_RELAXED_LOAD(&node->zero_pool.count),
+	           ATOMIC_RELAXED_LOAD(&node->numa_stats.zero_pool_hits),
+	           ATOMIC_RELAXED_LOAD(&node->numa_stats.zero_pool_misses));
+	log_printf("memstat node=%u kind=reclaim free=%U low=%U high=%U wakeups=%U reclaimed=%U\n", id,
+	           mem_reclaim_free_bytes(id), node->watermarks.low, node->watermarks.high,
+	           ATOMIC_RELAXED_LOAD(&node->watermarks.wakeups),
+	           ATOMIC_RELAXED_LOAD(&node->watermarks.reclaimed));
+	// Dump heap slab orders. Fragmentation is the share of slab objects that are sitting free
+	for (size_t i = 0; i < MEM_HEAP_SLAB_ORDERS; ++i) {
+		if (heap.slabs[i] == 0) {
+			continue;
+		}
+		const size_t objects = heap.allocated[i] + heap.free[i];
+		log_printf("memstat node=%u kind=heap order=%U allocated=%U free=%U slabs=%U "
+		           "frag_permille=%U\n",
+		           id, i, heap.allocated[i], heap.free[i], heap.slabs[i],
+		           mem_stats_permille(heap.free[i], objects));
+	}
+	log_printf("memstat node=%u kind=heap_total empty_slabs=%U chunks=%U\n", id, heap.empty_slabs,
+	           heap.chunks);
+	// Dump PMM orders. Fragmentation is the share of free memory that is not in the largest block
+	size_t free_bytes = 0;
+	size_t allocated_bytes = 0;
+	size_t largest_free = 0;
+	for (size_t i = 0; i < MEM_PHYS_SLAB_ORDERS_COUNT; ++i) {
+		if (phys.free_blocks[i] == 0 && phys.allocated_blocks[i] == 0) {
+			continue;
+		}
+		free_bytes += phys.free_blocks[i] << i;
+		allocated_bytes += phys.allocated_blocks[i] << i;
+		if (phys.free_blocks[i] != 0 && (1ULL << i) > largest_free) {
+			largest_free = 1ULL << i;
+		}
+		log_printf("memstat node=%u kind=phys order=%U allocated=%U free=%U\n", id, i,
+		           phys.allocated_blocks[i], phys.free_blocks[i]);
+	}
+	log_printf("memstat node=%u kind=phys_total total=%U allocated=%U free=%U frag_permille=%U\n",
+	           id, phys.total_bytes, allocated_bytes, free_bytes,
+	           free_bytes == 0 ? 0 : 1000 - mem_stats_permille(largest_free, free_bytes));
+}
+
+//! @brief Dump heap and PMM statistics for all NUMA nodes and vmalloc statistics to kernel log
+void mem_stats_dump(void) {
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		if (numa_nodes[i].initialized) {
+			mem_stats_dump_node(i);
+		}
+	}
+	// Dump vmalloc accounting. Slack is the memory lost to rounding up to the page size
+	struct mem_vmalloc_stats vmalloc;
+	mem_vmalloc_get_stats(&vmalloc);
+	log_printf("memstat kind=vmalloc areas=%U pages=%U huge_pages=%U requested=%U slack=%U\n",
+	           vmalloc.areas, vmalloc.pages, vmalloc.huge_pages, vmalloc.requested_bytes,
+	           vmalloc.pages * PAGE_SIZE - vmalloc.requested_bytes);
+}
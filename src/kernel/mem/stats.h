@@ -0,0 +1,52 @@
+//! @file stats.h
+//! @brief File containing declarations of memory management statistics
+
+#pragma once
+
+#include <misc/atomics.h>
+#include <misc/types.h>
+
+//! @brief Per-node NUMA placement statistics
+//! @note Counters are updated with relaxed atomics, as they are not protected by a single lock
+struct mem_stats_numa {
+	//! @brief Number of heap allocations this node has served on behalf of other nodes
+	size_t heap_remote_served;
+	//! @brief Number of heap allocations requested for this node that were served by neighbours
+	size_t heap_fallbacks;
+	//! @brief Number of physical allocations this node has served on behalf of other nodes
+	size_t phys_remote_served;
+	//! @brief Number of physical allocations requested for this node that were served by
+	//! neighbours
+	size_t phys_fallbacks;
+	//! @brief Number of heap allocations requested for this node that could not be served
+	size_t heap_failures;
+	//! @brief Number of physical allocations requested for this node that could not be served
+	size_t phys_failures;
+	//! @brief Number of zeroed pages taken from the node's pool
+	size_t zero_pool_hits;
+	//! @brief Number of zeroed pages that had to be zeroed on allocation
+	size_t zero_pool_misses;
+};
+
+//! @brief Static NUMA statistics init
+#define MEM_STATS_NUMA_INIT                                                                        \
+	(struct mem_stats_numa) {                                                                      \
+		0, 0, 0, 0, 0, 0, 0, 0                                                                     \
+	}
+
+//! @brief Bump NUMA statistics counter
+//! @param node Pointer to the NUMA node
+//! @param counter Name of the counter in struct mem_stats_numa
+#define MEM_STATS_NUMA_BUMP(node, counter) ATOMIC_FETCH_INCREMENT_REL(&(node)->numa_stats.counter)
+
+//! @brief Dump heap and PMM statistics for all NUMA nodes and vmalloc statistics to kernel log
+//! @note Output format is one "memstat" record per line with space-separated key=value pairs:
+//! @note memstat node=<id> kind=numa heap_remote_served=<n> heap_fallbacks=<n> ...
+//! @note memstat node=<id> kind=zero_pool pages=<n> hits=<n> misses=<n>
+//! @note memstat node=<id> kind=reclaim free=<n> low=<n> high=<n> wakeups=<n> reclaimed=<n>
+//! @note memstat node=<id> kind=heap order=<n> allocated=<n> free=<n> slabs=<n> frag_permille=<n>
+//! @note memstat node=<id> kind=heap_total empty_slabs=<n> chunks=<n>
+//! @note memstat node=<id> kind=phys order=<n> allocated=<n> free=<n>
+//! @note memstat node=<id> kind=phys_total total=<n> allocated=<n> free=<n> frag_permille=<n>
+//! @note memstat kind=vmalloc areas=<n> pages=<n> huge_pages=<n> requested=<n> slack=<n>
+void mem_stats_dump(void);
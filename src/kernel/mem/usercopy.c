@@ -0,0 +1,183 @@
+//! @file usercopy.c
+//! @brief File containing implementation of functions for copying memory from and to userspace
+
+#include <lib/string.h>
+#include <lib/target.h>
+#include <mem/usercopy.h>
+#include <mem/virt/paging.h>
+#include <misc/symbol.h>
+
+MODULE("mem/usercopy")
+TARGET(mem_usercopy_available, META_DUMMY, {string_dispatch_available})
+META_DEFINE_DUMMY()
+
+//! @brief Add exception table entry
+//! @param insn Label of the instruction that may fault
+//! @param fixup Label of the instruction to resume at
+#define MEM_USERCOPY_EXTABLE(insn, fixup)                                                          \
+	".pushsection .extable, \"a\"\n"                                                               \
+	".balign 4\n"                                                                                  \
+	".long " insn " - .\n"                                                                         \
+	".long " fixup " - .\n"                                                                        \
+	".popsection\n"
+
+//! @brief Number of bytes copied by one iteration of the non-temporal copy loop
+#define MEM_USERCOPY_NT_BLOCK 32
+
+//! @brief Start of the exception table
+extern symbol _kernel_extable_start;
+
+//! @brief End of the exception table
+extern symbol _kernel_extable_end;
+
+//! @brief Check that user range lies in the lower half of the address space
+//! @param user_mem Pointer to the userspace memory
+//! @param size Size of the range
+//! @return True if range can be accessed on behalf of userspace
+static bool mem_usercopy_range_ok(const void *user_mem, size_t size) {
+	const uintptr_t addr = (uintptr_t)user_mem;
+	return addr + size >= addr && addr + size <= mem_paging_lower_half_size();
+}
+
+//! @brief Copy memory with string instructions, stopping at the first unresolved fault
+//! @param dst Destination
+//! @param src Source
+//! @param size Bytes to copy
+//! @return True if all bytes have been copied
+static bool mem_usercopy_raw(void *dst, const void *src, size_t size) {
+	// Faulting rep instruction leaves number of iterations left in rcx, which is never zero
+	if (string_erms_supported) {
+		asm volatile("1: rep movsb\n"
+		             "2:\n" MEM_USERCOPY_EXTABLE("1b", "2b")
+		             : "+D"(dst), "+S"(src), "+c"(size)
+		             :
+		             : "memory");
+		return size == 0;
+	}
+	size_t tail = size % 8;
+	size /= 8;
+	asm volatile("1: rep movsq\n"
+	             "mov %[tail], %%rcx\n"
+	             "2: rep movsb\n"
+	             "3:\n" MEM_USERCOPY_EXTABLE("1b", "3b") MEM_USERCOPY_EXTABLE("2b", "3b")
+	             : "+D"(dst), "+S"(src), "+c"(size)
+	             : [tail] "r"(tail)
+	             : "memory");
+	return size == 0;
+}
+
+//! @brief Copy memory with non-temporal stores, stopping at the first unresolved fault
+//! @param dst Destination
+//! @param src Source
+//! @param size Bytes to copy
+//! @return True if all bytes have been copied
+static bool mem_usercopy_nt(uint8_t *dst, const uint8_t *src, size_t size) {
+	// Head is copied with regular stores until destination is 8 bytes aligned
+	const size_t head = (8 - (uintptr_t)dst % 8) % 8;
+	if (!mem_usercopy_raw(dst, src, head)) {
+		return false;
+	}
+	dst += head;
+	src += head;
+	size -= head;
+	const size_t body = size - size % MEM_USERCOPY_NT_BLOCK;
+	for (size_t i = 0; i < body; i += MEM_USERCOPY_NT_BLOCK) {
+		asm goto("1: movq 0(%0), %%rax\n"
+		         "2: movq 8(%0), %%rdx\n"
+		         "3: movq 16(%0), %%r8\n"
+		         "4: movq 24(%0), %%r9\n"
+		         "5: movnti %%rax, 0(%1)\n"
+		         "6: movnti %%rdx, 8(%1)\n"
+		         "7: movnti %%r8, 16(%1)\n"
+		         "8: movnti %%r9, 24(%1)\n" MEM_USERCOPY_EXTABLE("1b", "%l2")
+		             MEM_USERCOPY_EXTABLE("2b", "%l2") MEM_USERCOPY_EXTABLE("3b", "%l2")
+		                 MEM_USERCOPY_EXTABLE("4b", "%l2") MEM_USERCOPY_EXTABLE("5b", "%l2")
+		                     MEM_USERCOPY_EXTABLE("6b", "%l2") MEM_USERCOPY_EXTABLE("7b", "%l2")
+		                         MEM_USERCOPY_EXTABLE("8b", "%l2")
+		         :
+		         : "r"(src + i), "r"(dst + i)
+		         : "rax", "rdx", "r8", "r9", "memory"
+		         : fault);
+	}
+	// Order non-temporal stores before stores that publish the memory
+	asm volatile("sfence" ::: "memory");
+	return mem_usercopy_raw(dst + body, src + body, size - body);
+fault:
+	asm volatile("sfence" ::: "memory");
+	return false;
+}
+
+//! @brief Copy memory from userspace
+//! @param kernel_mem Pointer to the kernel memory
+//! @param user_mem Pointer to the userspace memory
+//! @param size Bytes to copy
+//! @return True if copy has been successful, false if user memory is not accessible
+bool mem_copy_from_user(void *kernel_mem, const void *user_mem, size_t size) {
+	if (!mem_usercopy_range_ok(user_mem, size)) {
+		return false;
+	}
+	return mem_usercopy_raw(kernel_mem, user_mem, size);
+}
+
+//! @brief Copy memory to userspace
+//! @param user_mem Pointer to the userspace memory
+//! @param kernel_mem Pointer to the kernel memory
+//! @param size Bytes to copy
+//! @return True if copy has been successful, false if user memory is not accessible
+bool mem_copy_to_user(void *user_mem, const void *kernel_mem, size_t size) {
+	if (!mem_usercopy_range_ok(user_mem, size)) {
+		return false;
+	}
+	return mem_usercopy_raw(user_mem, kernel_mem, size);
+}
+
+//! @brief Copy large buffer from userspace
+//! @param kernel_mem Pointer to the kernel memory
+//! @param user_mem Pointer to the userspace memory
+//! @param size Bytes to copy
+//! @return True if copy has been successful, false if user memory is not accessible
+//! @note Copies larger than MEM_USERCOPY_BULK_NT_THRESHOLD use non-temporal stores, so that they
+//! don't evict the working set from caches
+bool mem_copy_from_user_bulk(void *kernel_mem, const void *user_mem, size_t size) {
+	if (!mem_usercopy_range_ok(user_mem, size)) {
+		return false;
+	}
+	if (size < MEM_USERCOPY_BULK_NT_THRESHOLD) {
+		return mem_usercopy_raw(kernel_mem, user_mem, size);
+	}
+	return mem_usercopy_nt(kernel_mem, user_mem, size);
+}
+
+//! @brief Copy large buffer to userspace
+//! @param user_mem Pointer to the userspace memory
+//! @param kernel_mem Pointer to the kernel memory
+//! @param size Bytes to copy
+//! @return True if copy has been successful, false if user memory is not accessible
+//! @note Copies larger than MEM_USERCOPY_BULK_NT_THRESHOLD use non-temporal stores, so that they
+//! don't evict the working set from caches
+bool mem_copy_to_user_bulk(void *user_mem, const void *kernel_mem, size_t size) {
+	if (!mem_usercopy_range_ok(user_mem, size)) {
+		return false;
+	}
+	if (size < MEM_USERCOPY_BULK_NT_THRESHOLD) {
+		return mem_usercopy_raw(user_mem, kernel_mem, size);
+	}
+	return mem_usercopy_nt(user_mem, kernel_mem, size);
+}
+
+//! @brief Find fixup address for the faulting instruction
+//! @param rip Address of the faulting instruction
+//! @return Address to resume at or 0 if instruction is not in the exception table
+uintptr_t mem_usercopy_fixup(uintptr_t rip) {
+	struct mem_usercopy_extable_entry *entry =
+	    (struct mem_usercopy_extable_entry *)_kernel_extable_start;
+	struct mem_usercopy_extable_entry *end =
+	    (struct mem_usercopy_extable_entry *)_kernel_extable_end;
+	// Table is small, so linear search is good enough
+	for (; entry < end; ++entry) {
+		if ((uintptr_t)&entry->insn + entry->insn == rip) {
+			return (uintptr_t)&entry->fixup + entry->fixup;
+		}
+	}
+	return 0;
+}
@@ -1,29 +1,64 @@
 //! @file usercopy.h
-//! @brief File containing function for copying memory from userspace
+//! @brief File containing functions for copying memory from and to userspace
+//!
+//! User pointers are checked to lie in the lower half of the address space. Accesses to them are
+//! done by instructions listed in the exception table, so that page fault handler resumes at the
+//! fixup address instead of panicking if the fault can't be resolved (i.e. memory is not mapped
+//! and not reserved). In that case copy functions return false
 
 #pragma once
 
-#include <lib/string.h>
+#include <lib/target.h>
 #include <misc/types.h>
 
+//! @brief Copies of at least this many bytes done by bulk variants bypass caches
+#define MEM_USERCOPY_BULK_NT_THRESHOLD 0x40000
+
+//! @brief Exception table entry. Addresses are stored relative to the entry fields, so that table
+//! needs no relocations
+struct mem_usercopy_extable_entry {
+	//! @brief Offset of the instruction that may fault on user memory
+	int32_t insn;
+	//! @brief Offset of the instruction to resume at
+	int32_t fixup;
+};
+
 //! @brief Copy memory from userspace
 //! @param kernel_mem Pointer to the kernel memory
 //! @param user_mem Pointer to the userspace memory
 //! @param size Bytes to copy
-//! @return True if copy has been successful
-inline static bool mem_copy_from_user(void *kernel_mem, const void *user_mem, size_t size) {
-	// TODO: Implement properly
-	memcpy(kernel_mem, user_mem, size);
-	return true;
-}
+//! @return True if copy has been successful, false if user memory is not accessible
+bool mem_copy_from_user(void *kernel_mem, const void *user_mem, size_t size);
 
 //! @brief Copy memory to userspace
 //! @param user_mem Pointer to the userspace memory
 //! @param kernel_mem Pointer to the kernel memory
 //! @param size Bytes to copy
-//! @return True if copy has been successful
-inline static bool mem_copy_to_user(void *user_mem, const void *kernel_mem, size_t size) {
-	// TODO: implement properly
-	memcpy(user_mem, kernel_mem, size);
-	return true;
-}
+//! @return True if copy has been successful, false if user memory is not accessible
+bool mem_copy_to_user(void *user_mem, const void *kernel_mem, size_t size);
+
+//! @brief Copy large buffer from userspace
+//! @param kernel_mem Pointer to the kernel memory
+//! @param user_mem Pointer to the userspace memory
+//! @param size Bytes to copy
+//! @return True if copy has been successful, false if user memory is not accessible
+//! @note Copies larger than MEM_USERCOPY_BULK_NT_THRESHOLD use non-temporal stores, so that they
+//! don't evict the working set from caches
+bool mem_copy_from_user_bulk(void *kernel_mem, const void *user_mem, size_t size);
+
+//! @brief Copy large buffer to userspace
+//! @param user_mem Pointer to the userspace memory
+//! @param kernel_mem Pointer to the kernel memory
+//! @param size Bytes to copy
+//! @return True if copy has been successful, false if user memory is not accessible
+//! @note Copies larger than MEM_USERCOPY_BULK_NT_THRESHOLD use non-temporal stores, so that they
+//! don't evict the working set from caches
+bool mem_copy_to_user_bulk(void *user_mem, const void *kernel_mem, size_t size);
+
+//! @brief Find fixup address for the faulting instruction
+//! @param rip Address of the faulting instruction
+//! @return Address to resume at or 0 if instruction is not in the exception table
+uintptr_t mem_usercopy_fixup(uintptr_t rip);
+
+//! @brief Export usercopy initialization target
+EXPORT_TARGET(mem_usercopy_available)
@@ -0,0 +1,91 @@
+//! @file fault.c
+//! @brief File containing page fault handler
+
+#include <lib/panic.h>
+#include <lib/target.h>
+#include <mem/misc.h>
+#include <mem/usercopy.h>
+#include <mem/virt/fault.h>
+#include <mem/virt/paging.h>
+#include <mem/virt/vmalloc.h>
+#include <sys/arch/interrupts.h>
+#include <sys/cr.h>
+#include <sys/intlevel.h>
+#include <thread/smp/core.h>
+#include <thread/tasking/localsched.h>
+#include <thread/tasking/task.h>
+
+MODULE("mem/virt/fault")
+TARGET(mem_virt_fault_available, mem_virt_fault_init, {idt_available})
+
+//! @brief Error code bit set if fault was caused by protection violation on present page
+#define MEM_VIRT_FAULT_PRESENT 1ULL
+
+//! @brief Error code bit set if fault was caused by write access
+#define MEM_VIRT_FAULT_WRITE 2ULL
+
+//! @brief Error code bit set if fault was caused by userspace access
+#define MEM_VIRT_FAULT_USER 4ULL
+
+//! @brief Interrupt enable flag in RFLAGS
+#define MEM_VIRT_FAULT_RFLAGS_IF (1ULL << 9ULL)
+
+//! @brief Try to resolve page fault by populating reserved range or copying copy-on-write page
+//! @param addr Faulting address
+//! @param errcode Page fault error code
+//! @return True if access can be retried
+static bool mem_virt_fault_resolve(uintptr_t addr, uint64_t errcode) {
+	const bool write = (errcode & MEM_VIRT_FAULT_WRITE) != 0;
+	if (addr >= mem_wb_phys_win_base) {
+		// Only kernel accesses to not yet populated lazy vmalloc areas are resolved in the upper
+		// half
+		if ((errcode & (MEM_VIRT_FAULT_PRESENT | MEM_VIRT_FAULT_USER)) != 0) {
+			return false;
+		}
+		return mem_vmalloc_handle_fault(addr);
+	}
+	// Only writes to present pages may be resolved (copy-on-write)
+	if ((errcode & MEM_VIRT_FAULT_PRESENT) != 0 && !write) {
+		return false;
+	}
+	// Kernel-only tasks run on borrowed roots and never touch the lower half
+	struct thread_task *task = thread_localsched_get_current_task();
+	if (task == NULL || task->kernel_only) {
+		return false;
+	}
+	struct mem_paging_root *root = mem_paging_lookup_root(rdcr3());
+	if (root == NULL) {
+		return false;
+	}
+	return mem_paging_handle_fault(root, addr, write);
+}
+
+//! @brief Page fault handler
+//! @param frame Interrupt frame
+//! @param ctx Unused
+static void mem_virt_fault_handler(struct interrupt_frame *frame, void *ctx) {
+	(void)ctx;
+	// CR2 is read before interrupts are enabled, as faults in other tasks would overwrite it
+	const uintptr_t addr = rdcr2();
+	// Fault is resolved with interrupt state of the faulting context, so that copy-on-write
+	// faults can shoot down stale translations
+	const bool int_state = (frame->rflags & MEM_VIRT_FAULT_RFLAGS_IF) != 0;
+	intlevel_recover(int_state);
+	const bool resolved = mem_virt_fault_resolve(addr, frame->errcode);
+	intlevel_elevate();
+	if (!resolved) {
+		// Usercopy routines report inaccessible user memory to the caller instead
+		const uintptr_t fixup = mem_usercopy_fixup(frame->rip);
+		if (fixup != 0) {
+			frame->rip = fixup;
+			return;
+		}
+		PANIC("Page fault at 0x%p, rip=0x%p, e=0x%p, cpu=%u", addr, frame->rip, frame->errcode,
+		      PER_CPU(logical_id));
+	}
+}
+
+//! @brief Register page fault handler
+static void mem_virt_fault_init(void) {
+	interrupt_register_handler(MEM_VIRT_FAULT_VEC, mem_virt_fault_handler, NULL, 0, 0, true);
+}
@@ -0,0 +1,12 @@
+//! @file fault.h
+//! @brief File containing declarations of page fault handler
+
+#pragma once
+
+#include <lib/target.h>
+
+//! @brief Page fault vector
+#define MEM_VIRT_FAULT_VEC 14
+
+//! @brief Export page fault handler initialization target
+EXPORT_TARGET(mem_virt_fault_available)
@@ -8,18 +8,93 @@
 #include <mem/heap/heap.h>
 #include <mem/virt/invtlb.h>
 #include <misc/atomics.h>
+#include <misc/misc.h>
 #include <misc/types.h>
+#include <sys/arch/interrupts.h>
+#include <sys/arch/tss.h>
+#include <sys/cpuid.h>
 #include <sys/cr.h>
+#include <sys/ic.h>
+#include <sys/intlevel.h>
 #include <thread/locking/spinlock.h>
 #include <thread/smp/core.h>
 
 MODULE("mem/virt/invtlb")
 TARGET(mem_virt_invtlb_available, mem_virt_invtlb_init,
-       {thread_smp_core_available, mem_heap_available})
+       {thread_smp_core_available, mem_heap_available, idt_available})
 
 //! @brief Idle state
 #define MEM_VIRT_INVTLB_STATE_IDLE 2
 
+//! @brief Number of PCIDs each core hands out to address spaces. PCID 0 is left for CR3 writes
+//! that bypass invtlb subsystem
+#define MEM_VIRT_INVTLB_PCIDS 8
+
+//! @brief PCID assigned to the address space on some core
+struct mem_virt_invtlb_pcid {
+	//! @brief Physical address of the paging root or 0 if PCID is free
+	uint64_t cr3;
+	//! @brief Core flush generation at which TLB entries tagged with this PCID were last valid
+	uint64_t gen;
+};
+
+//! @brief Per-core PCID state
+struct mem_virt_invtlb_pcid_state {
+	//! @brief PCIDs in use. PCID of the slot at index i is i + 1
+	struct mem_virt_invtlb_pcid pcids[MEM_VIRT_INVTLB_PCIDS];
+	//! @brief Flush generation. Incremented each time all PCIDs have to be flushed, which makes all
+	//! of them stale at once. Starts at 1, so that 0 can be used to mark forgotten PCIDs
+	uint64_t gen;
+	//! @brief Index of the slot to be recycled next
+	size_t victim;
+	//! @brief True if CR4.PCIDE is set on this core
+	bool enabled;
+};
+
+//! @brief Maximum number of pages in the shootdown for which entries are invalidated one by one.
+//! Larger shootdowns flush the whole TLB
+#define MEM_VIRT_INVTLB_INVLPG_MAX 32
+
+//! @brief Interrupt vector for shootdown IPIs
+static uint8_t mem_virt_invtlb_shootdown_vec = 0x6a;
+
+//! @brief Shootdown request. Each core owns one and reuses it once all targets have acked it
+struct mem_virt_invtlb_shootdown {
+	//! @brief Ranges to invalidate
+	struct mem_virt_invtlb_batch batch;
+	//! @brief Number of targets yet to ack the request
+	size_t acks_left;
+};
+
+//! @brief Per-core shootdown requests
+static struct mem_virt_invtlb_shootdown *mem_virt_invtlb_shootdowns = NULL;
+
+//! @brief Per-core bitmaps of cores whose shootdown requests are yet to be handled by this core
+static uint64_t *mem_virt_invtlb_shootdown_pending;
+
+//! @brief Number of 64-bit words in one pending requests bitmap
+static size_t mem_virt_invtlb_shootdown_words;
+
+//! @brief Paging roots currently loaded on each core or 0 if core has not loaded any yet
+static uint64_t *mem_virt_invtlb_loaded;
+
+//! @brief Per-core lazy TLB flags. Set while core runs kernel-only task on a borrowed paging root
+static bool *mem_virt_invtlb_lazy;
+
+//! @brief Physical address of the kernel paging root. Lazy cores switch to it once borrowed root
+//! is shot down
+static uint64_t mem_virt_invtlb_kernel_cr3;
+
+//! @brief Set for cores that were not interrupted by kernel shootdowns (idle or not yet online
+//! cores), so that they flush TLB before they run anything
+static bool *mem_virt_invtlb_flush_pending;
+
+//! @brief True if CPU supports PCIDs
+static bool mem_virt_invtlb_pcid_supported = false;
+
+//! @brief Per-core PCID states
+static struct mem_virt_invtlb_pcid_state *mem_virt_invtlb_pcid_states;
+
 //! @brief Current pending state
 static uint8_t mem_virt_invtlb_pending_state = 0;
 
@@ -35,6 +110,18 @@ static size_t mem_virt_invtlb_pending_tlb_updates = 0;
 //! @brief Is global invalidation pending?
 static bool mem_virt_invtlb_pending = false;
 
+//! @brief Was global invalidation requested while another one was pending?
+static bool mem_virt_invtlb_rerequested = false;
+
+//! @brief Number of completed global invalidations
+static uint64_t mem_virt_invtlb_gen = 0;
+
+//! @brief Number of started global invalidations
+static uint64_t mem_virt_invtlb_started = 0;
+
+//! @brief Number of started global invalidations at the moment core entered idle state
+static uint64_t *mem_virt_invtlb_idle_marks;
+
 //! @brief TLB subsystem lock
 static struct thread_spinlock mem_virt_invtlb_lock;
 
@@ -53,14 +140,242 @@ static inline void mem_virt_invtlb_flip_states() {
 	ATOMIC_RELEASE_STORE(&mem_virt_invtlb_pending_state, 1 - mem_virt_invtlb_pending_state);
 }
 
-//! @brief Initialize invtlb subsystem
-static void mem_virt_invtlb_init(void) {
-	mem_virt_invtlb_states = mem_heap_alloc(thread_smp_core_max_cpus);
-	if (mem_virt_invtlb_states == NULL) {
-		PANIC("Failed to allocate core state table");
+//! @brief Load paging root using PCIDs
+//! @param cr3 Physical address of the paging root
+//! @param flush True if all TLB entries of this core have to be flushed
+//! @note Runs with ints disabled
+static void mem_virt_invtlb_pcid_load(uint64_t cr3, bool flush) {
+	struct mem_virt_invtlb_pcid_state *state = mem_virt_invtlb_pcid_states + PER_CPU(logical_id);
+	if (!state->enabled) {
+		// PCIDE can only be set while PCID in CR3 is 0
+		wrcr3(rdcr3() & CR3_ADDR_MASK);
+		wrcr4(rdcr4() | CR4_PCIDE);
+		state->enabled = true;
+	}
+	if (flush) {
+		// Entries of the current PCID are flushed below, others are flushed once switched to
+		state->gen++;
+	}
+	const uint64_t addr = cr3 & CR3_ADDR_MASK;
+	size_t index = 0;
+	while (index < MEM_VIRT_INVTLB_PCIDS &&
+	       ATOMIC_ACQUIRE_LOAD(&state->pcids[index].cr3) != addr) {
+		++index;
+	}
+	if (index == MEM_VIRT_INVTLB_PCIDS) {
+		// Recycle PCID in round-robin order. Entries tagged with it are flushed on load
+		index = state->victim;
+		state->victim = (state->victim + 1) % MEM_VIRT_INVTLB_PCIDS;
+		ATOMIC_RELEASE_STORE(&state->pcids[index].gen, 0);
+		ATOMIC_RELEASE_STORE(&state->pcids[index].cr3, addr);
+	}
+	struct mem_virt_invtlb_pcid *pcid = state->pcids + index;
+	uint64_t value = addr | (index + 1);
+	if (ATOMIC_ACQUIRE_LOAD(&pcid->gen) == state->gen) {
+		if (rdcr3() == value) {
+			return;
+		}
+		value |= CR3_NOFLUSH;
+	}
+	ATOMIC_RELEASE_STORE(&pcid->gen, state->gen);
+	wrcr3(value);
+}
+
+//! @brief Get PCID state of this core if PCIDs are in use
+//! @return Pointer to the PCID state or NULL if PCIDs are not enabled on this core
+//! @note Runs with ints disabled
+static struct mem_virt_invtlb_pcid_state *mem_virt_invtlb_pcid_local_state(void) {
+	if (!mem_virt_invtlb_pcid_supported) {
+		return NULL;
+	}
+	struct mem_virt_invtlb_pcid_state *state = mem_virt_invtlb_pcid_states + PER_CPU(logical_id);
+	return state->enabled ? state : NULL;
+}
+
+//! @brief Mark TLB entries tagged with the current PCID as valid on this core
+//! @param state Pointer to the PCID state of this core
+//! @note Runs with ints disabled. Caller is responsible for invalidating these entries by hand
+static void mem_virt_invtlb_pcid_revalidate_current(struct mem_virt_invtlb_pcid_state *state) {
+	const uint64_t current = rdcr3() & CR3_PCID_MASK;
+	if (current != 0) {
+		ATOMIC_RELEASE_STORE(&state->pcids[current - 1].gen, state->gen);
+	}
+}
+
+//! @brief Make TLB entries tagged with PCIDs other than the current one stale on this core
+//! @note Runs with ints disabled. Caller is responsible for the current PCID
+static void mem_virt_invtlb_pcid_invalidate_others(void) {
+	struct mem_virt_invtlb_pcid_state *state = mem_virt_invtlb_pcid_local_state();
+	if (state == NULL) {
+		return;
+	}
+	state->gen++;
+	mem_virt_invtlb_pcid_revalidate_current(state);
+}
+
+//! @brief Make TLB entries tagged with the PCID assigned to the paging root stale on this core
+//! @param cr3 Physical address of the paging root
+//! @note Runs with ints disabled
+static void mem_virt_invtlb_pcid_forget_local(uint64_t cr3) {
+	struct mem_virt_invtlb_pcid_state *state = mem_virt_invtlb_pcid_local_state();
+	for (size_t i = 0; state != NULL && i < MEM_VIRT_INVTLB_PCIDS; ++i) {
+		if (ATOMIC_RELAXED_LOAD(&state->pcids[i].cr3) == cr3) {
+			ATOMIC_RELEASE_STORE(&state->pcids[i].gen, 0);
+		}
+	}
+}
+
+//! @brief Flush local TLB
+//! @note Runs with ints disabled
+static void mem_virt_invtlb_flush_local(void) {
+	if (mem_virt_invtlb_pcid_supported) {
+		mem_virt_invtlb_pcid_load(rdcr3(), true);
+	} else {
+		wrcr3(rdcr3());
+	}
+}
+
+//! @brief Invalidate TLB entries of one page on this core
+//! @param vaddr Virtual address of the page
+static inline void mem_virt_invtlb_invlpg(uintptr_t vaddr) {
+	asm volatile("invlpg (%0)" ::"r"(vaddr) : "memory");
+}
+
+//! @brief Invalidate batch ranges in the local TLB
+//! @param batch Pointer to the batch
+//! @note Runs with ints disabled
+static void mem_virt_invtlb_invalidate_local(const struct mem_virt_invtlb_batch *batch) {
+	const bool kernel = batch->cr3 == MEM_VIRT_INVTLB_KERNEL;
+	if (!kernel && (rdcr3() & CR3_ADDR_MASK) == batch->cr3 && mem_virt_invtlb_lazy != NULL &&
+	    mem_virt_invtlb_lazy[PER_CPU(logical_id)]) {
+		// Kernel-only task does not need the borrowed root. Drop it, so that further shootdowns
+		// of this root skip this core
+		mem_virt_invtlb_update_cr3(0, mem_virt_invtlb_kernel_cr3);
+	}
+	if (!kernel && (rdcr3() & CR3_ADDR_MASK) != batch->cr3) {
+		// Core has switched away. Entries are flushed once it switches back
+		mem_virt_invtlb_pcid_forget_local(batch->cr3);
+		return;
+	}
+	size_t pages = 0;
+	for (size_t i = 0; i < batch->count; ++i) {
+		pages += batch->ranges[i].size / PAGE_SIZE;
+	}
+	if (pages > MEM_VIRT_INVTLB_INVLPG_MAX && kernel) {
+		mem_virt_invtlb_flush_local();
+		return;
+	}
+	if (pages > MEM_VIRT_INVTLB_INVLPG_MAX) {
+		// Only flushes entries of the current PCID, others do not belong to this root
+		wrcr3(rdcr3());
+	} else {
+		for (size_t i = 0; i < batch->count; ++i) {
+			const struct mem_virt_invtlb_range *range = batch->ranges + i;
+			for (size_t offset = 0; offset < range->size; offset += PAGE_SIZE) {
+				mem_virt_invtlb_invlpg(range->base + offset);
+			}
+		}
+	}
+	if (kernel) {
+		// invlpg only touches entries of the current PCID, while kernel is mapped in all of them
+		mem_virt_invtlb_pcid_invalidate_others();
+		return;
+	}
+	// Initiator has made current PCID stale, which is no longer needed
+	struct mem_virt_invtlb_pcid_state *state = mem_virt_invtlb_pcid_local_state();
+	if (state != NULL) {
+		mem_virt_invtlb_pcid_revalidate_current(state);
+	}
+}
+
+//! @brief Handle shootdown requests sent to this core
+//! @note Runs with ints disabled
+static void mem_virt_invtlb_shootdown_handle(void) {
+	uint64_t *pending = mem_virt_invtlb_shootdown_pending +
+	                    PER_CPU(logical_id) * mem_virt_invtlb_shootdown_words;
+	for (size_t i = 0; i < mem_virt_invtlb_shootdown_words; ++i) {
+		if (ATOMIC_RELAXED_LOAD(pending + i) == 0) {
+			continue;
+		}
+		uint64_t bits = ATOMIC_EXCHANGE(pending + i, 0);
+		while (bits != 0) {
+			const size_t initiator = i * 64 + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			struct mem_virt_invtlb_shootdown *request = mem_virt_invtlb_shootdowns + initiator;
+			mem_virt_invtlb_invalidate_local(&request->batch);
+			ATOMIC_FETCH_DECREMENT(&request->acks_left);
+		}
+	}
+}
+
+//! @brief Shootdown IPI handler
+//! @param frame Unused
+//! @param ctx Unused
+static void mem_virt_invtlb_shootdown_ipi(struct interrupt_frame *frame, void *ctx) {
+	(void)frame;
+	(void)ctx;
+	mem_virt_invtlb_shootdown_handle();
+	ic_ack();
+}
+
+//! @brief Consume TLB flush requested by kernel shootdowns that skipped this core
+//! @return True if TLB has to be flushed
+//! @note Runs with ints disabled
+static bool mem_virt_invtlb_consume_flush_pending(void) {
+	if (mem_virt_invtlb_flush_pending == NULL) {
+		return false;
+	}
+	bool *flag = mem_virt_invtlb_flush_pending + PER_CPU(logical_id);
+	return ATOMIC_RELAXED_LOAD(flag) && ATOMIC_EXCHANGE(flag, false);
+}
+
+//! @brief Initialize shootdown state
+static void mem_virt_invtlb_shootdown_init(void) {
+	const size_t cores = thread_smp_core_max_cpus;
+	mem_virt_invtlb_shootdown_words = (cores + 63) / 64;
+	const size_t pending_size = cores * mem_virt_invtlb_shootdown_words * sizeof(uint64_t);
+	mem_virt_invtlb_shootdown_pending = mem_heap_alloc(pending_size);
+	mem_virt_invtlb_loaded = mem_heap_alloc(cores * sizeof(uint64_t));
+	mem_virt_invtlb_flush_pending = mem_heap_alloc(cores * sizeof(bool));
+	mem_virt_invtlb_lazy = mem_heap_alloc(cores * sizeof(bool));
+	struct mem_virt_invtlb_shootdown *shootdowns =
+	    mem_heap_alloc(cores * sizeof(struct mem_virt_invtlb_shootdown));
+	if (mem_virt_invtlb_shootdown_pending == NULL || mem_virt_invtlb_loaded == NULL ||
+	    mem_virt_invtlb_flush_pending == NULL || mem_virt_invtlb_lazy == NULL ||
+	    shootdowns == NULL) {
+		PANIC("Failed to allocate shootdown state");
+	}
+	memset(mem_virt_invtlb_shootdown_pending, 0, pending_size);
+	memset(mem_virt_invtlb_loaded, 0, cores * sizeof(uint64_t));
+	memset(mem_virt_invtlb_flush_pending, 0, cores * sizeof(bool));
+	memset(mem_virt_invtlb_lazy, 0, cores * sizeof(bool));
+	// Boot paging root maps nothing but the kernel
+	mem_virt_invtlb_kernel_cr3 = rdcr3() & CR3_ADDR_MASK;
+	memset(shootdowns, 0, cores * sizeof(struct mem_virt_invtlb_shootdown));
+	interrupt_register_handler(mem_virt_invtlb_shootdown_vec, mem_virt_invtlb_shootdown_ipi, NULL,
+	                           0, TSS_INT_IST, true);
+	// Shootdowns are only sent once all of the above is in place
+	ATOMIC_RELEASE_STORE(&mem_virt_invtlb_shootdowns, shootdowns);
+}
+
+//! @brief Forget PCIDs assigned to the paging root on all cores
+//! @param cr3 Physical address of the paging root
+//! @note Should be called before paging root memory is freed, as new root may get the same address
+void mem_virt_invtlb_forget_cr3(uint64_t cr3) {
+	if (!mem_virt_invtlb_pcid_supported) {
+		return;
+	}
+	const uint64_t addr = cr3 & CR3_ADDR_MASK;
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		struct mem_virt_invtlb_pcid_state *state = mem_virt_invtlb_pcid_states + i;
+		for (size_t j = 0; j < MEM_VIRT_INVTLB_PCIDS; ++j) {
+			// Core gens start at 1, so gen 0 makes PCID stale. Slot may be recycled concurrently,
+			// which only costs its new owner one extra flush
+			if (ATOMIC_ACQUIRE_LOAD(&state->pcids[j].cr3) == addr) {
+				ATOMIC_RELEASE_STORE(&state->pcids[j].gen, 0);
+			}
+		}
 	}
-	memset(mem_virt_invtlb_states, mem_virt_invtlb_pending_state, thread_smp_core_max_cpus);
-	mem_virt_invtlb_lock = THREAD_SPINLOCK_INIT;
 }
 
 //! @brief Ack pending global invalidation
@@ -86,17 +401,34 @@ static enum
 	return MEM_VIRT_INVTLB_NO_INVALIDATION_REQUIRED;
 }
 
+//! @brief Start global invalidation without taking invtlb subsystem lock
+static void mem_virt_invtlb_start_nolock(void) {
+	mem_virt_invtlb_pending = true;
+	mem_virt_invtlb_started++;
+	ATOMIC_RELEASE_STORE(&mem_virt_invtlb_pending_tlb_updates,
+	                     thread_smp_core_max_cpus - mem_virt_invtlb_idle_cores);
+	mem_virt_invtlb_flip_states();
+}
+
 //! @brief Perform generation update without taking invtlb subsystem lock
 static void mem_virt_invtlb_gen_update_nolock(void) {
 	mem_virt_invtlb_pending = false;
-	// TODO: Add update code here
+	ATOMIC_RELEASE_STORE(&mem_virt_invtlb_gen, mem_virt_invtlb_gen + 1);
+	// Someone unmapped pages after cores have started acking this generation. Run one more
+	if (mem_virt_invtlb_rerequested) {
+		mem_virt_invtlb_rerequested = false;
+		mem_virt_invtlb_start_nolock();
+	}
 }
 
 //! @brief Update cr3
 //! @param old_cr3 Old CR3 value (can be set to 0 if unknown)
 //! @param new_cr3 New CR3 value
 //! @note Runs with ints disabled
+//! @note If CPU supports PCIDs, each core assigns PCIDs to recently loaded paging roots, so that
+//! switching back to them keeps their TLB entries
 void mem_virt_invtlb_update_cr3(uint64_t old_cr3, uint64_t new_cr3) {
+	bool flush = false;
 	switch (mem_virt_invtlb_ack()) {
 	case MEM_VIRT_INVTLB_GEN_UPDATE_PENDING:
 		thread_spinlock_grab(&mem_virt_invtlb_lock);
@@ -104,25 +436,53 @@ void mem_virt_invtlb_update_cr3(uint64_t old_cr3, uint64_t new_cr3) {
 		thread_spinlock_ungrab(&mem_virt_invtlb_lock);
 		// fall through
 	case MEM_VIRT_INVTLB_FLUSH_CR3:
-		wrcr3(new_cr3);
+		flush = true;
 		break;
 	default:
-		if (old_cr3 != new_cr3) {
-			wrcr3(new_cr3);
-		}
 		break;
 	}
+	if (mem_virt_invtlb_loaded != NULL) {
+		mem_virt_invtlb_lazy[PER_CPU(logical_id)] = false;
+		uint64_t *loaded = mem_virt_invtlb_loaded + PER_CPU(logical_id);
+		const uint64_t addr = new_cr3 & CR3_ADDR_MASK;
+		if (ATOMIC_RELAXED_LOAD(loaded) != addr) {
+			// Shootdown initiators publish stale PCIDs and flush requests before they look at
+			// loaded roots, so either they see the new root or the core sees their updates
+			ATOMIC_RELEASE_STORE(loaded, addr);
+			ATOMIC_FENCE();
+		}
+		flush = mem_virt_invtlb_consume_flush_pending() || flush;
+	}
+	if (mem_virt_invtlb_pcid_supported) {
+		mem_virt_invtlb_pcid_load(new_cr3, flush);
+	} else if (flush || old_cr3 != new_cr3) {
+		wrcr3(new_cr3);
+	}
+}
+
+//! @brief Keep paging root that is loaded on this core for a kernel-only task (lazy TLB)
+//! @note Runs with ints disabled. Pending global invalidations are acked as usual. Core switches
+//! to the kernel paging root once borrowed root is shot down
+void mem_virt_invtlb_update_cr3_lazy(void) {
+	const uint64_t cr3 = rdcr3() & CR3_ADDR_MASK;
+	mem_virt_invtlb_update_cr3(cr3, cr3);
+	if (mem_virt_invtlb_lazy != NULL) {
+		mem_virt_invtlb_lazy[PER_CPU(logical_id)] = true;
+	}
 }
 
 //! @brief Notify invtlb subsystem that core enters idle state
 //! @note Runs with ints disabled
 void mem_virt_invtlb_on_idle_enter(void) {
 	thread_spinlock_grab(&mem_virt_invtlb_lock);
-	if (mem_virt_invtlb_ack() == MEM_VIRT_INVTLB_GEN_UPDATE_PENDING) {
-		mem_virt_invtlb_gen_update_nolock();
-	}
+	const bool gen_update = mem_virt_invtlb_ack() == MEM_VIRT_INVTLB_GEN_UPDATE_PENDING;
+	// Mark core as idle before generation update, as it may start a new global invalidation
 	mem_virt_invtlb_idle_cores++;
 	mem_virt_invtlb_states[PER_CPU(logical_id)] = MEM_VIRT_INVTLB_STATE_IDLE;
+	mem_virt_invtlb_idle_marks[PER_CPU(logical_id)] = mem_virt_invtlb_started;
+	if (gen_update) {
+		mem_virt_invtlb_gen_update_nolock();
+	}
 	thread_spinlock_ungrab(&mem_virt_invtlb_lock);
 }
 
@@ -133,28 +493,242 @@ void mem_virt_invtlb_on_idle_exit() {
 	mem_virt_invtlb_idle_cores--;
 	mem_virt_invtlb_states[PER_CPU(logical_id)] =
 	    mem_virt_invtlb_flip_state(mem_virt_invtlb_pending_state);
+	// Idle cores are not waited for, but they still may have stale entries in the TLB
+	bool flush = mem_virt_invtlb_idle_marks[PER_CPU(logical_id)] != mem_virt_invtlb_started;
+	flush = mem_virt_invtlb_consume_flush_pending() || flush;
 	thread_spinlock_ungrab(&mem_virt_invtlb_lock);
+	if (flush) {
+		mem_virt_invtlb_flush_local();
+	}
 }
 
 //! @brief Request global invalidation
-void mem_virt_invtlb_request(void) {
+//! @return Generation after completion of which all TLB entries that were present at the time of
+//! the call are guaranteed to be flushed
+uint64_t mem_virt_invtlb_request(void) {
+	// Before initialization there is no one else to notify
+	if (mem_virt_invtlb_states == NULL) {
+		return 0;
+	}
 	const bool int_state = thread_spinlock_lock(&mem_virt_invtlb_lock);
 	if (mem_virt_invtlb_pending) {
+		// Some cores may have already acked pending invalidation. Ask for one more
+		mem_virt_invtlb_rerequested = true;
+		const uint64_t result = mem_virt_invtlb_gen + 2;
 		thread_spinlock_unlock(&mem_virt_invtlb_lock, int_state);
-		return;
+		return result;
 	}
-	ATOMIC_RELEASE_STORE(&mem_virt_invtlb_pending_tlb_updates,
-	                     thread_smp_core_max_cpus - mem_virt_invtlb_idle_cores);
-	mem_virt_invtlb_flip_states();
+	const uint64_t result = mem_virt_invtlb_gen + 1;
+	mem_virt_invtlb_start_nolock();
 	thread_spinlock_ungrab(&mem_virt_invtlb_lock);
 	switch (mem_virt_invtlb_ack()) {
 	case MEM_VIRT_INVTLB_GEN_UPDATE_PENDING:
 		thread_spinlock_grab(&mem_virt_invtlb_lock);
 		mem_virt_invtlb_gen_update_nolock();
 		thread_spinlock_ungrab(&mem_virt_invtlb_lock);
+		// fall through
+	case MEM_VIRT_INVTLB_FLUSH_CR3:
+		mem_virt_invtlb_pcid_invalidate_others();
 		break;
 	default:
 		break;
 	}
 	intlevel_recover(int_state);
+	return result;
+}
+
+//! @brief Check if global invalidation generation has been completed
+//! @param gen Generation returned from mem_virt_invtlb_request
+//! @return True if all cores have flushed their TLBs since the corresponding request
+bool mem_virt_invtlb_gen_completed(uint64_t gen) {
+	return ATOMIC_ACQUIRE_LOAD(&mem_virt_invtlb_gen) >= gen;
+}
+
+//! @brief Check if shootdowns can be waited for
+//! @return True if interrupts are enabled. Otherwise caller may hold a spinlock someone spins on
+//! with interrupts disabled, which would never ack the shootdown
+bool mem_virt_invtlb_shootdown_allowed(void) {
+	return intlevel_enabled();
+}
+
+//! @brief Add range to the shootdown batch
+//! @param batch Pointer to the batch
+//! @param base Base of the range. Should be page size aligned
+//! @param size Size of the range
+//! @note Range is merged with the last one if they are adjacent. Full batch is committed first
+void mem_virt_invtlb_batch_add(struct mem_virt_invtlb_batch *batch, uintptr_t base, size_t size) {
+	ASSERT(base % PAGE_SIZE == 0, "Address 0x%p is not page size aligned", base);
+	size = align_up(size, PAGE_SIZE);
+	if (batch->count != 0) {
+		struct mem_virt_invtlb_range *last = batch->ranges + batch->count - 1;
+		if (last->base + last->size == base) {
+			last->size += size;
+			return;
+		}
+	}
+	if (batch->count == MEM_VIRT_INVTLB_BATCH_RANGES) {
+		mem_virt_invtlb_batch_commit(batch);
+	}
+	batch->ranges[batch->count].base = base;
+	batch->ranges[batch->count].size = size;
+	batch->count++;
+}
+
+//! @brief Send shootdown request to the core
+//! @param request Pointer to the request of this core
+//! @param core Logical ID of the target core
+static void mem_virt_invtlb_shootdown_send(struct mem_virt_invtlb_shootdown *request,
+                                           size_t core) {
+	const size_t self = PER_CPU(logical_id);
+	uint64_t *pending = mem_virt_invtlb_shootdown_pending + core * mem_virt_invtlb_shootdown_words;
+	// Count target in before it can see the request, acks are only waited for once all are sent
+	ATOMIC_FETCH_INCREMENT(&request->acks_left);
+	ATOMIC_FETCH_OR(pending + self / 64, 1ULL << (self % 64));
+	ic_send_ipi(thread_smp_core_array[core].apic_id, mem_virt_invtlb_shootdown_vec);
+}
+
+//! @brief Send kernel shootdown request to all cores that may use kernel TLB entries
+//! @param request Pointer to the request of this core
+static void mem_virt_invtlb_shootdown_kernel(struct mem_virt_invtlb_shootdown *request) {
+	const size_t self = PER_CPU(logical_id);
+	// Idle cores and cores that are not online yet are asked to flush on their own. Idle states
+	// only change under the lock, so cores can't exit idle state without seeing the flag
+	thread_spinlock_grab(&mem_virt_invtlb_lock);
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		const uint64_t status = ATOMIC_ACQUIRE_LOAD(&thread_smp_core_array[i].status);
+		if (i != self && (mem_virt_invtlb_states[i] == MEM_VIRT_INVTLB_STATE_IDLE ||
+		                  status != THREAD_SMP_CORE_STATUS_ONLINE)) {
+			ATOMIC_RELEASE_STORE(mem_virt_invtlb_flush_pending + i, true);
+		}
+	}
+	thread_spinlock_ungrab(&mem_virt_invtlb_lock);
+	ATOMIC_FENCE();
+	// Flags still set belong to cores that will flush before running anything. Everyone else is
+	// interrupted, including cores that consumed their flags in the meantime
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		const uint64_t status = ATOMIC_ACQUIRE_LOAD(&thread_smp_core_array[i].status);
+		if (i != self && status == THREAD_SMP_CORE_STATUS_ONLINE &&
+		    !ATOMIC_ACQUIRE_LOAD(mem_virt_invtlb_flush_pending + i)) {
+			mem_virt_invtlb_shootdown_send(request, i);
+		}
+	}
+}
+
+//! @brief Send shootdown request to all cores that have the paging root loaded
+//! @param request Pointer to the request of this core
+static void mem_virt_invtlb_shootdown_root(struct mem_virt_invtlb_shootdown *request) {
+	const size_t self = PER_CPU(logical_id);
+	// Cores that switch to the root later will find its PCIDs stale
+	mem_virt_invtlb_forget_cr3(request->batch.cr3);
+	ATOMIC_FENCE();
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		if (i != self && ATOMIC_ACQUIRE_LOAD(mem_virt_invtlb_loaded + i) == request->batch.cr3) {
+			mem_virt_invtlb_shootdown_send(request, i);
+		}
+	}
+}
+
+//! @brief Invalidate batch ranges on all cores that may have them in TLB and wait for that to
+//! complete
+//! @param batch Pointer to the batch. Batch is emptied once committed
+//! @note Only cores that have the paging root loaded are interrupted. Other cores' PCIDs assigned
+//! to it are made stale. Kernel ranges interrupt all non-idle cores, idle cores flush on wakeup
+//! @note Should only be called if mem_virt_invtlb_shootdown_allowed returns true
+void mem_virt_invtlb_batch_commit(struct mem_virt_invtlb_batch *batch) {
+	if (batch->count == 0) {
+		return;
+	}
+	batch->cr3 &= CR3_ADDR_MASK;
+	const bool int_state = intlevel_elevate();
+	struct mem_virt_invtlb_shootdown *shootdowns = ATOMIC_ACQUIRE_LOAD(&mem_virt_invtlb_shootdowns);
+	// Before initialization there is no one else to notify
+	if (shootdowns == NULL) {
+		mem_virt_invtlb_invalidate_local(batch);
+		intlevel_recover(int_state);
+		batch->count = 0;
+		return;
+	}
+	struct mem_virt_invtlb_shootdown *request = shootdowns + PER_CPU(logical_id);
+	request->batch = *batch;
+	if (batch->cr3 == MEM_VIRT_INVTLB_KERNEL) {
+		mem_virt_invtlb_shootdown_kernel(request);
+	} else {
+		mem_virt_invtlb_shootdown_root(request);
+	}
+	// Local entries are invalidated after PCIDs were made stale, so that current one is revalidated
+	mem_virt_invtlb_invalidate_local(batch);
+	// Targets may be waiting for acks from this core as well
+	while (ATOMIC_ACQUIRE_LOAD(&request->acks_left) != 0) {
+		mem_virt_invtlb_shootdown_handle();
+		asm volatile("pause");
+	}
+	intlevel_recover(int_state);
+	batch->count = 0;
+}
+
+//! @brief Invalidate range on all cores that may have it in TLB and wait for that to complete
+//! @param cr3 Physical address of the paging root or MEM_VIRT_INVTLB_KERNEL
+//! @param base Base of the range. Should be page size aligned
+//! @param size Size of the range
+//! @note Should only be called if mem_virt_invtlb_shootdown_allowed returns true
+void mem_virt_invtlb_shootdown(uint64_t cr3, uintptr_t base, size_t size) {
+	struct mem_virt_invtlb_batch batch = MEM_VIRT_INVTLB_BATCH_INIT(cr3);
+	mem_virt_invtlb_batch_add(&batch, base, size);
+	mem_virt_invtlb_batch_commit(&batch);
+}
+
+//! @brief Make sure paging root is not used by any core
+//! @param cr3 Physical address of the paging root
+//! @note Should be called before paging root memory is freed. Root should not be loaded by any
+//! task, but lazy cores may still borrow it. Such cores are asked to switch away
+//! @note Should only be called if mem_virt_invtlb_shootdown_allowed returns true
+void mem_virt_invtlb_release_cr3(uint64_t cr3) {
+	const uint64_t addr = cr3 & CR3_ADDR_MASK;
+	mem_virt_invtlb_forget_cr3(addr);
+	if (mem_virt_invtlb_loaded == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		if (ATOMIC_ACQUIRE_LOAD(mem_virt_invtlb_loaded + i) == addr) {
+			// Any shootdown of the root makes lazy cores drop it
+			mem_virt_invtlb_shootdown(addr, 0, PAGE_SIZE);
+			break;
+		}
+	}
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		ASSERT(ATOMIC_ACQUIRE_LOAD(mem_virt_invtlb_loaded + i) != addr,
+		       "Paging root 0x%p is still in use by core %U", addr, i);
+	}
+}
+
+//! @brief Initialize invtlb subsystem
+static void mem_virt_invtlb_init(void) {
+	mem_virt_invtlb_states = mem_heap_alloc(thread_smp_core_max_cpus);
+	if (mem_virt_invtlb_states == NULL) {
+		PANIC("Failed to allocate core state table");
+	}
+	mem_virt_invtlb_idle_marks = mem_heap_alloc(thread_smp_core_max_cpus * sizeof(uint64_t));
+	if (mem_virt_invtlb_idle_marks == NULL) {
+		PANIC("Failed to allocate core idle marks table");
+	}
+	memset(mem_virt_invtlb_states, mem_virt_invtlb_pending_state, thread_smp_core_max_cpus);
+	mem_virt_invtlb_lock = THREAD_SPINLOCK_INIT;
+	mem_virt_invtlb_shootdown_init();
+	// Detect PCID support
+	struct cpuid buf;
+	cpuid(1, 0, &buf);
+	if ((buf.ecx & (1 << 17)) == 0) {
+		return;
+	}
+	const size_t states_size = thread_smp_core_max_cpus * sizeof(struct mem_virt_invtlb_pcid_state);
+	mem_virt_invtlb_pcid_states = mem_heap_alloc(states_size);
+	if (mem_virt_invtlb_pcid_states == NULL) {
+		PANIC("Failed to allocate PCID state table");
+	}
+	memset(mem_virt_invtlb_pcid_states, 0, states_size);
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		mem_virt_invtlb_pcid_states[i].gen = 1;
+	}
+	mem_virt_invtlb_pcid_supported = true;
+	LOG_SUCCESS("PCID support detected, %u PCIDs per core", MEM_VIRT_INVTLB_PCIDS);
 }
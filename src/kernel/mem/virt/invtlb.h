@@ -6,12 +6,56 @@
 #include <lib/target.h>
 #include <misc/types.h>
 
+//! @brief Address space argument for shootdowns of kernel half ranges, which are present on all
+//! cores
+#define MEM_VIRT_INVTLB_KERNEL 0
+
+//! @brief Maximum number of ranges in one shootdown batch
+#define MEM_VIRT_INVTLB_BATCH_RANGES 8
+
+//! @brief Range of virtual addresses to invalidate
+struct mem_virt_invtlb_range {
+	//! @brief Base of the range. Should be page size aligned
+	uintptr_t base;
+	//! @brief Size of the range
+	size_t size;
+};
+
+//! @brief Batch of ranges of one address space. All ranges in the batch are shot down at once
+struct mem_virt_invtlb_batch {
+	//! @brief Physical address of the paging root or MEM_VIRT_INVTLB_KERNEL
+	uint64_t cr3;
+	//! @brief Number of ranges in the batch
+	size_t count;
+	//! @brief Ranges
+	struct mem_virt_invtlb_range ranges[MEM_VIRT_INVTLB_BATCH_RANGES];
+};
+
+//! @brief Statically initialize shootdown batch
+//! @param _cr3 Physical address of the paging root or MEM_VIRT_INVTLB_KERNEL
+#define MEM_VIRT_INVTLB_BATCH_INIT(_cr3)                                                           \
+	(struct mem_virt_invtlb_batch) {                                                               \
+		.cr3 = (_cr3), .count = 0                                                                  \
+	}
+
 //! @brief Update cr3
 //! @param old_cr3 Old CR3 value (can be set to 0 if unknown)
 //! @param new_cr3 New CR3 value
 //! @note Runs with ints disabled
+//! @note If CPU supports PCIDs, each core assigns PCIDs to recently loaded paging roots, so that
+//! switching back to them keeps their TLB entries
 void mem_virt_invtlb_update_cr3(uint64_t old_cr3, uint64_t new_cr3);
 
+//! @brief Forget PCIDs assigned to the paging root on all cores
+//! @param cr3 Physical address of the paging root
+//! @note Should be called before paging root memory is freed, as new root may get the same address
+void mem_virt_invtlb_forget_cr3(uint64_t cr3);
+
+//! @brief Keep paging root that is loaded on this core for a kernel-only task (lazy TLB)
+//! @note Runs with ints disabled. Pending global invalidations are acked as usual. Core switches
+//! to the kernel paging root once borrowed root is shot down
+void mem_virt_invtlb_update_cr3_lazy(void);
+
 //! @brief Notify invtlb subsystem that core enters idle state
 //! @note Runs with ints disabled
 void mem_virt_invtlb_on_idle_enter(void);
@@ -21,8 +65,49 @@ void mem_virt_invtlb_on_idle_enter(void);
 void mem_virt_invtlb_on_idle_exit();
 
 //! @brief Request global invalidation
+//! @return Generation after completion of which all TLB entries that were present at the time of
+//! the call are guaranteed to be flushed
 //! @note Caller should switch CR3 on its own
-void mem_virt_invtlb_request(void);
+uint64_t mem_virt_invtlb_request(void);
+
+//! @brief Check if global invalidation generation has been completed
+//! @param gen Generation returned from mem_virt_invtlb_request
+//! @return True if all cores have flushed their TLBs since the corresponding request
+bool mem_virt_invtlb_gen_completed(uint64_t gen);
+
+//! @brief Check if shootdowns can be waited for
+//! @return True if interrupts are enabled. Otherwise caller may hold a spinlock someone spins on
+//! with interrupts disabled, which would never ack the shootdown
+bool mem_virt_invtlb_shootdown_allowed(void);
+
+//! @brief Add range to the shootdown batch
+//! @param batch Pointer to the batch
+//! @param base Base of the range. Should be page size aligned
+//! @param size Size of the range
+//! @note Range is merged with the last one if they are adjacent. Full batch is committed first
+void mem_virt_invtlb_batch_add(struct mem_virt_invtlb_batch *batch, uintptr_t base, size_t size);
+
+//! @brief Invalidate batch ranges on all cores that may have them in TLB and wait for that to
+//! complete
+//! @param batch Pointer to the batch. Batch is emptied once committed
+//! @note Only cores that have the paging root loaded are interrupted. Other cores' PCIDs assigned
+//! to it are made stale. Kernel ranges interrupt all non-idle cores, idle cores flush on wakeup
+//! @note Should only be called if mem_virt_invtlb_shootdown_allowed returns true
+void mem_virt_invtlb_batch_commit(struct mem_virt_invtlb_batch *batch);
+
+//! @brief Invalidate range on all cores that may have it in TLB and wait for that to complete
+//! @param cr3 Physical address of the paging root or MEM_VIRT_INVTLB_KERNEL
+//! @param base Base of the range. Should be page size aligned
+//! @param size Size of the range
+//! @note Should only be called if mem_virt_invtlb_shootdown_allowed returns true
+void mem_virt_invtlb_shootdown(uint64_t cr3, uintptr_t base, size_t size);
+
+//! @brief Make sure paging root is not used by any core
+//! @param cr3 Physical address of the paging root
+//! @note Should be called before paging root memory is freed. Root should not be loaded by any
+//! task, but lazy cores may still borrow it. Such cores are asked to switch away
+//! @note Should only be called if mem_virt_invtlb_shootdown_allowed returns true
+void mem_virt_invtlb_release_cr3(uint64_t cr3);
 
 //! @brief Target for TLB maintenance subsystem initialization
 EXPORT_TARGET(mem_virt_invtlb_available)
@@ -1,18 +1,27 @@
 //! @file paging.c
 //! @brief Implementation of paging functions
 
+#include <lib/intmap.h>
 #include <lib/log.h>
 #include <lib/panic.h>
 #include <lib/string.h>
 #include <lib/target.h>
 #include <mem/heap/heap.h>
+#include <mem/mem.h>
 #include <mem/misc.h>
 #include <mem/phys/phys.h>
 #include <mem/rc.h>
+#include <mem/reclaim.h>
+#include <mem/virt/invtlb.h>
 #include <mem/virt/paging.h>
+#include <mem/virt/vma.h>
+#include <misc/atomics.h>
+#include <misc/misc.h>
 #include <sys/cr.h>
+#include <sys/intlevel.h>
 #include <thread/locking/spinlock.h>
 #include <thread/smp/core.h>
+#include <thread/tasking/localsched.h>
 
 MODULE("mem/virt/paging")
 
@@ -31,6 +40,37 @@ MODULE("mem/virt/paging")
 //! @brief No-exec flag
 #define FLAGS_NOEXEC (1ULL << 63ULL)
 
+//! @brief Copy-on-write flag (ignored by CPU). Set in read-only leaf entries that were writable
+//! before frame was shared by mem_paging_duplicate
+#define FLAG_COW (1ULL << 9ULL)
+
+//! @brief Page size flag. Set in entries of level 2 and 3 tables that map huge pages directly
+#define FLAG_HUGE (1ULL << 7ULL)
+
+//! @brief Flags of intermediate entries in the lower half
+#define INTERM_FLAGS_USER (FLAG_PRESENT | FLAG_WRITABLE | FLAGS_USER)
+
+//! @brief Flags of intermediate entries in the higher half
+#define INTERM_FLAGS_KERNEL (FLAG_PRESENT | FLAG_WRITABLE)
+
+struct mem_paging_root;
+
+//! @brief Copy of the paging root lower half tables. Each replica has its own CR3 value
+struct mem_paging_replica {
+	//! @brief Node in the roots registry (keyed by CR3 value)
+	struct intmap_node registry_node;
+	//! @brief Paging root replica belongs to
+	struct mem_paging_root *root;
+	//! @brief Physical address of the root table or PHYS_NULL if there is no replica
+	uintptr_t cr3;
+	//! @brief Zeroed tables allocated on the replica node, linked through their first entry.
+	//! Guarded by root lock
+	uintptr_t stash;
+	//! @brief True if replica ran out of memory and its root entries point to primary tables. Such
+	//! replica is rebuilt once tables can be stashed again. Guarded by root lock
+	bool degraded;
+};
+
 //! @brief Paging root
 struct mem_paging_root {
 	//! @brief RC base
@@ -39,8 +79,77 @@ struct mem_paging_root {
 	struct thread_spinlock lock;
 	//! @brief CR3 value
 	uintptr_t cr3;
+	//! @brief Ranges populated on first touch. Guarded by the lock
+	struct mem_vma_tree vmas;
+	//! @brief Primary tables in the roots registry
+	struct mem_paging_replica primary;
+	//! @brief Per-node replicas indexed by NUMA node ID or NULL if root is not replicated. Set once
+	//! under the lock
+	struct mem_paging_replica *replicas;
+	//! @brief True once replicas mirror primary tables and can be loaded
+	bool replicated;
+	//! @brief Teardown queued to the reclaim task once the last reference is dropped
+	struct mem_reclaim_work teardown;
+};
+
+//! @brief Number of buckets in the roots registry
+#define MEM_PAGING_REGISTRY_BUCKETS 64
+
+//! @brief Number of pages unmapped at once when reserved range is released
+#define MEM_PAGING_RELEASE_CHUNK 64
+
+//! @brief Number of frames given back to PMM at once by root teardown. Deferred teardown yields
+//! after each batch
+#define MEM_PAGING_TEARDOWN_BATCH 64
+
+//! @brief State of the paging root teardown
+struct mem_paging_teardown {
+	//! @brief Frames waiting to be given back to PMM
+	uintptr_t frames[MEM_PAGING_TEARDOWN_BATCH];
+	//! @brief Number of frames in the batch
+	size_t count;
+	//! @brief True if teardown runs in the reclaim task and can yield between batches
+	bool preemptible;
+};
+
+//! @brief Buckets of the roots registry
+static struct list mem_paging_registry_buckets[MEM_PAGING_REGISTRY_BUCKETS];
+
+//! @brief Registry of paging roots. Used by page fault handler to find root by CR3 value
+static struct intmap mem_paging_registry = {
+    .buckets_count = MEM_PAGING_REGISTRY_BUCKETS,
+    .nodes = mem_paging_registry_buckets,
+};
+
+//! @brief Lock guarding roots registry
+static struct thread_spinlock mem_paging_registry_lock = THREAD_SPINLOCK_INIT;
+
+//! @brief Number of zeroed tables allocated for the replica stash at once
+#define MEM_PAGING_REPLICA_STASH 8
+
+//! @brief Number of replicated paging roots. CR3 loads skip registry lookup if there are none
+static size_t mem_paging_replicated_roots = 0;
+
+//! @brief Maximum number of pages invalidated one by one on range unmap. Whole TLB is flushed if
+//! range is larger
+#define MEM_PAGING_INVLPG_MAX 32
+
+//! @brief Table unlinked from the hierarchy (e.g. replaced by a huge page). Header is stored in the
+//! table page itself
+struct mem_paging_retired_table {
+	//! @brief Physical address of the next retired table or PHYS_NULL
+	uintptr_t next;
+	//! @brief Invtlb generation after which table can be freed
+	uint64_t gen;
 };
 
+//! @brief Lock guarding creation of intermediate tables in the kernel half of the address space
+//! and the list of retired tables
+static struct thread_spinlock mem_paging_kernel_lock = THREAD_SPINLOCK_INIT;
+
+//! @brief Tables waiting for all cores to flush their TLBs before being freed
+static uintptr_t mem_paging_retired = PHYS_NULL;
+
 //! @brief Get index for a given page level
 //! @param addr Virtual address
 //! @param lvl Level
@@ -51,52 +160,306 @@ uint16_t mem_paging_get_lvl_index(uintptr_t addr, uint8_t lvl) {
 //! @brief Allocate zeroed page
 //! @return New zeroed page or PHYS_NULL on failure
 static uintptr_t mem_paging_new_zeroed() {
-	uintptr_t res = mem_phys_alloc_on_behalf(PAGE_SIZE, PER_CPU(numa_id));
-	if (res == PHYS_NULL) {
-		return PHYS_NULL;
+	return mem_phys_alloc_zeroed_page(PER_CPU(numa_id));
+}
+
+//! @brief Get size of pages mapped by entries of the table at a given level
+//! @param level Table level
+//! @return Page size
+static size_t mem_paging_level_page_size(uint8_t level) {
+	return 1ULL << (9 * level + 3);
+}
+
+//! @brief Get level of the table which entries map pages of a given size
+//! @param size Page size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @return Table level
+static uint8_t mem_paging_huge_level(size_t size) {
+	if (size == MEM_PHYS_HUGE_2M_SIZE) {
+		return 2;
 	}
-	uintptr_t virt = res + mem_wb_phys_win_base;
-	memset((void *)virt, 0, PAGE_SIZE);
-	return res;
+	ASSERT(size == MEM_PHYS_HUGE_1G_SIZE, "Unsupported huge page size %U", size);
+	ASSERT(mem_1gb_pages_supported, "1 GB pages are not supported by the CPU");
+	return 3;
+}
+
+//! @brief Check if entry maps page directly
+//! @param entry Table entry
+//! @param level Level of the table entry belongs to
+//! @return True if entry is a leaf
+static bool mem_paging_is_leaf(uintptr_t entry, uint8_t level) {
+	return level == 1 || (entry & FLAG_HUGE) != 0;
 }
 
-//! @brief Dispose paging table at level
+//! @brief Check if table or any of its subtables maps at least one page
 //! @param addr Table physical address
-//! @param lvl Level
-static void mem_paging_dispose_at_level(uintptr_t addr, uint8_t level) {
-	if (level == 0) {
+//! @param level Table level
+//! @return True if there are mapped pages
+static bool mem_paging_table_maps_pages(uintptr_t addr, uint8_t level) {
+	const uintptr_t *table = (const uintptr_t *)(addr + mem_wb_phys_win_base);
+	for (uint16_t i = 0; i < 512; ++i) {
+		if (table[i] == 0) {
+			continue;
+		}
+		if (mem_paging_is_leaf(table[i], level) ||
+		    mem_paging_table_maps_pages(table[i] & (~FLAGS_MASK), level - 1)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//! @brief Take zeroed table from the stash
+//! @param stash Pointer to the stash head. Stashed tables are linked through their first entry
+//! @return Physical address of the zeroed table
+static uintptr_t mem_paging_stash_take(uintptr_t *stash) {
+	const uintptr_t result = *stash;
+	ASSERT(result != PHYS_NULL, "Table stash ran out");
+	uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + result);
+	*stash = table[0];
+	table[0] = 0;
+	return result;
+}
+
+//! @brief Free all tables in the list
+//! @param list Physical address of the first table. Tables are linked through their first entry
+static void mem_paging_free_list(uintptr_t list) {
+	while (list != PHYS_NULL) {
+		const uintptr_t next = *(uintptr_t *)(mem_wb_phys_win_base + list);
+		mem_phys_free(list);
+		list = next;
+	}
+}
+
+//! @brief Collect table and its subtables into the list without touching mapped pages
+//! @param addr Table physical address
+//! @param level Table level
+//! @param list Pointer to the list head. Tables are linked through their first entry
+static void mem_paging_collect_tables(uintptr_t addr, uint8_t level, uintptr_t *list) {
+	uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + addr);
+	for (uint16_t i = 0; i < 512; ++i) {
+		if (table[i] != 0 && !mem_paging_is_leaf(table[i], level)) {
+			mem_paging_collect_tables(table[i] & (~FLAGS_MASK), level - 1, list);
+		}
+	}
+	table[0] = *list;
+	*list = addr;
+}
+
+//! @brief Invalidate local TLB entry for a given page
+//! @param vaddr Virtual address of the page
+static inline void mem_paging_invlpg(uintptr_t vaddr) {
+	asm volatile("invlpg (%0)" ::"r"(vaddr) : "memory");
+}
+
+//! @brief Free retired tables that are no longer present in any TLB
+//! @note Kernel paging lock should be held
+static void mem_paging_free_retired_nolock(void) {
+	uintptr_t *link = &mem_paging_retired;
+	while (*link != PHYS_NULL) {
+		const uintptr_t addr = *link;
+		struct mem_paging_retired_table *header =
+		    (struct mem_paging_retired_table *)(mem_wb_phys_win_base + addr);
+		if (!mem_virt_invtlb_gen_completed(header->gen)) {
+			link = &header->next;
+			continue;
+		}
+		*link = header->next;
 		mem_phys_free(addr);
 	}
+}
+
+//! @brief Free tables unlinked from the hierarchy once all cores flush their TLBs
+//! @param list Physical address of the first table. Tables are linked through their first entry
+//! @param vaddr Virtual address inside the range covered by the tables
+//! @note Other cores may still cache unlinked tables in paging-structure caches and walk into them
+//! if they were reused right away
+static void mem_paging_retire_list(uintptr_t list, uintptr_t vaddr) {
+	if (list == PHYS_NULL) {
+		return;
+	}
+	// INVLPG drops all paging-structure cache entries of the current PCID, not only ones for vaddr
+	mem_paging_invlpg(vaddr);
+	const uint64_t gen = mem_virt_invtlb_request();
+	const bool int_state = thread_spinlock_lock(&mem_paging_kernel_lock);
+	mem_paging_free_retired_nolock();
+	// Link to the next table is already where retired table header keeps it
+	struct mem_paging_retired_table *header;
+	uintptr_t current = list;
+	while (true) {
+		header = (struct mem_paging_retired_table *)(mem_wb_phys_win_base + current);
+		header->gen = gen;
+		if (header->next == PHYS_NULL) {
+			break;
+		}
+		current = header->next;
+	}
+	header->next = mem_paging_retired;
+	mem_paging_retired = list;
+	thread_spinlock_unlock(&mem_paging_kernel_lock, int_state);
+}
+
+//! @brief Add tables to the roots registry
+//! @param replica Pointer to the primary tables or replica
+static void mem_paging_registry_insert(struct mem_paging_replica *replica) {
+	replica->registry_node.key = replica->cr3;
+	const bool int_state = thread_spinlock_lock(&mem_paging_registry_lock);
+	intmap_insert(&mem_paging_registry, &replica->registry_node);
+	thread_spinlock_unlock(&mem_paging_registry_lock, int_state);
+}
+
+//! @brief Remove tables from the roots registry
+//! @param replica Pointer to the primary tables or replica
+static void mem_paging_registry_remove(struct mem_paging_replica *replica) {
+	const bool int_state = thread_spinlock_lock(&mem_paging_registry_lock);
+	intmap_remove(&mem_paging_registry, &replica->registry_node);
+	thread_spinlock_unlock(&mem_paging_registry_lock, int_state);
+}
+
+//! @brief Dispose replicas of the paging root
+//! @param root Pointer to the paging root
+//! @note Pages are owned by primary tables, only replica tables are freed
+static void mem_paging_dispose_replicas(struct mem_paging_root *root) {
+	if (root->replicas == NULL) {
+		return;
+	}
+	if (root->replicated) {
+		ATOMIC_FETCH_DECREMENT(&mem_paging_replicated_roots);
+	}
+	const uint8_t lvls = mem_5level_paging_enabled ? 5 : 4;
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		struct mem_paging_replica *replica = root->replicas + i;
+		if (replica->cr3 == PHYS_NULL) {
+			continue;
+		}
+		if (root->replicated) {
+			mem_paging_registry_remove(replica);
+		}
+		mem_virt_invtlb_release_cr3(replica->cr3);
+		uintptr_t list = replica->stash;
+		const uintptr_t *root_table = (const uintptr_t *)(mem_wb_phys_win_base + replica->cr3);
+		const uintptr_t *primary_table = (const uintptr_t *)(mem_wb_phys_win_base + root->cr3);
+		for (uint16_t j = 0; j < 256; ++j) {
+			// Entries of degraded replicas may point to primary tables
+			if (root_table[j] != 0 &&
+			    (root_table[j] & (~FLAGS_MASK)) != (primary_table[j] & (~FLAGS_MASK))) {
+				mem_paging_collect_tables(root_table[j] & (~FLAGS_MASK), lvls - 1, &list);
+			}
+		}
+		mem_paging_free_list(list);
+		mem_phys_free(replica->cr3);
+	}
+	mem_heap_free(root->replicas, numa_nodes_size * sizeof(struct mem_paging_replica));
+}
+
+//! @brief Give batched frames back to PMM
+//! @param teardown Pointer to the teardown state
+static void mem_paging_teardown_flush(struct mem_paging_teardown *teardown) {
+	mem_phys_put_batch(teardown->frames, teardown->count);
+	teardown->count = 0;
+	// Root may map gigabytes of memory, so other tasks on this core get a chance to run
+	if (teardown->preemptible) {
+		thread_localsched_yield();
+	}
+}
+
+//! @brief Add frame to the batch of frames given back to PMM
+//! @param teardown Pointer to the teardown state
+//! @param frame Physical address of the frame or of the huge page
+static void mem_paging_teardown_put(struct mem_paging_teardown *teardown, uintptr_t frame) {
+	if (teardown->count == MEM_PAGING_TEARDOWN_BATCH) {
+		mem_paging_teardown_flush(teardown);
+	}
+	teardown->frames[teardown->count++] = frame;
+}
+
+//! @brief Tear down paging table at level
+//! @param teardown Pointer to the teardown state
+//! @param addr Table physical address
+//! @param level Table level
+//! @note Entries are cleared on the way, so the table is zeroed once it is torn down and can be
+//! reused by the zeroed pages pool as is
+static void mem_paging_teardown_at_level(struct mem_paging_teardown *teardown, uintptr_t addr,
+                                         uint8_t level) {
 	uintptr_t *table = (uintptr_t *)(addr + mem_wb_phys_win_base);
 	for (uint16_t i = 0; i < 512; ++i) {
-		if (table[i] != 0) {
-			mem_paging_dispose_at_level(table[i] & (~FLAGS_MASK), level - 1);
+		if (table[i] == 0) {
+			continue;
 		}
+		if (mem_paging_is_leaf(table[i], level)) {
+			mem_paging_teardown_put(teardown, table[i] & (~FLAGS_MASK));
+		} else {
+			mem_paging_teardown_at_level(teardown, table[i] & (~FLAGS_MASK), level - 1);
+		}
+		table[i] = 0;
+	}
+	if (!mem_phys_zero_pool_put(addr)) {
+		mem_paging_teardown_put(teardown, addr);
 	}
 }
 
-//! @brief Dispose paging root
+//! @brief Tear down paging root
 //! @param root Pointer to the paging root
-static void mem_paging_dispose_root(struct mem_paging_root *root) {
+//! @param preemptible True if teardown runs in the reclaim task
+static void mem_paging_teardown_root(struct mem_paging_root *root, bool preemptible) {
+	mem_paging_registry_remove(&root->primary);
+	mem_paging_dispose_replicas(root);
+	// Pages populated in reserved ranges are freed along with the tables
+	while (root->vmas.root != NULL) {
+		struct mem_vma *vma = root->vmas.root;
+		mem_vma_remove(&root->vmas, vma);
+		mem_heap_free(vma, sizeof(struct mem_vma));
+	}
+	// Lazy cores may still walk the tables, so they are asked to switch away first
+	mem_virt_invtlb_release_cr3(root->cr3);
+	struct mem_paging_teardown teardown;
+	teardown.count = 0;
+	teardown.preemptible = preemptible;
 	uintptr_t *root_table = (uintptr_t *)(root->cr3 + mem_wb_phys_win_base);
 	for (uint16_t i = 0; i < 256; ++i) {
 		if (root_table[i] != 0) {
-			mem_paging_dispose_at_level(root_table[i] & (~FLAGS_MASK),
-			                            mem_5level_paging_enabled ? 4 : 3);
+			mem_paging_teardown_at_level(&teardown, root_table[i] & (~FLAGS_MASK),
+			                             mem_5level_paging_enabled ? 4 : 3);
 		}
 	}
-	mem_phys_free(root->cr3);
+	mem_paging_teardown_put(&teardown, root->cr3);
+	// Last batch is given back without yielding, there is nothing left to do
+	teardown.preemptible = false;
+	mem_paging_teardown_flush(&teardown);
 	mem_heap_free(root, sizeof(struct mem_paging_root));
 }
 
+//! @brief Tear down paging root from the reclaim task
+//! @param root Pointer to the paging root
+static void mem_paging_teardown_deferred(struct mem_paging_root *root) {
+	mem_paging_teardown_root(root, true);
+}
+
+//! @brief Dispose paging root
+//! @param root Pointer to the paging root
+//! @note Teardown is queued to the reclaim task of the node root table belongs to, so that the
+//! task dropping the last reference does not stall. Root is torn down right away if reclaim tasks
+//! have not been started yet
+static void mem_paging_dispose_root(struct mem_paging_root *root) {
+	root->teardown.callback = CALLBACK_VOID(mem_paging_teardown_deferred, root);
+	if (!mem_reclaim_defer(mem_range_lookup(root->cr3)->node_id, &root->teardown)) {
+		mem_paging_teardown_root(root, false);
+	}
+}
+
 //! @brief Create new paging root
 //! @return Pointer to the new paging root or NULL on failure
+//! @note Root is torn down by the reclaim task once the last reference is dropped. Before reclaim
+//! tasks are started, last reference should be dropped with interrupts enabled, as disposal waits
+//! for lazy TLB cores to switch away from it
 struct mem_paging_root *mem_paging_new_root(void) {
 	struct mem_paging_root *res = mem_heap_alloc(sizeof(struct mem_paging_root));
-	res->lock = THREAD_SPINLOCK_INIT;
 	if (res == NULL) {
 		return NULL;
 	}
+	res->lock = THREAD_SPINLOCK_INIT;
+	res->vmas = MEM_VMA_TREE_INIT;
+	res->replicas = NULL;
+	res->replicated = false;
 	res->cr3 = mem_paging_new_zeroed();
 	if (res->cr3 == PHYS_NULL) {
 		mem_heap_free(res, sizeof(struct mem_paging_root));
@@ -104,15 +467,70 @@ struct mem_paging_root *mem_paging_new_root(void) {
 	}
 	MEM_REF_INIT(res, mem_paging_dispose_root);
 	// Copy all higher half entries
-	uintptr_t current_cr3 = rdcr3();
+	uintptr_t current_cr3 = rdcr3() & CR3_ADDR_MASK;
 	uintptr_t *current_root_table = (uintptr_t *)(current_cr3 + mem_wb_phys_win_base);
 	uintptr_t *new_root_table = (uintptr_t *)(res->cr3 + mem_wb_phys_win_base);
 	for (size_t i = 256; i < 512; ++i) {
 		new_root_table[i] = current_root_table[i];
 	}
+	res->primary.root = res;
+	res->primary.cr3 = res->cr3;
+	res->primary.stash = PHYS_NULL;
+	mem_paging_registry_insert(&res->primary);
 	return res;
 }
 
+//! @brief Find paging root by its CR3 value
+//! @param cr3 Physical address of the root table or of one of its replicas
+//! @return Pointer to the paging root or NULL if there is none (e.g. boot root)
+//! @note No reference is taken. Root should be loaded on this core by the current task, which
+//! keeps it alive
+struct mem_paging_root *mem_paging_lookup_root(uint64_t cr3) {
+	const bool int_state = thread_spinlock_lock(&mem_paging_registry_lock);
+	struct intmap_node *node = intmap_search(&mem_paging_registry, cr3 & CR3_ADDR_MASK);
+	thread_spinlock_unlock(&mem_paging_registry_lock, int_state);
+	if (node == NULL) {
+		return NULL;
+	}
+	return CONTAINER_OF(node, struct mem_paging_replica, registry_node)->root;
+}
+
+//! @brief Get CR3 value cores of this node should load to switch to the paging root
+//! @param cr3 Physical address of the root table
+//! @return Physical address of the local replica root table or cr3 if there is none
+//! @note Should be called with interrupts disabled
+uint64_t mem_paging_local_cr3(uint64_t cr3) {
+	if (ATOMIC_RELAXED_LOAD(&mem_paging_replicated_roots) == 0) {
+		return cr3;
+	}
+	struct mem_paging_root *root = mem_paging_lookup_root(cr3);
+	if (root == NULL || !ATOMIC_ACQUIRE_LOAD(&root->replicated)) {
+		return cr3;
+	}
+	const uintptr_t local = root->replicas[PER_CPU(numa_id)].cr3;
+	return local == PHYS_NULL ? cr3 : local;
+}
+
+//! @brief Get physical address of the primary root table of the paging root
+//! @param root Pointer to the paging root
+//! @return Physical address of the root table
+uint64_t mem_paging_root_cr3(struct mem_paging_root *root) {
+	return root->cr3;
+}
+
+//! @brief Get physical address of the replica root table of the paging root
+//! @param root Pointer to the paging root
+//! @param id ID of the replica node
+//! @return Physical address of the replica root table or PHYS_NULL if there is no replica on the
+//! node
+uint64_t mem_paging_replica_cr3(struct mem_paging_root *root, numa_id_t id) {
+	const struct mem_paging_replica *replicas = ATOMIC_ACQUIRE_LOAD(&root->replicas);
+	if (replicas == NULL || id >= numa_nodes_size) {
+		return PHYS_NULL;
+	}
+	return replicas[id].cr3;
+}
+
 //! @brief Try to create a new paging mapper
 //! @param mapper Pointer to the mapper
 //! @return True on success and false on failure
@@ -152,92 +570,1256 @@ static bool mem_paging_regen_cache(struct mem_paging_mapper *mapper) {
 	return true;
 }
 
-//! @brief Map 4k page at a given addresss
+//! @brief Convert MEM_PAGING_* permissions to page table entry flags
+//! @param perms Permissions
+//! @return Page table entry flags
+static uintptr_t mem_paging_perms_to_flags(int perms) {
+	uintptr_t flags = FLAG_PRESENT;
+	if ((perms & MEM_PAGING_WRITABLE) != 0) {
+		flags |= FLAG_WRITABLE;
+	}
+	if ((perms & MEM_PAGING_EXECUTABLE) == 0) {
+		flags |= FLAGS_NOEXEC;
+	}
+	if ((perms & MEM_PAGING_USER) != 0) {
+		flags |= FLAGS_USER;
+	}
+	return flags;
+}
+
+//! @brief Split huge page entry into the table of smaller pages with the same permissions
+//! @param entry Pointer to the huge page entry
+//! @param level Level of the table entry belongs to
+//! @param new_table Physical address of the zeroed page to be used as the new table
+//! @param interm_flags Flags of the entry pointing to the new table
+static void mem_paging_split_huge(uintptr_t *entry, uint8_t level, uintptr_t new_table,
+                                  uintptr_t interm_flags) {
+	const uintptr_t base = *entry & (~FLAGS_MASK);
+	uintptr_t flags = *entry & FLAGS_MASK;
+	// Size bit means PAT in level 1 tables, so it is only kept if new entries are still huge
+	if (level == 2) {
+		flags &= ~FLAG_HUGE;
+	}
+	const size_t step = mem_paging_level_page_size(level - 1);
+	uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + new_table);
+	for (uint16_t i = 0; i < 512; ++i) {
+		table[i] = (base + i * step) | flags;
+	}
+	*entry = new_table | interm_flags;
+}
+
+//! @brief Split huge page in the lower half
+//! @param entry Pointer to the huge page entry
+//! @param level Level of the table entry belongs to
+//! @param new_table Physical address of the zeroed page to be used as the new table
+//! @note Frames of the page are split in PMM as well, as paging root owns all mapped frames
+static void mem_paging_split_user_huge(uintptr_t *entry, uint8_t level, uintptr_t new_table) {
+	const uintptr_t base = *entry & (~FLAGS_MASK);
+	mem_paging_split_huge(entry, level, new_table, INTERM_FLAGS_USER);
+	mem_phys_split(base, mem_paging_level_page_size(level - 1));
+}
+
+//! @brief Walk lower half paging hierarchy down to the table at a given level
 //! @param root Pointer to the paging root
-//! @param vaddr Virtual address at which page should be mapped
-//! @param paddr Physical address of the page to map
-//! @param perms Permissions to map with
-//! @return True on success, false on error
-bool mem_paging_map_at(struct mem_paging_root *root, uintptr_t vaddr, uintptr_t paddr, int perms) {
-	ASSERT(vaddr < mem_wb_phys_win_base, "Address 0x%p is not in lower half", vaddr);
+//! @param mapper Pointer to the mapper to take new tables from or NULL if tables should not be
+//! changed
+//! @param vaddr Virtual address
+//! @param level Level of the table to walk down to
+//! @param create If true, missing tables are allocated. Requires mapper
+//! @return Pointer to the table or NULL if there is none
+//! @note Root lock should be held. Huge pages on the way are split if mapper is given, unless they
+//! are shared copy-on-write
+static uintptr_t *mem_paging_walk(struct mem_paging_root *root, struct mem_paging_mapper *mapper,
+                                  uintptr_t vaddr, uint8_t level, bool create) {
+	uintptr_t current_phys = root->cr3;
+	const uint8_t lvls = mem_5level_paging_enabled ? 5 : 4;
+	for (uint8_t i = lvls; i > level; --i) {
+		uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + current_phys);
+		uintptr_t *entry = table + mem_paging_get_lvl_index(vaddr, i);
+		if (*entry == 0 || (*entry & FLAG_HUGE) != 0) {
+			if (mapper == NULL || (*entry == 0 && !create) ||
+			    mapper->zeroed_pages[i - 2] == PHYS_NULL ||
+			    (*entry != 0 && mem_phys_shared(*entry & (~FLAGS_MASK)))) {
+				return NULL;
+			}
+			const uintptr_t new_table = mapper->zeroed_pages[i - 2];
+			mapper->zeroed_pages[i - 2] = PHYS_NULL;
+			if (*entry == 0) {
+				*entry = new_table | INTERM_FLAGS_USER;
+			} else {
+				mem_paging_split_user_huge(entry, i, new_table);
+			}
+		}
+		current_phys = *entry & (~FLAGS_MASK);
+	}
+	return (uintptr_t *)(mem_wb_phys_win_base + current_phys);
+}
+
+//! @brief Find entry that maps a given address in the lower half
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address
+//! @param level Buffer to store level of the table entry belongs to
+//! @return Pointer to the leaf entry or to the empty entry on the way to it
+//! @note Root lock should be held
+static uintptr_t *mem_paging_find_entry(struct mem_paging_root *root, uintptr_t vaddr,
+                                        uint8_t *level) {
+	uintptr_t current_phys = root->cr3;
+	for (uint8_t i = mem_5level_paging_enabled ? 5 : 4;; --i) {
+		uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + current_phys);
+		uintptr_t *entry = table + mem_paging_get_lvl_index(vaddr, i);
+		if (*entry == 0 || mem_paging_is_leaf(*entry, i)) {
+			*level = i;
+			return entry;
+		}
+		current_phys = *entry & (~FLAGS_MASK);
+	}
+}
+
+//! @brief Mirror range of the table in its replica
+//! @param src Primary table physical address
+//! @param dst Replica table physical address
+//! @param level Table level
+//! @param base Virtual address mapped by the first entry of the table
+//! @param from Start of the range
+//! @param to End of the range
+//! @param replica Pointer to the replica to take new tables from
+//! @param garbage Pointer to the list of replica tables that are not used anymore
+//! @return False if replica ran out of stashed tables
+//! @note Root lock should be held
+static bool mem_paging_sync_level(uintptr_t src, uintptr_t dst, uint8_t level, uintptr_t base,
+                                  uintptr_t from, uintptr_t to, struct mem_paging_replica *replica,
+                                  uintptr_t *garbage) {
+	const uintptr_t *src_table = (const uintptr_t *)(mem_wb_phys_win_base + src);
+	uintptr_t *dst_table = (uintptr_t *)(mem_wb_phys_win_base + dst);
+	const size_t page_size = mem_paging_level_page_size(level);
+	const size_t last = (to - 1 - base) / page_size;
+	for (size_t i = (from - base) / page_size; i <= last; ++i) {
+		const uintptr_t entry = src_table[i];
+		const uintptr_t old = dst_table[i];
+		const bool old_table = old != 0 && !mem_paging_is_leaf(old, level);
+		if (entry == 0 || mem_paging_is_leaf(entry, level)) {
+			dst_table[i] = entry;
+			if (old_table) {
+				mem_paging_collect_tables(old & (~FLAGS_MASK), level - 1, garbage);
+			}
+			continue;
+		}
+		const uintptr_t entry_base = base + i * page_size;
+		uintptr_t entry_from = from > entry_base ? from : entry_base;
+		uintptr_t entry_to = to < entry_base + page_size ? to : entry_base + page_size;
+		uintptr_t table = old & (~FLAGS_MASK);
+		// Root entries of degraded replicas point to primary tables, which are replaced by copies
+		if (!old_table || table == (entry & (~FLAGS_MASK))) {
+			if (replica->stash == PHYS_NULL) {
+				return false;
+			}
+			// New table mirrors the whole range covered by the entry
+			table = mem_paging_stash_take(&replica->stash);
+			entry_from = entry_base;
+			entry_to = entry_base + page_size;
+		}
+		dst_table[i] = table | (entry & FLAGS_MASK);
+		if (!mem_paging_sync_level(entry & (~FLAGS_MASK), table, level - 1, entry_base,
+		                           entry_from, entry_to, replica, garbage)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//! @brief Point lower half root entries of the replica to primary tables
+//! @param root Pointer to the paging root
+//! @param replica Pointer to the replica
+//! @param garbage Pointer to the list of replica tables that are not used anymore
+//! @note Root lock should be held. Replica stays consistent with primary tables without allocating
+//! anything, at the cost of cores of its node walking remote tables
+static void mem_paging_replica_share_nolock(struct mem_paging_root *root,
+                                            struct mem_paging_replica *replica,
+                                            uintptr_t *garbage) {
+	const uint8_t lvls = mem_5level_paging_enabled ? 5 : 4;
+	const uintptr_t *src_table = (const uintptr_t *)(mem_wb_phys_win_base + root->cr3);
+	uintptr_t *dst_table = (uintptr_t *)(mem_wb_phys_win_base + replica->cr3);
+	for (uint16_t i = 0; i < 256; ++i) {
+		const uintptr_t old = dst_table[i];
+		if (old != 0 && (old & (~FLAGS_MASK)) != (src_table[i] & (~FLAGS_MASK))) {
+			mem_paging_collect_tables(old & (~FLAGS_MASK), lvls - 1, garbage);
+		}
+		dst_table[i] = src_table[i];
+	}
+	replica->degraded = true;
+}
+
+//! @brief Refill replica stash with zeroed tables from the replica node
+//! @param root Pointer to the paging root
+//! @param id ID of the replica node
+//! @return True if at least one table was stashed, false on allocation failure
+//! @note Degraded replica is rebuilt by the following syncs once tables are stashed
+static bool mem_paging_replica_refill(struct mem_paging_root *root, numa_id_t id) {
+	uintptr_t list = PHYS_NULL;
+	uintptr_t tail = PHYS_NULL;
+	for (size_t i = 0; i < MEM_PAGING_REPLICA_STASH; ++i) {
+		// Remote table is still better than a degraded replica
+		uintptr_t table = mem_phys_alloc_zeroed_page(id);
+		if (table == PHYS_NULL) {
+			table = mem_paging_new_zeroed();
+		}
+		if (table == PHYS_NULL) {
+			break;
+		}
+		*(uintptr_t *)(mem_wb_phys_win_base + table) = list;
+		list = table;
+		if (tail == PHYS_NULL) {
+			tail = table;
+		}
+	}
+	if (list == PHYS_NULL) {
+		return false;
+	}
+	struct mem_paging_replica *replica = root->replicas + id;
+	const bool int_state = thread_spinlock_lock(&root->lock);
+	*(uintptr_t *)(mem_wb_phys_win_base + tail) = replica->stash;
+	replica->stash = list;
+	replica->degraded = false;
+	thread_spinlock_unlock(&root->lock, int_state);
+	return true;
+}
+
+//! @brief Bring replicas of the range up to date with primary tables
+//! @param root Pointer to the paging root
+//! @param vaddr Start of the range
+//! @param size Size of the range
+//! @return True if all replicas mirror the range with their own tables, false if some of them ran
+//! out of memory and were degraded to primary tables
+//! @note Should be called without root lock held after primary tables are changed and before
+//! frames unmapped from the range are shot down. Replicas are consistent with primary tables
+//! afterwards either way, so callers don't have to undo their changes on failure
+static bool mem_paging_replicas_sync(struct mem_paging_root *root, uintptr_t vaddr, size_t size) {
+	struct mem_paging_replica *replicas = ATOMIC_ACQUIRE_LOAD(&root->replicas);
+	if (replicas == NULL || size == 0) {
+		return true;
+	}
+	// Degraded replicas are given another chance to get their own tables
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		if (replicas[i].cr3 != PHYS_NULL && ATOMIC_RELAXED_LOAD(&replicas[i].degraded)) {
+			mem_paging_replica_refill(root, i);
+		}
+	}
+	const uint8_t lvls = mem_5level_paging_enabled ? 5 : 4;
+	bool result = true;
+	while (true) {
+		uintptr_t garbage = PHYS_NULL;
+		numa_id_t starved = numa_nodes_size;
+		bool int_state = thread_spinlock_lock(&root->lock);
+		for (numa_id_t i = 0; i < numa_nodes_size && starved == numa_nodes_size; ++i) {
+			struct mem_paging_replica *replica = replicas + i;
+			if (replica->cr3 == PHYS_NULL) {
+				continue;
+			}
+			if (replica->degraded) {
+				// New root entries may have been added to primary tables
+				mem_paging_replica_share_nolock(root, replica, &garbage);
+			} else if (!mem_paging_sync_level(root->cr3, replica->cr3, lvls, 0, vaddr,
+			                                  vaddr + size, replica, &garbage)) {
+				starved = i;
+			}
+		}
+		thread_spinlock_unlock(&root->lock, int_state);
+		mem_paging_retire_list(garbage, vaddr);
+		if (starved == numa_nodes_size) {
+			return result;
+		}
+		// Sync is idempotent, so it is restarted from scratch once new tables are stashed
+		if (mem_paging_replica_refill(root, starved)) {
+			continue;
+		}
+		// Stale replica would keep translations primary tables no longer have, so it falls back to
+		// primary tables instead
+		LOG_WARN("No memory for paging root replica tables on node %u, sharing primary tables",
+		         starved);
+		garbage = PHYS_NULL;
+		int_state = thread_spinlock_lock(&root->lock);
+		mem_paging_replica_share_nolock(root, replicas + starved, &garbage);
+		thread_spinlock_unlock(&root->lock, int_state);
+		mem_paging_retire_list(garbage, vaddr);
+		result = false;
+	}
+}
+
+//! @brief Size of the lower half of the address space
+//! @return Size in bytes
+size_t mem_paging_lower_half_size(void) {
+	return mem_5level_paging_enabled ? (1ULL << 56) : (1ULL << 47);
+}
+
+//! @brief Replicate lower half tables of the paging root on all NUMA nodes with cores
+//! @param root Pointer to the paging root
+//! @return True on success, false on allocation failure. If replica tables could not be allocated,
+//! root is still replicated, but some replicas share primary tables until memory is available
+//! @note Cores switching to the root load replica of their node. All functions that change the
+//! mappings keep replicas in sync, which makes them more expensive. Replication can't be undone
+bool mem_paging_replicate(struct mem_paging_root *root) {
+	ASSERT(ATOMIC_ACQUIRE_LOAD(&root->replicas) == NULL, "Paging root is already replicated");
+	const size_t size = numa_nodes_size * sizeof(struct mem_paging_replica);
+	struct mem_paging_replica *replicas = mem_heap_alloc(size);
+	if (replicas == NULL) {
+		return false;
+	}
+	// Cores of the node that replicates the root keep using primary tables
+	const numa_id_t home = PER_CPU(numa_id);
+	const uintptr_t *primary_table = (const uintptr_t *)(mem_wb_phys_win_base + root->cr3);
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		replicas[i].root = root;
+		replicas[i].cr3 = PHYS_NULL;
+		replicas[i].stash = PHYS_NULL;
+		replicas[i].degraded = false;
+		if (i == home || !numa_nodes[i].initialized ||
+		    thread_smp_core_find_on_node(i) == thread_smp_core_max_cpus) {
+			continue;
+		}
+		replicas[i].cr3 = mem_phys_alloc_zeroed_page(i);
+		if (replicas[i].cr3 == PHYS_NULL) {
+			for (numa_id_t j = 0; j < i; ++j) {
+				if (replicas[j].cr3 != PHYS_NULL) {
+					mem_phys_free(replicas[j].cr3);
+				}
+			}
+			mem_heap_free(replicas, size);
+			return false;
+		}
+		// Higher half is shared by all roots
+		uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + replicas[i].cr3);
+		for (size_t j = 256; j < 512; ++j) {
+			table[j] = primary_table[j];
+		}
+	}
+	// Mappings changed from now on are mirrored by their functions, the rest is mirrored below
+	const bool int_state = thread_spinlock_lock(&root->lock);
+	ATOMIC_RELEASE_STORE(&root->replicas, replicas);
+	thread_spinlock_unlock(&root->lock, int_state);
+	const bool synced = mem_paging_replicas_sync(root, 0, mem_paging_lower_half_size());
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		if (replicas[i].cr3 != PHYS_NULL) {
+			mem_paging_registry_insert(replicas + i);
+		}
+	}
+	ATOMIC_FETCH_INCREMENT(&mem_paging_replicated_roots);
+	ATOMIC_RELEASE_STORE(&root->replicated, true);
+	return synced;
+}
+
+//! @brief Unmap range of pages
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address of the first page. Should be page size aligned
+//! @param count Number of 4k pages in the range
+//! @param frames Buffer of at least count entries to store unmapped frames in or NULL
+//! @return Number of frames that were unmapped
+//! @note Huge pages inside the range are reported as one frame. Huge pages partially covered by
+//! the range are split first, if there is no memory for that or if they are shared copy-on-write
+//! they stay mapped
+//! @note TLB entries are not invalidated, frames should not be reused until
+//! mem_paging_shootdown_range is called. Frames that may be shared should be dropped with
+//! mem_phys_put
+size_t mem_paging_unmap_range(struct mem_paging_root *root, uintptr_t vaddr, size_t count,
+                              uintptr_t *frames) {
 	ASSERT(vaddr % PAGE_SIZE == 0, "Address 0x%p is not page size aligned", vaddr);
+	ASSERT(vaddr + count * PAGE_SIZE <= mem_wb_phys_win_base, "Range at 0x%p is not in lower half",
+	       vaddr);
 
 	struct mem_paging_mapper *mapper = &thread_localsched_get_current_task()->mapper;
-	if (!mem_paging_regen_cache(mapper)) {
+	const uintptr_t end = vaddr + count * PAGE_SIZE;
+	size_t unmapped = 0;
+
+	bool int_state = thread_spinlock_lock(&root->lock);
+	uintptr_t current = vaddr;
+	while (current < end) {
+		uint8_t level;
+		uintptr_t *entry = mem_paging_find_entry(root, current, &level);
+		const size_t page_size = mem_paging_level_page_size(level);
+		const uintptr_t page_base = current & ~(page_size - 1);
+		if (*entry == 0) {
+			// Nothing is mapped in the whole region covered by the entry
+			current = page_base + page_size;
+			continue;
+		}
+		if (level == 1) {
+			// Clear consecutive entries of the last level table in one pass
+			uint16_t index = mem_paging_get_lvl_index(current, 1);
+			for (; index < 512 && current < end; ++index, ++entry, current += PAGE_SIZE) {
+				if (*entry == 0) {
+					continue;
+				}
+				if (frames != NULL) {
+					frames[unmapped] = *entry & (~FLAGS_MASK);
+				}
+				unmapped++;
+				*entry = 0;
+			}
+			continue;
+		}
+		if (page_base >= vaddr && page_base + page_size <= end) {
+			if (frames != NULL) {
+				frames[unmapped] = *entry & (~FLAGS_MASK);
+			}
+			unmapped++;
+			*entry = 0;
+			current = page_base + page_size;
+			continue;
+		}
+		if (mem_phys_shared(*entry & (~FLAGS_MASK))) {
+			LOG_WARN("Huge page at 0x%p is shared copy-on-write, leaving it mapped", page_base);
+			current = page_base + page_size;
+			continue;
+		}
+		if (mapper->zeroed_pages[level - 2] != PHYS_NULL) {
+			const uintptr_t new_table = mapper->zeroed_pages[level - 2];
+			mapper->zeroed_pages[level - 2] = PHYS_NULL;
+			mem_paging_split_user_huge(entry, level, new_table);
+			continue;
+		}
+		// New tables can't be allocated with the lock held. Entry is looked up again afterwards
+		thread_spinlock_unlock(&root->lock, int_state);
+		const bool regenerated = mem_paging_regen_cache(mapper);
+		int_state = thread_spinlock_lock(&root->lock);
+		if (!regenerated) {
+			LOG_WARN("No memory to split huge page at 0x%p, leaving it mapped", page_base);
+			current = page_base + page_size;
+		}
+	}
+	thread_spinlock_unlock(&root->lock, int_state);
+	mem_paging_replicas_sync(root, vaddr, count * PAGE_SIZE);
+
+	return unmapped;
+}
+
+//! @brief Invalidate TLB entries of the range on all cores that may have them
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address of the first page. Should be page size aligned
+//! @param count Number of 4k pages in the range
+//! @note Only cores that have the root or its replicas loaded are interrupted. Should only be
+//! called if mem_virt_invtlb_shootdown_allowed returns true
+void mem_paging_shootdown_range(struct mem_paging_root *root, uintptr_t vaddr, size_t count) {
+	mem_virt_invtlb_shootdown(root->cr3, vaddr, count * PAGE_SIZE);
+	const struct mem_paging_replica *replicas = ATOMIC_ACQUIRE_LOAD(&root->replicas);
+	if (replicas == NULL) {
+		return;
+	}
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		if (replicas[i].cr3 != PHYS_NULL) {
+			mem_virt_invtlb_shootdown(replicas[i].cr3, vaddr, count * PAGE_SIZE);
+		}
+	}
+}
+
+//! @brief Reserve range of the lower half to be populated with zeroed pages on first touch
+//! @param root Pointer to the paging root
+//! @param vaddr Base of the range. Should be page size aligned
+//! @param size Size of the range. Should be a multiple of page size
+//! @param perms Permissions to map pages with
+//! @param fault_around Number of pages populated by one fault. Should be a power of two not
+//! greater than MEM_PAGING_FAULT_AROUND_MAX
+//! @return True on success, false if range overlaps with reserved one or on allocation failure
+bool mem_paging_reserve(struct mem_paging_root *root, uintptr_t vaddr, size_t size, int perms,
+                        size_t fault_around) {
+	ASSERT(vaddr % PAGE_SIZE == 0 && size % PAGE_SIZE == 0 && size != 0,
+	       "Invalid range 0x%p of size %U", vaddr, size);
+	ASSERT(vaddr + size <= mem_wb_phys_win_base, "Range at 0x%p is not in lower half", vaddr);
+	ASSERT(fault_around != 0 && fault_around <= MEM_PAGING_FAULT_AROUND_MAX &&
+	           (fault_around & (fault_around - 1)) == 0,
+	       "Invalid fault-around window of %U pages", fault_around);
+	struct mem_vma *vma = mem_heap_alloc(sizeof(struct mem_vma));
+	if (vma == NULL) {
 		return false;
 	}
+	vma->base = vaddr;
+	vma->size = size;
+	vma->perms = perms;
+	vma->fault_around = fault_around;
+	const bool int_state = thread_spinlock_lock(&root->lock);
+	const bool inserted = mem_vma_insert(&root->vmas, vma);
+	thread_spinlock_unlock(&root->lock, int_state);
+	if (!inserted) {
+		mem_heap_free(vma, sizeof(struct mem_vma));
+	}
+	return inserted;
+}
 
+//! @brief Release reserved range and free pages populated in it
+//! @param root Pointer to the paging root
+//! @param vaddr Base of the range
+//! @return True on success, false if there is no range reserved at vaddr
+//! @note Pages are shot down before being freed, so this should only be called if
+//! mem_virt_invtlb_shootdown_allowed returns true
+bool mem_paging_release(struct mem_paging_root *root, uintptr_t vaddr) {
+	ASSERT(mem_virt_invtlb_shootdown_allowed(), "Reserved range released with interrupts disabled");
 	const bool int_state = thread_spinlock_lock(&root->lock);
+	struct mem_vma *vma = mem_vma_find(&root->vmas, vaddr);
+	if (vma == NULL || vma->base != vaddr) {
+		thread_spinlock_unlock(&root->lock, int_state);
+		return false;
+	}
+	mem_vma_remove(&root->vmas, vma);
+	thread_spinlock_unlock(&root->lock, int_state);
+	// Range is unmapped in chunks, so that frames buffer fits on the stack
+	uintptr_t frames[MEM_PAGING_RELEASE_CHUNK];
+	const size_t pages = vma->size / PAGE_SIZE;
+	for (size_t i = 0; i < pages; i += MEM_PAGING_RELEASE_CHUNK) {
+		const uintptr_t base = vma->base + i * PAGE_SIZE;
+		const size_t left = pages - i;
+		const size_t count = left > MEM_PAGING_RELEASE_CHUNK ? MEM_PAGING_RELEASE_CHUNK : left;
+		const size_t unmapped = mem_paging_unmap_range(root, base, count, frames);
+		if (unmapped == 0) {
+			continue;
+		}
+		mem_paging_shootdown_range(root, base, count);
+		for (size_t j = 0; j < unmapped; ++j) {
+			mem_phys_put(frames[j]);
+		}
+	}
+	mem_heap_free(vma, sizeof(struct mem_vma));
+	return true;
+}
 
-	uintptr_t current_phys = root->cr3;
-	uint8_t lvls = mem_5level_paging_enabled ? 5 : 4;
+//! @brief Populate non-present page of the reserved range and its fault-around window
+//! @param root Pointer to the paging root
+//! @param vaddr Page size aligned faulting address
+//! @param write True if faulting access was a write
+//! @return True if page was populated and access can be retried, false if access is invalid or
+//! there is no memory to populate the page
+static bool mem_paging_fault_populate(struct mem_paging_root *root, uintptr_t vaddr, bool write) {
+	struct thread_task *task = thread_localsched_get_current_task();
+	struct mem_paging_mapper *mapper = &task->mapper;
+	uintptr_t pages[MEM_PAGING_FAULT_AROUND_MAX] = {0};
 
-	// Map all intermidiate pages
-	for (uint8_t i = lvls; i > 1; --i) {
-		uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + current_phys);
-		uint16_t index = mem_paging_get_lvl_index(vaddr, i);
-		const uintptr_t interm_perms = FLAG_PRESENT | FLAG_WRITABLE | FLAGS_USER;
-		if (table[index] == 0) {
-			table[index] = mapper->zeroed_pages[i - 2] | interm_perms;
-			current_phys = mapper->zeroed_pages[i - 2];
-			mapper->zeroed_pages[i - 2] = PHYS_NULL;
-		} else {
-			current_phys = table[index] & (~FLAGS_MASK);
+	// Pick fault-around window and find pages in it that are not populated yet
+	bool int_state = thread_spinlock_lock(&root->lock);
+	struct mem_vma *vma = mem_vma_find(&root->vmas, vaddr);
+	if (vma == NULL || (write && (vma->perms & MEM_PAGING_WRITABLE) == 0)) {
+		thread_spinlock_unlock(&root->lock, int_state);
+		return false;
+	}
+	// Window is aligned to its size, hence it never crosses last level table boundary
+	const size_t window = vma->fault_around * PAGE_SIZE;
+	const uintptr_t aligned = align_down(vaddr, window);
+	const uintptr_t start = aligned < vma->base ? vma->base : aligned;
+	const uintptr_t vma_end = vma->base + vma->size;
+	const uintptr_t end = aligned + window > vma_end ? vma_end : aligned + window;
+	const size_t count = (end - start) / PAGE_SIZE;
+	const size_t faulting = (vaddr - start) / PAGE_SIZE;
+	bool missing[MEM_PAGING_FAULT_AROUND_MAX] = {false};
+	const uintptr_t *table = mem_paging_walk(root, NULL, start, 1, false);
+	const uint16_t first = mem_paging_get_lvl_index(start, 1);
+	for (size_t i = 0; i < count; ++i) {
+		missing[i] = table == NULL || table[first + i] == 0;
+	}
+	thread_spinlock_unlock(&root->lock, int_state);
+	if (!missing[faulting]) {
+		// Page was populated by another core, access can be retried
+		return true;
+	}
+
+	// Allocate pages with the lock dropped. Only the faulting page is required
+	const numa_id_t node = mem_policy_next_node(&task->policy);
+	for (size_t i = 0; i < count; ++i) {
+		if (missing[i]) {
+			pages[i] = mem_phys_alloc_zeroed_page(node);
 		}
 	}
+	bool result = pages[faulting] != PHYS_NULL && mem_paging_regen_cache(mapper);
 
-	// Map last level page
-	uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + current_phys);
+	// Map pages whose entries are still empty. Range may have been released in the meantime
+	int_state = thread_spinlock_lock(&root->lock);
+	vma = mem_vma_find(&root->vmas, vaddr);
+	uintptr_t *entries = NULL;
+	if (result && vma != NULL) {
+		entries = mem_paging_walk(root, mapper, start, 1, true);
+	}
+	result = entries != NULL;
+	if (result) {
+		const uintptr_t flags = mem_paging_perms_to_flags(vma->perms);
+		for (size_t i = 0; i < count; ++i) {
+			const uintptr_t current = start + i * PAGE_SIZE;
+			if (pages[i] == PHYS_NULL || entries[first + i] != 0 || current < vma->base ||
+			    current - vma->base >= vma->size) {
+				continue;
+			}
+			entries[first + i] = pages[i] | flags;
+			pages[i] = PHYS_NULL;
+		}
+	}
+	thread_spinlock_unlock(&root->lock, int_state);
+	mem_paging_replicas_sync(root, start, count * PAGE_SIZE);
 
-	uintptr_t perms_mask = FLAG_PRESENT;
-	if ((perms & MEM_PAGING_WRITABLE) != 0) {
-		perms_mask |= FLAG_WRITABLE;
+	// Give back pages that were populated concurrently
+	for (size_t i = 0; i < count; ++i) {
+		if (pages[i] != PHYS_NULL) {
+			mem_phys_free(pages[i]);
+		}
 	}
-	if ((perms & MEM_PAGING_EXECUTABLE) == 0) {
-		perms_mask |= FLAGS_NOEXEC;
+	return result;
+}
+
+//! @brief Break copy-on-write sharing of the page on write fault
+//! @param root Pointer to the paging root
+//! @param vaddr Page size aligned faulting address
+//! @return True if page is writable now and access can be retried, false if access is invalid or
+//! there is no memory to copy the page
+static bool mem_paging_fault_cow(struct mem_paging_root *root, uintptr_t vaddr) {
+	bool int_state = thread_spinlock_lock(&root->lock);
+	uint8_t level;
+	uintptr_t *entry = mem_paging_find_entry(root, vaddr, &level);
+	const uintptr_t old = *entry;
+	if ((old & FLAG_COW) == 0) {
+		// Either sharing was broken by another core or page is read-only
+		thread_spinlock_unlock(&root->lock, int_state);
+		return old != 0 && (old & FLAG_WRITABLE) != 0;
 	}
-	if ((perms & MEM_PAGING_USER) != 0) {
-		perms_mask |= FLAGS_USER;
+	const uintptr_t frame = old & (~FLAGS_MASK);
+	const uintptr_t flags = ((old & FLAGS_MASK) | FLAG_WRITABLE) & ~FLAG_COW;
+	if (!mem_phys_shared(frame)) {
+		// Other roots dropped the frame, so it is reused in place. Stale read-only TLB entries on
+		// other cores only cause spurious faults
+		*entry = frame | flags;
+		thread_spinlock_unlock(&root->lock, int_state);
+		mem_paging_replicas_sync(root, align_down(vaddr, mem_paging_level_page_size(level)),
+		                         mem_paging_level_page_size(level));
+		return true;
+	}
+	thread_spinlock_unlock(&root->lock, int_state);
+	// Other cores running on this root have to drop translations to the old frame
+	if (!mem_virt_invtlb_shootdown_allowed()) {
+		return false;
+	}
+	const size_t page_size = mem_paging_level_page_size(level);
+	const numa_id_t node = mem_policy_next_node(&thread_localsched_get_current_task()->policy);
+	const uintptr_t copy = page_size == PAGE_SIZE
+	                           ? mem_phys_alloc_on_behalf(PAGE_SIZE, node)
+	                           : mem_phys_alloc_aligned_on_behalf(page_size, node);
+	if (copy == PHYS_NULL) {
+		return false;
+	}
+	// If frame is unmapped in the meantime, entry changes and the copy is discarded below
+	memcpy((void *)(mem_wb_phys_win_base + copy), (const void *)(mem_wb_phys_win_base + frame),
+	       page_size);
+	int_state = thread_spinlock_lock(&root->lock);
+	entry = mem_paging_find_entry(root, vaddr, &level);
+	const bool replaced = *entry == old;
+	if (replaced) {
+		*entry = copy | flags;
+	}
+	thread_spinlock_unlock(&root->lock, int_state);
+	if (!replaced) {
+		mem_phys_free(copy);
+		return true;
 	}
+	mem_paging_replicas_sync(root, align_down(vaddr, page_size), page_size);
+	mem_paging_shootdown_range(root, align_down(vaddr, page_size), page_size / PAGE_SIZE);
+	mem_phys_put(frame);
+	return true;
+}
+
+//! @brief Handle page fault in the lower half
+//! @param root Pointer to the paging root
+//! @param vaddr Faulting address
+//! @param write True if faulting access was a write
+//! @return True if fault was resolved and access can be retried, false if access is invalid or
+//! there is no memory to resolve the fault
+//! @note Non-present pages of reserved ranges are populated, writes to copy-on-write pages copy
+//! them. Copying requires interrupts to be enabled at the time of the fault
+bool mem_paging_handle_fault(struct mem_paging_root *root, uintptr_t vaddr, bool write) {
+	vaddr = align_down(vaddr, PAGE_SIZE);
+	const bool int_state = thread_spinlock_lock(&root->lock);
+	uint8_t level;
+	const uintptr_t entry = *mem_paging_find_entry(root, vaddr, &level);
+	thread_spinlock_unlock(&root->lock, int_state);
+	if (entry == 0) {
+		return mem_paging_fault_populate(root, vaddr, write);
+	}
+	if (!write || (entry & FLAG_WRITABLE) != 0) {
+		// Page was populated or made writable by another core
+		return true;
+	}
+	return mem_paging_fault_cow(root, vaddr);
+}
+
+//! @brief Count tables below the given one in the lower half
+//! @param addr Table physical address
+//! @param level Table level
+//! @param entries Number of entries to look at (256 for root table, 512 otherwise)
+//! @return Number of tables
+static size_t mem_paging_count_tables(uintptr_t addr, uint8_t level, size_t entries) {
+	const uintptr_t *table = (const uintptr_t *)(mem_wb_phys_win_base + addr);
+	size_t result = 0;
+	for (size_t i = 0; i < entries; ++i) {
+		if (table[i] != 0 && !mem_paging_is_leaf(table[i], level)) {
+			result += 1 + mem_paging_count_tables(table[i] & (~FLAGS_MASK), level - 1, 512);
+		}
+	}
+	return result;
+}
 
-	table[mem_paging_get_lvl_index(vaddr, 1)] = paddr | perms_mask;
+//! @brief Count areas in the subtree
+//! @param vma Pointer to the subtree root or NULL
+//! @return Number of areas
+static size_t mem_paging_count_vmas(const struct mem_vma *vma) {
+	if (vma == NULL) {
+		return 0;
+	}
+	return 1 + mem_paging_count_vmas(vma->left) + mem_paging_count_vmas(vma->right);
+}
+
+//! @brief Share pages mapped by the table with the copy of the table
+//! @param src Source table physical address
+//! @param dst Destination table physical address
+//! @param level Table level
+//! @param entries Number of entries to copy (256 for root table, 512 otherwise)
+//! @param stash Pointer to the stash of zeroed tables to take new tables from
+//! @note Writable pages become read-only copy-on-write pages in both tables
+static void mem_paging_share_level(uintptr_t src, uintptr_t dst, uint8_t level, size_t entries,
+                                   uintptr_t *stash) {
+	uintptr_t *src_table = (uintptr_t *)(mem_wb_phys_win_base + src);
+	uintptr_t *dst_table = (uintptr_t *)(mem_wb_phys_win_base + dst);
+	for (size_t i = 0; i < entries; ++i) {
+		uintptr_t entry = src_table[i];
+		if (entry == 0) {
+			continue;
+		}
+		if (!mem_paging_is_leaf(entry, level)) {
+			const uintptr_t table = mem_paging_stash_take(stash);
+			dst_table[i] = table | (entry & FLAGS_MASK);
+			mem_paging_share_level(entry & (~FLAGS_MASK), table, level - 1, 512, stash);
+			continue;
+		}
+		if ((entry & FLAG_WRITABLE) != 0) {
+			entry = (entry & ~FLAG_WRITABLE) | FLAG_COW;
+			src_table[i] = entry;
+		}
+		mem_phys_share(entry & (~FLAGS_MASK));
+		dst_table[i] = entry;
+	}
+}
+
+//! @brief Copy areas of the subtree to another tree
+//! @param vma Pointer to the subtree root or NULL
+//! @param dst Pointer to the tree to copy areas to
+//! @param spare Pointer to the list of spare areas (linked through left pointer)
+static void mem_paging_copy_vmas(const struct mem_vma *vma, struct mem_vma_tree *dst,
+                                 struct mem_vma **spare) {
+	if (vma == NULL) {
+		return;
+	}
+	struct mem_vma *copy = *spare;
+	ASSERT(copy != NULL, "Spare areas ran out");
+	*spare = copy->left;
+	copy->base = vma->base;
+	copy->size = vma->size;
+	copy->perms = vma->perms;
+	copy->fault_around = vma->fault_around;
+	const bool inserted = mem_vma_insert(dst, copy);
+	ASSERT(inserted, "Copy of area at 0x%p overlaps", vma->base);
+	mem_paging_copy_vmas(vma->left, dst, spare);
+	mem_paging_copy_vmas(vma->right, dst, spare);
+}
+
+//! @brief Free tables and areas left after duplication
+//! @param stash Stash of zeroed tables
+//! @param spare List of spare areas
+static void mem_paging_free_spares(uintptr_t stash, struct mem_vma *spare) {
+	mem_paging_free_list(stash);
+	while (spare != NULL) {
+		struct mem_vma *next = spare->left;
+		mem_heap_free(spare, sizeof(struct mem_vma));
+		spare = next;
+	}
+}
 
+//! @brief Duplicate lower half of the paging root copy-on-write
+//! @param root Pointer to the paging root
+//! @return Pointer to the new paging root or NULL on failure
+//! @note Pages are shared read-only by both roots and copied on the first write. Reserved ranges
+//! are copied as well. Should only be called if mem_virt_invtlb_shootdown_allowed returns true,
+//! as writable translations of the source root have to be shot down
+struct mem_paging_root *mem_paging_duplicate(struct mem_paging_root *root) {
+	ASSERT(mem_virt_invtlb_shootdown_allowed(), "Paging root duplicated with interrupts disabled");
+	struct mem_paging_root *res = mem_paging_new_root();
+	if (res == NULL) {
+		return NULL;
+	}
+	const uint8_t lvls = mem_5level_paging_enabled ? 5 : 4;
+	uintptr_t stash = PHYS_NULL;
+	size_t stashed = 0;
+	struct mem_vma *spare = NULL;
+	size_t spared = 0;
+	// New tables can't be allocated with the lock held, so they are counted first and allocated
+	// with the lock dropped. Loop exits with the lock held
+	bool int_state;
+	while (true) {
+		int_state = thread_spinlock_lock(&root->lock);
+		const size_t tables = mem_paging_count_tables(root->cr3, lvls, 256);
+		const size_t vmas = mem_paging_count_vmas(root->vmas.root);
+		if (stashed >= tables && spared >= vmas) {
+			break;
+		}
+		thread_spinlock_unlock(&root->lock, int_state);
+		for (; stashed < tables; ++stashed) {
+			const uintptr_t table = mem_paging_new_zeroed();
+			if (table == PHYS_NULL) {
+				break;
+			}
+			*(uintptr_t *)(mem_wb_phys_win_base + table) = stash;
+			stash = table;
+		}
+		for (; spared < vmas; ++spared) {
+			struct mem_vma *vma = mem_heap_alloc(sizeof(struct mem_vma));
+			if (vma == NULL) {
+				break;
+			}
+			vma->left = spare;
+			spare = vma;
+		}
+		if (stashed < tables || spared < vmas) {
+			mem_paging_free_spares(stash, spare);
+			MEM_REF_DROP(res);
+			return NULL;
+		}
+	}
+	mem_paging_share_level(root->cr3, res->cr3, lvls, 256, &stash);
+	mem_paging_copy_vmas(root->vmas.root, &res->vmas, &spare);
 	thread_spinlock_unlock(&root->lock, int_state);
+	// Source root may still be written through stale writable translations
+	mem_paging_replicas_sync(root, 0, mem_paging_lower_half_size());
+	mem_paging_shootdown_range(root, 0, mem_paging_lower_half_size() / PAGE_SIZE);
+	mem_paging_free_spares(stash, spare);
+	return res;
+}
+
+//! @brief Map range of 4k pages
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address at which the first page should be mapped. Should be page size
+//! aligned
+//! @param pages Physical addresses of the pages to map
+//! @param count Number of pages
+//! @param perms Permissions to map with
+//! @return True on success, false on error. On error, pages mapped by this call are unmapped
+//! @note Root lock is taken once and each table is walked once. Lock is only dropped to allocate
+//! missing tables
+bool mem_paging_map_range(struct mem_paging_root *root, uintptr_t vaddr, const uintptr_t *pages,
+                          size_t count, int perms) {
+	ASSERT(vaddr % PAGE_SIZE == 0, "Address 0x%p is not page size aligned", vaddr);
+	ASSERT(vaddr + count * PAGE_SIZE <= mem_wb_phys_win_base, "Range at 0x%p is not in lower half",
+	       vaddr);
+
+	struct mem_paging_mapper *mapper = &thread_localsched_get_current_task()->mapper;
+	if (!mem_paging_regen_cache(mapper)) {
+		return false;
+	}
+	const uintptr_t flags = mem_paging_perms_to_flags(perms);
+
+	bool int_state = thread_spinlock_lock(&root->lock);
+	bool refilled = true;
+	size_t i = 0;
+	while (i < count) {
+		const uintptr_t current = vaddr + i * PAGE_SIZE;
+		uintptr_t *table = mem_paging_walk(root, mapper, current, 1, true);
+		if (table == NULL) {
+			// Mapper ran out of zeroed pages. New ones can't be allocated with the lock held. If
+			// cache was full, walk failed on the shared huge page, which can't be split
+			thread_spinlock_unlock(&root->lock, int_state);
+			if (refilled || !mem_paging_regen_cache(mapper)) {
+				mem_paging_unmap_range(root, vaddr, i, NULL);
+				return false;
+			}
+			refilled = true;
+			int_state = thread_spinlock_lock(&root->lock);
+			continue;
+		}
+		refilled = false;
+		// Fill consecutive entries of the last level table in one pass
+		uint16_t index = mem_paging_get_lvl_index(current, 1);
+		for (; index < 512 && i < count; ++index, ++i) {
+			table[index] = pages[i] | flags;
+		}
+	}
+	thread_spinlock_unlock(&root->lock, int_state);
+	mem_paging_replicas_sync(root, vaddr, count * PAGE_SIZE);
 
 	return true;
 }
 
+//! @brief Map 4k page at a given addresss
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address at which page should be mapped
+//! @param paddr Physical address of the page to map
+//! @param perms Permissions to map with
+//! @return True on success, false on error
+//! @note If address is covered by a huge page, huge page is split first
+bool mem_paging_map_at(struct mem_paging_root *root, uintptr_t vaddr, uintptr_t paddr, int perms) {
+	ASSERT(vaddr < mem_wb_phys_win_base, "Address 0x%p is not in lower half", vaddr);
+	return mem_paging_map_range(root, vaddr, &paddr, 1, perms);
+}
+
 //! @brief Unmap 4k page at a given address
 //! @param root Pointer to the paging root
 //! @param vaddr Virtual address to be unmapped
 //! @return Physical address that was unmapped or 0 if there was none
+//! @note If address is covered by a huge page, huge page is split first. 0 is returned if there
+//! is no memory for that
 uintptr_t mem_paging_unmap_at(struct mem_paging_root *root, uintptr_t vaddr) {
 	ASSERT(vaddr < mem_wb_phys_win_base, "Address 0x%p is not in lower half", vaddr);
-	ASSERT(vaddr % PAGE_SIZE == 0, "Address 0x%p is not page size aligned", vaddr);
+	uintptr_t frame = 0;
+	mem_paging_unmap_range(root, vaddr, 1, &frame);
+	return frame;
+}
 
-	uintptr_t current_phys = root->cr3;
-	uint8_t lvls = mem_5level_paging_enabled ? 5 : 4;
+//! @brief Map huge page at a given address
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address at which page should be mapped. Should be aligned to page size
+//! @param paddr Physical address of the page to map. Should be aligned to page size
+//! @param size Page size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @param perms Permissions to map with
+//! @return True on success, false on error
+//! @note Tables that covered the range are merged into the huge page if they map nothing, they are
+//! freed once all cores flush their TLBs. Mapping fails if some smaller pages in the range are
+//! still mapped, if huge page of that size is already mapped at vaddr or if the range is covered
+//! by a larger huge page
+bool mem_paging_map_huge(struct mem_paging_root *root, uintptr_t vaddr, uintptr_t paddr,
+                         size_t size, int perms) {
+	ASSERT(vaddr < mem_wb_phys_win_base, "Address 0x%p is not in lower half", vaddr);
+	ASSERT(vaddr % size == 0 && paddr % size == 0, "Page 0x%p at 0x%p is not aligned to 0x%p",
+	       paddr, vaddr, size);
+	const uint8_t level = mem_paging_huge_level(size);
 
-	const bool int_state = thread_spinlock_lock(&root->lock);
+	struct mem_paging_mapper *mapper = &thread_localsched_get_current_task()->mapper;
+	if (!mem_paging_regen_cache(mapper)) {
+		return false;
+	}
 
-	// Walk intermidiate pages
-	for (uint8_t i = lvls; i > 1; --i) {
-		uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + current_phys);
-		uintptr_t next = table[mem_paging_get_lvl_index(vaddr, i)] & (~FLAGS_MASK);
-		current_phys = next;
+	const bool int_state = thread_spinlock_lock(&root->lock);
+	uintptr_t *table = mem_paging_walk(root, mapper, vaddr, level, true);
+	if (table == NULL) {
+		// Range is covered by a larger huge page (possibly shared copy-on-write)
+		thread_spinlock_unlock(&root->lock, int_state);
+		return false;
 	}
+	uintptr_t *entry = table + mem_paging_get_lvl_index(vaddr, level);
+	if ((*entry & FLAG_HUGE) != 0) {
+		// Replacing the page would leak it and leave stale translations
+		thread_spinlock_unlock(&root->lock, int_state);
+		return false;
+	}
+	uintptr_t garbage = PHYS_NULL;
+	if (*entry != 0) {
+		const uintptr_t old_table = *entry & (~FLAGS_MASK);
+		if (mem_paging_table_maps_pages(old_table, level - 1)) {
+			thread_spinlock_unlock(&root->lock, int_state);
+			return false;
+		}
+		mem_paging_collect_tables(old_table, level - 1, &garbage);
+	}
+	*entry = paddr | mem_paging_perms_to_flags(perms) | FLAG_HUGE;
+	thread_spinlock_unlock(&root->lock, int_state);
+	mem_paging_replicas_sync(root, vaddr, size);
+	mem_paging_retire_list(garbage, vaddr);
+
+	return true;
+}
 
-	uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + current_phys);
-	uintptr_t addr = table[mem_paging_get_lvl_index(vaddr, 1)] & (~FLAGS_MASK);
-	table[mem_paging_get_lvl_index(vaddr, 1)] = 0;
+//! @brief Unmap huge page at a given address
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address to be unmapped. Should be aligned to page size
+//! @param size Page size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @return Physical address that was unmapped or 0 if there was no huge page of that size
+uintptr_t mem_paging_unmap_huge(struct mem_paging_root *root, uintptr_t vaddr, size_t size) {
+	ASSERT(vaddr < mem_wb_phys_win_base, "Address 0x%p is not in lower half", vaddr);
+	ASSERT(vaddr % size == 0, "Address 0x%p is not aligned to 0x%p", vaddr, size);
+	const uint8_t level = mem_paging_huge_level(size);
 
+	const bool int_state = thread_spinlock_lock(&root->lock);
+	uintptr_t *table = mem_paging_walk(root, NULL, vaddr, level, false);
+	uintptr_t addr = 0;
+	if (table != NULL) {
+		uintptr_t *entry = table + mem_paging_get_lvl_index(vaddr, level);
+		if ((*entry & FLAG_HUGE) != 0) {
+			addr = *entry & (~FLAGS_MASK);
+			*entry = 0;
+		}
+	}
 	thread_spinlock_unlock(&root->lock, int_state);
+	mem_paging_replicas_sync(root, vaddr, size);
 
 	return addr;
 }
 
-//! @brief Switch to a new paging hierarchy
-//! @param root Pointer to the paging root
+//! @brief Preallocate root table entry covering a given kernel address
+//! @param vaddr Kernel virtual address
+//! @return True on success, false on failure
+//! @note Root table entries in the higher half are copied to new roots, hence new ones can't be
+//! added after roots other than the boot one were created. Call this on boot instead
+bool mem_paging_kernel_prealloc_root_entry(uintptr_t vaddr) {
+	ASSERT(vaddr >= mem_wb_phys_win_base, "Address 0x%p is not in higher half", vaddr);
+	uintptr_t *root_table = (uintptr_t *)(mem_wb_phys_win_base + (rdcr3() & ~(PAGE_SIZE - 1)));
+	const uint16_t index = mem_paging_get_lvl_index(vaddr, mem_5level_paging_enabled ? 5 : 4);
+	const bool int_state = thread_spinlock_lock(&mem_paging_kernel_lock);
+	if (root_table[index] == 0) {
+		const uintptr_t table = mem_paging_new_zeroed();
+		if (table == PHYS_NULL) {
+			thread_spinlock_unlock(&mem_paging_kernel_lock, int_state);
+			return false;
+		}
+		ATOMIC_RELEASE_STORE(root_table + index, table | INTERM_FLAGS_KERNEL);
+	}
+	thread_spinlock_unlock(&mem_paging_kernel_lock, int_state);
+	return true;
+}
+
+//! @brief Walk kernel page tables down to the table at a given level
+//! @param vaddr Kernel virtual address
+//! @param level Level of the table to walk down to
+//! @param create If true, missing intermediate tables are allocated
+//! @return Pointer to the table or NULL if there is none (or allocation failed)
+//! @note Intermediate tables in the kernel half are only freed when they are replaced by huge
+//! pages, which requires the caller to own the whole range covered by the table. Hence entries on
+//! the way to other ranges can be read without locking
+static uintptr_t *mem_paging_kernel_walk(uintptr_t vaddr, uint8_t level, bool create) {
+	const uint8_t lvls = mem_5level_paging_enabled ? 5 : 4;
+	uintptr_t current_phys = rdcr3() & ~(PAGE_SIZE - 1);
+	for (uint8_t i = lvls; i > level; --i) {
+		uintptr_t *table = (uintptr_t *)(mem_wb_phys_win_base + current_phys);
+		const uint16_t index = mem_paging_get_lvl_index(vaddr, i);
+		uintptr_t entry = ATOMIC_ACQUIRE_LOAD(table + index);
+		if (entry == 0) {
+			ASSERT(i != lvls, "Root table entry for 0x%p was not preallocated", vaddr);
+			if (!create) {
+				return NULL;
+			}
+			const bool int_state = thread_spinlock_lock(&mem_paging_kernel_lock);
+			entry = table[index];
+			if (entry == 0) {
+				const uintptr_t new_table = mem_paging_new_zeroed();
+				if (new_table == PHYS_NULL) {
+					thread_spinlock_unlock(&mem_paging_kernel_lock, int_state);
+					return NULL;
+				}
+				entry = new_table | INTERM_FLAGS_KERNEL;
+				ATOMIC_RELEASE_STORE(table + index, entry);
+			}
+			thread_spinlock_unlock(&mem_paging_kernel_lock, int_state);
+		}
+		// Kernel huge pages are never split, their owners unmap them as a whole
+		ASSERT((entry & FLAG_HUGE) == 0, "Walk to 0x%p runs into a huge page", vaddr);
+		current_phys = entry & (~FLAGS_MASK);
+	}
+	return (uintptr_t *)(mem_wb_phys_win_base + current_phys);
+}
+
+//! @brief Unmap range of 4k pages in the kernel half of the address space
+//! @param vaddr Virtual address of the first page. Should be page size aligned
+//! @param count Number of pages in the range
+//! @param frames Buffer of at least count entries to store unmapped frames in or NULL
+//! @return Number of frames that were unmapped
+//! @note Only local TLB entries are invalidated. Use invtlb subsystem to flush other cores' TLBs
+size_t mem_paging_kernel_unmap_range(uintptr_t vaddr, size_t count, uintptr_t *frames) {
+	ASSERT(vaddr >= mem_wb_phys_win_base, "Address 0x%p is not in higher half", vaddr);
+	ASSERT(vaddr % PAGE_SIZE == 0, "Address 0x%p is not page size aligned", vaddr);
+	size_t unmapped = 0;
+	size_t i = 0;
+	while (i < count) {
+		const uintptr_t current = vaddr + i * PAGE_SIZE;
+		const size_t first = mem_paging_get_lvl_index(current, 1);
+		const size_t in_table = 512 - first < count - i ? 512 - first : count - i;
+		// Missing table means that nothing is mapped up to its end
+		uintptr_t *table = mem_paging_kernel_walk(current, 1, false);
+		for (size_t j = 0; table != NULL && j < in_table; ++j) {
+			if (table[first + j] == 0) {
+				continue;
+			}
+			if (frames != NULL) {
+				frames[unmapped] = table[first + j] & (~FLAGS_MASK);
+			}
+			unmapped++;
+			table[first + j] = 0;
+		}
+		i += in_table;
+	}
+	if (count > MEM_PAGING_INVLPG_MAX) {
+		wrcr3(rdcr3());
+	} else {
+		for (size_t j = 0; j < count; ++j) {
+			mem_paging_invlpg(vaddr + j * PAGE_SIZE);
+		}
+	}
+	return unmapped;
+}
+
+//! @brief Map range of 4k pages in the kernel half of the address space
+//! @param vaddr Virtual address at which the first page should be mapped. Should be page size
+//! aligned
+//! @param pages Physical addresses of the pages to map
+//! @param count Number of pages
+//! @param perms Permissions to map with
+//! @return True on success, false on error. On error, pages mapped by this call are unmapped
+//! @note Caller should own the virtual address range exclusively. Each table is walked once
+bool mem_paging_kernel_map_range(uintptr_t vaddr, const uintptr_t *pages, size_t count,
+                                 int perms) {
+	ASSERT(vaddr >= mem_wb_phys_win_base, "Address 0x%p is not in higher half", vaddr);
+	ASSERT(vaddr % PAGE_SIZE == 0, "Address 0x%p is not page size aligned", vaddr);
+	ASSERT((perms & MEM_PAGING_USER) == 0, "Attempt to map user page at 0x%p", vaddr);
+	const uintptr_t flags = mem_paging_perms_to_flags(perms);
+	size_t i = 0;
+	while (i < count) {
+		const uintptr_t current = vaddr + i * PAGE_SIZE;
+		uintptr_t *table = mem_paging_kernel_walk(current, 1, true);
+		if (table == NULL) {
+			mem_paging_kernel_unmap_range(vaddr, i, NULL);
+			return false;
+		}
+		// Fill consecutive entries of the last level table in one pass
+		uint16_t index = mem_paging_get_lvl_index(current, 1);
+		for (; index < 512 && i < count; ++index, ++i) {
+			table[index] = pages[i] | flags;
+		}
+	}
+	return true;
+}
+
+//! @brief Map 4k page at a given address in the kernel half of the address space
+//! @param vaddr Virtual address at which page should be mapped
+//! @param paddr Physical address of the page to map
+//! @param perms Permissions to map with
+//! @return True on success, false on error
+//! @note Caller should own the virtual address range exclusively
+bool mem_paging_kernel_map_at(uintptr_t vaddr, uintptr_t paddr, int perms) {
+	return mem_paging_kernel_map_range(vaddr, &paddr, 1, perms);
+}
+
+//! @brief Map huge page at a given address in the kernel half of the address space
+//! @param vaddr Virtual address at which page should be mapped. Should be aligned to page size
+//! @param paddr Physical address of the page to map. Should be aligned to page size
+//! @param size Page size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @param perms Permissions to map with
+//! @return True on success, false on error
+//! @note Caller should own the virtual address range exclusively. Range should not have smaller
+//! pages mapped, tables left from previous mappings are freed once all cores flush their TLBs
+bool mem_paging_kernel_map_huge(uintptr_t vaddr, uintptr_t paddr, size_t size, int perms) {
+	ASSERT(vaddr >= mem_wb_phys_win_base, "Address 0x%p is not in higher half", vaddr);
+	ASSERT(vaddr % size == 0 && paddr % size == 0, "Page 0x%p at 0x%p is not aligned to 0x%p",
+	       paddr, vaddr, size);
+	ASSERT((perms & MEM_PAGING_USER) == 0, "Attempt to map user page at 0x%p", vaddr);
+	const uint8_t level = mem_paging_huge_level(size);
+	uintptr_t *table = mem_paging_kernel_walk(vaddr, level, true);
+	if (table == NULL) {
+		return false;
+	}
+	uintptr_t *entry = table + mem_paging_get_lvl_index(vaddr, level);
+	const uintptr_t old_entry = *entry;
+	ATOMIC_RELEASE_STORE(entry, paddr | mem_paging_perms_to_flags(perms) | FLAG_HUGE);
+	if (old_entry == 0 || (old_entry & FLAG_HUGE) != 0) {
+		return true;
+	}
+	const uintptr_t old_table = old_entry & (~FLAGS_MASK);
+	ASSERT(!mem_paging_table_maps_pages(old_table, level - 1),
+	       "Huge page at 0x%p overlaps mapped pages", vaddr);
+	uintptr_t garbage = PHYS_NULL;
+	mem_paging_collect_tables(old_table, level - 1, &garbage);
+	mem_paging_retire_list(garbage, vaddr);
+	return true;
+}
+
+//! @brief Get physical address and size of the page mapped in the kernel half of the address
+//! space
+//! @param vaddr Virtual address inside the page
+//! @param page_size Buffer to store page size in
+//! @return Physical address of the start of the page or PHYS_NULL if there is none
+uintptr_t mem_paging_kernel_lookup(uintptr_t vaddr, size_t *page_size) {
+	const uint8_t lvls = mem_5level_paging_enabled ? 5 : 4;
+	uintptr_t current_phys = rdcr3() & ~(PAGE_SIZE - 1);
+	for (uint8_t i = lvls; i > 0; --i) {
+		const uintptr_t *table = (const uintptr_t *)(mem_wb_phys_win_base + current_phys);
+		const uintptr_t entry = ATOMIC_ACQUIRE_LOAD(table + mem_paging_get_lvl_index(vaddr, i));
+		if (entry == 0) {
+			break;
+		}
+		if (mem_paging_is_leaf(entry, i)) {
+			*page_size = mem_paging_level_page_size(i);
+			return entry & (~FLAGS_MASK);
+		}
+		current_phys = entry & (~FLAGS_MASK);
+	}
+	return PHYS_NULL;
+}
+
+//! @brief Get physical address of the page mapped in the kernel half of the address space
+//! @param vaddr Virtual address of the page
+//! @return Physical address of the page or PHYS_NULL if there is none
+//! @note For addresses inside huge pages, address of the corresponding 4k part is returned
+uintptr_t mem_paging_kernel_translate(uintptr_t vaddr) {
+	size_t page_size;
+	const uintptr_t base = mem_paging_kernel_lookup(vaddr, &page_size);
+	if (base == PHYS_NULL) {
+		return PHYS_NULL;
+	}
+	return base + ((vaddr & (page_size - 1)) & ~(PAGE_SIZE - 1));
+}
+
+//! @brief Check that no pages are mapped in the huge page sized range of the kernel half
+//! @param vaddr Virtual address of the range. Should be aligned to size
+//! @param size Range size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @return True if huge page can be mapped at vaddr without overlapping mapped pages
+bool mem_paging_kernel_range_unmapped(uintptr_t vaddr, size_t size) {
+	ASSERT(vaddr >= mem_wb_phys_win_base, "Address 0x%p is not in higher half", vaddr);
+	ASSERT(vaddr % size == 0, "Address 0x%p is not aligned to 0x%p", vaddr, size);
+	const uint8_t level = mem_paging_huge_level(size);
+	const uintptr_t *table = mem_paging_kernel_walk(vaddr, level, false);
+	if (table == NULL) {
+		return true;
+	}
+	const uintptr_t entry = ATOMIC_ACQUIRE_LOAD(table + mem_paging_get_lvl_index(vaddr, level));
+	if (entry == 0) {
+		return true;
+	}
+	return !mem_paging_is_leaf(entry, level) &&
+	       !mem_paging_table_maps_pages(entry & (~FLAGS_MASK), level - 1);
+}
+
+//! @brief Unmap 4k page at a given address in the kernel half of the address space
+//! @param vaddr Virtual address to be unmapped
+//! @return Physical address that was unmapped or PHYS_NULL if there was none
+//! @note Only local TLB entry is invalidated. Use invtlb subsystem to flush other cores' TLBs
+uintptr_t mem_paging_kernel_unmap_at(uintptr_t vaddr) {
+	uintptr_t frame = PHYS_NULL;
+	mem_paging_kernel_unmap_range(vaddr, 1, &frame);
+	return frame;
+}
+
+//! @brief Unmap huge page at a given address in the kernel half of the address space
+//! @param vaddr Virtual address to be unmapped. Should be aligned to page size
+//! @param size Page size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @return Physical address that was unmapped or PHYS_NULL if there was no huge page of that size
+//! @note Only local TLB entry is invalidated. Use invtlb subsystem to flush other cores' TLBs
+uintptr_t mem_paging_kernel_unmap_huge(uintptr_t vaddr, size_t size) {
+	ASSERT(vaddr >= mem_wb_phys_win_base, "Address 0x%p is not in higher half", vaddr);
+	ASSERT(vaddr % size == 0, "Address 0x%p is not aligned to 0x%p", vaddr, size);
+	const uint8_t level = mem_paging_huge_level(size);
+	uintptr_t *table = mem_paging_kernel_walk(vaddr, level, false);
+	if (table == NULL) {
+		return PHYS_NULL;
+	}
+	const uint16_t index = mem_paging_get_lvl_index(vaddr, level);
+	const uintptr_t entry = table[index];
+	if ((entry & FLAG_HUGE) == 0) {
+		return PHYS_NULL;
+	}
+	table[index] = 0;
+	mem_paging_invlpg(vaddr);
+	return entry & (~FLAGS_MASK);
+}
+
+//! @brief Switch current task to a new paging hierarchy
+//! @param root Pointer to the paging root. Task does not take a reference, root should outlive
+//! its use by the task
 void mem_paging_switch_to(struct mem_paging_root *root) {
-	wrcr3(root->cr3);
+	// Go through invtlb subsystem, so that shootdowns know root is loaded on this core
+	const bool int_state = intlevel_elevate();
+	thread_localsched_get_current_task()->cr3 = root->cr3;
+	mem_virt_invtlb_update_cr3(rdcr3(), mem_paging_local_cr3(root->cr3));
+	intlevel_recover(int_state);
 }
@@ -5,6 +5,7 @@
 
 #include <mem/misc.h>
 #include <misc/types.h>
+#include <sys/numa/numa.h>
 
 //! @brief READ permissions
 #define MEM_PAGING_READABLE 1
@@ -18,6 +19,9 @@
 //! @brief USER permissions
 #define MEM_PAGING_USER 8
 
+//! @brief Maximum number of pages populated by one page fault (fault-around window)
+#define MEM_PAGING_FAULT_AROUND_MAX 16
+
 //! @brief Paging hierarchy root. Reference-counted
 struct mem_paging_root;
 
@@ -30,8 +34,44 @@ struct mem_paging_mapper {
 
 //! @brief Create new paging root
 //! @return Pointer to the new paging root or NULL on failure
+//! @note Root is torn down by the reclaim task once the last reference is dropped. Before reclaim
+//! tasks are started, last reference should be dropped with interrupts enabled, as disposal waits
+//! for lazy TLB cores to switch away from it
 struct mem_paging_root *mem_paging_new_root(void);
 
+//! @brief Find paging root by its CR3 value
+//! @param cr3 Physical address of the root table or of one of its replicas
+//! @return Pointer to the paging root or NULL if there is none (e.g. boot root)
+//! @note No reference is taken. Root should be loaded on this core by the current task, which
+//! keeps it alive
+struct mem_paging_root *mem_paging_lookup_root(uint64_t cr3);
+
+//! @brief Get CR3 value cores of this node should load to switch to the paging root
+//! @param cr3 Physical address of the root table
+//! @return Physical address of the local replica root table or cr3 if there is none
+//! @note Should be called with interrupts disabled
+uint64_t mem_paging_local_cr3(uint64_t cr3);
+
+//! @brief Get physical address of the primary root table of the paging root
+//! @param root Pointer to the paging root
+//! @return Physical address of the root table
+uint64_t mem_paging_root_cr3(struct mem_paging_root *root);
+
+//! @brief Get physical address of the replica root table of the paging root
+//! @param root Pointer to the paging root
+//! @param id ID of the replica node
+//! @return Physical address of the replica root table or PHYS_NULL if there is no replica on the
+//! node
+uint64_t mem_paging_replica_cr3(struct mem_paging_root *root, numa_id_t id);
+
+//! @brief Replicate lower half tables of the paging root on all NUMA nodes with cores
+//! @param root Pointer to the paging root
+//! @return True on success, false on allocation failure. If replica tables could not be allocated,
+//! root is still replicated, but some replicas share primary tables until memory is available
+//! @note Cores switching to the root load replica of their node. All functions that change the
+//! mappings keep replicas in sync, which makes them more expensive. Replication can't be undone
+bool mem_paging_replicate(struct mem_paging_root *root);
+
 //! @brief Try to create a new paging mapper
 //! @param mapper Pointer to the mapper
 //! @return True on success and false on failure
@@ -53,8 +93,184 @@ bool mem_paging_map_at(struct mem_paging_root *root, uintptr_t vaddr, uintptr_t
 //! @param root Pointer to the paging root
 //! @param vaddr Virtual address to be unmapped
 //! @return Physical address that was unmapped or 0 if there was none
+//! @note If address is covered by a huge page, huge page is split first. 0 is returned if there
+//! is no memory for that
 uintptr_t mem_paging_unmap_at(struct mem_paging_root *root, uintptr_t vaddr);
 
-//! @brief Switch to a new paging hierarchy
+//! @brief Map range of 4k pages
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address at which the first page should be mapped. Should be page size
+//! aligned
+//! @param pages Physical addresses of the pages to map
+//! @param count Number of pages
+//! @param perms Permissions to map with
+//! @return True on success, false on error. On error, pages mapped by this call are unmapped
+//! @note Root lock is taken once and each table is walked once. Lock is only dropped to allocate
+//! missing tables
+bool mem_paging_map_range(struct mem_paging_root *root, uintptr_t vaddr, const uintptr_t *pages,
+                          size_t count, int perms);
+
+//! @brief Unmap range of pages
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address of the first page. Should be page size aligned
+//! @param count Number of 4k pages in the range
+//! @param frames Buffer of at least count entries to store unmapped frames in or NULL
+//! @return Number of frames that were unmapped
+//! @note Huge pages inside the range are reported as one frame. Huge pages partially covered by
+//! the range are split first, if there is no memory for that or if they are shared copy-on-write
+//! they stay mapped
+//! @note TLB entries are not invalidated, frames should not be reused until
+//! mem_paging_shootdown_range is called. Frames that may be shared should be dropped with
+//! mem_phys_put
+size_t mem_paging_unmap_range(struct mem_paging_root *root, uintptr_t vaddr, size_t count,
+                              uintptr_t *frames);
+
+//! @brief Invalidate TLB entries of the range on all cores that may have them
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address of the first page. Should be page size aligned
+//! @param count Number of 4k pages in the range
+//! @note Only cores that have the root or its replicas loaded are interrupted. Should only be
+//! called if mem_virt_invtlb_shootdown_allowed returns true
+void mem_paging_shootdown_range(struct mem_paging_root *root, uintptr_t vaddr, size_t count);
+
+//! @brief Reserve range of the lower half to be populated with zeroed pages on first touch
+//! @param root Pointer to the paging root
+//! @param vaddr Base of the range. Should be page size aligned
+//! @param size Size of the range. Should be a multiple of page size
+//! @param perms Permissions to map pages with
+//! @param fault_around Number of pages populated by one fault. Should be a power of two not
+//! greater than MEM_PAGING_FAULT_AROUND_MAX
+//! @return True on success, false if range overlaps with reserved one or on allocation failure
+bool mem_paging_reserve(struct mem_paging_root *root, uintptr_t vaddr, size_t size, int perms,
+                        size_t fault_around);
+
+//! @brief Release reserved range and free pages populated in it
+//! @param root Pointer to the paging root
+//! @param vaddr Base of the range
+//! @return True on success, false if there is no range reserved at vaddr
+//! @note Pages are shot down before being freed, so this should only be called if
+//! mem_virt_invtlb_shootdown_allowed returns true
+bool mem_paging_release(struct mem_paging_root *root, uintptr_t vaddr);
+
+//! @brief Handle page fault in the lower half
+//! @param root Pointer to the paging root
+//! @param vaddr Faulting address
+//! @param write True if faulting access was a write
+//! @return True if fault was resolved and access can be retried, false if access is invalid or
+//! there is no memory to resolve the fault
+//! @note Non-present pages of reserved ranges are populated, writes to copy-on-write pages copy
+//! them. Copying requires interrupts to be enabled at the time of the fault
+bool mem_paging_handle_fault(struct mem_paging_root *root, uintptr_t vaddr, bool write);
+
+//! @brief Duplicate lower half of the paging root copy-on-write
+//! @param root Pointer to the paging root
+//! @return Pointer to the new paging root or NULL on failure
+//! @note Pages are shared read-only by both roots and copied on the first write. Reserved ranges
+//! are copied as well. Should only be called if mem_virt_invtlb_shootdown_allowed returns true,
+//! as writable translations of the source root have to be shot down
+struct mem_paging_root *mem_paging_duplicate(struct mem_paging_root *root);
+
+//! @brief Map huge page at a given address
 //! @param root Pointer to the paging root
+//! @param vaddr Virtual address at which page should be mapped. Should be aligned to page size
+//! @param paddr Physical address of the page to map. Should be aligned to page size
+//! @param size Page size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @param perms Permissions to map with
+//! @return True on success, false on error
+//! @note Tables that covered the range are merged into the huge page if they map nothing.
+//! Mapping fails if some smaller pages in the range are still mapped, if huge page of that size is
+//! already mapped at vaddr or if the range is covered by a larger huge page
+bool mem_paging_map_huge(struct mem_paging_root *root, uintptr_t vaddr, uintptr_t paddr,
+                         size_t size, int perms);
+
+//! @brief Unmap huge page at a given address
+//! @param root Pointer to the paging root
+//! @param vaddr Virtual address to be unmapped. Should be aligned to page size
+//! @param size Page size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @return Physical address that was unmapped or 0 if there was no huge page of that size
+uintptr_t mem_paging_unmap_huge(struct mem_paging_root *root, uintptr_t vaddr, size_t size);
+
+//! @brief Preallocate root table entry covering a given kernel address
+//! @param vaddr Kernel virtual address
+//! @return True on success, false on failure
+//! @note Root table entries in the higher half are copied to new roots, hence new ones can't be
+//! added after roots other than the boot one were created. Call this on boot instead
+bool mem_paging_kernel_prealloc_root_entry(uintptr_t vaddr);
+
+//! @brief Map 4k page at a given address in the kernel half of the address space
+//! @param vaddr Virtual address at which page should be mapped
+//! @param paddr Physical address of the page to map
+//! @param perms Permissions to map with
+//! @return True on success, false on error
+//! @note Caller should own the virtual address range exclusively
+bool mem_paging_kernel_map_at(uintptr_t vaddr, uintptr_t paddr, int perms);
+
+//! @brief Map range of 4k pages in the kernel half of the address space
+//! @param vaddr Virtual address at which the first page should be mapped. Should be page size
+//! aligned
+//! @param pages Physical addresses of the pages to map
+//! @param count Number of pages
+//! @param perms Permissions to map with
+//! @return True on success, false on error. On error, pages mapped by this call are unmapped
+//! @note Caller should own the virtual address range exclusively. Each table is walked once
+bool mem_paging_kernel_map_range(uintptr_t vaddr, const uintptr_t *pages, size_t count,
+                                 int perms);
+
+//! @brief Map huge page at a given address in the kernel half of the address space
+//! @param vaddr Virtual address at which page should be mapped. Should be aligned to page size
+//! @param paddr Physical address of the page to map. Should be aligned to page size
+//! @param size Page size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @param perms Permissions to map with
+//! @return True on success, false on error
+//! @note Caller should own the virtual address range exclusively. Range should not have smaller
+//! pages mapped, tables left from previous mappings are freed once all cores flush their TLBs
+bool mem_paging_kernel_map_huge(uintptr_t vaddr, uintptr_t paddr, size_t size, int perms);
+
+//! @brief Get physical address and size of the page mapped in the kernel half of the address
+//! space
+//! @param vaddr Virtual address inside the page
+//! @param page_size Buffer to store page size in
+//! @return Physical address of the start of the page or PHYS_NULL if there is none
+uintptr_t mem_paging_kernel_lookup(uintptr_t vaddr, size_t *page_size);
+
+//! @brief Get physical address of the page mapped in the kernel half of the address space
+//! @param vaddr Virtual address of the page
+//! @return Physical address of the page or PHYS_NULL if there is none
+//! @note For addresses inside huge pages, address of the corresponding 4k part is returned
+uintptr_t mem_paging_kernel_translate(uintptr_t vaddr);
+
+//! @brief Check that no pages are mapped in the huge page sized range of the kernel half
+//! @param vaddr Virtual address of the range. Should be aligned to size
+//! @param size Range size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @return True if huge page can be mapped at vaddr without overlapping mapped pages
+bool mem_paging_kernel_range_unmapped(uintptr_t vaddr, size_t size);
+
+//! @brief Unmap 4k page at a given address in the kernel half of the address space
+//! @param vaddr Virtual address to be unmapped
+//! @return Physical address that was unmapped or PHYS_NULL if there was none
+//! @note Only local TLB entry is invalidated. Use invtlb subsystem to flush other cores' TLBs
+uintptr_t mem_paging_kernel_unmap_at(uintptr_t vaddr);
+
+//! @brief Unmap range of 4k pages in the kernel half of the address space
+//! @param vaddr Virtual address of the first page. Should be page size aligned
+//! @param count Number of pages in the range
+//! @param frames Buffer of at least count entries to store unmapped frames in or NULL
+//! @return Number of frames that were unmapped
+//! @note Only local TLB entries are invalidated. Use invtlb subsystem to flush other cores' TLBs
+size_t mem_paging_kernel_unmap_range(uintptr_t vaddr, size_t count, uintptr_t *frames);
+
+//! @brief Unmap huge page at a given address in the kernel half of the address space
+//! @param vaddr Virtual address to be unmapped. Should be aligned to page size
+//! @param size Page size (MEM_PHYS_HUGE_2M_SIZE or MEM_PHYS_HUGE_1G_SIZE)
+//! @return Physical address that was unmapped or PHYS_NULL if there was no huge page of that size
+//! @note Only local TLB entry is invalidated. Use invtlb subsystem to flush other cores' TLBs
+uintptr_t mem_paging_kernel_unmap_huge(uintptr_t vaddr, size_t size);
+
+//! @brief Size of the lower half of the address space
+//! @return Size in bytes
+size_t mem_paging_lower_half_size(void);
+
+//! @brief Switch current task to a new paging hierarchy
+//! @param root Pointer to the paging root. Task does not take a reference, root should outlive
+//! its use by the task
 void mem_paging_switch_to(struct mem_paging_root *root);
@@ -0,0 +1,167 @@
+//! @file vma.c
+//! @brief File containing implementation of virtual memory area tree
+
+#include <lib/panic.h>
+#include <lib/target.h>
+#include <mem/virt/vma.h>
+
+MODULE("mem/virt/vma")
+
+//! @brief Get height of the subtree
+//! @param vma Pointer to the subtree root or NULL
+//! @return Height of the subtree (0 for empty one)
+static size_t mem_vma_height(struct mem_vma *vma) {
+	return vma == NULL ? 0 : vma->height;
+}
+
+//! @brief Recompute height of the subtree from heights of its children
+//! @param vma Pointer to the subtree root
+static void mem_vma_update(struct mem_vma *vma) {
+	const size_t left = mem_vma_height(vma->left);
+	const size_t right = mem_vma_height(vma->right);
+	vma->height = (left > right ? left : right) + 1;
+}
+
+//! @brief Rotate subtree to the right
+//! @param vma Pointer to the subtree root
+//! @return Pointer to the new subtree root
+static struct mem_vma *mem_vma_rotate_right(struct mem_vma *vma) {
+	struct mem_vma *pivot = vma->left;
+	vma->left = pivot->right;
+	pivot->right = vma;
+	mem_vma_update(vma);
+	mem_vma_update(pivot);
+	return pivot;
+}
+
+//! @brief Rotate subtree to the left
+//! @param vma Pointer to the subtree root
+//! @return Pointer to the new subtree root
+static struct mem_vma *mem_vma_rotate_left(struct mem_vma *vma) {
+	struct mem_vma *pivot = vma->right;
+	vma->right = pivot->left;
+	pivot->left = vma;
+	mem_vma_update(vma);
+	mem_vma_update(pivot);
+	return pivot;
+}
+
+//! @brief Restore balance of the subtree after one of its children has changed height by one
+//! @param vma Pointer to the subtree root
+//! @return Pointer to the new subtree root
+static struct mem_vma *mem_vma_balance(struct mem_vma *vma) {
+	mem_vma_update(vma);
+	const size_t left = mem_vma_height(vma->left);
+	const size_t right = mem_vma_height(vma->right);
+	if (left > right + 1) {
+		if (mem_vma_height(vma->left->left) < mem_vma_height(vma->left->right)) {
+			vma->left = mem_vma_rotate_left(vma->left);
+		}
+		return mem_vma_rotate_right(vma);
+	}
+	if (right > left + 1) {
+		if (mem_vma_height(vma->right->right) < mem_vma_height(vma->right->left)) {
+			vma->right = mem_vma_rotate_right(vma->right);
+		}
+		return mem_vma_rotate_left(vma);
+	}
+	return vma;
+}
+
+//! @brief Find area containing a given address
+//! @param tree Pointer to the tree
+//! @param addr Virtual address
+//! @return Pointer to the area or NULL if address is not in any area
+struct mem_vma *mem_vma_find(struct mem_vma_tree *tree, uintptr_t addr) {
+	struct mem_vma *current = tree->root;
+	while (current != NULL) {
+		if (addr < current->base) {
+			current = current->left;
+		} else if (addr - current->base >= current->size) {
+			current = current->right;
+		} else {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+//! @brief Insert area in the subtree
+//! @param subtree Pointer to the subtree root or NULL
+//! @param vma Pointer to the area
+//! @param overlaps Set to true if area overlaps with one of the areas in the subtree
+//! @return Pointer to the new subtree root
+static struct mem_vma *mem_vma_insert_at(struct mem_vma *subtree, struct mem_vma *vma,
+                                         bool *overlaps) {
+	if (subtree == NULL) {
+		return vma;
+	}
+	if (vma->base + vma->size <= subtree->base) {
+		subtree->left = mem_vma_insert_at(subtree->left, vma, overlaps);
+	} else if (subtree->base + subtree->size <= vma->base) {
+		subtree->right = mem_vma_insert_at(subtree->right, vma, overlaps);
+	} else {
+		*overlaps = true;
+		return subtree;
+	}
+	return mem_vma_balance(subtree);
+}
+
+//! @brief Insert area in the tree
+//! @param tree Pointer to the tree
+//! @param vma Pointer to the area. Base and size should be set
+//! @return True on success, false if area overlaps with one of the areas in the tree
+bool mem_vma_insert(struct mem_vma_tree *tree, struct mem_vma *vma) {
+	ASSERT(vma->size != 0, "Attempt to insert empty area at 0x%p", vma->base);
+	vma->left = vma->right = NULL;
+	vma->height = 1;
+	bool overlaps = false;
+	tree->root = mem_vma_insert_at(tree->root, vma, &overlaps);
+	return !overlaps;
+}
+
+//! @brief Detach the leftmost area of the subtree
+//! @param subtree Pointer to the subtree root
+//! @param min Buffer to store pointer to the detached area in
+//! @return Pointer to the new subtree root
+static struct mem_vma *mem_vma_detach_min(struct mem_vma *subtree, struct mem_vma **min) {
+	if (subtree->left == NULL) {
+		*min = subtree;
+		return subtree->right;
+	}
+	subtree->left = mem_vma_detach_min(subtree->left, min);
+	return mem_vma_balance(subtree);
+}
+
+//! @brief Remove area from the subtree
+//! @param subtree Pointer to the subtree root
+//! @param vma Pointer to the area in the subtree
+//! @return Pointer to the new subtree root
+static struct mem_vma *mem_vma_remove_at(struct mem_vma *subtree, struct mem_vma *vma) {
+	ASSERT(subtree != NULL, "Area at 0x%p is not in the tree", vma->base);
+	if (vma->base < subtree->base) {
+		subtree->left = mem_vma_remove_at(subtree->left, vma);
+		return mem_vma_balance(subtree);
+	}
+	if (vma->base > subtree->base) {
+		subtree->right = mem_vma_remove_at(subtree->right, vma);
+		return mem_vma_balance(subtree);
+	}
+	// Area is replaced by its successor, if there is one
+	if (subtree->right == NULL) {
+		return subtree->left;
+	}
+	struct mem_vma *successor;
+	struct mem_vma *right = mem_vma_detach_min(subtree->right, &successor);
+	successor->left = subtree->left;
+	successor->right = right;
+	return mem_vma_balance(successor);
+}
+
+//! @brief Remove area from the tree
+//! @param tree Pointer to the tree
+//! @param vma Pointer to the area in the tree
+void mem_vma_remove(struct mem_vma_tree *tree, struct mem_vma *vma) {
+	tree->root = mem_vma_remove_at(tree->root, vma);
+	vma->left = vma->right = NULL;
+}
@@ -0,0 +1,53 @@
+//! @file vma.h
+//! @brief File containing declarations of virtual memory area tree
+
+#pragma once
+
+#include <misc/types.h>
+
+//! @brief Virtual memory area. Range that is populated on first touch
+struct mem_vma {
+	//! @brief Base of the area. Page size aligned
+	uintptr_t base;
+	//! @brief Size of the area. Multiple of page size
+	size_t size;
+	//! @brief Permissions to map pages with (MEM_PAGING_* flags)
+	int perms;
+	//! @brief Number of pages populated by one fault (fault-around window). Power of two
+	size_t fault_around;
+	//! @brief Left subtree (areas below this one)
+	struct mem_vma *left;
+	//! @brief Right subtree (areas above this one)
+	struct mem_vma *right;
+	//! @brief Height of the subtree rooted at this area
+	size_t height;
+};
+
+//! @brief Tree of non-overlapping virtual memory areas sorted by base (AVL tree)
+struct mem_vma_tree {
+	//! @brief Root area or NULL if tree is empty
+	struct mem_vma *root;
+};
+
+//! @brief Statically initialize virtual memory area tree
+#define MEM_VMA_TREE_INIT                                                                          \
+	(struct mem_vma_tree) {                                                                        \
+		.root = NULL                                                                               \
+	}
+
+//! @brief Find area containing a given address
+//! @param tree Pointer to the tree
+//! @param addr Virtual address
+//! @return Pointer to the area or NULL if address is not in any area
+struct mem_vma *mem_vma_find(struct mem_vma_tree *tree, uintptr_t addr);
+
+//! @brief Insert area in the tree
+//! @param tree Pointer to the tree
+//! @param vma Pointer to the area. Base and size should be set
+//! @return True on success, false if area overlaps with one of the areas in the tree
+bool mem_vma_insert(struct mem_vma_tree *tree, struct mem_vma *vma);
+
+//! @brief Remove area from the tree
+//! @param tree Pointer to the tree
+//! @param vma Pointer to the area in the tree
+void mem_vma_remove(struct mem_vma_tree *tree, struct mem_vma *vma);
@@ -0,0 +1,790 @@
+//! @file vmalloc.c
+//! @brief File containing implementation of virtually contiguous memory allocator
+
+#include <lib/containerof.h>
+#include <lib/panic.h>
+#include <lib/string.h>
+#include <lib/target.h>
+#include <mem/heap/heap.h>
+#include <mem/misc.h>
+#include <mem/phys/phys.h>
+#include <mem/virt/invtlb.h>
+#include <mem/virt/paging.h>
+#include <mem/virt/vma.h>
+#include <mem/virt/vmalloc.h>
+#include <misc/atomics.h>
+#include <misc/misc.h>
+#include <thread/locking/spinlock.h>
+#include <thread/smp/core.h>
+
+// Overview
+// 1. vmalloc hands out ranges from a dedicated area in the higher half. Root table entry for the
+// area is preallocated on boot, so all paging roots share it
+// 2. Each allocation is backed by individual 4k pages, so that only ceil(size / 4k) pages are
+// used, as opposed to the next power of two from PMM. Pages do not have to be contiguous
+// 3. Each range is followed by an unmapped guard page
+// 4. Freed ranges are shot down on cores that may have them in TLB before pages are freed and the
+// range is reused. If caller runs with interrupts disabled, shootdown can't be waited for. Such
+// ranges are kept in quarantine list tagged with invtlb generation until all cores flush TLBs
+// 5. Allocations of at least MEM_PHYS_HUGE_2M_SIZE bytes get 2 MB aligned ranges. Each whole 2 MB
+// chunk is backed by a 2 MB page if PMM has one on the right node, which saves TLB entries and
+// page table memory. Whatever is left is backed by 4k pages. Such areas are copied on realloc
+// 6. Lazy areas are only reserved. Page fault handler populates them on first touch, so that
+// large and sparsely used buffers only cost what is touched. Whole 2 MB chunks are backed by 2 MB
+// pages like in eager areas, the rest and chunks for which 2 MB page is not available by zeroed
+// 4k pages around the faulting one
+
+MODULE("mem/virt/vmalloc")
+TARGET(mem_vmalloc_available, mem_vmalloc_init,
+       {mem_phys_available, mem_misc_collect_info_available, mem_phys_space_size_available,
+        thread_smp_core_available})
+
+//! @brief Free range of virtual addresses
+struct mem_vmalloc_hole {
+	//! @brief Next hole
+	struct mem_vmalloc_hole *next;
+	//! @brief Base of the range
+	uintptr_t base;
+	//! @brief Size of the range
+	size_t size;
+	//! @brief Invtlb generation after which range can be reused (only used in quarantine)
+	uint64_t gen;
+};
+
+//! @brief Holes sorted by base address
+static struct mem_vmalloc_hole *mem_vmalloc_holes = NULL;
+
+//! @brief Freed ranges waiting for TLB flush
+static struct mem_vmalloc_hole *mem_vmalloc_quarantine = NULL;
+
+//! @brief Hole covering the whole area on boot. Not allocated from heap
+static struct mem_vmalloc_hole mem_vmalloc_initial_hole;
+
+//! @brief Lock guarding hole lists
+static struct thread_spinlock mem_vmalloc_lock = THREAD_SPINLOCK_INIT;
+
+//! @brief vmalloc statistics
+static struct mem_vmalloc_stats mem_vmalloc_stats = {0, 0, 0, 0};
+
+//! @brief Area populated on first touch
+struct mem_vmalloc_lazy_area {
+	//! @brief Range of the area
+	struct mem_vma vma;
+	//! @brief Placement policy of the backing pages
+	struct mem_policy policy;
+};
+
+//! @brief Lazy areas
+static struct mem_vma_tree mem_vmalloc_lazy_areas = {NULL};
+
+//! @brief Lock guarding lazy areas tree and population of their pages
+static struct thread_spinlock mem_vmalloc_lazy_lock = THREAD_SPINLOCK_INIT;
+
+//! @brief Initialize vmalloc
+static void mem_vmalloc_init(void) {
+	if (mem_wb_phys_win_base + mem_phys_space_size > MEM_VMALLOC_BASE) {
+		PANIC("Physical window overlaps vmalloc area");
+	}
+	if (!mem_paging_kernel_prealloc_root_entry(MEM_VMALLOC_BASE)) {
+		PANIC("Failed to preallocate vmalloc area root table entry");
+	}
+	mem_vmalloc_initial_hole.next = NULL;
+	mem_vmalloc_initial_hole.base = MEM_VMALLOC_BASE;
+	mem_vmalloc_initial_hole.size = MEM_VMALLOC_SIZE;
+	mem_vmalloc_initial_hole.gen = 0;
+	mem_vmalloc_holes = &mem_vmalloc_initial_hole;
+}
+
+//! @brief Dispose hole object
+//! @param hole Pointer to the hole
+static void mem_vmalloc_dispose_hole(struct mem_vmalloc_hole *hole) {
+	if (hole != &mem_vmalloc_initial_hole) {
+		mem_heap_free(hole, sizeof(struct mem_vmalloc_hole));
+	}
+}
+
+//! @brief Insert hole in the sorted hole list, merging it with neighbours if possible
+//! @param hole Pointer to the hole
+//! @note vmalloc lock should be held
+static void mem_vmalloc_insert_hole_nolock(struct mem_vmalloc_hole *hole) {
+	struct mem_vmalloc_hole *prev = NULL;
+	struct mem_vmalloc_hole *next = mem_vmalloc_holes;
+	while (next != NULL && next->base < hole->base) {
+		prev = next;
+		next = next->next;
+	}
+	// Merge with the next hole
+	if (next != NULL && hole->base + hole->size == next->base) {
+		hole->size += next->size;
+		hole->next = next->next;
+		mem_vmalloc_dispose_hole(next);
+	} else {
+		hole->next = next;
+	}
+	// Merge with the previous hole
+	if (prev != NULL && prev->base + prev->size == hole->base) {
+		prev->size += hole->size;
+		prev->next = hole->next;
+		mem_vmalloc_dispose_hole(hole);
+	} else if (prev != NULL) {
+		prev->next = hole;
+	} else {
+		mem_vmalloc_holes = hole;
+	}
+}
+
+//! @brief Move ranges that are no longer present in any TLB from quarantine to hole list
+//! @return True if at least one range was moved
+//! @note vmalloc lock should be held
+static bool mem_vmalloc_reclaim_nolock(void) {
+	bool reclaimed = false;
+	struct mem_vmalloc_hole **link = &mem_vmalloc_quarantine;
+	while (*link != NULL) {
+		struct mem_vmalloc_hole *hole = *link;
+		if (!mem_virt_invtlb_gen_completed(hole->gen)) {
+			link = &hole->next;
+			continue;
+		}
+		*link = hole->next;
+		mem_vmalloc_insert_hole_nolock(hole);
+		reclaimed = true;
+	}
+	return reclaimed;
+}
+
+//! @brief Reserve virtual address range using first fit
+//! @param size Size of the range
+//! @param align Alignment of the range base
+//! @param spare Pointer to the spare hole object used if hole has to be split in two. Set to NULL
+//! if spare hole was consumed
+//! @return Base of the range or 0 on failure
+//! @note vmalloc lock should be held
+static uintptr_t mem_vmalloc_reserve_nolock(size_t size, size_t align,
+                                            struct mem_vmalloc_hole **spare) {
+	struct mem_vmalloc_hole **link = &mem_vmalloc_holes;
+	while (*link != NULL) {
+		struct mem_vmalloc_hole *hole = *link;
+		const uintptr_t result = align_up(hole->base, align);
+		const uintptr_t end = hole->base + hole->size;
+		// Range cut from the middle of the hole leaves two holes, that needs a spare object
+		const bool needs_spare = result != hole->base && result + size != end;
+		if (result + size > end || (needs_spare && *spare == NULL)) {
+			link = &hole->next;
+			continue;
+		}
+		if (result == hole->base && result + size == end) {
+			*link = hole->next;
+			mem_vmalloc_dispose_hole(hole);
+		} else if (result == hole->base) {
+			hole->base += size;
+			hole->size -= size;
+		} else if (result + size == end) {
+			hole->size = result - hole->base;
+		} else {
+			struct mem_vmalloc_hole *tail = *spare;
+			*spare = NULL;
+			tail->base = result + size;
+			tail->size = end - tail->base;
+			tail->next = hole->next;
+			hole->size = result - hole->base;
+			hole->next = tail;
+		}
+		return result;
+	}
+	return 0;
+}
+
+//! @brief Reserve virtual address range
+//! @param size Size of the range
+//! @param align Alignment of the range base. Should be a power of two not less than PAGE_SIZE
+//! @return Base of the range or 0 on failure
+static uintptr_t mem_vmalloc_reserve(size_t size, size_t align) {
+	// Holes are allocated upfront, as heap can't be called with vmalloc lock held
+	struct mem_vmalloc_hole *spare = NULL;
+	if (align != PAGE_SIZE) {
+		spare = mem_heap_alloc(sizeof(struct mem_vmalloc_hole));
+	}
+	const bool int_state = thread_spinlock_lock(&mem_vmalloc_lock);
+	uintptr_t result = mem_vmalloc_reserve_nolock(size, align, &spare);
+	if (result == 0 && mem_vmalloc_reclaim_nolock()) {
+		result = mem_vmalloc_reserve_nolock(size, align, &spare);
+	}
+	thread_spinlock_unlock(&mem_vmalloc_lock, int_state);
+	if (spare != NULL) {
+		mem_heap_free(spare, sizeof(struct mem_vmalloc_hole));
+	}
+	return result;
+}
+
+//! @brief Release virtual address range
+//! @param base Base of the range
+//! @param size Size of the range
+//! @param flushed True if range has already been shot down. Otherwise it is reused once all TLBs
+//! are flushed
+//! @note All pages in the range should already be unmapped
+static void mem_vmalloc_release(uintptr_t base, size_t size, bool flushed) {
+	struct mem_vmalloc_hole *hole = mem_heap_alloc(sizeof(struct mem_vmalloc_hole));
+	if (hole == NULL) {
+		// Leaking virtual address space is harmless, and there is plenty of it anyway
+		return;
+	}
+	hole->base = base;
+	hole->size = size;
+	hole->gen = flushed ? 0 : mem_virt_invtlb_request();
+	const bool int_state = thread_spinlock_lock(&mem_vmalloc_lock);
+	if (flushed) {
+		mem_vmalloc_insert_hole_nolock(hole);
+	} else {
+		hole->next = mem_vmalloc_quarantine;
+		mem_vmalloc_quarantine = hole;
+	}
+	thread_spinlock_unlock(&mem_vmalloc_lock, int_state);
+}
+
+//! @brief Number of 4k pages in one 2 MB page
+#define MEM_VMALLOC_HUGE_PAGES (MEM_PHYS_HUGE_2M_SIZE / PAGE_SIZE)
+
+//! @brief Number of 4k pages mapped or unmapped in one batch
+#define MEM_VMALLOC_BATCH 64
+
+//! @brief Free pages linked through their first 8 bytes
+//! @param list Physical address of the first page or PHYS_NULL
+static void mem_vmalloc_free_list(uintptr_t list) {
+	while (list != PHYS_NULL) {
+		const uintptr_t next = *(uintptr_t *)(mem_wb_phys_win_base + list);
+		mem_phys_free(list);
+		list = next;
+	}
+}
+
+//! @brief Unmap pages in the range
+//! @param base Base of the range
+//! @param from Index of the first page to unmap
+//! @param to Index of the page after the last one to unmap
+//! @param free_pages True if unmapped pages should be returned to PMM
+//! @param shootdown True if unmapped pages should be shot down on other cores. Pages are only
+//! freed once that is done. Otherwise only local TLB is flushed
+//! @return Number of 2 MB pages that were unmapped
+static size_t mem_vmalloc_unmap(uintptr_t base, size_t from, size_t to, bool free_pages,
+                                bool shootdown) {
+	struct mem_virt_invtlb_batch batch = MEM_VIRT_INVTLB_BATCH_INIT(MEM_VIRT_INVTLB_KERNEL);
+	// Unmapped pages are linked through their first 8 bytes and freed after the shootdown, so
+	// that the whole range takes one IPI round
+	uintptr_t garbage = PHYS_NULL;
+	size_t huge_pages = 0;
+	size_t i = from;
+	while (i < to) {
+		const uintptr_t vaddr = base + i * PAGE_SIZE;
+		// Huge pages are only used for whole 2 MB chunks
+		if (vaddr % MEM_PHYS_HUGE_2M_SIZE == 0 && to - i >= MEM_VMALLOC_HUGE_PAGES) {
+			const uintptr_t page = mem_paging_kernel_unmap_huge(vaddr, MEM_PHYS_HUGE_2M_SIZE);
+			if (page != PHYS_NULL) {
+				if (shootdown) {
+					mem_virt_invtlb_batch_add(&batch, vaddr, MEM_PHYS_HUGE_2M_SIZE);
+				}
+				if (free_pages) {
+					*(uintptr_t *)(mem_wb_phys_win_base + page) = garbage;
+					garbage = page;
+				}
+				huge_pages++;
+				i += MEM_VMALLOC_HUGE_PAGES;
+				continue;
+			}
+		}
+		// Unmap 4k pages in batches that do not cross 2 MB boundaries, where huge pages may start
+		const size_t boundary = (align_up(vaddr + 1, MEM_PHYS_HUGE_2M_SIZE) - base) / PAGE_SIZE;
+		size_t count = (boundary < to ? boundary : to) - i;
+		if (count > MEM_VMALLOC_BATCH) {
+			count = MEM_VMALLOC_BATCH;
+		}
+		uintptr_t frames[MEM_VMALLOC_BATCH];
+		const size_t unmapped = mem_paging_kernel_unmap_range(vaddr, count, frames);
+		if (shootdown && unmapped != 0) {
+			mem_virt_invtlb_batch_add(&batch, vaddr, count * PAGE_SIZE);
+		}
+		for (size_t j = 0; free_pages && j < unmapped; ++j) {
+			*(uintptr_t *)(mem_wb_phys_win_base + frames[j]) = garbage;
+			garbage = frames[j];
+		}
+		i += count;
+	}
+	// Adjacent ranges are merged, so the whole range takes one shootdown
+	if (shootdown) {
+		mem_virt_invtlb_batch_commit(&batch);
+	}
+	mem_vmalloc_free_list(garbage);
+	return huge_pages;
+}
+
+//! @brief Allocate one backing page on a given node
+//! @param id ID of the node
+//! @param strict True if page may not be allocated on other nodes
+//! @param zeroed True if page should be zeroed
+//! @return Physical address of the page or PHYS_NULL on failure
+static uintptr_t mem_vmalloc_alloc_page_on(numa_id_t id, bool strict, bool zeroed) {
+	if (!strict) {
+		return zeroed ? mem_phys_alloc_zeroed_page(id) : mem_phys_alloc_on_behalf(PAGE_SIZE, id);
+	}
+	const uintptr_t page = mem_phys_alloc_specific(PAGE_SIZE, id);
+	if (page != PHYS_NULL && zeroed) {
+		memset((void *)(mem_wb_phys_win_base + page), 0, PAGE_SIZE);
+	}
+	return page;
+}
+
+//! @brief Allocate one backing page
+//! @param policy Pointer to the NUMA placement policy or NULL for local policy
+//! @param zeroed True if page should be zeroed
+//! @return Physical address of the page or PHYS_NULL on failure
+static uintptr_t mem_vmalloc_alloc_page(struct mem_policy *policy, bool zeroed) {
+	const numa_id_t id = mem_policy_next_node(policy);
+	return mem_vmalloc_alloc_page_on(id, mem_policy_is_strict(policy), zeroed);
+}
+
+//! @brief Back pages in the range with newly allocated memory
+//! @param base Base of the range
+//! @param from Index of the first page to populate
+//! @param to Index of the page after the last one to populate
+//! @param policy Pointer to the NUMA placement policy or NULL for local policy
+//! @param zeroed True if pages should be zeroed
+//! @return True on success, false on failure. On failure, range is left unpopulated
+static bool mem_vmalloc_populate(uintptr_t base, size_t from, size_t to,
+                                 struct mem_policy *policy, bool zeroed) {
+	uintptr_t batch[MEM_VMALLOC_BATCH];
+	for (size_t i = from; i < to; i += MEM_VMALLOC_BATCH) {
+		const size_t count = to - i < MEM_VMALLOC_BATCH ? to - i : MEM_VMALLOC_BATCH;
+		size_t allocated = 0;
+		for (; allocated < count; ++allocated) {
+			batch[allocated] = mem_vmalloc_alloc_page(policy, zeroed);
+			if (batch[allocated] == PHYS_NULL) {
+				break;
+			}
+		}
+		if (allocated != count ||
+		    !mem_paging_kernel_map_range(base + i * PAGE_SIZE, batch, count,
+		                                 MEM_PAGING_READABLE | MEM_PAGING_WRITABLE)) {
+			for (size_t j = 0; j < allocated; ++j) {
+				mem_phys_free(batch[j]);
+			}
+			mem_vmalloc_unmap(base, from, i, true, false);
+			return false;
+		}
+	}
+	return true;
+}
+
+//! @brief Back whole 2 MB chunks at the start of the range with 2 MB pages
+//! @param base Base of the range. Should be 2 MB aligned
+//! @param pages Number of 4k pages in the range
+//! @param policy Pointer to the NUMA placement policy or NULL for local policy
+//! @param zeroed True if pages should be zeroed
+//! @return Number of 4k pages backed by 2 MB pages. Stops at the first chunk PMM can't provide
+static size_t mem_vmalloc_populate_huge(uintptr_t base, size_t pages, struct mem_policy *policy,
+                                        bool zeroed) {
+	size_t i = 0;
+	for (; i + MEM_VMALLOC_HUGE_PAGES <= pages; i += MEM_VMALLOC_HUGE_PAGES) {
+		// Fallback to other nodes is left to 4k pages, as local 4k pages beat remote 2 MB ones
+		const uintptr_t page =
+		    mem_phys_alloc_specific(MEM_PHYS_HUGE_2M_SIZE, mem_policy_next_node(policy));
+		if (page == PHYS_NULL) {
+			break;
+		}
+		if (zeroed) {
+			memset((void *)(mem_wb_phys_win_base + page), 0, MEM_PHYS_HUGE_2M_SIZE);
+		}
+		if (!mem_paging_kernel_map_huge(base + i * PAGE_SIZE, page, MEM_PHYS_HUGE_2M_SIZE,
+		                                MEM_PAGING_READABLE | MEM_PAGING_WRITABLE)) {
+			mem_phys_free(page);
+			break;
+		}
+	}
+	return i;
+}
+
+//! @brief Check if area is backed by 2 MB pages
+//! @param base Base of the area
+//! @param pages Number of 4k pages in the area
+//! @return True if area starts with a 2 MB page
+static bool mem_vmalloc_is_huge(uintptr_t base, size_t pages) {
+	if (base % MEM_PHYS_HUGE_2M_SIZE != 0 || pages < MEM_VMALLOC_HUGE_PAGES) {
+		return false;
+	}
+	size_t page_size = 0;
+	mem_paging_kernel_lookup(base, &page_size);
+	return page_size == MEM_PHYS_HUGE_2M_SIZE;
+}
+
+//! @brief Get number of pages needed to back allocation
+//! @param size Allocation size
+//! @return Number of pages
+static size_t mem_vmalloc_pages(size_t size) {
+	return align_up(size, PAGE_SIZE) / PAGE_SIZE;
+}
+
+//! @brief Allocate virtually contiguous memory
+//! @param size Size of the memory to be allocated
+//! @param policy Pointer to the NUMA placement policy or NULL for local policy
+//! @param zeroed True if memory should be zeroed
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+static void *mem_vmalloc_alloc_common(size_t size, struct mem_policy *policy, bool zeroed) {
+	if (size == 0 || size > MEM_VMALLOC_SIZE / 2) {
+		return NULL;
+	}
+	const size_t pages = mem_vmalloc_pages(size);
+	const bool huge = pages >= MEM_VMALLOC_HUGE_PAGES;
+	// Reserve one more page for the guard
+	const uintptr_t base =
+	    mem_vmalloc_reserve((pages + 1) * PAGE_SIZE, huge ? MEM_PHYS_HUGE_2M_SIZE : PAGE_SIZE);
+	if (base == 0) {
+		return NULL;
+	}
+	const size_t huge_backed = huge ? mem_vmalloc_populate_huge(base, pages, policy, zeroed) : 0;
+	if (!mem_vmalloc_populate(base, huge_backed, pages, policy, zeroed)) {
+		mem_vmalloc_unmap(base, 0, huge_backed, true, false);
+		mem_vmalloc_release(base, (pages + 1) * PAGE_SIZE, false);
+		return NULL;
+	}
+	ATOMIC_FETCH_ADD_REL(&mem_vmalloc_stats.huge_pages, huge_backed / MEM_VMALLOC_HUGE_PAGES);
+	ATOMIC_FETCH_INCREMENT_REL(&mem_vmalloc_stats.areas);
+	ATOMIC_FETCH_ADD_REL(&mem_vmalloc_stats.pages, pages);
+	ATOMIC_FETCH_ADD_REL(&mem_vmalloc_stats.requested_bytes, size);
+	return (void *)base;
+}
+
+//! @brief Allocate virtually contiguous memory
+//! @param size Size of the memory to be allocated
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+void *mem_vmalloc_alloc(size_t size) {
+	return mem_vmalloc_alloc_on_behalf(size, PER_CPU(numa_id));
+}
+
+//! @brief Allocate virtually contiguous memory on behalf of a given node
+//! @param size Size of the memory to be allocated
+//! @param id Locality to which backing pages will belong
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+void *mem_vmalloc_alloc_on_behalf(size_t size, numa_id_t id) {
+	struct mem_policy policy = MEM_POLICY_PREFERRED_INIT(id);
+	return mem_vmalloc_alloc_common(size, &policy, false);
+}
+
+//! @brief Allocate zeroed virtually contiguous memory on behalf of a given node
+//! @param size Size of the memory to be allocated
+//! @param id Locality to which backing pages will belong
+//! @return NULL pointer if allocation failed, pointer to the zeroed virtual memory of size "size"
+//! otherwise
+//! @note Backing pages are taken from the pool of pre-zeroed pages if possible
+void *mem_vmalloc_alloc_zeroed_on_behalf(size_t size, numa_id_t id) {
+	struct mem_policy policy = MEM_POLICY_PREFERRED_INIT(id);
+	return mem_vmalloc_alloc_common(size, &policy, true);
+}
+
+//! @brief Allocate virtually contiguous memory according to the NUMA placement policy
+//! @param size Size of the memory to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+//! @note Policy is applied to each backing page separately, so interleave policy spreads pages. 2
+//! MB pages are interleaved as a whole
+void *mem_vmalloc_alloc_policy(size_t size, struct mem_policy *policy) {
+	return mem_vmalloc_alloc_common(size, policy, false);
+}
+
+//! @brief Allocate zeroed virtually contiguous memory according to the NUMA placement policy
+//! @param size Size of the memory to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return NULL pointer if allocation failed, pointer to the zeroed virtual memory of size "size"
+//! otherwise
+void *mem_vmalloc_alloc_zeroed_policy(size_t size, struct mem_policy *policy) {
+	return mem_vmalloc_alloc_common(size, policy, true);
+}
+
+//! @brief Free virtually contiguous memory
+//! @param mem Pointer to the previously allocated memory
+//! @param size Size of the allocated memory
+void mem_vmalloc_free(void *mem, size_t size) {
+	ASSERT(mem != NULL, "Attempt to free NULL");
+	const uintptr_t base = (uintptr_t)mem;
+	ASSERT(base >= MEM_VMALLOC_BASE && base < MEM_VMALLOC_BASE + MEM_VMALLOC_SIZE,
+	       "Address 0x%p is not in vmalloc area", base);
+	const size_t pages = mem_vmalloc_pages(size);
+	const bool shootdown = mem_virt_invtlb_shootdown_allowed();
+	const size_t huge_pages = mem_vmalloc_unmap(base, 0, pages, true, shootdown);
+	mem_vmalloc_release(base, (pages + 1) * PAGE_SIZE, shootdown);
+	ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.huge_pages, huge_pages);
+	ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.areas, 1);
+	ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.pages, pages);
+	ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.requested_bytes, size);
+}
+
+//! @brief Reserve virtually contiguous memory populated with zeroed pages on first touch
+//! @param size Size of the memory to be reserved
+//! @param policy Pointer to the placement policy of the backing pages or NULL for local policy.
+//! Policy is copied
+//! @return NULL pointer if reservation failed, pointer to the virtual memory of size "size"
+//! otherwise
+//! @note Pages are populated by the page fault handler, MEM_VMALLOC_LAZY_AROUND pages at once or
+//! 2 MB page at once for whole 2 MB chunks of large areas.
+//! Memory should only be touched by code that can take page faults (i.e. not with spinlocks held
+//! that the fault path takes) and is freed with mem_vmalloc_free_lazy
+void *mem_vmalloc_alloc_lazy(size_t size, struct mem_policy *policy) {
+	if (size == 0 || size > MEM_VMALLOC_SIZE / 2) {
+		return NULL;
+	}
+	struct mem_vmalloc_lazy_area *area = mem_heap_alloc(sizeof(struct mem_vmalloc_lazy_area));
+	if (area == NULL) {
+		return NULL;
+	}
+	const size_t pages = mem_vmalloc_pages(size);
+	// Large areas are aligned, so that whole 2 MB chunks can be backed by 2 MB pages on fault.
+	// Reserve one more page for the guard
+	const bool huge = pages >= MEM_VMALLOC_HUGE_PAGES;
+	const uintptr_t base =
+	    mem_vmalloc_reserve((pages + 1) * PAGE_SIZE, huge ? MEM_PHYS_HUGE_2M_SIZE : PAGE_SIZE);
+	if (base == 0) {
+		mem_heap_free(area, sizeof(struct mem_vmalloc_lazy_area));
+		return NULL;
+	}
+	area->vma.base = base;
+	area->vma.size = pages * PAGE_SIZE;
+	area->vma.perms = MEM_PAGING_READABLE | MEM_PAGING_WRITABLE;
+	area->vma.fault_around = MEM_VMALLOC_LAZY_AROUND;
+	area->policy = policy == NULL ? MEM_POLICY_LOCAL_INIT : *policy;
+	const bool int_state = thread_spinlock_lock(&mem_vmalloc_lazy_lock);
+	const bool inserted = mem_vma_insert(&mem_vmalloc_lazy_areas, &area->vma);
+	thread_spinlock_unlock(&mem_vmalloc_lazy_lock, int_state);
+	ASSERT(inserted, "Lazy area at 0x%p overlaps", base);
+	ATOMIC_FETCH_INCREMENT_REL(&mem_vmalloc_stats.areas);
+	ATOMIC_FETCH_ADD_REL(&mem_vmalloc_stats.requested_bytes, size);
+	return (void *)base;
+}
+
+//! @brief Free memory reserved with mem_vmalloc_alloc_lazy
+//! @param mem Pointer to the memory
+//! @param size Size of the memory
+void mem_vmalloc_free_lazy(void *mem, size_t size) {
+	ASSERT(mem != NULL, "Attempt to free NULL");
+	const uintptr_t base = (uintptr_t)mem;
+	// Area is removed first, so that faults can't populate it while it is unmapped
+	const bool int_state = thread_spinlock_lock(&mem_vmalloc_lazy_lock);
+	struct mem_vma *vma = mem_vma_find(&mem_vmalloc_lazy_areas, base);
+	ASSERT(vma != NULL && vma->base == base, "Address 0x%p is not a lazy area", base);
+	mem_vma_remove(&mem_vmalloc_lazy_areas, vma);
+	thread_spinlock_unlock(&mem_vmalloc_lazy_lock, int_state);
+	mem_heap_free(CONTAINER_OF(vma, struct mem_vmalloc_lazy_area, vma),
+	              sizeof(struct mem_vmalloc_lazy_area));
+	// Pages that were never touched are not mapped, unmap skips them
+	const size_t pages = mem_vmalloc_pages(size);
+	const bool shootdown = mem_virt_invtlb_shootdown_allowed();
+	const size_t huge_pages = mem_vmalloc_unmap(base, 0, pages, true, shootdown);
+	mem_vmalloc_release(base, (pages + 1) * PAGE_SIZE, shootdown);
+	ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.huge_pages, huge_pages);
+	ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.areas, 1);
+	ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.requested_bytes, size);
+}
+
+//! @brief Back 2 MB chunk of the lazy area with a 2 MB page on page fault
+//! @param addr Faulting address
+//! @return True if chunk is backed by 2 MB page and access can be retried, false if chunk is not
+//! entirely in a lazy area, already has 4k pages or 2 MB page could not be allocated
+static bool mem_vmalloc_handle_fault_huge(uintptr_t addr) {
+	const uintptr_t chunk = align_down(addr, MEM_PHYS_HUGE_2M_SIZE);
+	bool int_state = thread_spinlock_lock(&mem_vmalloc_lazy_lock);
+	struct mem_vma *vma = mem_vma_find(&mem_vmalloc_lazy_areas, addr);
+	if (vma == NULL || chunk < vma->base ||
+	    chunk + MEM_PHYS_HUGE_2M_SIZE > vma->base + vma->size ||
+	    !mem_paging_kernel_range_unmapped(chunk, MEM_PHYS_HUGE_2M_SIZE)) {
+		thread_spinlock_unlock(&mem_vmalloc_lazy_lock, int_state);
+		return false;
+	}
+	struct mem_vmalloc_lazy_area *area = CONTAINER_OF(vma, struct mem_vmalloc_lazy_area, vma);
+	const numa_id_t id = mem_policy_next_node(&area->policy);
+	thread_spinlock_unlock(&mem_vmalloc_lazy_lock, int_state);
+
+	// Fallback to other nodes is left to 4k pages, as local 4k pages beat remote 2 MB ones
+	const uintptr_t page = mem_phys_alloc_specific(MEM_PHYS_HUGE_2M_SIZE, id);
+	if (page == PHYS_NULL) {
+		return false;
+	}
+	memset((void *)(mem_wb_phys_win_base + page), 0, MEM_PHYS_HUGE_2M_SIZE);
+
+	// Chunk may have been populated or area freed in the meantime
+	int_state = thread_spinlock_lock(&mem_vmalloc_lazy_lock);
+	vma = mem_vma_find(&mem_vmalloc_lazy_areas, addr);
+	bool mapped = false;
+	if (vma != NULL && mem_paging_kernel_range_unmapped(chunk, MEM_PHYS_HUGE_2M_SIZE)) {
+		mapped = mem_paging_kernel_map_huge(chunk, page, MEM_PHYS_HUGE_2M_SIZE,
+		                                    MEM_PAGING_READABLE | MEM_PAGING_WRITABLE);
+	}
+	const bool result = vma != NULL && (mapped || mem_paging_kernel_translate(addr) != PHYS_NULL);
+	thread_spinlock_unlock(&mem_vmalloc_lazy_lock, int_state);
+	if (mapped) {
+		ATOMIC_FETCH_INCREMENT_REL(&mem_vmalloc_stats.huge_pages);
+	} else {
+		mem_phys_free(page);
+	}
+	return result;
+}
+
+//! @brief Populate page of the lazy area on page fault
+//! @param addr Faulting address
+//! @return True if page was populated and access can be retried, false if address is not in a
+//! lazy area or there is no memory to populate it
+bool mem_vmalloc_handle_fault(uintptr_t addr) {
+	if (addr < MEM_VMALLOC_BASE || addr >= MEM_VMALLOC_BASE + MEM_VMALLOC_SIZE) {
+		return false;
+	}
+	addr = align_down(addr, PAGE_SIZE);
+	if (mem_vmalloc_handle_fault_huge(addr)) {
+		return true;
+	}
+	uintptr_t pages[MEM_VMALLOC_LAZY_AROUND] = {0};
+	numa_id_t nodes[MEM_VMALLOC_LAZY_AROUND];
+
+	// Pick fault-around window and nodes for pages that are not populated yet
+	bool int_state = thread_spinlock_lock(&mem_vmalloc_lazy_lock);
+	struct mem_vma *vma = mem_vma_find(&mem_vmalloc_lazy_areas, addr);
+	if (vma == NULL) {
+		thread_spinlock_unlock(&mem_vmalloc_lazy_lock, int_state);
+		return false;
+	}
+	struct mem_vmalloc_lazy_area *area = CONTAINER_OF(vma, struct mem_vmalloc_lazy_area, vma);
+	const size_t window = MEM_VMALLOC_LAZY_AROUND * PAGE_SIZE;
+	const uintptr_t aligned = align_down(addr, window);
+	const uintptr_t start = aligned < vma->base ? vma->base : aligned;
+	const uintptr_t end =
+	    aligned + window > vma->base + vma->size ? vma->base + vma->size : aligned + window;
+	const size_t count = (end - start) / PAGE_SIZE;
+	const size_t faulting = (addr - start) / PAGE_SIZE;
+	const bool strict = mem_policy_is_strict(&area->policy);
+	bool missing[MEM_VMALLOC_LAZY_AROUND] = {false};
+	for (size_t i = 0; i < count; ++i) {
+		missing[i] = mem_paging_kernel_translate(start + i * PAGE_SIZE) == PHYS_NULL;
+		if (missing[i]) {
+			nodes[i] = mem_policy_next_node(&area->policy);
+		}
+	}
+	thread_spinlock_unlock(&mem_vmalloc_lazy_lock, int_state);
+	if (!missing[faulting]) {
+		// Page was populated by another core
+		return true;
+	}
+
+	// Allocate pages with the lock dropped. Only the faulting page is required
+	for (size_t i = 0; i < count; ++i) {
+		if (missing[i]) {
+			pages[i] = mem_vmalloc_alloc_page_on(nodes[i], strict, true);
+		}
+	}
+	bool result = pages[faulting] != PHYS_NULL;
+
+	// Map pages that are still missing. Area may have been freed in the meantime
+	int_state = thread_spinlock_lock(&mem_vmalloc_lazy_lock);
+	vma = mem_vma_find(&mem_vmalloc_lazy_areas, addr);
+	for (size_t i = 0; result && vma != NULL && i < count; ++i) {
+		const uintptr_t current = start + i * PAGE_SIZE;
+		if (pages[i] == PHYS_NULL || current < vma->base || current - vma->base >= vma->size ||
+		    mem_paging_kernel_translate(current) != PHYS_NULL) {
+			continue;
+		}
+		if (!mem_paging_kernel_map_at(current, pages[i],
+		                              MEM_PAGING_READABLE | MEM_PAGING_WRITABLE)) {
+			result = result && i != faulting;
+			continue;
+		}
+		pages[i] = PHYS_NULL;
+	}
+	result = result && vma != NULL;
+	thread_spinlock_unlock(&mem_vmalloc_lazy_lock, int_state);
+
+	// Give back pages that were populated concurrently
+	for (size_t i = 0; i < count; ++i) {
+		if (pages[i] != PHYS_NULL) {
+			mem_phys_free(pages[i]);
+		}
+	}
+	return result;
+}
+
+//! @brief Reallocate virtually contiguous memory
+//! @param mem Pointer to the memory
+//! @param newsize New size
+//! @param oldsize Old size
+//! @return Pointer to the new memory or NULL if realloc failed
+//! @note Backing pages are remapped instead of being copied, unless area is backed by 2 MB pages
+void *mem_vmalloc_realloc(void *mem, size_t newsize, size_t oldsize) {
+	if (mem == NULL) {
+		return mem_vmalloc_alloc(newsize);
+	}
+	if (newsize == 0) {
+		mem_vmalloc_free(mem, oldsize);
+		return NULL;
+	}
+	if (newsize > MEM_VMALLOC_SIZE / 2) {
+		return NULL;
+	}
+	const uintptr_t base = (uintptr_t)mem;
+	const size_t old_pages = mem_vmalloc_pages(oldsize);
+	const size_t new_pages = mem_vmalloc_pages(newsize);
+	if (mem_vmalloc_is_huge(base, old_pages)) {
+		// 2 MB pages can't be remapped at 4k granularity, and new area may get 2 MB pages too
+		void *result = mem_vmalloc_alloc(newsize);
+		if (result == NULL) {
+			return NULL;
+		}
+		memcpy(result, mem, newsize < oldsize ? newsize : oldsize);
+		mem_vmalloc_free(mem, oldsize);
+		return result;
+	}
+	if (new_pages <= old_pages) {
+		// Shrink in place. Range tail (including the old guard page) can be released
+		if (new_pages != old_pages) {
+			const bool shootdown = mem_virt_invtlb_shootdown_allowed();
+			mem_vmalloc_unmap(base, new_pages, old_pages, true, shootdown);
+			mem_vmalloc_release(base + (new_pages + 1) * PAGE_SIZE,
+			                    (old_pages - new_pages) * PAGE_SIZE, shootdown);
+		}
+		ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.pages, old_pages - new_pages);
+		ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.requested_bytes, oldsize);
+		ATOMIC_FETCH_ADD_REL(&mem_vmalloc_stats.requested_bytes, newsize);
+		return mem;
+	}
+	const uintptr_t new_base = mem_vmalloc_reserve((new_pages + 1) * PAGE_SIZE, PAGE_SIZE);
+	if (new_base == 0) {
+		return NULL;
+	}
+	// Map old pages at the new range. Old mapping stays valid until everything succeeds
+	for (size_t i = 0; i < old_pages; ++i) {
+		const uintptr_t page = mem_paging_kernel_translate(base + i * PAGE_SIZE);
+		ASSERT(page != PHYS_NULL, "Page at 0x%p is not mapped", base + i * PAGE_SIZE);
+		if (!mem_paging_kernel_map_at(new_base + i * PAGE_SIZE, page,
+		                              MEM_PAGING_READABLE | MEM_PAGING_WRITABLE)) {
+			mem_vmalloc_unmap(new_base, 0, i, false, false);
+			mem_vmalloc_release(new_base, (new_pages + 1) * PAGE_SIZE, false);
+			return NULL;
+		}
+	}
+	if (!mem_vmalloc_populate(new_base, old_pages, new_pages, NULL, false)) {
+		mem_vmalloc_unmap(new_base, 0, old_pages, false, false);
+		mem_vmalloc_release(new_base, (new_pages + 1) * PAGE_SIZE, false);
+		return NULL;
+	}
+	const bool shootdown = mem_virt_invtlb_shootdown_allowed();
+	mem_vmalloc_unmap(base, 0, old_pages, false, shootdown);
+	mem_vmalloc_release(base, (old_pages + 1) * PAGE_SIZE, shootdown);
+	ATOMIC_FETCH_ADD_REL(&mem_vmalloc_stats.pages, new_pages - old_pages);
+	ATOMIC_FETCH_SUB_REL(&mem_vmalloc_stats.requested_bytes, oldsize);
+	ATOMIC_FETCH_ADD_REL(&mem_vmalloc_stats.requested_bytes, newsize);
+	return (void *)new_base;
+}
+
+//! @brief Get vmalloc statistics
+//! @param stats Buffer to store statistics in
+void mem_vmalloc_get_stats(struct mem_vmalloc_stats *stats) {
+	stats->areas = ATOMIC_RELAXED_LOAD(&mem_vmalloc_stats.areas);
+	stats->pages = ATOMIC_RELAXED_LOAD(&mem_vmalloc_stats.pages);
+	stats->huge_pages = ATOMIC_RELAXED_LOAD(&mem_vmalloc_stats.huge_pages);
+	stats->requested_bytes = ATOMIC_RELAXED_LOAD(&mem_vmalloc_stats.requested_bytes);
+}
@@ -0,0 +1,110 @@
+//! @file vmalloc.h
+//! @brief File containing declarations of virtually contiguous memory allocator
+
+#pragma once
+
+#include <lib/target.h>
+#include <mem/policy.h>
+#include <misc/types.h>
+#include <sys/numa/numa.h>
+
+//! @brief Base of the vmalloc area
+#define MEM_VMALLOC_BASE 0xffffff0000000000ULL
+
+//! @brief Size of the vmalloc area (one root table entry in 4 level paging mode)
+#define MEM_VMALLOC_SIZE 0x8000000000ULL
+
+//! @brief Number of pages populated by one fault in lazy areas (fault-around window)
+#define MEM_VMALLOC_LAZY_AROUND 16
+
+//! @brief vmalloc statistics
+struct mem_vmalloc_stats {
+	//! @brief Number of live allocations
+	size_t areas;
+	//! @brief Number of pages backing live allocations
+	size_t pages;
+	//! @brief Number of 2 MB pages backing live allocations. Each also counts as 512 pages above
+	size_t huge_pages;
+	//! @brief Total size requested by live allocations
+	size_t requested_bytes;
+};
+
+//! @brief Allocate virtually contiguous memory
+//! @param size Size of the memory to be allocated
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+void *mem_vmalloc_alloc(size_t size);
+
+//! @brief Allocate virtually contiguous memory on behalf of a given node
+//! @param size Size of the memory to be allocated
+//! @param id Locality to which backing pages will belong
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+void *mem_vmalloc_alloc_on_behalf(size_t size, numa_id_t id);
+
+//! @brief Allocate zeroed virtually contiguous memory on behalf of a given node
+//! @param size Size of the memory to be allocated
+//! @param id Locality to which backing pages will belong
+//! @return NULL pointer if allocation failed, pointer to the zeroed virtual memory of size "size"
+//! otherwise
+//! @note Backing pages are taken from the pool of pre-zeroed pages if possible
+void *mem_vmalloc_alloc_zeroed_on_behalf(size_t size, numa_id_t id);
+
+//! @brief Allocate virtually contiguous memory according to the NUMA placement policy
+//! @param size Size of the memory to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return NULL pointer if allocation failed, pointer to the virtual memory of size "size"
+//! otherwise
+//! @note Policy is applied to each backing page separately, so interleave policy spreads pages. 2
+//! MB pages are interleaved as a whole
+void *mem_vmalloc_alloc_policy(size_t size, struct mem_policy *policy);
+
+//! @brief Allocate zeroed virtually contiguous memory according to the NUMA placement policy
+//! @param size Size of the memory to be allocated
+//! @param policy Pointer to the policy or NULL for local policy
+//! @return NULL pointer if allocation failed, pointer to the zeroed virtual memory of size "size"
+//! otherwise
+void *mem_vmalloc_alloc_zeroed_policy(size_t size, struct mem_policy *policy);
+
+//! @brief Free virtually contiguous memory
+//! @param mem Pointer to the previously allocated memory
+//! @param size Size of the allocated memory
+void mem_vmalloc_free(void *mem, size_t size);
+
+//! @brief Reserve virtually contiguous memory populated with zeroed pages on first touch
+//! @param size Size of the memory to be reserved
+//! @param policy Pointer to the placement policy of the backing pages or NULL for local policy.
+//! Policy is copied
+//! @return NULL pointer if reservation failed, pointer to the virtual memory of size "size"
+//! otherwise
+//! @note Pages are populated by the page fault handler, MEM_VMALLOC_LAZY_AROUND pages at once or
+//! 2 MB page at once for whole 2 MB chunks of large areas.
+//! Memory should only be touched by code that can take page faults (i.e. not with spinlocks held
+//! that the fault path takes) and is freed with mem_vmalloc_free_lazy
+void *mem_vmalloc_alloc_lazy(size_t size, struct mem_policy *policy);
+
+//! @brief Free memory reserved with mem_vmalloc_alloc_lazy
+//! @param mem Pointer to the memory
+//! @param size Size of the memory
+void mem_vmalloc_free_lazy(void *mem, size_t size);
+
+//! @brief Populate page of the lazy area on page fault
+//! @param addr Faulting address
+//! @return True if page was populated and access can be retried, false if address is not in a
+//! lazy area or there is no memory to populate it
+bool mem_vmalloc_handle_fault(uintptr_t addr);
+
+//! @brief Reallocate virtually contiguous memory
+//! @param mem Pointer to the memory
+//! @param newsize New size
+//! @param oldsize Old size
+//! @return Pointer to the new memory or NULL if realloc failed
+//! @note Backing pages are remapped instead of being copied, unless area is backed by 2 MB pages
+void *mem_vmalloc_realloc(void *mem, size_t newsize, size_t oldsize);
+
+//! @brief Get vmalloc statistics
+//! @param stats Buffer to store statistics in
+void mem_vmalloc_get_stats(struct mem_vmalloc_stats *stats);
+
+//! @brief Target to initialize vmalloc
+EXPORT_TARGET(mem_vmalloc_available)
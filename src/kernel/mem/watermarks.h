@@ -0,0 +1,42 @@
+//! @file watermarks.h
+//! @brief File containing definition of per-node memory pressure watermarks
+
+#pragma once
+
+#include <misc/types.h>
+#include <thread/locking/spinlock.h>
+
+struct mem_reclaim_work;
+
+//! @brief Memory pressure watermarks and reclaim task state of one NUMA node
+struct mem_watermarks {
+	//! @brief Reclaim task is woken up once free memory on the node drops below this number of
+	//! bytes
+	size_t low;
+	//! @brief Reclaim task runs shrinkers until free memory on the node gets back above this number
+	//! of bytes
+	size_t high;
+	//! @brief Node's reclaim task or NULL if it has not been started yet
+	struct thread_task *task;
+	//! @brief True if reclaim was requested and reclaim task has not picked the request up yet
+	bool pending;
+	//! @brief True if reclaim task is suspended waiting for requests
+	bool sleeping;
+	//! @brief Number of times reclaim task was woken up
+	size_t wakeups;
+	//! @brief Number of bytes released by shrinkers on behalf of this node
+	size_t reclaimed;
+	//! @brief First work item queued to reclaim task or NULL
+	struct mem_reclaim_work *work;
+	//! @brief Last work item queued to reclaim task or NULL
+	struct mem_reclaim_work *work_last;
+	//! @brief Lock protecting reclaim task state
+	struct thread_spinlock lock;
+};
+
+//! @brief Static watermarks init. Watermarks are set by mem_reclaim_available target
+#define MEM_WATERMARKS_INIT                                                                        \
+	(struct mem_watermarks) {                                                                      \
+		.low = 0, .high = 0, .task = NULL, .pending = false, .sleeping = false, .wakeups = 0,      \
+		.reclaimed = 0, .work = NULL, .work_last = NULL, .lock = THREAD_SPINLOCK_INIT,             \
+	}
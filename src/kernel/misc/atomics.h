@@ -13,11 +13,33 @@
 //! @note Uses acquire&release ordering
 #define ATOMIC_FETCH_DECREMENT(ptr) __atomic_fetch_sub(ptr, 1, __ATOMIC_ACQ_REL)
 
+//! @brief Atomic fetch and add
+//! @param ptr Pointer to the variable to be added to
+//! @param val Value to add
+//! @note Uses acquire&release ordering
+#define ATOMIC_FETCH_ADD(ptr, val) __atomic_fetch_add(ptr, val, __ATOMIC_ACQ_REL)
+
+//! @brief Atomic fetch and sub
+//! @param ptr Pointer to the variable to be subtracted from
+//! @param val Value to subtract
+//! @note Uses acquire&release ordering
+#define ATOMIC_FETCH_SUB(ptr, val) __atomic_fetch_sub(ptr, val, __ATOMIC_ACQ_REL)
+
 //! @brief Relaxed atomic fetch and increment
 //! @param ptr Pointer to the variable to be incremented
 //! @note Uses acquire&release ordering
 #define ATOMIC_FETCH_INCREMENT_REL(ptr) __atomic_fetch_add(ptr, 1, __ATOMIC_RELAXED)
 
+//! @brief Relaxed atomic fetch and add
+//! @param ptr Pointer to the variable to be added to
+//! @param val Value to add
+#define ATOMIC_FETCH_ADD_REL(ptr, val) __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED)
+
+//! @brief Relaxed atomic fetch and sub
+//! @param ptr Pointer to the variable to be subtracted from
+//! @param val Value to subtract
+#define ATOMIC_FETCH_SUB_REL(ptr, val) __atomic_fetch_sub(ptr, val, __ATOMIC_RELAXED)
+
 //! @brief Atomic acquire load
 //! @param ptr Pointer to the value to be loaded
 #define ATOMIC_ACQUIRE_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
@@ -30,3 +52,18 @@
 //! @param ptr Pointer to the store location
 //! @param val Value to be stored
 #define ATOMIC_RELEASE_STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+//! @brief Atomic exchange
+//! @param ptr Pointer to the variable
+//! @param val New value
+//! @note Uses acquire&release ordering
+#define ATOMIC_EXCHANGE(ptr, val) __atomic_exchange_n(ptr, val, __ATOMIC_ACQ_REL)
+
+//! @brief Atomic fetch and bitwise or
+//! @param ptr Pointer to the variable
+//! @param val Value to or with
+//! @note Uses acquire&release ordering
+#define ATOMIC_FETCH_OR(ptr, val) __atomic_fetch_or(ptr, val, __ATOMIC_ACQ_REL)
+
+//! @brief Full memory fence. Orders stores before it with loads after it
+#define ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
@@ -0,0 +1,248 @@
+//! @file hmat.c
+//! @brief File containing implementation of HMAT (Heterogeneous Memory Attribute Table) parser
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <misc/types.h>
+#include <sys/acpi/acpi.h>
+#include <sys/acpi/hmat.h>
+
+MODULE("sys/acpi/hmat")
+TARGET(acpi_hmat_available, acpi_hmat_init, {acpi_available})
+
+//! @brief Supported HMAT revision (ACPI 6.3+)
+#define ACPI_HMAT_REVISION 2
+
+//! @brief Mask of memory hierarchy bits in locality structure flags
+#define ACPI_HMAT_HIERARCHY_MASK 0xfU
+
+//! @brief Memory hierarchy value for the memory itself (as opposed to memory side caches)
+#define ACPI_HMAT_HIERARCHY_MEMORY 0
+
+//! @brief Flag in memory proximity structure that tells that initiator domain field is valid
+#define ACPI_HMAT_INITIATOR_VALID 1U
+
+//! @brief Nullable pointer to HMAT. Set by acpi_hmat_init if found
+struct acpi_hmat *acpi_boot_hmat = NULL;
+
+//! @brief HMAT structures iterator
+struct acpi_hmat_iter {
+	//! @brief Offset of the next structure
+	size_t offset;
+};
+
+//! @brief Statically initialize HMAT structures iterator
+#define ACPI_HMAT_ITER_INIT                                                                        \
+	(struct acpi_hmat_iter) {                                                                      \
+		0                                                                                          \
+	}
+
+//! @brief Get next HMAT structure
+//! @param iter Pointer to the iterator
+//! @return Pointer to the structure or NULL if there are none left
+static struct acpi_hmat_entry *acpi_hmat_next(struct acpi_hmat_iter *iter) {
+	if (acpi_boot_hmat == NULL) {
+		return NULL;
+	}
+	const uintptr_t starting_address = ((uintptr_t)acpi_boot_hmat) + sizeof(struct acpi_hmat);
+	const uintptr_t entries_len = acpi_boot_hmat->hdr.length - sizeof(struct acpi_hmat);
+	if (iter->offset + sizeof(struct acpi_hmat_entry) > entries_len) {
+		return NULL;
+	}
+	struct acpi_hmat_entry *entry = (struct acpi_hmat_entry *)(starting_address + iter->offset);
+	if (entry->length < sizeof(struct acpi_hmat_entry)) {
+		// Malformed entry, stop enumeration to avoid looping forever
+		return NULL;
+	}
+	iter->offset += entry->length;
+	return entry;
+}
+
+//! @brief Find index of the domain in the list
+//! @param list Pointer to the domains list
+//! @param count Number of domains in the list
+//! @param domain Domain to look for
+//! @return Index of the domain or count if it is not in the list
+static size_t acpi_hmat_find_domain(const uint32_t *list, size_t count, numa_id_t domain) {
+	for (size_t i = 0; i < count; ++i) {
+		if (list[i] == domain) {
+			return i;
+		}
+	}
+	return count;
+}
+
+//! @brief Apply value from the locality structure to the performance attributes
+//! @param locality Pointer to the locality structure
+//! @param raw Raw matrix entry
+//! @param buf Buffer with performance attributes
+static void acpi_hmat_apply(struct acpi_hmat_locality_entry *locality, uint16_t raw,
+                            struct acpi_hmat_perf *buf) {
+	// 0 means that data is not provided, 0xffff means that target is unreachable
+	if (raw == 0 || raw == 0xffff) {
+		return;
+	}
+	const uint64_t value = (uint64_t)raw * locality->base_unit;
+	switch (locality->data_type) {
+	case ACPI_HMAT_ACCESS_LATENCY:
+		buf->read_latency = buf->write_latency = value;
+		break;
+	case ACPI_HMAT_READ_LATENCY:
+		buf->read_latency = value;
+		break;
+	case ACPI_HMAT_WRITE_LATENCY:
+		buf->write_latency = value;
+		break;
+	case ACPI_HMAT_ACCESS_BANDWIDTH:
+		buf->read_bandwidth = buf->write_bandwidth = value;
+		break;
+	case ACPI_HMAT_READ_BANDWIDTH:
+		buf->read_bandwidth = value;
+		break;
+	case ACPI_HMAT_WRITE_BANDWIDTH:
+		buf->write_bandwidth = value;
+		break;
+	default:
+		break;
+	}
+}
+
+//! @brief Get performance attributes of memory accesses from initiator to target domain
+//! @param initiator Initiator proximity domain
+//! @param target Target (memory) proximity domain
+//! @param buf Buffer to store attributes in
+//! @return True if HMAT has at least one attribute for the pair, false otherwise
+bool acpi_hmat_get_perf(numa_id_t initiator, numa_id_t target, struct acpi_hmat_perf *buf) {
+	*buf = (struct acpi_hmat_perf){0, 0, 0, 0};
+	struct acpi_hmat_iter iter = ACPI_HMAT_ITER_INIT;
+	struct acpi_hmat_entry *entry;
+	bool found = false;
+	while ((entry = acpi_hmat_next(&iter)) != NULL) {
+		if (entry->type != ACPI_HMAT_LOCALITY_ENTRY) {
+			continue;
+		}
+		struct acpi_hmat_locality_entry *locality = (struct acpi_hmat_locality_entry *)entry;
+		// Memory side caches attributes are not relevant for allocation
+		if ((locality->flags & ACPI_HMAT_HIERARCHY_MASK) != ACPI_HMAT_HIERARCHY_MEMORY) {
+			continue;
+		}
+		const size_t initiators_count = locality->initiators_count;
+		const size_t targets_count = locality->targets_count;
+		const size_t needed = sizeof(struct acpi_hmat_locality_entry) +
+		                      4 * (initiators_count + targets_count) +
+		                      2 * initiators_count * targets_count;
+		if (entry->length < needed) {
+			LOG_WARN("Locality structure is truncated. Skipping");
+			continue;
+		}
+		const uint32_t *initiators = (const uint32_t *)(locality + 1);
+		const uint32_t *targets = initiators + initiators_count;
+		const uint16_t *values = (const uint16_t *)(targets + targets_count);
+		const size_t row = acpi_hmat_find_domain(initiators, initiators_count, initiator);
+		const size_t col = acpi_hmat_find_domain(targets, targets_count, target);
+		if (row == initiators_count || col == targets_count) {
+			continue;
+		}
+		acpi_hmat_apply(locality, values[row * targets_count + col], buf);
+		found = true;
+	}
+	return found;
+}
+
+//! @brief Get initiator domain attached to the memory domain
+//! @param domain Memory proximity domain
+//! @return Attached initiator domain or domain itself if HMAT does not specify one
+numa_id_t acpi_hmat_get_initiator(numa_id_t domain) {
+	struct acpi_hmat_iter iter = ACPI_HMAT_ITER_INIT;
+	struct acpi_hmat_entry *entry;
+	while ((entry = acpi_hmat_next(&iter)) != NULL) {
+		if (entry->type != ACPI_HMAT_MEM_PROX_ENTRY) {
+			continue;
+		}
+		struct acpi_hmat_mem_prox_entry *prox = (struct acpi_hmat_mem_prox_entry *)entry;
+		if (prox->memory_domain == domain && (prox->flags & ACPI_HMAT_INITIATOR_VALID) != 0) {
+			return prox->initiator_domain;
+		}
+	}
+	return domain;
+}
+
+//! @brief Get info about memory side cache of the memory domain
+//! @param domain Memory proximity domain
+//! @param level Cache level (1 is the closest to memory)
+//! @param buf Buffer to store info in
+//! @return True if such cache exists, false otherwise
+bool acpi_hmat_get_cache(numa_id_t domain, uint8_t level, struct acpi_hmat_cache_info *buf) {
+	struct acpi_hmat_iter iter = ACPI_HMAT_ITER_INIT;
+	struct acpi_hmat_entry *entry;
+	while ((entry = acpi_hmat_next(&iter)) != NULL) {
+		if (entry->type != ACPI_HMAT_CACHE_ENTRY) {
+			continue;
+		}
+		struct acpi_hmat_cache_entry *cache = (struct acpi_hmat_cache_entry *)entry;
+		// Attributes: bits 0-3 - total levels, 4-7 - cache level, 16-31 - line size
+		const uint8_t cache_level = (uint8_t)((cache->attributes >> 4) & 0xf);
+		if (cache->memory_domain != domain || cache_level != level) {
+			continue;
+		}
+		buf->size = cache->cache_size;
+		buf->level = cache_level;
+		buf->levels_count = (uint8_t)(cache->attributes & 0xf);
+		buf->line_size = (uint16_t)(cache->attributes >> 16);
+		return true;
+	}
+	return false;
+}
+
+//! @brief Dump HMAT
+static void acpi_hmat_dump(void) {
+	struct acpi_hmat_iter iter = ACPI_HMAT_ITER_INIT;
+	struct acpi_hmat_entry *entry;
+	while ((entry = acpi_hmat_next(&iter)) != NULL) {
+		switch (entry->type) {
+		case ACPI_HMAT_MEM_PROX_ENTRY: {
+			struct acpi_hmat_mem_prox_entry *prox = (struct acpi_hmat_mem_prox_entry *)entry;
+			if ((prox->flags & ACPI_HMAT_INITIATOR_VALID) != 0) {
+				LOG_INFO("Memory domain %u is attached to initiator %u", prox->memory_domain,
+				         prox->initiator_domain);
+			}
+			break;
+		}
+		case ACPI_HMAT_LOCALITY_ENTRY: {
+			struct acpi_hmat_locality_entry *locality = (struct acpi_hmat_locality_entry *)entry;
+			LOG_INFO("Locality data type %u for %u initiators and %u targets (hierarchy %u, unit "
+			         "%U)",
+			         (uint32_t)locality->data_type, locality->initiators_count,
+			         locality->targets_count,
+			         (uint32_t)(locality->flags & ACPI_HMAT_HIERARCHY_MASK), locality->base_unit);
+			break;
+		}
+		case ACPI_HMAT_CACHE_ENTRY: {
+			struct acpi_hmat_cache_entry *cache = (struct acpi_hmat_cache_entry *)entry;
+			LOG_INFO("Memory domain %u has memory side cache of size %U (attributes 0x%x)",
+			         cache->memory_domain, cache->cache_size, cache->attributes);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+//! @brief Initialize HMAT parser
+static void acpi_hmat_init(void) {
+	if (acpi_revision == 0) {
+		return;
+	}
+	struct acpi_hmat *hmat = (struct acpi_hmat *)acpi_find_table("HMAT", 0);
+	if (hmat == NULL) {
+		return;
+	}
+	if (hmat->hdr.rev != ACPI_HMAT_REVISION) {
+		LOG_WARN("HMAT revision %u is not supported. Discarding", (uint32_t)hmat->hdr.rev);
+		return;
+	}
+	acpi_boot_hmat = hmat;
+	acpi_hmat_dump();
+	LOG_SUCCESS("HMAT found");
+}
@@ -0,0 +1,137 @@
+//! @file hmat.h
+//! @brief File containing declarations of HMAT (Heterogeneous Memory Attribute Table) parser
+
+#pragma once
+
+#include <lib/target.h>
+#include <misc/attributes.h>
+#include <misc/types.h>
+#include <sys/acpi/acpi.h>
+#include <sys/numa/numa.h>
+
+//! @brief HMAT ACPI table
+struct acpi_hmat {
+	struct acpi_sdt_header hdr;
+	uint32_t reserved;
+} attribute_packed;
+
+//! @brief HMAT structure type
+enum
+{
+	//! @brief Memory proximity domain attributes structure
+	ACPI_HMAT_MEM_PROX_ENTRY = 0,
+	//! @brief System locality latency and bandwidth information structure
+	ACPI_HMAT_LOCALITY_ENTRY = 1,
+	//! @brief Memory side cache information structure
+	ACPI_HMAT_CACHE_ENTRY = 2,
+};
+
+//! @brief HMAT structure header
+struct acpi_hmat_entry {
+	uint16_t type;
+	uint16_t reserved;
+	uint32_t length;
+} attribute_packed;
+
+//! @brief HMAT memory proximity domain attributes structure
+struct acpi_hmat_mem_prox_entry {
+	struct acpi_hmat_entry base;
+	uint16_t flags;
+	uint16_t reserved;
+	uint32_t initiator_domain;
+	uint32_t memory_domain;
+	uint32_t reserved2;
+	uint64_t reserved3;
+	uint64_t reserved4;
+} attribute_packed;
+
+//! @brief HMAT locality data types
+enum
+{
+	//! @brief Access (read and write) latency
+	ACPI_HMAT_ACCESS_LATENCY = 0,
+	//! @brief Read latency
+	ACPI_HMAT_READ_LATENCY = 1,
+	//! @brief Write latency
+	ACPI_HMAT_WRITE_LATENCY = 2,
+	//! @brief Access (read and write) bandwidth
+	ACPI_HMAT_ACCESS_BANDWIDTH = 3,
+	//! @brief Read bandwidth
+	ACPI_HMAT_READ_BANDWIDTH = 4,
+	//! @brief Write bandwidth
+	ACPI_HMAT_WRITE_BANDWIDTH = 5,
+};
+
+//! @brief HMAT system locality latency and bandwidth information structure
+//! @note Followed by initiator domains list, target domains list and uint16_t entries matrix
+struct acpi_hmat_locality_entry {
+	struct acpi_hmat_entry base;
+	uint8_t flags;
+	uint8_t data_type;
+	uint8_t min_transfer_size;
+	uint8_t reserved;
+	uint32_t initiators_count;
+	uint32_t targets_count;
+	uint32_t reserved2;
+	uint64_t base_unit;
+} attribute_packed;
+
+//! @brief HMAT memory side cache information structure
+struct acpi_hmat_cache_entry {
+	struct acpi_hmat_entry base;
+	uint32_t memory_domain;
+	uint32_t reserved;
+	uint64_t cache_size;
+	uint32_t attributes;
+	uint16_t reserved2;
+	uint16_t smbios_handles_count;
+} attribute_packed;
+
+//! @brief Performance attributes of memory access from initiator to target domain
+struct acpi_hmat_perf {
+	//! @brief Read latency in picoseconds or 0 if unknown
+	uint64_t read_latency;
+	//! @brief Write latency in picoseconds or 0 if unknown
+	uint64_t write_latency;
+	//! @brief Read bandwidth in MB/s or 0 if unknown
+	uint64_t read_bandwidth;
+	//! @brief Write bandwidth in MB/s or 0 if unknown
+	uint64_t write_bandwidth;
+};
+
+//! @brief Memory side cache info
+struct acpi_hmat_cache_info {
+	//! @brief Cache size in bytes
+	uint64_t size;
+	//! @brief Cache level (1 is the closest to memory)
+	uint8_t level;
+	//! @brief Total number of cache levels for the memory domain
+	uint8_t levels_count;
+	//! @brief Cache line size in bytes
+	uint16_t line_size;
+};
+
+//! @brief Nullable pointer to HMAT. Set by acpi_hmat_init if found
+extern struct acpi_hmat *acpi_boot_hmat;
+
+//! @brief Get performance attributes of memory accesses from initiator to target domain
+//! @param initiator Initiator proximity domain
+//! @param target Target (memory) proximity domain
+//! @param buf Buffer to store attributes in
+//! @return True if HMAT has at least one attribute for the pair, false otherwise
+bool acpi_hmat_get_perf(numa_id_t initiator, numa_id_t target, struct acpi_hmat_perf *buf);
+
+//! @brief Get initiator domain attached to the memory domain
+//! @param domain Memory proximity domain
+//! @return Attached initiator domain or domain itself if HMAT does not specify one
+numa_id_t acpi_hmat_get_initiator(numa_id_t domain);
+
+//! @brief Get info about memory side cache of the memory domain
+//! @param domain Memory proximity domain
+//! @param level Cache level (1 is the closest to memory)
+//! @param buf Buffer to store info in
+//! @return True if such cache exists, false otherwise
+bool acpi_hmat_get_cache(numa_id_t domain, uint8_t level, struct acpi_hmat_cache_info *buf);
+
+//! @brief Export HMAT parser init target
+EXPORT_TARGET(acpi_hmat_available)
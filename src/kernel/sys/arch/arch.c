@@ -7,6 +7,7 @@
 #include <sys/arch/arch.h>
 #include <sys/arch/gdt.h>
 #include <sys/arch/interrupts.h>
+#include <sys/fpu.h>
 #include <sys/ic.h>
 #include <thread/smp/core.h>
 
@@ -54,6 +55,8 @@ void arch_init(void) {
 	// Set CPU stacks
 	tss_set_int_stack(locals->arch_state.tss, locals->interrupt_stack_top);
 	tss_set_sched_stack(locals->arch_state.tss, locals->scheduler_stack_top);
+	// Enable extended state
+	fpu_init_on_core();
 }
 
 //! @brief Initialize amd64 tables on BSP
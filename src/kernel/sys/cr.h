@@ -5,6 +5,39 @@
 
 #include <misc/types.h> // For uint64_t
 
+//! @brief Mask of the paging root physical address in CR3
+#define CR3_ADDR_MASK 0x000ffffffffff000ULL
+
+//! @brief Mask of the PCID in CR3 (when CR4.PCIDE is set)
+#define CR3_PCID_MASK 0xfffULL
+
+//! @brief Set in the value written to CR3 to keep TLB entries tagged with the new PCID
+#define CR3_NOFLUSH (1ULL << 63ULL)
+
+//! @brief CR0 bit that makes wait/fwait honor TS flag
+#define CR0_MP (1ULL << 1ULL)
+
+//! @brief CR0 bit that makes x87 and SSE instructions fault
+#define CR0_EM (1ULL << 2ULL)
+
+//! @brief CR0 bit that makes x87 and SSE instructions raise #NM until cleared by clts
+#define CR0_TS (1ULL << 3ULL)
+
+//! @brief CR0 bit that enables native x87 error reporting
+#define CR0_NE (1ULL << 5ULL)
+
+//! @brief CR4 bit that enables fxsave/fxrstor and SSE instructions
+#define CR4_OSFXSR (1ULL << 9ULL)
+
+//! @brief CR4 bit that enables unmasked SIMD floating point exceptions
+#define CR4_OSXMMEXCPT (1ULL << 10ULL)
+
+//! @brief CR4 bit that enables process-context identifiers
+#define CR4_PCIDE (1ULL << 17ULL)
+
+//! @brief CR4 bit that enables XSAVE feature set and XCR0 register
+#define CR4_OSXSAVE (1ULL << 18ULL)
+
 //! @brief Read CR0 value
 //! @return CR0
 inline static uint64_t rdcr0() {
@@ -0,0 +1,357 @@
+//! @file fpu.c
+//! @brief File containing implementation of extended state management
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <lib/string.h>
+#include <lib/target.h>
+#include <mem/heap/heap.h>
+#include <sys/arch/interrupts.h>
+#include <sys/cpuid.h>
+#include <sys/cr.h>
+#include <sys/fpu.h>
+#include <sys/intlevel.h>
+#include <sys/msr.h>
+#include <thread/smp/core.h>
+
+MODULE("sys/fpu")
+TARGET(fpu_available, fpu_init, {idt_available})
+
+//! @brief Device not available exception vector
+#define FPU_NM_VEC 7
+
+//! @brief Logical ID that matches no core
+#define FPU_NO_CPU 0xffffffffU
+
+//! @brief XCR0 bits of x87 and SSE state
+#define FPU_XCR0_SSE 0x3ULL
+
+//! @brief XCR0 bit of AVX state
+#define FPU_XCR0_AVX 0x4ULL
+
+//! @brief XCR0 bits of AVX-512 state (opmask, upper halves of ZMM0-15, ZMM16-31)
+#define FPU_XCR0_AVX512 0xe0ULL
+
+//! @brief Compacted format bit in XCOMP_BV
+#define FPU_XCOMP_BV_COMPACTED (1ULL << 63ULL)
+
+//! @brief IA32_XSS MSR (supervisor state components enabled for XSAVES)
+#define FPU_MSR_XSS 0xda0
+
+//! @brief Offset of FCW in the legacy region of the XSAVE area
+#define FPU_AREA_FCW 0
+
+//! @brief Offset of MXCSR in the legacy region of the XSAVE area
+#define FPU_AREA_MXCSR 24
+
+//! @brief Size of the legacy region of the XSAVE area
+#define FPU_AREA_LEGACY_SIZE 512
+
+//! @brief Default FCW value (all exceptions masked)
+#define FPU_FCW_DEFAULT 0x37f
+
+//! @brief Default MXCSR value (all exceptions masked)
+#define FPU_MXCSR_DEFAULT 0x1f80
+
+//! @brief Save/restore instruction families
+enum fpu_insns
+{
+	//! @brief fxsave/fxrstor
+	FPU_INSNS_FXSAVE,
+	//! @brief xsave/xrstor
+	FPU_INSNS_XSAVE,
+	//! @brief xsaveopt/xrstor (modified optimization)
+	FPU_INSNS_XSAVEOPT,
+	//! @brief xsaves/xrstors (compacted format, modified optimization)
+	FPU_INSNS_XSAVES,
+};
+
+//! @brief Names of instruction families
+static const char *fpu_insns_names[] = {
+    [FPU_INSNS_FXSAVE] = "fxsave",
+    [FPU_INSNS_XSAVE] = "xsave",
+    [FPU_INSNS_XSAVEOPT] = "xsaveopt",
+    [FPU_INSNS_XSAVES] = "xsaves",
+};
+
+//! @brief Size of the XSAVE area
+size_t fpu_area_size = 0;
+
+//! @brief Enabled state components (0 if XSAVE is not supported)
+static uint64_t fpu_xcr0 = 0;
+
+//! @brief Save/restore instructions in use
+static enum fpu_insns fpu_insns = FPU_INSNS_FXSAVE;
+
+//! @brief True if features have been detected
+static bool fpu_detected = false;
+
+//! @brief Write to extended control register
+//! @param reg Register index
+//! @param val New value
+static inline void fpu_xsetbv(uint32_t reg, uint64_t val) {
+	asm volatile("xsetbv" ::"c"(reg), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+//! @brief Set CR0.TS if it is not set already
+//! @param core Pointer to the core state
+static void fpu_set_ts(struct fpu_core_state *core) {
+	if (!core->ts) {
+		wrcr0(rdcr0() | CR0_TS);
+		core->ts = true;
+	}
+}
+
+//! @brief Clear CR0.TS if it is set
+//! @param core Pointer to the core state
+static void fpu_clear_ts(struct fpu_core_state *core) {
+	if (core->ts) {
+		asm volatile("clts");
+		core->ts = false;
+	}
+}
+
+//! @brief Save registers to the XSAVE area
+//! @param area Pointer to the XSAVE area
+static void fpu_save(void *area) {
+	switch (fpu_insns) {
+	case FPU_INSNS_FXSAVE:
+		asm volatile("fxsave64 (%0)" ::"r"(area) : "memory");
+		break;
+	case FPU_INSNS_XSAVE:
+		asm volatile("xsave64 (%0)" ::"r"(area), "a"(0xffffffff), "d"(0xffffffff) : "memory");
+		break;
+	case FPU_INSNS_XSAVEOPT:
+		asm volatile("xsaveopt64 (%0)" ::"r"(area), "a"(0xffffffff), "d"(0xffffffff) : "memory");
+		break;
+	case FPU_INSNS_XSAVES:
+		asm volatile("xsaves64 (%0)" ::"r"(area), "a"(0xffffffff), "d"(0xffffffff) : "memory");
+		break;
+	}
+}
+
+//! @brief Load registers from the XSAVE area
+//! @param area Pointer to the XSAVE area
+static void fpu_restore(void *area) {
+	switch (fpu_insns) {
+	case FPU_INSNS_FXSAVE:
+		asm volatile("fxrstor64 (%0)" ::"r"(area) : "memory");
+		break;
+	case FPU_INSNS_XSAVE:
+	case FPU_INSNS_XSAVEOPT:
+		asm volatile("xrstor64 (%0)" ::"r"(area), "a"(0xffffffff), "d"(0xffffffff) : "memory");
+		break;
+	case FPU_INSNS_XSAVES:
+		asm volatile("xrstors64 (%0)" ::"r"(area), "a"(0xffffffff), "d"(0xffffffff) : "memory");
+		break;
+	}
+}
+
+//! @brief Detect supported state components and save/restore instructions
+static void fpu_detect_features(void) {
+	struct cpuid buf;
+	cpuid(1, 0, &buf);
+	const bool xsave = (buf.ecx & (1U << 26U)) != 0;
+	const bool avx = (buf.ecx & (1U << 28U)) != 0;
+	if (!xsave) {
+		return;
+	}
+	cpuid(0xd, 0, &buf);
+	const uint64_t supported = buf.eax | ((uint64_t)buf.edx << 32ULL);
+	fpu_xcr0 = FPU_XCR0_SSE;
+	if (avx && (supported & FPU_XCR0_AVX) != 0) {
+		fpu_xcr0 |= FPU_XCR0_AVX;
+		// AVX-512 components can only be enabled all at once
+		if ((supported & FPU_XCR0_AVX512) == FPU_XCR0_AVX512) {
+			fpu_xcr0 |= FPU_XCR0_AVX512;
+		}
+	}
+	cpuid(0xd, 1, &buf);
+	if ((buf.eax & (1U << 3U)) != 0) {
+		fpu_insns = FPU_INSNS_XSAVES;
+	} else if ((buf.eax & 1U) != 0) {
+		fpu_insns = FPU_INSNS_XSAVEOPT;
+	} else {
+		fpu_insns = FPU_INSNS_XSAVE;
+	}
+}
+
+//! @brief Compute XSAVE area size for enabled components
+//! @note XSAVE should be enabled on this core
+static void fpu_detect_area_size(void) {
+	struct cpuid buf;
+	if (fpu_xcr0 == 0) {
+		fpu_area_size = FPU_AREA_LEGACY_SIZE;
+	} else if (fpu_insns == FPU_INSNS_XSAVES) {
+		// Size of the compacted area for components enabled in XCR0 and IA32_XSS
+		cpuid(0xd, 1, &buf);
+		fpu_area_size = buf.ebx;
+	} else {
+		// Size of the standard area for components enabled in XCR0
+		cpuid(0xd, 0, &buf);
+		fpu_area_size = buf.ebx;
+	}
+	LOG_INFO("Extended state: xcr0=0x%p, %U bytes, saved with %s", fpu_xcr0, fpu_area_size,
+	         fpu_insns_names[fpu_insns]);
+}
+
+//! @brief Enable extended state on this core
+//! @note Features are detected on the first call, which should happen on BSP
+void fpu_init_on_core(void) {
+	if (!fpu_detected) {
+		fpu_detect_features();
+	}
+	wrcr0((rdcr0() | CR0_MP | CR0_NE) & ~(CR0_EM | CR0_TS));
+	uint64_t cr4 = rdcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+	if (fpu_xcr0 != 0) {
+		cr4 |= CR4_OSXSAVE;
+	}
+	wrcr4(cr4);
+	if (fpu_xcr0 != 0) {
+		fpu_xsetbv(0, fpu_xcr0);
+	}
+	if (fpu_insns == FPU_INSNS_XSAVES) {
+		// No supervisor state components are managed
+		wrmsr(FPU_MSR_XSS, 0);
+	}
+	if (!fpu_detected) {
+		fpu_detect_area_size();
+		fpu_detected = true;
+	}
+	asm volatile("fninit");
+	// Registers belong to no task, first use will trap
+	struct fpu_core_state *core = &PER_CPU(fpu);
+	core->owner = NULL;
+	core->current = NULL;
+	core->live = false;
+	core->ts = false;
+	core->in_kernel = false;
+	fpu_set_ts(core);
+}
+
+//! @brief Allocate extended state for the task
+//! @param state Pointer to the task state
+//! @return True on success, false on allocation failure
+//! @note State starts in init configuration
+bool fpu_task_init(struct fpu_task_state *state) {
+	// Heap objects are naturally aligned, and area is larger than FPU_AREA_ALIGN
+	uint8_t *area = mem_heap_alloc(fpu_area_size);
+	if (area == NULL) {
+		return false;
+	}
+	ASSERT((uintptr_t)area % FPU_AREA_ALIGN == 0, "XSAVE area at 0x%p is misaligned", area);
+	// Zeroed XSAVE header marks all components as being in init state
+	memset(area, 0, fpu_area_size);
+	*(uint16_t *)(area + FPU_AREA_FCW) = FPU_FCW_DEFAULT;
+	*(uint32_t *)(area + FPU_AREA_MXCSR) = FPU_MXCSR_DEFAULT;
+	if (fpu_insns == FPU_INSNS_XSAVES) {
+		uint64_t *xcomp_bv = (uint64_t *)(area + FPU_AREA_LEGACY_SIZE + sizeof(uint64_t));
+		*xcomp_bv = FPU_XCOMP_BV_COMPACTED | fpu_xcr0;
+	}
+	state->area = area;
+	state->last_cpu = FPU_NO_CPU;
+	return true;
+}
+
+//! @brief Free extended state of the task
+//! @param state Pointer to the task state
+//! @note Cores that still have task's registers loaded won't reuse them, as no task can have its
+//! last_cpu set without restoring state on that core first
+void fpu_task_deinit(struct fpu_task_state *state) {
+	struct fpu_core_state *core = &PER_CPU(fpu);
+	if (core->current == state) {
+		// Task is terminating on this core, its registers are dropped without saving
+		core->current = NULL;
+		core->owner = NULL;
+		core->live = false;
+	}
+	mem_heap_free(state->area, fpu_area_size);
+	state->area = NULL;
+}
+
+//! @brief Save state of the task that is being switched out
+//! @param state Pointer to the task state
+//! @note Runs with interrupts disabled
+void fpu_switch_out(struct fpu_task_state *state) {
+	struct fpu_core_state *core = &PER_CPU(fpu);
+	ASSERT(core->current == state, "Switching out task that is not running");
+	// Task may resume on another core, so registers it has touched are saved right away
+	if (core->live) {
+		fpu_save(state->area);
+		core->live = false;
+	}
+	core->current = NULL;
+}
+
+//! @brief Prepare to run task on this core
+//! @param state Pointer to the task state
+//! @note Runs with interrupts disabled
+void fpu_switch_in(struct fpu_task_state *state) {
+	struct fpu_core_state *core = &PER_CPU(fpu);
+	core->current = state;
+	if (core->owner == state && state->last_cpu == PER_CPU(logical_id)) {
+		// Registers still hold task's state
+		fpu_clear_ts(core);
+		core->live = true;
+	} else {
+		fpu_set_ts(core);
+	}
+}
+
+//! @brief Device not available exception handler
+//! @param frame Interrupt frame
+//! @param ctx Unused
+static void fpu_nm_handler(struct interrupt_frame *frame, void *ctx) {
+	(void)ctx;
+	struct fpu_core_state *core = &PER_CPU(fpu);
+	if (core->current == NULL || core->in_kernel) {
+		PANIC("Unexpected #NM at rip=0x%p, cpu=%u", frame->rip, PER_CPU(logical_id));
+	}
+	// State of the previous owner was saved when it was switched out
+	fpu_clear_ts(core);
+	fpu_restore(core->current->area);
+	core->owner = core->current;
+	core->owner->last_cpu = PER_CPU(logical_id);
+	core->live = true;
+}
+
+//! @brief Begin in-kernel SIMD region
+//! @return Interrupt state to pass to fpu_kernel_end
+//! @note Interrupts are disabled in the region. Registers are in init state on entry, their
+//! values are lost on fpu_kernel_end. Regions can't be nested
+bool fpu_kernel_begin(void) {
+	const bool int_state = intlevel_elevate();
+	struct fpu_core_state *core = &PER_CPU(fpu);
+	ASSERT(!core->in_kernel, "Nested in-kernel SIMD region");
+	core->in_kernel = true;
+	if (core->live) {
+		fpu_save(core->owner->area);
+		core->live = false;
+	}
+	// Registers are clobbered, so that the owner reloads its state on the next use
+	core->owner = NULL;
+	fpu_clear_ts(core);
+	const uint32_t mxcsr = FPU_MXCSR_DEFAULT;
+	asm volatile("fninit\n"
+	             "ldmxcsr %0" ::"m"(mxcsr));
+	if ((fpu_xcr0 & FPU_XCR0_AVX) != 0) {
+		// Avoid SSE/AVX transition penalties due to dirty upper halves
+		asm volatile("vzeroupper");
+	}
+	return int_state;
+}
+
+//! @brief End in-kernel SIMD region
+//! @param int_state Value returned by fpu_kernel_begin
+void fpu_kernel_end(bool int_state) {
+	struct fpu_core_state *core = &PER_CPU(fpu);
+	ASSERT(core->in_kernel, "fpu_kernel_end without fpu_kernel_begin");
+	core->in_kernel = false;
+	fpu_set_ts(core);
+	intlevel_recover(int_state);
+}
+
+//! @brief Register #NM handler
+static void fpu_init(void) {
+	interrupt_register_handler(FPU_NM_VEC, fpu_nm_handler, NULL, 0, 0, true);
+}
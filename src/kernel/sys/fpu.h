@@ -0,0 +1,83 @@
+//! @file fpu.h
+//! @brief File containing declarations of extended (x87/SSE/AVX) state management functions
+//!
+//! Every task has an XSAVE area sized from CPUID leaf 0xD. State is saved on switch out only if
+//! the task has touched it during its timeslice, and restored lazily: CR0.TS is set on switch in,
+//! so that the first x87/SIMD instruction raises #NM, which loads task's state. If the task
+//! resumes on the core that still holds its registers, restore is skipped altogether. Saves use
+//! XSAVES or XSAVEOPT when available, so that components in init state or not modified since the
+//! last restore are not written.
+//!
+//! Kernel is built with -mgeneral-regs-only, so SIMD code in the kernel (written in inline
+//! assembly) should be wrapped in fpu_kernel_begin/fpu_kernel_end.
+
+#pragma once
+
+#include <lib/target.h>
+#include <misc/types.h>
+
+//! @brief Alignment of the XSAVE area
+#define FPU_AREA_ALIGN 64
+
+//! @brief Per-task extended state
+struct fpu_task_state {
+	//! @brief Pointer to the XSAVE area
+	void *area;
+	//! @brief Logical ID of the core that has restored state the last time
+	uint32_t last_cpu;
+};
+
+//! @brief Per-core extended state bookkeeping
+struct fpu_core_state {
+	//! @brief State of the task which registers are loaded on this core (may be stale)
+	struct fpu_task_state *owner;
+	//! @brief State of the task running on this core or NULL
+	struct fpu_task_state *current;
+	//! @brief True if registers may have been modified by the owner since they were saved
+	bool live;
+	//! @brief True if CR0.TS is set
+	bool ts;
+	//! @brief True if core is in fpu_kernel_begin/fpu_kernel_end region
+	bool in_kernel;
+};
+
+//! @brief Size of the XSAVE area
+extern size_t fpu_area_size;
+
+//! @brief Enable extended state on this core
+//! @note Features are detected on the first call, which should happen on BSP
+void fpu_init_on_core(void);
+
+//! @brief Allocate extended state for the task
+//! @param state Pointer to the task state
+//! @return True on success, false on allocation failure
+//! @note State starts in init configuration
+bool fpu_task_init(struct fpu_task_state *state);
+
+//! @brief Free extended state of the task
+//! @param state Pointer to the task state
+//! @note May be called by the task that terminates on the scheduler stack
+void fpu_task_deinit(struct fpu_task_state *state);
+
+//! @brief Save state of the task that is being switched out
+//! @param state Pointer to the task state
+//! @note Runs with interrupts disabled
+void fpu_switch_out(struct fpu_task_state *state);
+
+//! @brief Prepare to run task on this core
+//! @param state Pointer to the task state
+//! @note Runs with interrupts disabled
+void fpu_switch_in(struct fpu_task_state *state);
+
+//! @brief Begin in-kernel SIMD region
+//! @return Interrupt state to pass to fpu_kernel_end
+//! @note Interrupts are disabled in the region. Registers are in init state on entry, their
+//! values are lost on fpu_kernel_end. Regions can't be nested
+bool fpu_kernel_begin(void);
+
+//! @brief End in-kernel SIMD region
+//! @param int_state Value returned by fpu_kernel_begin
+void fpu_kernel_end(bool int_state);
+
+//! @brief Export target for #NM handler registration
+EXPORT_TARGET(fpu_available)
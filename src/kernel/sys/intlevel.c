@@ -19,3 +19,11 @@ void intlevel_recover(bool status) {
 		asm volatile("sti");
 	}
 }
+
+//! @brief Check if interrupts are enabled
+//! @return True if interrupts are enabled
+bool intlevel_enabled(void) {
+	uint64_t flags;
+	asm volatile("pushf; pop %0" : "=g"(flags));
+	return (flags & (1 << 9)) != 0;
+}
@@ -12,3 +12,7 @@ bool intlevel_elevate();
 //! @brief Enable interrupts if true is passed
 //! @param status True if interrupts should be enabled
 void intlevel_recover(bool status);
+
+//! @brief Check if interrupts are enabled
+//! @return True if interrupts are enabled
+bool intlevel_enabled(void);
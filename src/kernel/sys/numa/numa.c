@@ -4,13 +4,16 @@
 #include <lib/log.h>
 #include <lib/panic.h>
 #include <mem/bootstrap.h>
+#include <mem/phys/slab.h>
 #include <mem/rc.h>
+#include <sys/acpi/hmat.h>
 #include <sys/acpi/numa.h>
 #include <sys/numa/numa.h>
 #include <thread/locking/spinlock.h>
 
 MODULE("sys/numa")
-TARGET(numa_available, numa_init, {acpi_numa_available, mem_bootstrap_alloc_available})
+TARGET(numa_available, numa_init,
+       {acpi_numa_available, acpi_hmat_available, mem_bootstrap_alloc_available})
 
 //! @brief Number of nodes detected on the system
 numa_id_t numa_nodes_count;
@@ -21,9 +24,84 @@ struct numa_node *numa_nodes;
 //! @brief Size of NUMA nodes array
 numa_id_t numa_nodes_size;
 
-//! @brief Initialize neighbours array by iterating node lists
-//! @param id ID of the node for which neighbour lists should be initialized
-static void numa_init_neighbour_list(numa_id_t id) {
+//! @brief Neighbours comparator type
+//! @param id ID of the node neighbours are sorted for
+//! @param lhs ID of the first neighbour
+//! @param rhs ID of the second neighbour
+//! @return True if lhs should be placed before rhs
+typedef bool (*numa_neighbours_cmp_t)(numa_id_t id, numa_id_t lhs, numa_id_t rhs);
+
+//! @brief Compare values where 0 means unknown. Unknown values are ranked last
+//! @param lhs First value
+//! @param rhs Second value
+//! @param larger_first True if larger values are better
+//! @return -1 if lhs is better, 1 if rhs is better, 0 otherwise
+static int numa_compare_known(uint64_t lhs, uint64_t rhs, bool larger_first) {
+	if (lhs == rhs) {
+		return 0;
+	} else if (lhs == 0) {
+		return 1;
+	} else if (rhs == 0) {
+		return -1;
+	}
+	return ((lhs < rhs) != larger_first) ? -1 : 1;
+}
+
+//! @brief Get HMAT attributes of accesses to target from the node's initiator
+//! @param id ID of the node
+//! @param target ID of the target node
+//! @param buf Buffer to store attributes in
+static void numa_get_perf(numa_id_t id, numa_id_t target, struct acpi_hmat_perf *buf) {
+	// Memory-only nodes are ranked from the perspective of their attached initiator
+	acpi_hmat_get_perf(acpi_hmat_get_initiator(id), target, buf);
+}
+
+//! @brief Compare neighbours by latency, then by bandwidth, then by SLIT distance
+//! @param id ID of the node neighbours are sorted for
+//! @param lhs ID of the first neighbour
+//! @param rhs ID of the second neighbour
+//! @return True if lhs should be placed before rhs
+static bool numa_closer_by_latency(numa_id_t id, numa_id_t lhs, numa_id_t rhs) {
+	struct acpi_hmat_perf lhs_perf, rhs_perf;
+	numa_get_perf(id, lhs, &lhs_perf);
+	numa_get_perf(id, rhs, &rhs_perf);
+	int result = numa_compare_known(lhs_perf.read_latency, rhs_perf.read_latency, false);
+	if (result == 0) {
+		result = numa_compare_known(lhs_perf.write_latency, rhs_perf.write_latency, false);
+	}
+	if (result == 0) {
+		result = numa_compare_known(lhs_perf.read_bandwidth, rhs_perf.read_bandwidth, true);
+	}
+	if (result == 0) {
+		return acpi_numa_get_distance(id, lhs) < acpi_numa_get_distance(id, rhs);
+	}
+	return result < 0;
+}
+
+//! @brief Compare neighbours by bandwidth, then by latency, then by SLIT distance
+//! @param id ID of the node neighbours are sorted for
+//! @param lhs ID of the first neighbour
+//! @param rhs ID of the second neighbour
+//! @return True if lhs should be placed before rhs
+static bool numa_closer_by_bandwidth(numa_id_t id, numa_id_t lhs, numa_id_t rhs) {
+	struct acpi_hmat_perf lhs_perf, rhs_perf;
+	numa_get_perf(id, lhs, &lhs_perf);
+	numa_get_perf(id, rhs, &rhs_perf);
+	int result = numa_compare_known(lhs_perf.read_bandwidth, rhs_perf.read_bandwidth, true);
+	if (result == 0) {
+		result = numa_compare_known(lhs_perf.write_bandwidth, rhs_perf.write_bandwidth, true);
+	}
+	if (result == 0) {
+		return numa_closer_by_latency(id, lhs, rhs);
+	}
+	return result < 0;
+}
+
+//! @brief Create neighbours array sorted with a given comparator
+//! @param id ID of the node for which neighbour list should be created
+//! @param cmp Neighbours comparator
+//! @return Pointer to the neighbours array
+static numa_id_t *numa_create_neighbour_list(numa_id_t id, numa_neighbours_cmp_t cmp) {
 	numa_id_t *neighbours_array = mem_bootstrap_alloc(numa_nodes_count * sizeof(numa_id_t));
 	size_t currrent_index = 0;
 	for (size_t i = 0; i < numa_nodes_size; ++i) {
@@ -32,12 +110,12 @@ static void numa_init_neighbour_list(numa_id_t id) {
 		}
 	}
 	for (size_t i = 0; i < numa_nodes_count; ++i) {
-		numa_id_t minimum_id = i;
-		numa_distance_t minimum_distance = acpi_numa_get_distance(id, neighbours_array[i]);
+		size_t minimum_id = i;
 		for (size_t j = i + 1; j < numa_nodes_count; ++j) {
-			numa_distance_t new_distance = acpi_numa_get_distance(id, neighbours_array[j]);
-			if (new_distance < minimum_distance) {
-				minimum_distance = new_distance;
+			// Node itself always goes first, so that allocations on its behalf stay local
+			const numa_id_t candidate = neighbours_array[j];
+			const numa_id_t current = neighbours_array[minimum_id];
+			if (current != id && (candidate == id || cmp(id, candidate, current))) {
 				minimum_id = j;
 			}
 		}
@@ -45,8 +123,19 @@ static void numa_init_neighbour_list(numa_id_t id) {
 		neighbours_array[i] = neighbours_array[minimum_id];
 		neighbours_array[minimum_id] = tmp;
 	}
+	return neighbours_array;
+}
+
+//! @brief Initialize neighbours arrays by iterating node lists
+//! @param id ID of the node for which neighbour lists should be initialized
+static void numa_init_neighbour_list(numa_id_t id) {
 	struct numa_node *self = numa_nodes + id;
-	self->neighbours = neighbours_array;
+	self->neighbours = numa_create_neighbour_list(id, numa_closer_by_latency);
+	if (acpi_boot_hmat != NULL) {
+		self->bandwidth_neighbours = numa_create_neighbour_list(id, numa_closer_by_bandwidth);
+	} else {
+		self->bandwidth_neighbours = self->neighbours;
+	}
 }
 
 //! @brief Dump NUMA nodes
@@ -59,7 +148,16 @@ static void numa_dump_nodes(void) {
 		for (size_t j = 0; j < numa_nodes_count; ++j) {
 			log_printf("%%\033[32m%u\033[0m, ", numa_nodes[i].neighbours[j]);
 		}
+		log_printf("}, bandwidth_neighbours: { ");
+		for (size_t j = 0; j < numa_nodes_count; ++j) {
+			log_printf("%%\033[32m%u\033[0m, ", numa_nodes[i].bandwidth_neighbours[j]);
+		}
 		log_printf("} }\n");
+		struct acpi_hmat_cache_info cache;
+		for (uint8_t level = 1; acpi_hmat_get_cache(i, level, &cache); ++level) {
+			log_printf("Node %%\033[36m%u\033[0m: memory side cache L%u: %U bytes, line %u\n", i,
+			           (uint32_t)cache.level, cache.size, (uint32_t)cache.line_size);
+		}
 	}
 }
 
@@ -92,6 +190,12 @@ static void numa_init(void) {
 		if (!numa_nodes[buf].initialized) {
 			numa_nodes[buf].initialized = true;
 			numa_nodes[buf].slab_data = MEM_HEAP_SLAB_DATA_INIT;
+			numa_nodes[buf].numa_stats = MEM_STATS_NUMA_INIT;
+			numa_nodes[buf].zero_pool = MEM_PHYS_ZERO_POOL_INIT;
+			numa_nodes[buf].watermarks = MEM_WATERMARKS_INIT;
+			numa_nodes[buf].huge_reserve = PHYS_NULL;
+			numa_nodes[buf].huge_reserve_count = 0;
+			numa_nodes[buf].huge_reserve_target = 0;
 			numa_nodes[buf].lock = THREAD_SPINLOCK_INIT;
 			numa_nodes[buf].ranges = NULL;
 			numa_nodes_count++;
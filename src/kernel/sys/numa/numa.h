@@ -5,7 +5,10 @@
 
 #include <lib/target.h>
 #include <mem/heap/slab.h>
+#include <mem/phys/zero.h>
 #include <mem/rc.h>
+#include <mem/stats.h>
+#include <mem/watermarks.h>
 #include <thread/locking/spinlock.h>
 
 //! @brief Type of NUMA node ID
@@ -18,11 +21,30 @@ typedef uint32_t numa_distance_t;
 struct numa_node {
 	//! @brief Neighbours sorted by distance (from the smallest to the largest)
 	//! @note Includes self for convinience
+	//! @note If HMAT is present, distance is read latency from the node's initiator, with bandwidth
+	//! and SLIT distance used to break ties
 	numa_id_t *neighbours;
+	//! @brief Neighbours sorted by read bandwidth from the node's initiator (from the largest to
+	//! the smallest). Same as neighbours if HMAT is not present
+	numa_id_t *bandwidth_neighbours;
 	//! @brief Memory ranges
 	struct mem_range *ranges;
 	//! @brief Heap slabs on this node
 	struct mem_heap_slab_data slab_data;
+	//! @brief NUMA placement statistics
+	struct mem_stats_numa numa_stats;
+	//! @brief Pool of pre-zeroed pages
+	struct mem_phys_zero_pool zero_pool;
+	//! @brief Memory pressure watermarks
+	struct mem_watermarks watermarks;
+	//! @brief 1 GiB blocks reserved for huge page allocations, linked through their first 8 bytes.
+	//! Guarded by node's lock
+	uintptr_t huge_reserve;
+	//! @brief Number of reserved 1 GiB blocks. Guarded by node's lock
+	size_t huge_reserve_count;
+	//! @brief Number of 1 GiB blocks node keeps reserved. Freed 1 GiB blocks are put back in the
+	//! reserve until it is full. Set once deferred PMM initialization is finished
+	size_t huge_reserve_target;
 	//! @brief Node's lock
 	struct thread_spinlock lock;
 	//! @brief True if node's data was initialized
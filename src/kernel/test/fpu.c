@@ -0,0 +1,90 @@
+//! @file fpu.c
+//! @brief File containing extended state switching tests
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <lib/string.h>
+#include <lib/target.h>
+#include <misc/atomics.h>
+#include <sys/fpu.h>
+#include <thread/tasking/balancer.h>
+#include <thread/tasking/localsched.h>
+#include <thread/tasking/tasking.h>
+
+MODULE("test/fpu")
+
+//! @brief Number of tasks using SSE registers concurrently
+#define TEST_FPU_THREADS_NO 8
+
+//! @brief Number of context switches each task goes through
+#define TEST_FPU_ITERATIONS 256
+
+//! @brief In-kernel SIMD region is entered every TEST_FPU_KERNEL_PERIOD iterations
+#define TEST_FPU_KERNEL_PERIOD 16
+
+//! @brief Size of the buffer copied in the in-kernel SIMD region
+#define TEST_FPU_COPY_SIZE 64
+
+//! @brief Number of tasks that are yet to finish
+static size_t test_fpu_yet_to_finish = TEST_FPU_THREADS_NO;
+
+//! @brief Copy buffer with SSE registers
+//! @param dst Destination buffer of TEST_FPU_COPY_SIZE bytes
+//! @param src Source buffer of TEST_FPU_COPY_SIZE bytes
+static void test_fpu_sse_copy(uint8_t *dst, const uint8_t *src) {
+	const bool int_state = fpu_kernel_begin();
+	asm volatile("movdqu 0(%1), %%xmm0\n"
+	             "movdqu 16(%1), %%xmm1\n"
+	             "movdqu 32(%1), %%xmm2\n"
+	             "movdqu 48(%1), %%xmm3\n"
+	             "movdqu %%xmm0, 0(%0)\n"
+	             "movdqu %%xmm1, 16(%0)\n"
+	             "movdqu %%xmm2, 32(%0)\n"
+	             "movdqu %%xmm3, 48(%0)\n" ::"r"(dst),
+	             "r"(src)
+	             : "memory");
+	fpu_kernel_end(int_state);
+}
+
+//! @brief Task that keeps values in SSE registers across context switches
+//! @param id Task index
+static void test_fpu_thread(uintptr_t id) {
+	const uint64_t pattern = 0x0101010101010101ULL * (id + 1);
+	for (size_t i = 0; i < TEST_FPU_ITERATIONS; ++i) {
+		// Registers are loaded outside of in-kernel regions, like userspace would do
+		const uint64_t expected = pattern ^ i;
+		asm volatile("movq %0, %%xmm5" ::"r"(expected));
+		thread_localsched_yield();
+		if (i % TEST_FPU_KERNEL_PERIOD == 0) {
+			// In-kernel region clobbers registers, they are reloaded from the XSAVE area
+			uint8_t src[TEST_FPU_COPY_SIZE], dst[TEST_FPU_COPY_SIZE];
+			memset(src, (int)id, TEST_FPU_COPY_SIZE);
+			test_fpu_sse_copy(dst, src);
+			ASSERT(memcmp(src, dst, TEST_FPU_COPY_SIZE) == 0, "SSE copy corrupted data");
+		}
+		uint64_t actual;
+		asm volatile("movq %%xmm5, %0" : "=r"(actual));
+		ASSERT(actual == expected, "xmm5 corrupted in task %U: 0x%p instead of 0x%p", id, actual,
+		       expected);
+	}
+	ATOMIC_FETCH_DECREMENT(&test_fpu_yet_to_finish);
+	thread_localsched_terminate();
+}
+
+//! @brief Extended state test
+void test_fpu(void) {
+	uint8_t src[TEST_FPU_COPY_SIZE], dst[TEST_FPU_COPY_SIZE];
+	for (size_t i = 0; i < TEST_FPU_COPY_SIZE; ++i) {
+		src[i] = (uint8_t)i;
+	}
+	test_fpu_sse_copy(dst, src);
+	ASSERT(memcmp(src, dst, TEST_FPU_COPY_SIZE) == 0, "SSE copy corrupted data");
+	for (size_t i = 0; i < TEST_FPU_THREADS_NO; ++i) {
+		struct thread_task *task = thread_task_create_call(CALLBACK_VOID(test_fpu_thread, i));
+		ASSERT(task != NULL, "Failed to allocate test thread for extended state test");
+		thread_balancer_allocate_to_any(task);
+	}
+	while (ATOMIC_ACQUIRE_LOAD(&test_fpu_yet_to_finish) != 0) {
+		thread_localsched_yield();
+	}
+}
@@ -1,11 +1,15 @@
 //! @file rpc.c
 //! @brief File containing code for paging test
 
+#include <lib/log.h>
 #include <lib/panic.h>
 #include <lib/target.h>
 #include <mem/phys/phys.h>
+#include <mem/virt/invtlb.h>
 #include <mem/virt/paging.h>
+#include <mem/virt/vmalloc.h>
 #include <misc/atomics.h>
+#include <sys/intlevel.h>
 #include <thread/smp/core.h>
 #include <thread/tasking/balancer.h>
 #include <thread/tasking/localsched.h>
@@ -16,9 +20,78 @@ MODULE("test/paging")
 //! @brief Test thread count
 #define TEST_PAGING_THREADS_NO 1
 
+//! @brief Number of pages in the range test. Range crosses last level table boundary
+#define TEST_PAGING_RANGE_PAGES 600
+
+//! @brief Number of pages in the demand paging test range
+#define TEST_PAGING_DEMAND_PAGES 64
+
+//! @brief Fault-around window of the demand paging test range
+#define TEST_PAGING_DEMAND_AROUND 8
+
+//! @brief Mask of the physical address in the page table entry
+#define TEST_PAGING_ADDR_MASK 0x000ffffffffff000ULL
+
+//! @brief Page size flag of the page table entry
+#define TEST_PAGING_FLAG_HUGE (1ULL << 7ULL)
+
 //! @brief Pointer to the paging root;
 static struct mem_paging_root *test_paging_root;
 
+//! @brief Find entry that maps a given address
+//! @param cr3 Physical address of the root table
+//! @param vaddr Virtual address
+//! @param level Buffer to store level of the table entry belongs to
+//! @return Leaf entry or 0 if nothing is mapped at vaddr
+static uintptr_t test_paging_leaf(uintptr_t cr3, uintptr_t vaddr, uint8_t *level) {
+	uintptr_t table = cr3;
+	for (uint8_t i = mem_5level_paging_enabled ? 5 : 4;; --i) {
+		const uintptr_t *entries = (const uintptr_t *)(mem_wb_phys_win_base + table);
+		const uintptr_t entry = entries[(vaddr >> (9 * i + 3)) & 0777ULL];
+		if (entry == 0 || i == 1 || (entry & TEST_PAGING_FLAG_HUGE) != 0) {
+			*level = i;
+			return entry;
+		}
+		table = entry & TEST_PAGING_ADDR_MASK;
+	}
+}
+
+//! @brief Check that all replicas of the test root map the range the same way primary tables do
+//! @param vaddr Start of the range. Should be page size aligned
+//! @param count Number of 4k pages in the range
+static void test_paging_check_replicas(uintptr_t vaddr, size_t count) {
+	const uintptr_t primary = mem_paging_root_cr3(test_paging_root);
+	for (numa_id_t id = 0; id < numa_nodes_size; ++id) {
+		const uintptr_t replica = mem_paging_replica_cr3(test_paging_root, id);
+		if (replica == PHYS_NULL) {
+			continue;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			const uintptr_t current = vaddr + i * PAGE_SIZE;
+			uint8_t expected_level, actual_level;
+			const uintptr_t expected = test_paging_leaf(primary, current, &expected_level);
+			const uintptr_t actual = test_paging_leaf(replica, current, &actual_level);
+			// Empty entries may be found at different levels, as replicas only have tables that
+			// were needed at the time of sync
+			ASSERT(expected == actual && (expected == 0 || expected_level == actual_level),
+			       "Replica on node %u maps 0x%p to 0x%p instead of 0x%p", id, current, actual,
+			       expected);
+		}
+	}
+}
+
+//! @brief Count replicas of the test root
+//! @return Number of nodes with replica tables
+static size_t test_paging_count_replicas(void) {
+	size_t result = 0;
+	for (numa_id_t id = 0; id < numa_nodes_size; ++id) {
+		if (mem_paging_replica_cr3(test_paging_root, id) != PHYS_NULL) {
+			result++;
+		}
+	}
+	return result;
+}
+
 //! @brief Number of threads yet to finish
 size_t test_paging_yet_to_finish = TEST_PAGING_THREADS_NO;
 
@@ -46,11 +119,181 @@ static void test_paging_thread(uintptr_t vaddr) {
 	thread_localsched_terminate();
 }
 
+//! @brief Test huge page mapping and splitting in the current paging root
+static void test_paging_huge(void) {
+	const uintptr_t vaddr = MEM_PHYS_HUGE_2M_SIZE;
+	const uintptr_t huge = mem_phys_alloc_specific(MEM_PHYS_HUGE_2M_SIZE, PER_CPU(numa_id));
+	ASSERT(huge != PHYS_NULL, "Failed to allocate huge page for paging test");
+	bool res = mem_paging_map_huge(test_paging_root, vaddr, huge, MEM_PHYS_HUGE_2M_SIZE,
+	                               MEM_PAGING_READABLE | MEM_PAGING_USER | MEM_PAGING_WRITABLE);
+	ASSERT(res, "Failed to map huge page 0x%p at 0x%p", huge, vaddr);
+	test_paging_check_replicas(vaddr, MEM_PHYS_HUGE_2M_SIZE / PAGE_SIZE);
+	// Mapped huge page is not replaced silently
+	res = mem_paging_map_huge(test_paging_root, vaddr, huge, MEM_PHYS_HUGE_2M_SIZE,
+	                          MEM_PAGING_READABLE | MEM_PAGING_USER | MEM_PAGING_WRITABLE);
+	ASSERT(!res, "Huge page at 0x%p was mapped over existing one", vaddr);
+	// Page has not been mapped before, so there are no stale TLB entries yet
+	*(volatile uint64_t *)(vaddr + PAGE_SIZE) = 0xdeadbeef;
+	if (*(volatile uint64_t *)(mem_wb_phys_win_base + huge + PAGE_SIZE) != 0xdeadbeef) {
+		PANIC("Write through huge page mapping did not reach physical page 0x%p", huge);
+	}
+	// Unmapping 4k part splits the huge page, and the part can be freed on its own
+	const uintptr_t part = mem_paging_unmap_at(test_paging_root, vaddr + PAGE_SIZE);
+	ASSERT(part == huge + PAGE_SIZE, "Invalid part of split huge page (expected 0x%p, got 0x%p)",
+	       huge + PAGE_SIZE, part);
+	mem_phys_free(part);
+	test_paging_check_replicas(vaddr, MEM_PHYS_HUGE_2M_SIZE / PAGE_SIZE);
+	const uintptr_t unmapped =
+	    mem_paging_unmap_huge(test_paging_root, vaddr, MEM_PHYS_HUGE_2M_SIZE);
+	ASSERT(unmapped == PHYS_NULL, "Split huge page was unmapped as a whole");
+	// Remaining parts are freed along with the paging root
+}
+
+//! @brief Test batched range mapping and unmapping in the current paging root
+static void test_paging_range(void) {
+	static uintptr_t pages[TEST_PAGING_RANGE_PAGES];
+	static uintptr_t frames[TEST_PAGING_RANGE_PAGES];
+	const uintptr_t vaddr = 4 * MEM_PHYS_HUGE_2M_SIZE - 100 * PAGE_SIZE;
+	for (size_t i = 0; i < TEST_PAGING_RANGE_PAGES; ++i) {
+		pages[i] = mem_phys_alloc_on_behalf(PAGE_SIZE, PER_CPU(numa_id));
+		ASSERT(pages[i] != PHYS_NULL, "Failed to allocate page for paging test");
+	}
+	bool res = mem_paging_map_range(test_paging_root, vaddr, pages, TEST_PAGING_RANGE_PAGES,
+	                                MEM_PAGING_READABLE | MEM_PAGING_USER | MEM_PAGING_WRITABLE);
+	ASSERT(res, "Failed to map range at 0x%p", vaddr);
+	test_paging_check_replicas(vaddr, TEST_PAGING_RANGE_PAGES);
+	const size_t unmapped =
+	    mem_paging_unmap_range(test_paging_root, vaddr, TEST_PAGING_RANGE_PAGES, frames);
+	ASSERT(unmapped == TEST_PAGING_RANGE_PAGES, "Unmapped %U pages instead of %U", unmapped,
+	       TEST_PAGING_RANGE_PAGES);
+	test_paging_check_replicas(vaddr, TEST_PAGING_RANGE_PAGES);
+	// Test thread may still have range in its TLB
+	mem_paging_shootdown_range(test_paging_root, vaddr, TEST_PAGING_RANGE_PAGES);
+	for (size_t i = 0; i < TEST_PAGING_RANGE_PAGES; ++i) {
+		ASSERT(frames[i] == pages[i], "Invalid frame at index %U (expected 0x%p, got 0x%p)", i,
+		       pages[i], frames[i]);
+		mem_phys_free(frames[i]);
+	}
+	// Range is empty now, tables are left in place
+	const size_t again =
+	    mem_paging_unmap_range(test_paging_root, vaddr, TEST_PAGING_RANGE_PAGES, frames);
+	ASSERT(again == 0, "Unmapped %U pages from the empty range", again);
+}
+
+//! @brief Test that reserved ranges are populated with zeroed pages on first touch
+static void test_paging_demand(void) {
+	const uintptr_t vaddr = 8 * MEM_PHYS_HUGE_2M_SIZE;
+	const size_t size = TEST_PAGING_DEMAND_PAGES * PAGE_SIZE;
+	bool res = mem_paging_reserve(test_paging_root, vaddr, size,
+	                              MEM_PAGING_READABLE | MEM_PAGING_USER | MEM_PAGING_WRITABLE,
+	                              TEST_PAGING_DEMAND_AROUND);
+	ASSERT(res, "Failed to reserve range at 0x%p", vaddr);
+	res = mem_paging_reserve(test_paging_root, vaddr + size - PAGE_SIZE, PAGE_SIZE,
+	                         MEM_PAGING_READABLE | MEM_PAGING_USER, 1);
+	ASSERT(!res, "Overlapping range was reserved");
+	// Faults are taken with interrupts disabled, so that test task stays on this root
+	const bool int_state = intlevel_elevate();
+	volatile uint64_t *page = (volatile uint64_t *)(vaddr + 3 * PAGE_SIZE);
+	ASSERT(*page == 0, "Page populated on first touch is not zeroed");
+	*page = 0xdeadbeef;
+	// Neighbours in the fault-around window were populated by the same fault
+	volatile uint64_t *neighbour = (volatile uint64_t *)(vaddr + 5 * PAGE_SIZE);
+	ASSERT(*neighbour == 0, "Page populated by fault-around is not zeroed");
+	ASSERT(*page == 0xdeadbeef, "Write to populated page was lost");
+	intlevel_recover(int_state);
+	test_paging_check_replicas(vaddr, TEST_PAGING_DEMAND_PAGES);
+	ASSERT(mem_paging_release(test_paging_root, vaddr), "Failed to release range at 0x%p", vaddr);
+	test_paging_check_replicas(vaddr, TEST_PAGING_DEMAND_PAGES);
+	ASSERT(!mem_paging_release(test_paging_root, vaddr), "Range at 0x%p was released twice",
+	       vaddr);
+}
+
+//! @brief Test copy-on-write duplication of the paging root
+static void test_paging_cow(void) {
+	const uintptr_t vaddr = 9 * MEM_PHYS_HUGE_2M_SIZE;
+	bool res = mem_paging_reserve(test_paging_root, vaddr, PAGE_SIZE,
+	                              MEM_PAGING_READABLE | MEM_PAGING_USER | MEM_PAGING_WRITABLE, 1);
+	ASSERT(res, "Failed to reserve range at 0x%p", vaddr);
+	volatile uint64_t *page = (volatile uint64_t *)vaddr;
+	*page = 1;
+	struct mem_paging_root *copy = mem_paging_duplicate(test_paging_root);
+	ASSERT(copy != NULL, "Failed to duplicate paging root");
+	// Source pages became read-only copy-on-write in replicas as well
+	test_paging_check_replicas(vaddr, 1);
+	// Write in the source root copies the page, copy still sees the old contents
+	*page = 2;
+	mem_paging_switch_to(copy);
+	ASSERT(*page == 1, "Write to the source root is visible in its copy");
+	// Frame is not shared anymore, so it is reused in place
+	*page = 3;
+	mem_paging_switch_to(test_paging_root);
+	ASSERT(*page == 2, "Write to the copy is visible in the source root");
+	test_paging_check_replicas(vaddr, 1);
+	ASSERT(mem_paging_release(copy, vaddr), "Reserved range was not copied");
+	MEM_REF_DROP(copy);
+	ASSERT(mem_paging_release(test_paging_root, vaddr), "Failed to release range at 0x%p", vaddr);
+}
+
+//! @brief Test that large vmalloc areas are backed by 2 MB pages
+static void test_paging_vmalloc_huge(void) {
+	const size_t size = 2 * MEM_PHYS_HUGE_2M_SIZE + PAGE_SIZE;
+	uint8_t *area = mem_vmalloc_alloc_zeroed_on_behalf(size, PER_CPU(numa_id));
+	ASSERT(area != NULL, "Failed to allocate vmalloc area for paging test");
+	ASSERT((uintptr_t)area % MEM_PHYS_HUGE_2M_SIZE == 0, "vmalloc area 0x%p is not 2 MB aligned",
+	       area);
+	size_t page_size = 0;
+	const uintptr_t page = mem_paging_kernel_lookup((uintptr_t)area + PAGE_SIZE, &page_size);
+	if (page_size != MEM_PHYS_HUGE_2M_SIZE) {
+		// Not an error, as PMM may be out of 2 MB blocks on this node
+		LOG_WARN("vmalloc area at 0x%p is backed by pages of size 0x%p", area, page_size);
+	} else if (mem_paging_kernel_translate((uintptr_t)area + PAGE_SIZE) != page + PAGE_SIZE) {
+		PANIC("Invalid translation of the address inside 2 MB page");
+	}
+	for (size_t i = 0; i < size; i += PAGE_SIZE) {
+		ASSERT(area[i] == 0, "vmalloc area at 0x%p is not zeroed", area);
+		area[i] = 1;
+	}
+	mem_vmalloc_free(area, size);
+}
+
+//! @brief Test that lazy vmalloc areas are backed on first touch, whole 2 MB chunks by 2 MB pages
+static void test_paging_vmalloc_lazy(void) {
+	const size_t size = 2 * MEM_PHYS_HUGE_2M_SIZE + PAGE_SIZE;
+	uint8_t *area = mem_vmalloc_alloc_lazy(size, NULL);
+	ASSERT(area != NULL, "Failed to reserve lazy vmalloc area for paging test");
+	ASSERT((uintptr_t)area % MEM_PHYS_HUGE_2M_SIZE == 0,
+	       "Lazy vmalloc area 0x%p is not 2 MB aligned", area);
+	ASSERT(mem_paging_kernel_translate((uintptr_t)area) == PHYS_NULL,
+	       "Lazy vmalloc area at 0x%p is populated before first touch", area);
+	ASSERT(area[PAGE_SIZE] == 0, "Lazy vmalloc area at 0x%p is not zeroed", area);
+	size_t page_size = 0;
+	mem_paging_kernel_lookup((uintptr_t)area + PAGE_SIZE, &page_size);
+	if (page_size != MEM_PHYS_HUGE_2M_SIZE) {
+		// Not an error, as PMM may be out of 2 MB blocks on this node
+		LOG_WARN("Lazy vmalloc area at 0x%p is backed by pages of size 0x%p", area, page_size);
+	}
+	// Tail is not a whole 2 MB chunk and is backed by 4k pages
+	area[size - 1] = 1;
+	mem_paging_kernel_lookup((uintptr_t)area + size - 1, &page_size);
+	ASSERT(page_size == PAGE_SIZE, "Tail of lazy vmalloc area is backed by page of size 0x%p",
+	       page_size);
+	for (size_t i = 0; i < size; i += PAGE_SIZE) {
+		ASSERT(area[i] == 0, "Lazy vmalloc area at 0x%p is not zeroed", area);
+		area[i] = 1;
+	}
+	mem_vmalloc_free_lazy(area, size);
+}
+
 //! @brief Paging test
 void test_paging() {
 	// Create new paging context
 	test_paging_root = mem_paging_new_root();
 	ASSERT(test_paging_root != NULL, "Failed to allocate paging root for paging test");
+	// Tests below change mappings of the replicated root, which keeps replicas in sync
+	ASSERT(mem_paging_replicate(test_paging_root), "Failed to replicate paging root");
+	if (test_paging_count_replicas() == 0) {
+		LOG_INFO("No other NUMA nodes with cores, replica consistency checks are skipped");
+	}
 	// Remember current cr3
 	uintptr_t cr3 = rdcr3();
 	// Switch to the new paging context
@@ -66,8 +309,17 @@ void test_paging() {
 	while (ATOMIC_ACQUIRE_LOAD(&test_paging_yet_to_finish) != 0) {
 		asm volatile("pause");
 	}
+	test_paging_huge();
+	test_paging_range();
+	test_paging_demand();
+	test_paging_cow();
 	// Recover CR3
-	wrcr3(cr3);
+	const bool int_state = intlevel_elevate();
+	thread_localsched_get_current_task()->cr3 = cr3 & CR3_ADDR_MASK;
+	mem_virt_invtlb_update_cr3(rdcr3(), cr3);
+	intlevel_recover(int_state);
 	// Destroy test paging root
 	MEM_REF_DROP(test_paging_root);
+	test_paging_vmalloc_huge();
+	test_paging_vmalloc_lazy();
 }
@@ -0,0 +1,137 @@
+//! @file phys.c
+//! @brief File containing tests for physical memory allocation
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <lib/progress.h>
+#include <lib/target.h>
+#include <mem/misc.h>
+#include <mem/phys/phys.h>
+#include <mem/phys/slab.h>
+#include <misc/types.h>
+#include <thread/smp/core.h>
+
+MODULE("test/phys")
+
+//! @brief Size of the memory range test slab manages
+#define ARENA_SIZE (16 * 1024 * 1024)
+//! @brief Maximum number of kept-alive blocks
+#define MAX_OBJ 256
+//! @brief Maximum block size in pages
+#define MAX_PAGES 8
+//! @brief Number of iterations (allocation/free attempts)
+#define ITERATIONS 65536
+//! @brief Progress bar size
+#define PROGRESS_BAR_SIZE 50
+//! @brief Number of 2 MiB blocks allocated at once in huge blocks test
+#define HUGE_BLOCKS 4
+
+//! @brief Tag block with a given value
+static void test_phys_tag(uintptr_t block, size_t size, size_t val) {
+	*(size_t *)(mem_wb_phys_win_base + block) = val;
+	*(size_t *)(mem_wb_phys_win_base + block + size - sizeof(size_t)) = val;
+}
+
+//! @brief Assert that block is still tagged with a given value
+static void test_phys_assert_tagged(uintptr_t block, size_t size, size_t val) {
+	if (*(size_t *)(mem_wb_phys_win_base + block) != val ||
+	    *(size_t *)(mem_wb_phys_win_base + block + size - sizeof(size_t)) != val) {
+		PANIC("Overlapping physical blocks detected");
+	}
+}
+
+//! @brief Physical memory slab fragmentation stress test
+void test_phys_fragmentation(void) {
+	uintptr_t arena = mem_phys_alloc_on_behalf(ARENA_SIZE, PER_CPU(numa_id));
+	if (arena == PHYS_NULL) {
+		PANIC("Failed to allocate test arena");
+	}
+	struct mem_phys_slab slab;
+	mem_phys_slab_init(&slab, arena, ARENA_SIZE);
+	const size_t initial_max_order = mem_phys_slab_max_free_order(&slab);
+	if (initial_max_order == MEM_PHYS_SLAB_ORDERS_COUNT) {
+		PANIC("Test slab is empty");
+	}
+	// Random churn with blocks of different sizes
+	size_t prng_current = 3847;
+	uintptr_t blocks[MAX_OBJ] = {PHYS_NULL};
+	size_t sizes[MAX_OBJ] = {0};
+	for (size_t i = 0; i < ITERATIONS; ++i) {
+		progress_bar(i, ITERATIONS, PROGRESS_BAR_SIZE);
+		uint8_t index = (uint8_t)prng_current;
+		prng_current = ((prng_current + 1) * 17 + 19) % MAX_OBJ;
+		if (blocks[index] == PHYS_NULL) {
+			size_t size = (prng_current % MAX_PAGES + 1) * PAGE_SIZE;
+			prng_current = ((prng_current + 1) * 17 + 19) % MAX_OBJ;
+			blocks[index] = mem_phys_slab_alloc(&slab, size);
+			if (blocks[index] == PHYS_NULL) {
+				PANIC("Out of memory with at most %U bytes in use",
+				      (size_t)MAX_OBJ * MAX_PAGES * PAGE_SIZE);
+			}
+			sizes[index] = size;
+			test_phys_tag(blocks[index], size, index);
+		} else {
+			test_phys_assert_tagged(blocks[index], sizes[index], index);
+			mem_phys_slab_free(&slab, blocks[index], sizes[index]);
+			blocks[index] = PHYS_NULL;
+		}
+	}
+	progress_bar(ITERATIONS, ITERATIONS, PROGRESS_BAR_SIZE);
+	log_printf("\n");
+	for (size_t i = 0; i < MAX_OBJ; ++i) {
+		if (blocks[i] != PHYS_NULL) {
+			test_phys_assert_tagged(blocks[i], sizes[i], i);
+			mem_phys_slab_free(&slab, blocks[i], sizes[i]);
+		}
+	}
+	// All buddies should have been merged back
+	if (mem_phys_slab_max_free_order(&slab) != initial_max_order) {
+		PANIC("Largest free block order is %U after churn, expected %U",
+		      mem_phys_slab_max_free_order(&slab), initial_max_order);
+	}
+	const uintptr_t large = mem_phys_slab_alloc(&slab, 1ULL << initial_max_order);
+	if (large == PHYS_NULL) {
+		PANIC("Failed to allocate largest block after churn");
+	}
+	if (large % (1ULL << initial_max_order) != 0) {
+		PANIC("Block at %p is not naturally aligned", large);
+	}
+	mem_phys_slab_free(&slab, large, 1ULL << initial_max_order);
+	mem_phys_free(arena);
+	LOG_SUCCESS("Physical memory fragmentation test succeeded!");
+}
+
+//! @brief Naturally aligned huge blocks allocation test
+void test_phys_huge(void) {
+	uintptr_t blocks[HUGE_BLOCKS];
+	for (size_t i = 0; i < HUGE_BLOCKS; ++i) {
+		blocks[i] = mem_phys_alloc_aligned_on_behalf(MEM_PHYS_HUGE_2M_SIZE, PER_CPU(numa_id));
+		if (blocks[i] == PHYS_NULL) {
+			PANIC("Failed to allocate 2 MiB block");
+		}
+		if (blocks[i] % MEM_PHYS_HUGE_2M_SIZE != 0) {
+			PANIC("2 MiB block at %p is not naturally aligned", blocks[i]);
+		}
+		test_phys_tag(blocks[i], MEM_PHYS_HUGE_2M_SIZE, i);
+	}
+	for (size_t i = 0; i < HUGE_BLOCKS; ++i) {
+		test_phys_assert_tagged(blocks[i], MEM_PHYS_HUGE_2M_SIZE, i);
+		mem_phys_free(blocks[i]);
+	}
+	// Nodes large enough reserve 1 GiB blocks, so only small ones may legitimately have none
+	const numa_id_t id = PER_CPU(numa_id);
+	const uintptr_t giant = mem_phys_alloc_aligned_on_behalf(MEM_PHYS_HUGE_1G_SIZE, id);
+	if (giant == PHYS_NULL) {
+		if (numa_nodes[id].huge_reserve_target != 0) {
+			PANIC("Failed to allocate 1 GiB block on node %u with 1 GiB blocks reserved", id);
+		}
+		LOG_INFO("Node %u is smaller than 0x%p bytes and reserves no 1 GiB blocks, skipping", id,
+		         MEM_PHYS_HUGE_1G_RESERVE_MIN_NODE);
+	} else {
+		if (giant % MEM_PHYS_HUGE_1G_SIZE != 0) {
+			PANIC("1 GiB block at %p is not naturally aligned", giant);
+		}
+		mem_phys_free(giant);
+	}
+	LOG_SUCCESS("Huge physical blocks test succeeded!");
+}
@@ -0,0 +1,77 @@
+//! @file policy.c
+//! @brief File containing tests for NUMA memory placement policies
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <mem/heap/heap.h>
+#include <mem/mem.h>
+#include <mem/misc.h>
+#include <mem/policy.h>
+#include <mem/virt/paging.h>
+#include <sys/numa/numa.h>
+#include <thread/smp/core.h>
+
+MODULE("test/policy")
+
+//! @brief Number of pages in test buffer
+#define PAGES 64
+
+//! @brief Get node backing a given page of the heap allocation
+//! @param buf Pointer to the buffer
+//! @param page Page index
+//! @return ID of the NUMA node
+static numa_id_t test_policy_page_node(uint8_t *buf, size_t page) {
+	const uintptr_t phys = mem_paging_kernel_translate((uintptr_t)(buf + page * PAGE_SIZE));
+	if (phys == PHYS_NULL) {
+		PANIC("Page %U of the buffer is not mapped", page);
+	}
+	struct mem_range *range = mem_range_lookup(phys);
+	if (range == NULL) {
+		PANIC("Page %U of the buffer is not managed by PMM", page);
+	}
+	return range->node_id;
+}
+
+//! @brief NUMA memory placement policies test
+void test_policy(void) {
+	// Bind policy should place every page on the given node
+	const numa_id_t local = PER_CPU(numa_id);
+	struct mem_policy bind = MEM_POLICY_BIND_INIT(local);
+	uint8_t *buf = mem_heap_alloc_policy(PAGES * PAGE_SIZE, &bind);
+	if (buf == NULL) {
+		PANIC("Failed to allocate buffer with bind policy");
+	}
+	for (size_t i = 0; i < PAGES; ++i) {
+		if (test_policy_page_node(buf, i) != local) {
+			PANIC("Page %U of bound buffer is not on node %u", i, local);
+		}
+	}
+	mem_heap_free(buf, PAGES * PAGE_SIZE);
+	// Interleave policy should spread consecutive pages over all nodes
+	struct mem_policy interleave = MEM_POLICY_INTERLEAVE_INIT;
+	buf = mem_heap_alloc_zeroed_policy(PAGES * PAGE_SIZE, &interleave);
+	if (buf == NULL) {
+		PANIC("Failed to allocate buffer with interleave policy");
+	}
+	// Round-robin cursor starts at zero, so first pages should land on distinct nodes
+	size_t distinct = 0;
+	for (size_t i = 0; i < numa_nodes_count && i < PAGES; ++i) {
+		bool seen = false;
+		for (size_t j = 0; j < i; ++j) {
+			seen = seen || test_policy_page_node(buf, i) == test_policy_page_node(buf, j);
+		}
+		distinct += seen ? 0 : 1;
+	}
+	mem_heap_free(buf, PAGES * PAGE_SIZE);
+	// Nodes without memory can not back pages
+	size_t expected = 0;
+	for (numa_id_t i = 0; i < numa_nodes_size; ++i) {
+		if (numa_nodes[i].initialized && numa_nodes[i].ranges != NULL) {
+			expected++;
+		}
+	}
+	if (distinct < expected) {
+		PANIC("Interleaved buffer spans %U nodes, expected %U", distinct, expected);
+	}
+	LOG_SUCCESS("NUMA policy test succeeded!");
+}
@@ -0,0 +1,63 @@
+//! @file rc.c
+//! @brief File containing tests for reference counts sharded across CPUs
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <mem/rc_per_cpu.h>
+
+MODULE("test/rc")
+
+//! @brief Test object
+struct test_rc_object {
+	//! @brief RC base
+	struct mem_rc_per_cpu rc_base;
+	//! @brief Number of times object was disposed
+	size_t disposed;
+};
+
+//! @brief Dispose test object
+//! @param object Pointer to the object
+static void test_rc_dispose(struct test_rc_object *object) {
+	object->disposed++;
+}
+
+//! @brief Sharded reference counts test
+void test_rc(void) {
+	struct test_rc_object object;
+	object.disposed = 0;
+	if (!MEM_REF_PER_CPU_INIT(&object, test_rc_dispose)) {
+		PANIC("Failed to allocate shards");
+	}
+	// References borrowed and dropped while owner is alive only touch shards
+	for (size_t i = 0; i < 16; ++i) {
+		mem_rc_per_cpu_borrow(&object.rc_base);
+	}
+	for (size_t i = 0; i < 15; ++i) {
+		mem_rc_per_cpu_drop(&object.rc_base);
+	}
+	if (object.rc_base.count != MEM_RC_PER_CPU_BIAS + 1) {
+		PANIC("Atomic counter was touched while shards are in use");
+	}
+	// Reference borrowed on one core may be dropped on the other one, so shards may wrap
+	if (thread_smp_core_max_cpus > 1) {
+		const size_t other = PER_CPU(logical_id) == 0 ? 1 : 0;
+		mem_rc_per_cpu_borrow(&object.rc_base);
+		ATOMIC_FETCH_SUB(object.rc_base.shards[other], MEM_RC_PER_CPU_UNIT);
+	}
+	// Last owner reference is dropped, one borrowed reference is still alive
+	MEM_REF_DROP(&object);
+	if (object.disposed != 0) {
+		PANIC("Object was disposed while borrowed reference is alive");
+	}
+	if (object.rc_base.count != 1) {
+		PANIC("Shards were folded into %U references instead of 1", object.rc_base.count);
+	}
+	// Sealed shards redirect to the atomic counter
+	mem_rc_per_cpu_borrow(&object.rc_base);
+	mem_rc_per_cpu_drop(&object.rc_base);
+	mem_rc_per_cpu_drop(&object.rc_base);
+	if (object.disposed != 1) {
+		PANIC("Object was disposed %U times instead of once", object.disposed);
+	}
+	LOG_INFO("Sharded reference count test passed");
+}
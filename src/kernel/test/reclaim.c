@@ -0,0 +1,81 @@
+//! @file reclaim.c
+//! @brief File containing tests for memory reclaim
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <mem/mem.h>
+#include <mem/phys/phys.h>
+#include <mem/reclaim.h>
+#include <sys/numa/numa.h>
+#include <thread/smp/core.h>
+#include <thread/tasking/localsched.h>
+
+MODULE("test/reclaim")
+
+//! @brief Check that free bytes counter agrees with per-order free block counters
+//! @param id ID of the NUMA node
+static void test_reclaim_check_free_bytes(numa_id_t id) {
+	struct numa_node *node = numa_nodes + id;
+	size_t counted = 0;
+	// Idle cores may allocate pages for zero pools, so both are computed under node lock
+	const bool int_state = thread_spinlock_lock(&node->lock);
+	for (struct mem_range *range = node->ranges; range != NULL; range = range->next_range) {
+		for (size_t i = 0; i < MEM_PHYS_SLAB_ORDERS_COUNT; ++i) {
+			counted += range->slab.free_blocks[i] << i;
+		}
+	}
+	const size_t estimated = mem_reclaim_free_bytes(id);
+	thread_spinlock_unlock(&node->lock, int_state);
+	if (counted != estimated) {
+		PANIC("Free bytes counter is %U, while free lists have %U bytes", estimated, counted);
+	}
+}
+
+//! @brief Mark deferred work as done
+//! @param done Pointer to the flag
+static void test_reclaim_work_done(bool *done) {
+	ATOMIC_RELEASE_STORE(done, true);
+}
+
+//! @brief Check that work deferred to the reclaim task is run
+//! @param id ID of the NUMA node
+static void test_reclaim_check_deferred(numa_id_t id) {
+	bool done = false;
+	struct mem_reclaim_work work;
+	work.callback = CALLBACK_VOID(test_reclaim_work_done, &done);
+	if (!mem_reclaim_defer(id, &work)) {
+		PANIC("Reclaim task of node %u is not running", id);
+	}
+	// Reclaim task may be associated with this core, so it is given a chance to run
+	while (!ATOMIC_ACQUIRE_LOAD(&done)) {
+		thread_localsched_yield();
+	}
+}
+
+//! @brief Memory reclaim test
+void test_reclaim(void) {
+	const numa_id_t id = PER_CPU(numa_id);
+	struct numa_node *node = numa_nodes + id;
+	test_reclaim_check_free_bytes(id);
+	// Watermarks should be ordered
+	if (node->watermarks.low > node->watermarks.high) {
+		PANIC("Low watermark %U is above high watermark %U", node->watermarks.low,
+		      node->watermarks.high);
+	}
+	// Fill the zero pool and check that direct reclaim gives all of it back. Pool is not checked
+	// to be empty afterwards, as idle cores start refilling it right away
+	while (mem_phys_zero_pool_refill_step(id)) {
+	}
+	const size_t pooled = ATOMIC_RELAXED_LOAD(&node->zero_pool.count);
+	const size_t reclaimed_before = ATOMIC_RELAXED_LOAD(&node->watermarks.reclaimed);
+	const size_t released = mem_reclaim_direct(id);
+	if (released < pooled * PAGE_SIZE) {
+		PANIC("Direct reclaim released %U bytes, but %U pages were pooled", released, pooled);
+	}
+	if (ATOMIC_RELAXED_LOAD(&node->watermarks.reclaimed) < reclaimed_before + pooled * PAGE_SIZE) {
+		PANIC("Reclaimed bytes were not accounted");
+	}
+	test_reclaim_check_free_bytes(id);
+	test_reclaim_check_deferred(id);
+	LOG_INFO("Direct reclaim released %U bytes (%U pooled pages)", released, pooled);
+}
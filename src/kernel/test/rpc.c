@@ -155,6 +155,8 @@ void test_rpc(void) {
 	if (server_task == NULL) {
 		PANIC("Failed to create server task");
 	}
+	client_task->kernel_only = true;
+	server_task->kernel_only = true;
 	thread_localsched_associate(0, client_task);
 	thread_localsched_associate(0, server_task);
 	thread_localsched_suspend_current(CALLBACK_VOID_NULL);
@@ -5,12 +5,87 @@
 #include <lib/panic.h>
 #include <lib/string.h>
 #include <lib/target.h>
+#include <mem/phys/phys.h>
+#include <mem/usercopy.h>
+#include <mem/virt/invtlb.h>
+#include <mem/virt/paging.h>
+#include <sys/cr.h>
+#include <sys/intlevel.h>
+#include <thread/tasking/localsched.h>
 #include <user/entry.h>
 
 MODULE("test/shm")
 
+//! @brief Base of the user buffer SHM is copied from and to
+#define TEST_SHM_USER_BASE (8 * MEM_PHYS_HUGE_2M_SIZE)
+
+//! @brief Size of copies that take non-temporal path
+#define TEST_SHM_BULK_SIZE (2 * MEM_USERCOPY_BULK_NT_THRESHOLD)
+
+//! @brief Misalignment of the user buffer in bulk copies
+#define TEST_SHM_BULK_SKEW 3
+
+//! @brief Test copies that bypass caches, including misaligned heads and tails
+//! @param entry Pointer to the user API entry
+static void test_shm_bulk(struct user_api_entry *entry) {
+	size_t hshm, shm_id;
+	if (user_sys_create_shm_owned(entry, &hshm, &shm_id, TEST_SHM_BULK_SIZE) !=
+	    USER_STATUS_SUCCESS) {
+		PANIC("Failed to create SHM object");
+	}
+	uint8_t *buf = (uint8_t *)(TEST_SHM_USER_BASE + TEST_SHM_BULK_SKEW);
+	const size_t len = TEST_SHM_BULK_SIZE - 2 * TEST_SHM_BULK_SKEW;
+	// Buffer of this size is populated on first touch, pages should still read as zeroes
+	memset(buf, 0xff, len);
+	if (user_sys_read_from_shm_id(entry, shm_id, TEST_SHM_BULK_SKEW, len, (uintptr_t)buf) !=
+	    USER_STATUS_SUCCESS) {
+		PANIC("Failed to read from fresh SHM object");
+	}
+	for (size_t i = 0; i < len; ++i) {
+		if (buf[i] != 0) {
+			PANIC("Fresh SHM buffer is not zeroed at offset %U", i);
+		}
+	}
+	for (size_t i = 0; i < len; ++i) {
+		buf[i] = (uint8_t)(i * 7);
+	}
+	if (user_sys_write_to_shm_id(entry, shm_id, TEST_SHM_BULK_SKEW, len, (uintptr_t)buf) !=
+	    USER_STATUS_SUCCESS) {
+		PANIC("Failed to write data to SHM object");
+	}
+	memset(buf, 0, len);
+	if (user_sys_read_from_shm_id(entry, shm_id, TEST_SHM_BULK_SKEW, len, (uintptr_t)buf) !=
+	    USER_STATUS_SUCCESS) {
+		PANIC("Failed to read from SHM object");
+	}
+	for (size_t i = 0; i < len; ++i) {
+		if (buf[i] != (uint8_t)(i * 7)) {
+			PANIC("SHM buffer corruption in bulk copy at offset %U", i);
+		}
+	}
+	// Copy that runs off the reserved range fails midway instead of panicking
+	uint8_t *edge = (uint8_t *)(TEST_SHM_USER_BASE + TEST_SHM_BULK_SIZE + PAGE_SIZE - len / 2);
+	if (user_sys_read_from_shm_id(entry, shm_id, 0, len, (uintptr_t)edge) !=
+	    USER_STATUS_INVALID_MEM) {
+		PANIC("Bulk copy to unmapped memory succeeded");
+	}
+	if (user_sys_drop(entry, hshm) != USER_STATUS_SUCCESS) {
+		PANIC("Failed to drop SHM handle");
+	}
+}
+
 //! @brief Basic SHM test
 void test_shm(void) {
+	// Copies go through usercopy routines, so buffer is placed in the lower half
+	struct mem_paging_root *root = mem_paging_new_root();
+	ASSERT(root != NULL, "Failed to allocate paging root for SHM test");
+	const bool res = mem_paging_reserve(root, TEST_SHM_USER_BASE, TEST_SHM_BULK_SIZE + PAGE_SIZE,
+	                                    MEM_PAGING_READABLE | MEM_PAGING_USER | MEM_PAGING_WRITABLE,
+	                                    MEM_PAGING_FAULT_AROUND_MAX);
+	ASSERT(res, "Failed to reserve user buffer for SHM test");
+	const uintptr_t cr3 = rdcr3();
+	mem_paging_switch_to(root);
+	uint8_t *buf = (uint8_t *)TEST_SHM_USER_BASE;
 	// Create user API entry
 	struct user_api_entry entry;
 	if (user_api_entry_init(&entry) != USER_STATUS_SUCCESS) {
@@ -22,8 +97,8 @@ void test_shm(void) {
 		PANIC("Failed to create SHM object");
 	}
 	// Check that buffer is zeroed
-	uint8_t buf[4096];
-	if (user_sys_read_from_shm_id(&entry, shm_id, 0, 4096, (uintptr_t)&buf) !=
+	memset(buf, 0xff, 4096);
+	if (user_sys_read_from_shm_id(&entry, shm_id, 0, 4096, (uintptr_t)buf) !=
 	    USER_STATUS_SUCCESS) {
 		PANIC("Failed to read from SHM object");
 	}
@@ -33,7 +108,7 @@ void test_shm(void) {
 		}
 	}
 	// Test OOB checks
-	if (user_sys_read_from_shm_id(&entry, shm_id, 128, 4096, (uintptr_t)&buf) !=
+	if (user_sys_read_from_shm_id(&entry, shm_id, 128, 4096, (uintptr_t)buf) !=
 	    USER_STATUS_OUT_OF_BOUNDS) {
 		PANIC("OOB checks do not work");
 	}
@@ -46,18 +121,18 @@ void test_shm(void) {
 		PANIC("Failed to borrow read-write SHM reference");
 	}
 	// Attempt to write data from RO reference
-	if (user_sys_write_to_shm_ref(&entry, hshmro, 0, 4096, (uintptr_t)&buf) !=
+	if (user_sys_write_to_shm_ref(&entry, hshmro, 0, 4096, (uintptr_t)buf) !=
 	    USER_STATUS_INVALID_HANDLE_TYPE) {
 		PANIC("Checks for writes to RO refs do not work");
 	}
 	// Write some data
 	memset(buf, 0xaa, 4096);
-	if (user_sys_write_to_shm_ref(&entry, hshmrw, 0, 4096, (uintptr_t)&buf) !=
+	if (user_sys_write_to_shm_ref(&entry, hshmrw, 0, 4096, (uintptr_t)buf) !=
 	    USER_STATUS_SUCCESS) {
 		PANIC("Failed to write data to SHM object using read-write ref");
 	}
 	// Read using RO ref
-	if (user_sys_read_from_shm_ref(&entry, hshmro, 0, 4096, (uintptr_t)&buf) !=
+	if (user_sys_read_from_shm_ref(&entry, hshmro, 0, 4096, (uintptr_t)buf) !=
 	    USER_STATUS_SUCCESS) {
 		PANIC("Failed to read from SHM object");
 	}
@@ -67,7 +142,7 @@ void test_shm(void) {
 		}
 	}
 	// Check that data could be read with RW ref as well
-	if (user_sys_read_from_shm_ref(&entry, hshmrw, 0, 4096, (uintptr_t)&buf) !=
+	if (user_sys_read_from_shm_ref(&entry, hshmrw, 0, 4096, (uintptr_t)buf) !=
 	    USER_STATUS_SUCCESS) {
 		PANIC("Failed to read from SHM object");
 	}
@@ -76,5 +151,22 @@ void test_shm(void) {
 			PANIC("SHM buffer corruption");
 		}
 	}
+	// Kernel pointers and unreserved user memory are rejected
+	uint8_t kernel_buf[16];
+	if (user_sys_read_from_shm_id(&entry, shm_id, 0, 16, (uintptr_t)kernel_buf) !=
+	    USER_STATUS_INVALID_MEM) {
+		PANIC("Read to kernel memory succeeded");
+	}
+	if (user_sys_write_to_shm_ref(&entry, hshmrw, 0, 16, TEST_SHM_USER_BASE / 2) !=
+	    USER_STATUS_INVALID_MEM) {
+		PANIC("Write from unreserved memory succeeded");
+	}
+	test_shm_bulk(&entry);
 	user_api_entry_deinit(&entry);
+	// Recover CR3
+	const bool int_state = intlevel_elevate();
+	thread_localsched_get_current_task()->cr3 = cr3 & CR3_ADDR_MASK;
+	mem_virt_invtlb_update_cr3(rdcr3(), cr3);
+	intlevel_recover(int_state);
+	MEM_REF_DROP(root);
 }
@@ -0,0 +1,170 @@
+//! @file string.c
+//! @brief File containing tests and microbenchmark for memory functions
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <lib/string.h>
+#include <lib/target.h>
+#include <mem/heap/heap.h>
+#include <mem/misc.h>
+#include <sys/intlevel.h>
+#include <sys/tsc.h>
+
+MODULE("test/string")
+
+//! @brief Largest buffer size in the benchmark
+#define TEST_STRING_MAX_SIZE 0x400000
+
+//! @brief Sizes up to this one are checked with all alignments
+#define TEST_STRING_CHECK_SIZE 300
+
+//! @brief Number of bytes processed for each benchmarked size
+#define TEST_STRING_BENCH_BYTES 0x1000000ULL
+
+//! @brief Benchmarked functions
+enum test_string_op
+{
+	TEST_STRING_MEMCPY,
+	TEST_STRING_MEMSET,
+	TEST_STRING_MEMCPY_NT,
+	TEST_STRING_MEMSET_NT,
+};
+
+//! @brief Benchmarked sizes
+static const size_t test_string_sizes[] = {8, 64, 512, 0x1000, 0x8000, 0x40000, 0x400000};
+
+//! @brief Source buffer
+static uint8_t *test_string_src;
+
+//! @brief Destination buffer
+static uint8_t *test_string_dst;
+
+//! @brief Implementation names
+static const char *test_string_impl_names[] = {
+    [STRING_IMPL_UNROLLED] = "unrolled",
+    [STRING_IMPL_ERMS] = "erms",
+    [STRING_IMPL_FSRM] = "fsrm",
+};
+
+//! @brief Check if implementation is supported by the CPU
+//! @param kind Implementation kind
+//! @return True if implementation can be used
+static bool test_string_impl_supported(enum string_impl kind) {
+	switch (kind) {
+	case STRING_IMPL_ERMS:
+		return string_erms_supported;
+	case STRING_IMPL_FSRM:
+		return string_fsrm_supported;
+	default:
+		return true;
+	}
+}
+
+//! @brief Check that bytes outside of [begin, end) are untouched and bytes inside match pattern
+//! @param begin Start of the modified range
+//! @param end End of the modified range
+//! @param fill Byte expected in the modified range or -1 if range should match source buffer
+static void test_string_check_range(size_t begin, size_t end, int fill) {
+	for (size_t i = 0; i < end + 8; ++i) {
+		uint8_t expected = 0xee;
+		if (i >= begin && i < end) {
+			expected = fill < 0 ? test_string_src[i] : (uint8_t)fill;
+		}
+		ASSERT(test_string_dst[i] == expected, "Mismatch at %U in range [%U, %U)", i, begin, end);
+	}
+}
+
+//! @brief Check memory functions on small buffers with all alignments
+static void test_string_check(void) {
+	for (size_t size = 0; size <= TEST_STRING_CHECK_SIZE; ++size) {
+		for (size_t align = 0; align < 8; ++align) {
+			memset(test_string_dst, 0xee, TEST_STRING_CHECK_SIZE + 16);
+			memcpy(test_string_dst + align, test_string_src + align, size);
+			test_string_check_range(align, align + size, -1);
+			ASSERT(memcmp(test_string_dst + align, test_string_src + align, size) == 0,
+			       "memcmp reports mismatch for equal buffers of size %U", size);
+			if (size != 0) {
+				test_string_dst[align + size - 1] ^= 1;
+				ASSERT(memcmp(test_string_dst + align, test_string_src + align, size) != 0,
+				       "memcmp reports equality for different buffers of size %U", size);
+			}
+			memset(test_string_dst, 0xee, TEST_STRING_CHECK_SIZE + 16);
+			memset(test_string_dst + align, 0x5a, size);
+			test_string_check_range(align, align + size, 0x5a);
+			memset(test_string_dst, 0xee, TEST_STRING_CHECK_SIZE + 16);
+			memcpy_nt(test_string_dst + align, test_string_src + align, size);
+			test_string_check_range(align, align + size, -1);
+			memset(test_string_dst, 0xee, TEST_STRING_CHECK_SIZE + 16);
+			memset_nt(test_string_dst + align, 0xa5, size);
+			test_string_check_range(align, align + size, 0xa5);
+		}
+	}
+}
+
+//! @brief Benchmark memory function on a given size
+//! @param name Function name
+//! @param impl Implementation name
+//! @param size Buffer size
+//! @param op Benchmarked function
+static void test_string_bench(const char *name, const char *impl, size_t size,
+                              enum test_string_op op) {
+	const size_t iterations = TEST_STRING_BENCH_BYTES / size;
+	// Interrupts are disabled, so that preemption does not skew results
+	const bool int_state = intlevel_elevate();
+	const uint64_t start = tsc_read();
+	for (size_t i = 0; i < iterations; ++i) {
+		switch (op) {
+		case TEST_STRING_MEMCPY:
+			memcpy(test_string_dst, test_string_src, size);
+			break;
+		case TEST_STRING_MEMSET:
+			memset(test_string_dst, (int)i, size);
+			break;
+		case TEST_STRING_MEMCPY_NT:
+			memcpy_nt(test_string_dst, test_string_src, size);
+			break;
+		case TEST_STRING_MEMSET_NT:
+			memset_nt(test_string_dst, (int)i, size);
+			break;
+		}
+		asm volatile("" ::: "memory");
+	}
+	const uint64_t cycles = tsc_read() - start;
+	intlevel_recover(int_state);
+	LOG_INFO("%s (%s) %U bytes: %U cycles per call, %U bytes per 1000 cycles", name, impl, size,
+	         cycles / iterations, TEST_STRING_BENCH_BYTES * 1000 / (cycles == 0 ? 1 : cycles));
+}
+
+//! @brief Memory functions test and microbenchmark
+void test_string(void) {
+	test_string_src = mem_heap_alloc(TEST_STRING_MAX_SIZE);
+	test_string_dst = mem_heap_alloc(TEST_STRING_MAX_SIZE);
+	ASSERT(test_string_src != NULL && test_string_dst != NULL, "Failed to allocate buffers");
+	for (size_t i = 0; i < TEST_STRING_MAX_SIZE; ++i) {
+		test_string_src[i] = (uint8_t)(i * 13 + i / 256);
+	}
+	const enum string_impl best = string_dispatch_best();
+	for (enum string_impl kind = STRING_IMPL_UNROLLED; kind <= STRING_IMPL_FSRM; ++kind) {
+		if (!test_string_impl_supported(kind)) {
+			continue;
+		}
+		string_dispatch_force(kind);
+		test_string_check();
+		for (size_t i = 0; i < ARRAY_SIZE(test_string_sizes); ++i) {
+			test_string_bench("memcpy", test_string_impl_names[kind], test_string_sizes[i],
+			                  TEST_STRING_MEMCPY);
+			test_string_bench("memset", test_string_impl_names[kind], test_string_sizes[i],
+			                  TEST_STRING_MEMSET);
+		}
+	}
+	string_dispatch_force(best);
+	// Non-temporal variants only make sense for page-sized and larger buffers
+	for (size_t i = 0; i < ARRAY_SIZE(test_string_sizes); ++i) {
+		if (test_string_sizes[i] >= PAGE_SIZE) {
+			test_string_bench("memcpy_nt", "movnti", test_string_sizes[i], TEST_STRING_MEMCPY_NT);
+			test_string_bench("memset_nt", "movnti", test_string_sizes[i], TEST_STRING_MEMSET_NT);
+		}
+	}
+	mem_heap_free(test_string_src, TEST_STRING_MAX_SIZE);
+	mem_heap_free(test_string_dst, TEST_STRING_MAX_SIZE);
+}
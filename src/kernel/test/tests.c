@@ -10,6 +10,21 @@ MODULE("tests")
 //! @brief Heap integrity test
 void test_heap_integrity(void);
 
+//! @brief Physical memory fragmentation test
+void test_phys_fragmentation(void);
+
+//! @brief Huge physical blocks test
+void test_phys_huge(void);
+
+//! @brief NUMA policy test
+void test_policy(void);
+
+//! @brief Memory reclaim test
+void test_reclaim(void);
+
+//! @brief Sharded reference counts test
+void test_rc(void);
+
 //! @brief Pairing heap test
 void test_pairing_heap(void);
 
@@ -31,6 +46,15 @@ void test_tls(void);
 //! @brief Paging test
 void test_paging(void);
 
+//! @brief Memory functions test and microbenchmark
+void test_string(void);
+
+//! @brief Extended state test
+void test_fpu(void);
+
+//! @brief Pre-zeroed pages pool microbenchmark
+void test_zero_pool(void);
+
 //! @brief Test unit
 struct test_unit {
 	//! @brief Test name
@@ -50,13 +74,21 @@ static void tests_run_unit(struct test_unit *unit) {
 //! @brief Test units
 static struct test_unit units[] = {
     {.name = "Pairing heap test", .callback = test_pairing_heap},
+    {.name = "Memory functions test", .callback = test_string},
     {.name = "Resizable arrays test", .callback = test_dynarray},
+    {.name = "Sharded reference counts test", .callback = test_rc},
     {.name = "Universes test", .callback = test_universe},
     {.name = "Shared memory test", .callback = test_shm},
     {.name = "Thread-local storage test", .callback = test_tls},
     {.name = "Paging test", .callback = test_paging},
+    {.name = "Extended state test", .callback = test_fpu},
     {.name = "RPC test", .callback = test_rpc},
     {.name = "Heap integrity test", .callback = test_heap_integrity},
+    {.name = "Physical memory fragmentation test", .callback = test_phys_fragmentation},
+    {.name = "Huge physical blocks test", .callback = test_phys_huge},
+    {.name = "NUMA policy test", .callback = test_policy},
+    {.name = "Memory reclaim test", .callback = test_reclaim},
+    {.name = "Pre-zeroed pages pool benchmark", .callback = test_zero_pool},
 };
 
 //! @brief Run tests
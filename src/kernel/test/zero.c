@@ -0,0 +1,111 @@
+//! @file zero.c
+//! @brief File containing microbenchmark for the pool of pre-zeroed pages
+
+#include <lib/log.h>
+#include <lib/panic.h>
+#include <lib/target.h>
+#include <mem/phys/phys.h>
+#include <mem/virt/paging.h>
+#include <misc/atomics.h>
+#include <sys/intlevel.h>
+#include <sys/numa/numa.h>
+#include <sys/tsc.h>
+#include <thread/smp/core.h>
+#include <user/entry.h>
+
+MODULE("test/zero")
+
+//! @brief Number of calls timed in each benchmark. Pool should cover all of them (mapper takes up
+//! to 4 pages)
+#define TEST_ZERO_ITERATIONS 16
+
+//! @brief Size of benchmarked SHM objects. Page-sized buffers are backed by one zeroed page
+#define TEST_ZERO_SHM_SIZE 4096
+
+//! @brief Benchmarked operations
+enum test_zero_op
+{
+	TEST_ZERO_MAPPER,
+	TEST_ZERO_SHM,
+};
+
+//! @brief Operation names
+static const char *test_zero_op_names[] = {
+    [TEST_ZERO_MAPPER] = "mapper prefill",
+    [TEST_ZERO_SHM] = "SHM creation",
+};
+
+//! @brief Mappers created by the benchmark
+static struct mem_paging_mapper test_zero_mappers[TEST_ZERO_ITERATIONS];
+
+//! @brief Handles of SHM objects created by the benchmark
+static size_t test_zero_shms[TEST_ZERO_ITERATIONS];
+
+//! @brief Benchmark operation with the pool of pre-zeroed pages filled or drained
+//! @param entry Pointer to the user API entry
+//! @param op Benchmarked operation
+//! @param pooled True if pool should be filled, false if it should be drained
+//! @return Cycles per call
+static uint64_t test_zero_bench(struct user_api_entry *entry, enum test_zero_op op, bool pooled) {
+	// Interrupts are disabled, so that preemption and idle refills do not skew results. This also
+	// pins the task to the core, so the pool is the one of the local node
+	const bool int_state = intlevel_elevate();
+	const numa_id_t id = PER_CPU(numa_id);
+	if (pooled) {
+		while (mem_phys_zero_pool_refill_step(id)) {
+		}
+	} else {
+		mem_phys_zero_pool_drain(id);
+	}
+	const size_t available = ATOMIC_RELAXED_LOAD(&numa_nodes[id].zero_pool.count);
+	const uint64_t start = tsc_read();
+	for (size_t i = 0; i < TEST_ZERO_ITERATIONS; ++i) {
+		switch (op) {
+		case TEST_ZERO_MAPPER:
+			ASSERT(mem_paging_init_mapper(test_zero_mappers + i), "Failed to create mapper");
+			break;
+		case TEST_ZERO_SHM: {
+			size_t shm_id;
+			const int status = user_sys_create_shm_owned(entry, test_zero_shms + i, &shm_id,
+			                                             TEST_ZERO_SHM_SIZE);
+			ASSERT(status == USER_STATUS_SUCCESS, "Failed to create SHM object");
+			break;
+		}
+		}
+		asm volatile("" ::: "memory");
+	}
+	const uint64_t cycles = tsc_read() - start;
+	intlevel_recover(int_state);
+	for (size_t i = 0; i < TEST_ZERO_ITERATIONS; ++i) {
+		switch (op) {
+		case TEST_ZERO_MAPPER:
+			mem_paging_deinit_mapper(test_zero_mappers + i);
+			break;
+		case TEST_ZERO_SHM:
+			ASSERT(user_sys_drop(entry, test_zero_shms[i]) == USER_STATUS_SUCCESS,
+			       "Failed to drop SHM handle");
+			break;
+		}
+	}
+	LOG_INFO("%s (pool %s, %U pages pooled): %U cycles per call", test_zero_op_names[op],
+	         pooled ? "filled" : "drained", available, cycles / TEST_ZERO_ITERATIONS);
+	return cycles / TEST_ZERO_ITERATIONS;
+}
+
+//! @brief Pre-zeroed pages pool microbenchmark
+void test_zero_pool(void) {
+	struct user_api_entry entry;
+	if (user_api_entry_init(&entry) != USER_STATUS_SUCCESS) {
+		PANIC("Failed to create user API entry");
+	}
+	for (enum test_zero_op op = TEST_ZERO_MAPPER; op <= TEST_ZERO_SHM; ++op) {
+		// First run warms up caches and slabs
+		test_zero_bench(&entry, op, true);
+		const uint64_t drained = test_zero_bench(&entry, op, false);
+		const uint64_t pooled = test_zero_bench(&entry, op, true);
+		const uint64_t saved = drained > pooled ? drained - pooled : 0;
+		LOG_INFO("%s: pool saves %U cycles per call (%U%%)", test_zero_op_names[op], saved,
+		         saved * 100 / (drained == 0 ? 1 : drained));
+	}
+	user_api_entry_deinit(&entry);
+}
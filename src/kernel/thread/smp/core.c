@@ -60,6 +60,20 @@ struct thread_smp_core *thread_smp_core_get_for(uint32_t id) {
 	return thread_smp_core_array + id;
 }
 
+//! @brief Find online core on a given NUMA node
+//! @param id ID of the NUMA node
+//! @return Logical ID of the core or thread_smp_core_max_cpus if there is none
+size_t thread_smp_core_find_on_node(numa_id_t id) {
+	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+		struct thread_smp_core *core = thread_smp_core_array + i;
+		if (core->numa_id == id &&
+		    ATOMIC_ACQUIRE_LOAD(&core->status) == THREAD_SMP_CORE_STATUS_ONLINE) {
+			return i;
+		}
+	}
+	return thread_smp_core_max_cpus;
+}
+
 //! @brief Initialize CPU local storage on AP
 //! @note To be used on AP bootup
 //! @note Requires LAPIC to be enabled
@@ -89,6 +103,8 @@ void thread_smp_core_init(void) {
 	// Set asleep statuses
 	for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
 		thread_smp_core_array[i].self = thread_smp_core_array + i;
+		// Slots without CPUs are still visible to per-CPU allocations
+		thread_smp_core_array[i].numa_id = acpi_numa_boot_domain;
 		ATOMIC_RELEASE_STORE(&thread_smp_core_array[i].status, THREAD_SMP_CORE_STATUS_ASLEEP);
 	}
 	// Iterate over CPUs and initialize their stae
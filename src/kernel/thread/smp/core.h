@@ -4,7 +4,9 @@
 #pragma once
 
 #include <lib/target.h>
+#include <mem/phys/phys.h>
 #include <sys/arch/arch.h>
+#include <sys/fpu.h>
 #include <sys/ic.h>
 #include <sys/numa/numa.h>
 #include <thread/smp/topology.h>
@@ -62,6 +64,10 @@ struct thread_smp_core {
 	struct thread_smp_sched_domain *domain;
 	//! @brief CPU topology domain tree root
 	struct thread_smp_sched_domain *root;
+	//! @brief Cache of free 4k frames
+	struct mem_phys_frame_cache frame_cache;
+	//! @brief Extended state bookkeeping
+	struct fpu_core_state fpu;
 };
 
 //! @brief Macro to access per-cpu data
@@ -77,6 +83,11 @@ extern size_t thread_smp_core_max_cpus;
 //! @return Pointer to the thread_smp_core data structure
 struct thread_smp_core *thread_smp_core_get(void);
 
+//! @brief Find online core on a given NUMA node
+//! @param id ID of the NUMA node
+//! @return Logical ID of the core or thread_smp_core_max_cpus if there is none
+size_t thread_smp_core_find_on_node(numa_id_t id);
+
 //! @brief Initialize CPU local storage on AP
 //! @note To be used on AP bootup
 //! @note Requires LAPIC to be enabled
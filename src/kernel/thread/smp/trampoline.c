@@ -107,7 +107,7 @@ void thread_smp_trampoline_init() {
 	void *code_dst = (void *)(mem_wb_phys_win_base + THREAD_SMP_TRAMPOLINE_ADDR);
 	memcpy(code_dst, code_src, code_size);
 	// Assert that cr3 will be accessible from booted cores
-	uint64_t cr3 = rdcr3();
+	uint64_t cr3 = rdcr3() & CR3_ADDR_MASK;
 	if ((cr3 & 0xffffffffULL) != cr3) {
 		PANIC("CR3 won't be accessible from booted cores");
 	}
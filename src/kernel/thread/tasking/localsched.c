@@ -5,8 +5,10 @@
 #include <lib/pairing_heap.h>
 #include <lib/panic.h>
 #include <lib/string.h>
+#include <mem/phys/phys.h>
 #include <mem/virt/invtlb.h>
 #include <sys/arch/gdt.h>
+#include <sys/fpu.h>
 #include <sys/ic.h>
 #include <sys/intlevel.h>
 #include <sys/tsc.h>
@@ -18,7 +20,8 @@
 
 MODULE("thread/tasking/localsched")
 TARGET(thread_localsched_available, thread_localsched_init_target,
-       {thread_sched_call_available, thread_smp_core_available, mem_virt_invtlb_available})
+       {thread_sched_call_available, thread_smp_core_available, mem_virt_invtlb_available,
+        fpu_available})
 
 //! @brief Length of the minimal timeslice in us
 #define THREAD_LOCAL_TIMESLICE_MIN 10000
@@ -124,6 +127,16 @@ static struct thread_task *thread_localsched_dequeue(struct thread_localsched_da
 	// Drop queue lock
 	thread_spinlock_unlock(&data->lock, false);
 	while (true) {
+		// Use idle time to refill pool of zeroed pages, checking for new tasks after each page
+		while (mem_phys_zero_pool_refill_step(PER_CPU(numa_id))) {
+			result = thread_localsched_try_dequeue_lock(data);
+			if (result != NULL) {
+				mem_virt_invtlb_on_idle_exit();
+				// Enqueue IPI may not have been handled yet
+				ATOMIC_RELEASE_STORE(&data->idle, false);
+				return result;
+			}
+		}
 		// Wait for IPI
 		asm volatile("sti\n\r"
 		             "hlt\n\r"
@@ -144,6 +157,7 @@ static struct thread_task *thread_localsched_dequeue(struct thread_localsched_da
 static void thread_localsched_task_to_frame(struct thread_task *task,
                                             struct interrupt_frame *frame) {
 	*frame = task->frame;
+	fpu_switch_in(&task->fpu);
 }
 
 //! @brief Copy interrupt frame to the task state frame
@@ -152,6 +166,7 @@ static void thread_localsched_task_to_frame(struct thread_task *task,
 static void thread_localsched_frame_to_task(struct interrupt_frame *frame,
                                             struct thread_task *task) {
 	task->frame = *frame;
+	fpu_switch_out(&task->fpu);
 }
 
 //! @brief Pick the length of the timeslice on bootstrap/timer interrupt
@@ -169,18 +184,29 @@ static uint64_t thread_localsched_pick_timeslice_len(uint64_t current_unfairness
 	return us > THREAD_LOCAL_TIMESLICE_MIN ? us : THREAD_LOCAL_TIMESLICE_MIN;
 }
 
+//! @brief Switch to the paging root of the task
+//! @param task Pointer to the task about to run
+//! @note Kernel-only tasks keep the paging root that is already loaded. Replicated roots are
+//! loaded from the replica of this core's node
+static void thread_localsched_load_cr3(struct thread_task *task) {
+	if (task->kernel_only) {
+		mem_virt_invtlb_update_cr3_lazy();
+	} else {
+		mem_virt_invtlb_update_cr3(rdcr3(), mem_paging_local_cr3(task->cr3));
+	}
+}
+
 //! @brief Waits for the first task to run
 //! @param frame Interrupt frame
 //! @param ctx Unused
 static void thread_localsched_wait_on_boostrap(struct interrupt_frame *frame, void *ctx) {
 	(void)ctx;
-	uint64_t old_cr3 = rdcr3();
 	struct thread_localsched_data *data = &PER_CPU(localsched);
 	// Wait until we have task to run
 	bool exited_idle;
 	const bool int_state = thread_spinlock_lock(&data->lock);
 	struct thread_task *task = thread_localsched_dequeue(data, &exited_idle);
-	mem_virt_invtlb_update_cr3(old_cr3, task->cr3);
+	thread_localsched_load_cr3(task);
 	// Calculate optimal timeslice
 	uint64_t us = thread_localsched_pick_timeslice_len(task->unfairness);
 	thread_spinlock_unlock(&data->lock, int_state);
@@ -236,7 +262,6 @@ static void thread_localsched_timer_int_handler(struct interrupt_frame *frame, v
 		LOG_WARN("Spurious timer interrupt");
 		return;
 	}
-	uint64_t old_cr3 = old_task->cr3;
 	// Save old task data
 	thread_localsched_frame_to_task(frame, old_task);
 	// Lock CPU queue
@@ -251,7 +276,7 @@ static void thread_localsched_timer_int_handler(struct interrupt_frame *frame, v
 		// No other task to run, continue existing one
 		new_task = old_task;
 	}
-	mem_virt_invtlb_update_cr3(old_cr3, new_task->cr3);
+	thread_localsched_load_cr3(new_task);
 	// Pick timeslice length and create new one-shot timer event
 	uint64_t us = thread_localsched_pick_timeslice_len(new_task->unfairness);
 	ic_timer_one_shot(us);
@@ -277,7 +302,6 @@ static void thread_localsched_preemption_handler(struct interrupt_frame *frame,
 	struct thread_localsched_data *data = &PER_CPU(localsched);
 	// Save old task data
 	struct thread_task *old_task = data->current_task;
-	uint64_t old_cr3 = old_task->cr3;
 	thread_localsched_frame_to_task(frame, old_task);
 	// Update unfairness values
 	ASSERT(old_task != NULL, "No active task");
@@ -298,7 +322,7 @@ static void thread_localsched_preemption_handler(struct interrupt_frame *frame,
 	data->current_task = NULL;
 	bool exited_idle;
 	struct thread_task *new_task = thread_localsched_dequeue(data, &exited_idle);
-	mem_virt_invtlb_update_cr3(old_cr3, new_task->cr3);
+	thread_localsched_load_cr3(new_task);
 	// If exited_idle is true, we get to decide the length of the new timeslice
 	if (exited_idle) {
 		uint64_t us = thread_localsched_pick_timeslice_len(new_task->unfairness);
@@ -361,7 +385,6 @@ static void thread_localsched_termination_handler(struct interrupt_frame *frame,
 	(void)ctx;
 	struct thread_localsched_data *data = &PER_CPU(localsched);
 	struct thread_task *old_task = data->current_task;
-	uint64_t old_cr3 = old_task->cr3;
 	// Update unfairness values
 	thread_localsched_update_unfairness(old_task);
 	// Free task data
@@ -372,7 +395,7 @@ static void thread_localsched_termination_handler(struct interrupt_frame *frame,
 	data->current_task = NULL;
 	bool exited_idle;
 	struct thread_task *new_task = thread_localsched_dequeue(data, &exited_idle);
-	mem_virt_invtlb_update_cr3(old_cr3, new_task->cr3);
+	thread_localsched_load_cr3(new_task);
 	// If exited_idle is true, we get to decide the length of the new timeslice
 	if (exited_idle) {
 		uint64_t us = thread_localsched_pick_timeslice_len(new_task->unfairness);
@@ -26,6 +26,12 @@ struct thread_task *thread_task_create_call(struct callback_void callback) {
 		return NULL;
 	}
 	memset(task, 0, sizeof(struct thread_task));
+	if (!fpu_task_init(&task->fpu)) {
+		mem_paging_deinit_mapper(&task->mapper);
+		mem_heap_free(task, sizeof(struct thread_task));
+		mem_heap_free(stack, THREAD_TASK_STACK_SIZE);
+		return NULL;
+	}
 	task->frame.cs = GDT_CODE64;
 	task->frame.ss = GDT_DATA64;
 	task->frame.rip = (uint64_t)callback.func;
@@ -33,7 +39,8 @@ struct thread_task *thread_task_create_call(struct callback_void callback) {
 	task->frame.rflags = (1 << 9); // Enable interrupts
 	task->stack = (uintptr_t)stack + THREAD_TASK_STACK_SIZE;
 	task->frame.rsp = task->stack;
-	task->cr3 = rdcr3();
+	task->cr3 = rdcr3() & CR3_ADDR_MASK;
+	task->policy = MEM_POLICY_LOCAL_INIT;
 	return task;
 }
 
@@ -42,6 +49,8 @@ struct thread_task *thread_task_create_call(struct callback_void callback) {
 void thread_task_dispose(struct thread_task *task) {
 	// Dispose paging mapper
 	mem_paging_deinit_mapper(&task->mapper);
+	// Free extended state
+	fpu_task_deinit(&task->fpu);
 	// Free task stack
 	mem_heap_free((void *)(task->stack - THREAD_TASK_STACK_SIZE), THREAD_TASK_STACK_SIZE);
 	// Free task structure itself
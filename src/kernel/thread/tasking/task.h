@@ -5,9 +5,11 @@
 
 #include <lib/callback.h>
 #include <lib/pairing_heap.h>
+#include <mem/policy.h>
 #include <mem/virt/paging.h>
 #include <misc/types.h>
 #include <sys/arch/interrupts.h>
+#include <sys/fpu.h>
 
 //! @brief Task stack size
 #define THREAD_TASK_STACK_SIZE 0x10000
@@ -29,8 +31,15 @@ struct thread_task {
 	uintptr_t stack;
 	//! @brief CR3 register
 	uint64_t cr3;
+	//! @brief True if task never touches user memory. Such tasks run on whatever paging root is
+	//! loaded on the core when they are scheduled (lazy TLB), cr3 field is ignored
+	bool kernel_only;
+	//! @brief NUMA placement policy for memory allocated on behalf of the task
+	struct mem_policy policy;
 	//! @brief ID of the core task was allocated to
 	uint32_t core_id;
+	//! @brief Extended (x87/SSE/AVX) state
+	struct fpu_task_state fpu;
 };
 
 //! @brief Create task with a given entrypoint
@@ -82,11 +82,11 @@ int user_sys_get_notification(struct user_api_entry *entry, size_t hmailbox,
 		return status;
 	}
 	if (ref.type != USER_OBJ_TYPE_MAILBOX) {
-		user_drop_ref(ref);
+		user_put_ref(ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_recieve_notification(ref.mailbox, buf);
-	user_drop_ref(ref);
+	user_put_ref(ref);
 	return status;
 }
 
@@ -141,11 +141,11 @@ int user_sys_join_group(struct user_api_entry *entry, size_t hgrp) {
 		return status;
 	}
 	if (group_ref.type != USER_OBJ_TYPE_GROUP_COOKIE) {
-		user_drop_ref(group_ref);
+		user_put_ref(group_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_entry_cookie_add_to_grp(entry->cookie, group_ref.group_cookie);
-	user_drop_ref(group_ref);
+	user_put_ref(group_ref);
 	return status;
 }
 
@@ -160,11 +160,11 @@ int user_sys_leave_group(struct user_api_entry *entry, size_t hgrp) {
 		return status;
 	}
 	if (group_ref.type != USER_OBJ_TYPE_GROUP_COOKIE) {
-		user_drop_ref(group_ref);
+		user_put_ref(group_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_entry_cookie_remove_from_grp(entry->cookie, group_ref.group_cookie);
-	user_drop_ref(group_ref);
+	user_put_ref(group_ref);
 	return status;
 }
 
@@ -180,22 +180,22 @@ int user_sys_add_entry_to_group(struct user_api_entry *entry, size_t hentry, siz
 		return status;
 	}
 	if (entry_ref.type != USER_OBJ_TYPE_ENTRY_COOKIE) {
-		user_drop_ref(entry_ref);
+		user_put_ref(entry_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_borrow_out(entry->universe, hgrp, &group_ref);
 	if (status != USER_STATUS_SUCCESS) {
-		user_drop_ref(entry_ref);
+		user_put_ref(entry_ref);
 		return status;
 	}
 	if (group_ref.type != USER_OBJ_TYPE_GROUP_COOKIE) {
-		user_drop_ref(entry_ref);
-		user_drop_ref(group_ref);
+		user_put_ref(entry_ref);
+		user_put_ref(group_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_entry_cookie_add_to_grp(entry_ref.entry_cookie, group_ref.group_cookie);
-	user_drop_ref(entry_ref);
-	user_drop_ref(group_ref);
+	user_put_ref(entry_ref);
+	user_put_ref(group_ref);
 	return status;
 }
 
@@ -211,22 +211,22 @@ int user_sys_remove_entry_from_group(struct user_api_entry *entry, size_t hentry
 		return status;
 	}
 	if (entry_ref.type != USER_OBJ_TYPE_ENTRY_COOKIE) {
-		user_drop_ref(entry_ref);
+		user_put_ref(entry_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_borrow_out(entry->universe, hgrp, &group_ref);
 	if (status != USER_STATUS_SUCCESS) {
-		user_drop_ref(entry_ref);
+		user_put_ref(entry_ref);
 		return status;
 	}
 	if (group_ref.type != USER_OBJ_TYPE_GROUP_COOKIE) {
-		user_drop_ref(entry_ref);
-		user_drop_ref(group_ref);
+		user_put_ref(entry_ref);
+		user_put_ref(group_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_entry_cookie_remove_from_grp(entry_ref.entry_cookie, group_ref.group_cookie);
-	user_drop_ref(entry_ref);
-	user_drop_ref(group_ref);
+	user_put_ref(entry_ref);
+	user_put_ref(group_ref);
 	return status;
 }
 
@@ -244,12 +244,12 @@ int user_sys_create_caller(struct user_api_entry *entry, size_t hmailbox, size_t
 		return status;
 	}
 	if (mailbox_ref.type != USER_OBJ_TYPE_MAILBOX) {
-		user_drop_ref(mailbox_ref);
+		user_put_ref(mailbox_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	struct user_rpc_caller *caller;
 	status = user_rpc_create_caller(mailbox_ref.mailbox, opaque, &caller);
-	user_drop_ref(mailbox_ref);
+	user_put_ref(mailbox_ref);
 	if (status != USER_STATUS_SUCCESS) {
 		return status;
 	}
@@ -283,13 +283,13 @@ int user_sys_create_callee(struct user_api_entry *entry, size_t hmailbox, size_t
 		return status;
 	}
 	if (mailbox_ref.type != USER_OBJ_TYPE_MAILBOX) {
-		user_drop_ref(mailbox_ref);
+		user_put_ref(mailbox_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	struct user_rpc_callee *callee;
 	struct user_rpc_token *token;
 	status = user_rpc_create_callee(mailbox_ref.mailbox, opaque, buckets, &callee, &token);
-	user_drop_ref(mailbox_ref);
+	user_put_ref(mailbox_ref);
 	if (status != USER_STATUS_SUCCESS) {
 		return status;
 	}
@@ -326,22 +326,22 @@ int user_sys_rpc_call(struct user_api_entry *entry, size_t hcaller, size_t htoke
 		return status;
 	}
 	if (caller_ref.type != USER_OBJ_TYPE_CALLER) {
-		user_drop_ref(caller_ref);
+		user_put_ref(caller_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_borrow_out(entry->universe, htoken, &token_ref);
 	if (status != USER_STATUS_SUCCESS) {
-		user_drop_ref(caller_ref);
+		user_put_ref(caller_ref);
 		return status;
 	}
 	if (token_ref.type != USER_OBJ_TYPE_TOKEN) {
-		user_drop_ref(token_ref);
-		user_drop_ref(caller_ref);
+		user_put_ref(token_ref);
+		user_put_ref(caller_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_rpc_initiate(caller_ref.caller, token_ref.token, args);
-	user_drop_ref(token_ref);
-	user_drop_ref(caller_ref);
+	user_put_ref(token_ref);
+	user_put_ref(caller_ref);
 	return status;
 }
 
@@ -357,11 +357,11 @@ int user_sys_rpc_accept(struct user_api_entry *entry, size_t hcallee, struct use
 		return status;
 	}
 	if (callee_ref.type != USER_OBJ_TYPE_CALLEE) {
-		user_drop_ref(callee_ref);
+		user_put_ref(callee_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_rpc_accept(callee_ref.callee, args);
-	user_drop_ref(callee_ref);
+	user_put_ref(callee_ref);
 	return status;
 }
 
@@ -378,11 +378,11 @@ int user_sys_rpc_return(struct user_api_entry *entry, size_t hcallee,
 		return status;
 	}
 	if (callee_ref.type != USER_OBJ_TYPE_CALLEE) {
-		user_drop_ref(callee_ref);
+		user_put_ref(callee_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_rpc_return(callee_ref.callee, ret);
-	user_drop_ref(callee_ref);
+	user_put_ref(callee_ref);
 	return status;
 }
 
@@ -399,11 +399,11 @@ int user_sys_rpc_recv_reply(struct user_api_entry *entry, size_t hcaller,
 		return status;
 	}
 	if (caller_ref.type != USER_OBJ_TYPE_CALLER) {
-		user_drop_ref(caller_ref);
+		user_put_ref(caller_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_rpc_get_result(caller_ref.caller, ret);
-	user_drop_ref(caller_ref);
+	user_put_ref(caller_ref);
 	return status;
 }
 
@@ -444,17 +444,17 @@ static int user_entry_extract_universe_pair(struct user_api_entry *entry, size_t
 		return status;
 	}
 	if (src_ref->type != USER_OBJ_TYPE_UNIVERSE) {
-		user_drop_ref(*src_ref);
+		user_put_ref(*src_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_borrow_out(entry->universe, hdst, dst_ref);
 	if (status != USER_STATUS_SUCCESS) {
-		user_drop_ref(*src_ref);
+		user_put_ref(*src_ref);
 		return status;
 	}
 	if (dst_ref->type != USER_OBJ_TYPE_UNIVERSE) {
-		user_drop_ref(*src_ref);
-		user_drop_ref(*dst_ref);
+		user_put_ref(*src_ref);
+		user_put_ref(*dst_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	return USER_STATUS_SUCCESS;
@@ -475,8 +475,8 @@ int user_sys_move_across_universes(struct user_api_entry *entry, size_t hsrc, si
 	}
 	status = user_universe_move_across(source_ref.universe, dest_ref.universe, hsrci, hdsti,
 	                                   entry->cookie);
-	user_drop_ref(source_ref);
-	user_drop_ref(dest_ref);
+	user_put_ref(source_ref);
+	user_put_ref(dest_ref);
 	return status;
 }
 
@@ -495,8 +495,8 @@ int user_sys_borrow_across_universes(struct user_api_entry *entry, size_t hsrc,
 	}
 	status = user_universe_borrow_across(source_ref.universe, dest_ref.universe, hsrci, hdsti,
 	                                     entry->cookie);
-	user_drop_ref(source_ref);
-	user_drop_ref(dest_ref);
+	user_put_ref(source_ref);
+	user_put_ref(dest_ref);
 	return status;
 }
 
@@ -512,12 +512,12 @@ int user_sys_move_in(struct user_api_entry *entry, size_t huniverse, size_t oute
 		return status;
 	}
 	if (universe_ref.type != USER_OBJ_TYPE_UNIVERSE) {
-		user_drop_ref(universe_ref);
+		user_put_ref(universe_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_move_across(entry->universe, universe_ref.universe, outer, inner,
 	                                   entry->cookie);
-	user_drop_ref(universe_ref);
+	user_put_ref(universe_ref);
 	return status;
 }
 
@@ -533,12 +533,12 @@ int user_sys_move_out(struct user_api_entry *entry, size_t huniverse, size_t inn
 		return status;
 	}
 	if (universe_ref.type != USER_OBJ_TYPE_UNIVERSE) {
-		user_drop_ref(universe_ref);
+		user_put_ref(universe_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_move_across(universe_ref.universe, entry->universe, inner, outer,
 	                                   entry->cookie);
-	user_drop_ref(universe_ref);
+	user_put_ref(universe_ref);
 	return status;
 }
 
@@ -555,12 +555,12 @@ int user_sys_borrow_in(struct user_api_entry *entry, size_t huniverse, size_t ou
 		return status;
 	}
 	if (universe_ref.type != USER_OBJ_TYPE_UNIVERSE) {
-		user_drop_ref(universe_ref);
+		user_put_ref(universe_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_borrow_across(entry->universe, universe_ref.universe, outer, inner,
 	                                     entry->cookie);
-	user_drop_ref(universe_ref);
+	user_put_ref(universe_ref);
 	return status;
 }
 
@@ -577,12 +577,12 @@ int user_sys_borrow_out(struct user_api_entry *entry, size_t huniverse, size_t i
 		return status;
 	}
 	if (universe_ref.type != USER_OBJ_TYPE_UNIVERSE) {
-		user_drop_ref(universe_ref);
+		user_put_ref(universe_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_borrow_across(universe_ref.universe, entry->universe, inner, outer,
 	                                     entry->cookie);
-	user_drop_ref(universe_ref);
+	user_put_ref(universe_ref);
 	return status;
 }
 
@@ -615,12 +615,12 @@ int user_sys_unpin_from_group(struct user_api_entry *entry, size_t handle, size_
 		return status;
 	}
 	if (group_ref.type != USER_OBJ_TYPE_GROUP_COOKIE) {
-		user_drop_ref(group_ref);
+		user_put_ref(group_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_unpin_from_group(entry->universe, handle, entry->cookie,
 	                                        group_ref.group_cookie);
-	user_drop_ref(group_ref);
+	user_put_ref(group_ref);
 	return status;
 }
 
@@ -637,12 +637,12 @@ int user_sys_pin_to_group(struct user_api_entry *entry, size_t handle, size_t hg
 		return status;
 	}
 	if (group_ref.type != USER_OBJ_TYPE_GROUP_COOKIE) {
-		user_drop_ref(group_ref);
+		user_put_ref(group_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status =
 	    user_universe_pin_to_group(entry->universe, handle, entry->cookie, group_ref.group_cookie);
-	user_drop_ref(group_ref);
+	user_put_ref(group_ref);
 	return status;
 }
 
@@ -658,14 +658,14 @@ int user_sys_fork_universe(struct user_api_entry *entry, size_t hsrc, size_t *hd
 		return status;
 	}
 	if (universe_ref.type != USER_OBJ_TYPE_UNIVERSE) {
-		user_drop_ref(universe_ref);
+		user_put_ref(universe_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	struct user_ref forked_ref;
 	forked_ref.type = USER_OBJ_TYPE_UNIVERSE;
 	forked_ref.pin_cookie = user_entry_cookie_get_key(entry->cookie);
 	status = user_universe_fork(entry->universe, &forked_ref.universe, entry->cookie);
-	user_drop_ref(universe_ref);
+	user_put_ref(universe_ref);
 	if (status != USER_STATUS_SUCCESS) {
 		return status;
 	}
@@ -689,11 +689,11 @@ int user_sys_drop_in(struct user_api_entry *entry, size_t huniverse, size_t inne
 		return status;
 	}
 	if (universe_ref.type != USER_OBJ_TYPE_UNIVERSE) {
-		user_drop_ref(universe_ref);
+		user_put_ref(universe_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_drop_cell(universe_ref.universe, inner, entry->cookie);
-	user_drop_ref(universe_ref);
+	user_put_ref(universe_ref);
 	return status;
 }
 
@@ -734,11 +734,11 @@ int user_sys_borrow_shm_rw(struct user_api_entry *entry, size_t hshm, size_t *hb
 		return status;
 	}
 	if (shm_owner_ref.type != USER_OBJ_TYPE_SHM_OWNER) {
-		user_drop_ref(shm_owner_ref);
+		user_put_ref(shm_owner_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	struct user_shm_ref *ref = user_shm_create_ref(shm_owner_ref.shm_owner);
-	user_drop_ref(shm_owner_ref);
+	user_put_ref(shm_owner_ref);
 	struct user_ref shm_ref;
 	shm_ref.shm_ref = ref;
 	shm_ref.type = USER_OBJ_TYPE_SHM_RW_REF;
@@ -763,11 +763,11 @@ int user_sys_borrow_shm_ro(struct user_api_entry *entry, size_t hshm, size_t *hb
 		return status;
 	}
 	if (shm_owner_ref.type != USER_OBJ_TYPE_SHM_OWNER) {
-		user_drop_ref(shm_owner_ref);
+		user_put_ref(shm_owner_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	struct user_shm_ref *ref = user_shm_create_ref(shm_owner_ref.shm_owner);
-	user_drop_ref(shm_owner_ref);
+	user_put_ref(shm_owner_ref);
 	struct user_ref shm_ref;
 	shm_ref.shm_ref = ref;
 	shm_ref.type = USER_OBJ_TYPE_SHM_RO_REF;
@@ -795,11 +795,11 @@ int user_sys_read_from_shm_ref(struct user_api_entry *entry, size_t hshmref, siz
 		return status;
 	}
 	if (shm_ref.type != USER_OBJ_TYPE_SHM_RO_REF && shm_ref.type != USER_OBJ_TYPE_SHM_RW_REF) {
-		user_drop_ref(shm_ref);
+		user_put_ref(shm_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_shm_read_by_ref(shm_ref.shm_ref, offset, len, (void *)data);
-	user_drop_ref(shm_ref);
+	user_put_ref(shm_ref);
 	return USER_STATUS_SUCCESS;
 }
 
@@ -818,11 +818,11 @@ int user_sys_write_to_shm_ref(struct user_api_entry *entry, size_t hshmref, size
 		return status;
 	}
 	if (shm_ref.type != USER_OBJ_TYPE_SHM_RW_REF) {
-		user_drop_ref(shm_ref);
+		user_put_ref(shm_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_shm_write_by_ref(shm_ref.shm_ref, offset, len, (void *)data);
-	user_drop_ref(shm_ref);
+	user_put_ref(shm_ref);
 	return USER_STATUS_SUCCESS;
 }
 
@@ -862,11 +862,11 @@ int user_sys_unrestrict_shm(struct user_api_entry *entry, size_t hshm, bool rw)
 		return status;
 	}
 	if (shm_owner_ref.type != USER_OBJ_TYPE_SHM_OWNER) {
-		user_drop_ref(shm_owner_ref);
+		user_put_ref(shm_owner_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_shm_drop_ownership(shm_owner_ref.shm_owner, rw);
-	user_drop_ref(shm_owner_ref);
+	user_put_ref(shm_owner_ref);
 	return status;
 }
 
@@ -881,11 +881,11 @@ int user_sys_restrict_shm(struct user_api_entry *entry, size_t hshm, bool rw) {
 		return status;
 	}
 	if (shm_owner_ref.type != USER_OBJ_TYPE_SHM_OWNER) {
-		user_drop_ref(shm_owner_ref);
+		user_put_ref(shm_owner_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_shm_acquire_ownership(shm_owner_ref.shm_owner, entry->cookie, rw);
-	user_drop_ref(shm_owner_ref);
+	user_put_ref(shm_owner_ref);
 	return status;
 }
 
@@ -902,22 +902,22 @@ int user_sys_restrict_shm_to_group(struct user_api_entry *entry, size_t hshm, si
 		return status;
 	}
 	if (shm_owner_ref.type != USER_OBJ_TYPE_SHM_OWNER) {
-		user_drop_ref(shm_owner_ref);
+		user_put_ref(shm_owner_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_universe_borrow_out(entry->universe, hgrp, &group_ref);
 	if (status != USER_STATUS_SUCCESS) {
-		user_drop_ref(shm_owner_ref);
+		user_put_ref(shm_owner_ref);
 		return status;
 	}
 	if (group_ref.type != USER_OBJ_TYPE_GROUP_COOKIE) {
-		user_drop_ref(shm_owner_ref);
-		user_drop_ref(group_ref);
+		user_put_ref(shm_owner_ref);
+		user_put_ref(group_ref);
 		return USER_STATUS_INVALID_HANDLE_TYPE;
 	}
 	status = user_shm_give_ownership_to_grp(shm_owner_ref.shm_owner, group_ref.group_cookie, rw);
-	user_drop_ref(shm_owner_ref);
-	user_drop_ref(group_ref);
+	user_put_ref(shm_owner_ref);
+	user_put_ref(group_ref);
 	return status;
 }
 
@@ -8,6 +8,7 @@
 #include <lib/target.h>
 #include <mem/heap/heap.h>
 #include <mem/rc.h>
+#include <mem/rc_per_cpu.h>
 #include <thread/locking/spinlock.h>
 #include <thread/smp/core.h>
 #include <thread/tasking/localsched.h>
@@ -21,8 +22,8 @@ MODULE("user/notifications")
 union user_local_global_queue {
 	//! @brief Global wait queue
 	struct queue global_queue;
-	//! @brief Local wait queues
-	struct queue *local_queues;
+	//! @brief Local wait queues (one cache line isolated queue per core)
+	struct queue **local_queues;
 };
 
 //! @brief Wait queue nodes
@@ -56,15 +57,15 @@ struct user_raiser {
 	union {
 		//! @brief Single channel for global mailboxes
 		struct user_raiser_channel global_channel;
-		//! @brief Pointer to the array of per-cpu channels
-		struct user_raiser_channel *local_channels;
+		//! @brief Pointer to the table of per-cpu channels
+		struct user_raiser_channel **local_channels;
 	};
 };
 
 //! @brief Notifications mailbox. Allows to recieve notifications
 struct user_mailbox {
-	//! @brief Shutdown RC base
-	struct mem_rc shutdown_rc_base;
+	//! @brief Shutdown RC base. Borrowed on every API call, so it is sharded across CPUs
+	struct mem_rc_per_cpu shutdown_rc_base;
 	//! @brief Dealloc RC base
 	struct mem_rc dealloc_rc_base;
 	//! @brief Lock
@@ -85,13 +86,12 @@ struct user_mailbox {
 //! @return True if queue initialization was successful, false if OOM was returned instead
 static bool user_local_global_init(union user_local_global_queue *queue, bool is_per_cpu) {
 	if (is_per_cpu) {
-		size_t core_count = thread_smp_core_max_cpus;
-		struct queue *queues = mem_heap_alloc(sizeof(struct queue) * core_count);
+		struct queue **queues = (struct queue **)mem_heap_alloc_per_cpu(sizeof(struct queue));
 		if (queues == NULL) {
 			return false;
 		}
-		for (size_t i = 0; i < core_count; ++i) {
-			queues[i] = QUEUE_INIT;
+		for (size_t i = 0; i < thread_smp_core_max_cpus; ++i) {
+			*queues[i] = QUEUE_INIT;
 		}
 		queue->local_queues = queues;
 	} else {
@@ -108,7 +108,7 @@ static bool user_local_global_init(union user_local_global_queue *queue, bool is
 static void user_local_global_enqueue(union user_local_global_queue *queue, struct queue_node *node,
                                       bool is_per_cpu, size_t id) {
 	if (is_per_cpu) {
-		queue_enqueue(queue->local_queues + id, node);
+		queue_enqueue(queue->local_queues[id], node);
 	} else {
 		queue_enqueue(&queue->global_queue, node);
 	}
@@ -121,7 +121,7 @@ static void user_local_global_enqueue(union user_local_global_queue *queue, stru
 static struct queue_node *user_local_global_dequeue(union user_local_global_queue *queue,
                                                     bool is_per_cpu, size_t id) {
 	if (is_per_cpu) {
-		return queue_dequeue(queue->local_queues + id);
+		return queue_dequeue(queue->local_queues[id]);
 	}
 	return queue_dequeue(&queue->global_queue);
 }
@@ -131,7 +131,7 @@ static struct queue_node *user_local_global_dequeue(union user_local_global_queu
 //! @param is_per_cpu True if queue is used in per-cpu mode
 static void user_local_global_deinit(union user_local_global_queue *queue, bool is_per_cpu) {
 	if (is_per_cpu) {
-		mem_heap_free(queue->local_queues, sizeof(struct queue) * thread_smp_core_max_cpus);
+		mem_heap_free_per_cpu((void **)queue->local_queues, sizeof(struct queue));
 	}
 }
 
@@ -182,10 +182,15 @@ int user_create_mailbox(struct user_mailbox **mailbox, bool percpu) {
 		mem_heap_free(res_mailbox, sizeof(struct user_mailbox));
 		return USER_STATUS_OUT_OF_MEMORY;
 	}
+	if (!MEM_REF_PER_CPU_INIT(&res_mailbox->shutdown_rc_base, user_shutdown_mailbox)) {
+		user_local_global_deinit(&res_mailbox->msg_queue, percpu);
+		user_local_global_deinit(&res_mailbox->task_queue, percpu);
+		mem_heap_free(res_mailbox, sizeof(struct user_mailbox));
+		return USER_STATUS_OUT_OF_MEMORY;
+	}
 	res_mailbox->lock = THREAD_SPINLOCK_INIT;
 	res_mailbox->is_per_cpu = percpu;
 	res_mailbox->is_shut_down = false;
-	MEM_REF_INIT(&res_mailbox->shutdown_rc_base, user_shutdown_mailbox);
 	MEM_REF_INIT(&res_mailbox->dealloc_rc_base, user_destroy_mailbox);
 	*mailbox = res_mailbox;
 	return USER_STATUS_SUCCESS;
@@ -196,8 +201,7 @@ int user_create_mailbox(struct user_mailbox **mailbox, bool percpu) {
 static void user_destroy_raiser(struct user_raiser *raiser) {
 	bool is_per_cpu = raiser->mailbox_ref->is_per_cpu;
 	if (is_per_cpu) {
-		mem_heap_free(raiser->local_channels,
-		              sizeof(struct user_raiser_channel) * thread_smp_core_max_cpus);
+		mem_heap_free_per_cpu((void **)raiser->local_channels, sizeof(struct user_raiser_channel));
 	}
 	MEM_REF_DROP(&raiser->mailbox_ref->dealloc_rc_base);
 	mem_heap_free(raiser, sizeof(struct user_raiser));
@@ -215,15 +219,15 @@ int user_create_raiser(struct user_mailbox *mailbox, struct user_raiser **raiser
 		return USER_STATUS_OUT_OF_MEMORY;
 	}
 	if (mailbox->is_per_cpu) {
-		res_raiser->local_channels =
-		    mem_heap_alloc(sizeof(struct user_raiser_channel) * thread_smp_core_max_cpus);
+		res_raiser->local_channels = (struct user_raiser_channel **)mem_heap_alloc_per_cpu(
+		    sizeof(struct user_raiser_channel));
 		if (res_raiser->local_channels == NULL) {
 			mem_heap_free(res_raiser, sizeof(struct user_raiser));
 			return USER_STATUS_OUT_OF_MEMORY;
 		}
 		for (uint32_t i = 0; i < thread_smp_core_max_cpus; ++i) {
-			res_raiser->local_channels[i].pending = 0;
-			res_raiser->local_channels[i].owner = res_raiser;
+			res_raiser->local_channels[i]->pending = 0;
+			res_raiser->local_channels[i]->owner = res_raiser;
 		}
 	} else {
 		res_raiser->global_channel.pending = 0;
@@ -250,13 +254,13 @@ static void user_raiser_enqueue_nolock(struct user_raiser *raiser, uint32_t id)
 		struct user_wait_queue_node *node =
 		    CONTAINER_OF(wait_node, struct user_wait_queue_node, node);
 		if (mailbox->is_per_cpu) {
-			node->channel = raiser->local_channels + id;
+			node->channel = raiser->local_channels[id];
 		} else {
 			node->channel = &raiser->global_channel;
 		}
 		thread_localsched_wake_up(node->task);
 	} else if (mailbox->is_per_cpu) {
-		user_local_global_enqueue(&mailbox->msg_queue, &raiser->local_channels[id].node, true, id);
+		user_local_global_enqueue(&mailbox->msg_queue, &raiser->local_channels[id]->node, true, id);
 	} else {
 		user_local_global_enqueue(&mailbox->msg_queue, &raiser->global_channel.node, false, id);
 	}
@@ -274,8 +278,8 @@ void user_send_notification_to_core(struct user_raiser *raiser, uint32_t id) {
 		return;
 	}
 	if (is_per_cpu) {
-		raiser->local_channels[id].pending++;
-		if (raiser->local_channels[id].pending == 1) {
+		raiser->local_channels[id]->pending++;
+		if (raiser->local_channels[id]->pending == 1) {
 			user_raiser_enqueue_nolock(raiser, id);
 		}
 	} else {
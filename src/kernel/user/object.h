@@ -3,7 +3,9 @@
 
 #pragma once
 
+#include <lib/containerof.h>
 #include <mem/rc.h>
+#include <mem/rc_per_cpu.h>
 #include <user/cookie.h>
 
 //! @brief Object type
@@ -83,3 +85,32 @@ static inline struct user_ref user_borrow_ref(struct user_ref ref) {
 	result.ref = MEM_REF_BORROW(ref.ref);
 	return result;
 }
+
+//! @brief Check if object type counts borrowed references on per-CPU shards
+//! @param type Object type
+//! @return True if object starts with mem_rc_per_cpu header
+static inline bool user_ref_is_per_cpu(int type) {
+	return type == USER_OBJ_TYPE_CALLEE || type == USER_OBJ_TYPE_TOKEN ||
+	       type == USER_OBJ_TYPE_MAILBOX;
+}
+
+//! @brief Borrow reference to the object for the duration of the API call
+//! @param ref Owner reference (e.g. one stored in universe)
+//! @return Borrowed reference. Should be dropped with user_put_ref and should not be stored
+static inline struct user_ref user_get_ref(struct user_ref ref) {
+	if (!user_ref_is_per_cpu(ref.type)) {
+		return user_borrow_ref(ref);
+	}
+	mem_rc_per_cpu_borrow(CONTAINER_OF(ref.ref, struct mem_rc_per_cpu, rc_base));
+	return ref;
+}
+
+//! @brief Drop reference obtained with user_get_ref
+//! @param ref Reference to drop
+static inline void user_put_ref(struct user_ref ref) {
+	if (!user_ref_is_per_cpu(ref.type)) {
+		user_drop_ref(ref);
+		return;
+	}
+	mem_rc_per_cpu_drop(CONTAINER_OF(ref.ref, struct mem_rc_per_cpu, rc_base));
+}
@@ -3,15 +3,19 @@
 
 #include <lib/containerof.h>
 #include <lib/intmap.h>
+#include <lib/list.h>
 #include <lib/queue.h>
 #include <lib/string.h>
 #include <lib/target.h>
 #include <mem/heap/heap.h>
 #include <mem/rc.h>
+#include <mem/rc_per_cpu.h>
+#include <mem/reclaim.h>
 #include <thread/locking/spinlock.h>
 #include <user/rpc.h>
 
 MODULE("user/rpc")
+TARGET(user_rpc_available, user_rpc_init, {mem_reclaim_available})
 
 //! @brief RPC container. Contains all info about RPC request
 struct user_rpc_container {
@@ -29,8 +33,8 @@ struct user_rpc_container {
 
 //! @brief RPC token. Used as RPC target
 struct user_rpc_token {
-	//! @brief Discoverability RC base
-	struct mem_rc rc_base;
+	//! @brief Discoverability RC base. Borrowed on every RPC call, so it is sharded across CPUs
+	struct mem_rc_per_cpu rc_base;
 };
 
 //! @brief RPC caller. Allows to initiate RPC requests
@@ -48,14 +52,23 @@ struct user_rpc_caller {
 	struct queue incoming_replies;
 	//! @brief Caller lock
 	struct thread_spinlock lock;
+	//! @brief Node in the list of all callers
+	struct list_node callers_node;
 	//! @brief True if caller has been shut down
 	bool is_shut_down;
 };
 
+//! @brief List of callers that are not shut down. Used to trim free containers pools
+static struct list user_rpc_callers = LIST_INIT;
+
+//! @brief Lock protecting callers list
+//! @note Should be taken before caller locks
+static struct thread_spinlock user_rpc_callers_lock = THREAD_SPINLOCK_INIT;
+
 //! @brief RPC callee. Allows to accept RPC requests
 struct user_rpc_callee {
-	//! @brief Shutdown RC base
-	struct mem_rc shutdown_rc_base;
+	//! @brief Shutdown RC base. Borrowed on every accept and return, so it is sharded across CPUs
+	struct mem_rc_per_cpu shutdown_rc_base;
 	//! @brief Deallocation RC base
 	struct mem_rc dealloc_rc_base;
 	//! @brief Attached token
@@ -91,6 +104,10 @@ static void user_rpc_shutdown_caller(struct mem_rc *shutdown_rc_base) {
 	ASSERT(!caller->is_shut_down, "Caller has already been shutdown");
 	caller->is_shut_down = true;
 	thread_spinlock_unlock(&caller->lock, int_state);
+	// Free containers pool is destroyed below, hide it from RPC shrinker first
+	const bool callers_int_state = thread_spinlock_lock(&user_rpc_callers_lock);
+	list_remove(&user_rpc_callers, &caller->callers_node);
+	thread_spinlock_unlock(&user_rpc_callers_lock, callers_int_state);
 	MEM_REF_DROP(caller->on_reply_raiser);
 	user_rpc_destroy_msg_queue(&caller->free_containers);
 	MEM_REF_DROP(&caller->dealloc_rc_base);
@@ -130,6 +147,9 @@ int user_rpc_create_caller(struct user_mailbox *mailbox, size_t opaque,
 	res_caller->incoming_replies = QUEUE_INIT;
 	res_caller->is_shut_down = false;
 	res_caller->lock = THREAD_SPINLOCK_INIT;
+	const bool int_state = thread_spinlock_lock(&user_rpc_callers_lock);
+	LIST_APPEND_TAIL(&user_rpc_callers, res_caller, callers_node);
+	thread_spinlock_unlock(&user_rpc_callers_lock, int_state);
 	return USER_STATUS_SUCCESS;
 }
 
@@ -164,7 +184,7 @@ static void user_rpc_enqueue_reply_container(struct user_rpc_container *containe
 //! @brief Shutdown callee
 static void user_rpc_shutdown_callee(struct mem_rc *shutdown_rc_base) {
 	struct user_rpc_callee *callee =
-	    CONTAINER_OF(shutdown_rc_base, struct user_rpc_callee, shutdown_rc_base);
+	    CONTAINER_OF(shutdown_rc_base, struct user_rpc_callee, shutdown_rc_base.rc_base);
 	const bool int_state = thread_spinlock_lock(&callee->lock);
 	ASSERT(!callee->is_shut_down, "Callee has already been shutdown");
 	callee->is_shut_down = true;
@@ -218,11 +238,22 @@ int user_rpc_create_callee(struct user_mailbox *mailbox, size_t opaque, size_t b
 		mem_heap_free(res_callee, sizeof(struct user_rpc_callee));
 		return status;
 	}
+	if (!MEM_REF_PER_CPU_INIT(&res_callee->shutdown_rc_base, user_rpc_shutdown_callee)) {
+		intmap_destroy(&res_callee->awaiting_reply);
+		MEM_REF_DROP(res_callee->on_incoming_raiser);
+		mem_heap_free(res_callee, sizeof(struct user_rpc_callee));
+		return USER_STATUS_OUT_OF_MEMORY;
+	}
+	if (!MEM_REF_PER_CPU_INIT(&res_callee->token, user_rpc_notify_callee_undiscoverable)) {
+		mem_rc_per_cpu_destroy(&res_callee->shutdown_rc_base);
+		intmap_destroy(&res_callee->awaiting_reply);
+		MEM_REF_DROP(res_callee->on_incoming_raiser);
+		mem_heap_free(res_callee, sizeof(struct user_rpc_callee));
+		return USER_STATUS_OUT_OF_MEMORY;
+	}
 	*callee = res_callee;
 	*token = &res_callee->token;
-	MEM_REF_INIT(&res_callee->shutdown_rc_base, user_rpc_shutdown_callee);
 	MEM_REF_INIT(&res_callee->dealloc_rc_base, user_rpc_dealloc_callee);
-	MEM_REF_INIT(&res_callee->token, user_rpc_notify_callee_undiscoverable);
 	res_callee->dealloc_rc_base.refcount = 2;
 	res_callee->incoming_rpcs = QUEUE_INIT;
 	res_callee->is_shut_down = false;
@@ -376,3 +407,35 @@ int user_rpc_get_result(struct user_rpc_caller *caller, struct user_rpc_msg *msg
 	thread_spinlock_unlock(&caller->lock, int_state);
 	return USER_STATUS_SUCCESS;
 }
+
+//! @brief Give free RPC containers of all callers back to the heap
+//! @param id Ignored, as containers are not tied to any NUMA node
+//! @return Number of bytes released
+static size_t user_rpc_shrink(numa_id_t id) {
+	(void)id;
+	size_t result = 0;
+	const bool int_state = thread_spinlock_lock(&user_rpc_callers_lock);
+	for (struct list_node *node = user_rpc_callers.head; node != NULL; node = node->next) {
+		struct user_rpc_caller *caller = CONTAINER_OF(node, struct user_rpc_caller, callers_node);
+		thread_spinlock_grab(&caller->lock);
+		struct user_rpc_container *container;
+		while ((container = QUEUE_DEQUEUE(&caller->free_containers, struct user_rpc_container,
+		                                  qnode)) != NULL) {
+			mem_heap_free(container, sizeof(struct user_rpc_container));
+			result += sizeof(struct user_rpc_container);
+		}
+		thread_spinlock_ungrab(&caller->lock);
+	}
+	thread_spinlock_unlock(&user_rpc_callers_lock, int_state);
+	return result;
+}
+
+//! @brief RPC free containers shrinker
+static struct mem_reclaim_shrinker user_rpc_shrinker;
+
+//! @brief Initialize RPC subsystem
+static void user_rpc_init(void) {
+	// Heap is called with caller locks held, so this shrinker can't be used for direct reclaim
+	user_rpc_shrinker = MEM_RECLAIM_SHRINKER_INIT("user/rpc_containers", user_rpc_shrink, false);
+	mem_reclaim_register_shrinker(&user_rpc_shrinker);
+}
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <lib/target.h>
 #include <misc/attributes.h>
 #include <misc/types.h>
 #include <user/notifications.h>
@@ -71,3 +72,6 @@ int user_rpc_return(struct user_rpc_callee *callee, const struct user_rpc_msg *m
 //! @param caller Pointer to the caller
 //! @param msg Buffer to store RPC result in
 int user_rpc_get_result(struct user_rpc_caller *caller, struct user_rpc_msg *msg);
+
+//! @brief Export RPC subsystem initialization target
+EXPORT_TARGET(user_rpc_available)
@@ -7,8 +7,10 @@
 #include <lib/log.h>
 #include <lib/panic.h>
 #include <mem/mem.h>
+#include <mem/policy.h>
 #include <mem/rc.h>
 #include <mem/usercopy.h>
+#include <mem/virt/vmalloc.h>
 #include <misc/atomics.h>
 #include <thread/locking/spinlock.h>
 #include <user/shm.h>
@@ -19,6 +21,9 @@ TARGET(user_shms_available, user_shm_init, {mem_all_available})
 //! @brief Number of buckets in SHM intmap
 #define USER_SHM_INTMAP_BUCKETS 1024
 
+//! @brief Buffers of at least this size are populated on first touch
+#define USER_SHM_LAZY_SIZE 0x10000
+
 //! @brief SHM ref object. Can be used to access SHM via capability
 struct user_shm_ref {
 	//! @brief Dealloc RC base
@@ -69,7 +74,11 @@ static void user_shm_shutdown(struct user_shm_owner *shm) {
 //! @param ref Pointer to the SHM ref object
 static void user_shm_dealloc(struct user_shm_ref *ref) {
 	struct user_shm_owner *shm = CONTAINER_OF(ref, struct user_shm_owner, ref);
-	mem_heap_free(shm->data, shm->size);
+	if (shm->size >= USER_SHM_LAZY_SIZE) {
+		mem_vmalloc_free_lazy(shm->data, shm->size);
+	} else {
+		mem_heap_free(shm->data, shm->size);
+	}
 	mem_heap_free(shm, sizeof(struct user_shm_owner));
 }
 
@@ -85,12 +94,19 @@ int user_shm_create(struct user_shm_owner **objbuf, size_t *idbuf, size_t size,
 	if (shm == NULL) {
 		return USER_STATUS_OUT_OF_MEMORY;
 	}
-	uint8_t *data = mem_heap_alloc(size);
+	// Place SHM buffer according to the creator's policy, e.g. interleave pages of buffers read by
+	// all nodes. Large buffers are only reserved and backed on first touch, so that creation does
+	// not zero memory that is never used
+	uint8_t *data = NULL;
+	if (size >= USER_SHM_LAZY_SIZE) {
+		data = mem_vmalloc_alloc_lazy(size, mem_policy_current());
+	} else {
+		data = mem_heap_alloc_zeroed_policy(size, mem_policy_current());
+	}
 	if (data == NULL) {
 		mem_heap_free(shm, sizeof(struct user_shm_owner));
 		return USER_STATUS_OUT_OF_MEMORY;
 	}
-	memset(data, 0, size);
 	shm->data = data;
 	shm->size = size;
 	shm->lock = THREAD_SPINLOCK_INIT;
@@ -139,7 +155,7 @@ int user_shm_write_by_ref(struct user_shm_ref *ref, size_t offset, size_t len, c
 	if (!user_shm_check_bounds(shm, offset, len)) {
 		return USER_STATUS_OUT_OF_BOUNDS;
 	}
-	if (!mem_copy_from_user(shm->data + offset, data, len)) {
+	if (!mem_copy_from_user_bulk(shm->data + offset, data, len)) {
 		return USER_STATUS_INVALID_MEM;
 	}
 	return USER_STATUS_SUCCESS;
@@ -156,7 +172,7 @@ int user_shm_read_by_ref(struct user_shm_ref *ref, size_t offset, size_t len, vo
 	if (!user_shm_check_bounds(shm, offset, len)) {
 		return USER_STATUS_OUT_OF_BOUNDS;
 	}
-	if (!mem_copy_to_user(data, shm->data + offset, len)) {
+	if (!mem_copy_to_user_bulk(data, shm->data + offset, len)) {
 		return USER_STATUS_INVALID_MEM;
 	}
 	return USER_STATUS_SUCCESS;
@@ -218,7 +234,7 @@ int user_shm_write_by_id(size_t id, size_t offset, size_t len, const void *data,
 		MEM_REF_DROP(&shm->ref);
 		return USER_STATUS_OUT_OF_BOUNDS;
 	}
-	if (!mem_copy_from_user(shm->data + offset, data, len)) {
+	if (!mem_copy_from_user_bulk(shm->data + offset, data, len)) {
 		MEM_REF_DROP(&shm->ref);
 		return USER_STATUS_INVALID_MEM;
 	}
@@ -250,7 +266,7 @@ int user_shm_read_by_id(size_t id, size_t offset, size_t len, void *data,
 		MEM_REF_DROP(&shm->ref);
 		return USER_STATUS_OUT_OF_BOUNDS;
 	}
-	if (!mem_copy_to_user(data, shm->data + offset, len)) {
+	if (!mem_copy_to_user_bulk(data, shm->data + offset, len)) {
 		MEM_REF_DROP(&shm->ref);
 		return USER_STATUS_INVALID_MEM;
 	}
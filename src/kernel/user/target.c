@@ -3,10 +3,11 @@
 
 #include <mem/mem.h>
 #include <thread/tasking/tasking.h>
+#include <user/rpc.h>
 #include <user/shm.h>
 #include <user/target.h>
 
 MODULE("user/target")
 TARGET(userspace_available, META_DUMMY,
-       {thread_tasking_available, mem_all_available, user_shms_available})
+       {thread_tasking_available, mem_all_available, user_shms_available, user_rpc_available})
 META_DEFINE_DUMMY()
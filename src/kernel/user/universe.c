@@ -185,14 +185,14 @@ int user_universe_drop_cell(struct user_universe *universe, size_t cell,
 //! @param cell Index of cell with the reference
 //! @param buf Buffer to store borrowed reference in
 //! @return API status
+//! @note Borrowed reference should be dropped with user_put_ref before API call returns
 int user_universe_borrow_out(struct user_universe *universe, size_t cell, struct user_ref *buf) {
 	thread_mutex_lock(&universe->lock);
 	if (!user_universe_check_ref_nolock(universe, cell)) {
 		thread_mutex_unlock(&universe->lock);
 		return USER_STATUS_INVALID_HANDLE;
 	}
-	buf->type = universe->cells[cell].ref.type;
-	buf->ref = MEM_REF_BORROW(universe->cells[cell].ref.ref);
+	*buf = user_get_ref(universe->cells[cell].ref);
 	thread_mutex_unlock(&universe->lock);
 	return USER_STATUS_SUCCESS;
 }
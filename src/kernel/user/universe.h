@@ -43,6 +43,7 @@ int user_universe_drop_cell(struct user_universe *universe, size_t cell,
 //! @param cell Index of cell with the reference
 //! @param buf Buffer to store borrowed reference in
 //! @return API status
+//! @note Borrowed reference should be dropped with user_put_ref before API call returns
 int user_universe_borrow_out(struct user_universe *universe, size_t cell, struct user_ref *buf);
 
 //! @brief Move reference to the object at index